@@ -95,6 +95,8 @@ testScripts = [
     'mempool_spendcoinbase.py',
     'mempool_reorg.py',
     'mempool_limit.py',
+    'mempool_persist.py',
+    'batchpayouts.py',
     'httpbasics.py',
     'multi_rpc.py',
     'zapwallettxes.py',
@@ -110,6 +112,8 @@ testScripts = [
     'blockchain.py',
     'disablewallet.py',
     'sendheaders.py',
+    'compactblocks.py',
+    'utxosnapshot.py',
     'keypool.py',
     'prioritise_transaction.py',
     'invalidblockrequest.py',
@@ -0,0 +1,80 @@
+#!/usr/bin/env python2
+# Copyright (c) 2016 The Bitcredit Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test createbatchpayouts: recipients split over transactions of at most
+# maxoutputs outputs, no coin spent twice, and all of them in the wallet
+# after a restart
+#
+from test_framework.test_framework import BitcreditTestFramework
+from test_framework.util import *
+
+class BatchPayoutsTest(BitcreditTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = start_nodes(2, self.options.tmpdir)
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        self.nodes[0].generate(101)
+        self.sync_all()
+
+        payouts = {}
+        for i in range(250):
+            payouts[self.nodes[1].getnewaddress()] = Decimal("0.01") * (i + 1)
+        total = sum(payouts.values())
+
+        result = self.nodes[0].createbatchpayouts(payouts, 100, "payouts")
+        txids = result["txids"]
+        assert_equal(len(txids), 3)
+        assert_equal(result["rejected"], [])
+        assert(result["fee"] > 0)
+
+        # Every recipient is paid exactly once, and no input is shared
+        inputs = set()
+        paid = {}
+        fee = Decimal("0")
+        for txid in txids:
+            tx = self.nodes[0].gettransaction(txid)
+            assert_equal(tx["comment"], "payouts")
+            fee -= tx["fee"]
+            decoded = self.nodes[0].decoderawtransaction(tx["hex"])
+            for vin in decoded["vin"]:
+                outpoint = (vin["txid"], vin["vout"])
+                assert(outpoint not in inputs)
+                inputs.add(outpoint)
+            for vout in decoded["vout"]:
+                address = vout["scriptPubKey"]["addresses"][0]
+                if address in payouts:
+                    assert(address not in paid)
+                    paid[address] = vout["value"]
+        assert_equal(paid, payouts)
+        assert_equal(fee, result["fee"])
+
+        self.sync_all()
+        assert_equal(set(self.nodes[1].getrawmempool()), set(txids))
+        self.nodes[0].generate(1)
+        self.sync_all()
+        assert_equal(self.nodes[1].getbalance(), total)
+
+        # The batch was written in one database transaction; it must all be there after a restart
+        stop_node(self.nodes[0], 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir)
+        for txid in txids:
+            assert_equal(self.nodes[0].gettransaction(txid)["confirmations"], 1)
+
+        # Bad requests
+        address = self.nodes[1].getnewaddress()
+        assert_raises(JSONRPCException, self.nodes[0].createbatchpayouts, {address: 1}, 0)
+        assert_raises(JSONRPCException, self.nodes[0].createbatchpayouts, {address: 100000000})
+
+if __name__ == '__main__':
+    BatchPayoutsTest().main()
@@ -0,0 +1,72 @@
+#!/usr/bin/env python2
+# Copyright (c) 2016 The Bitcredit Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test BIP152 compact block relay across a line of four nodes on loopback,
+# and compare block propagation latency with and without -cmpctblocks.
+#
+
+from test_framework.test_framework import BitcreditTestFramework
+from test_framework.util import *
+import time
+
+ROUNDS = 5
+TXS_PER_BLOCK = 20
+
+class CompactBlocksTest(BitcreditTestFramework):
+
+    def setup_network(self):
+        self.start_line(True)
+
+    def start_line(self, cmpctblocks):
+        args = ["-debug=cmpctblock", "-debug=net", "-cmpctblocks=%d" % int(cmpctblocks)]
+        self.nodes = start_nodes(4, self.options.tmpdir, [args] * 4)
+        # 0 -- 1 -- 2 -- 3: every block has to be relayed three hops
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 1, 2)
+        connect_nodes_bi(self.nodes, 2, 3)
+        self.is_network_split = False
+        self.sync_all()
+
+    def wait_for_tip(self, tip, timeout=60):
+        start = time.time()
+        while time.time() - start < timeout:
+            if all(node.getbestblockhash() == tip for node in self.nodes):
+                return time.time() - start
+            time.sleep(0.01)
+        raise AssertionError("block %s did not propagate within %d seconds" % (tip, timeout))
+
+    def measure(self):
+        latencies = []
+        address = self.nodes[3].getnewaddress()
+        for i in range(ROUNDS):
+            for j in range(TXS_PER_BLOCK):
+                self.nodes[0].sendtoaddress(address, Decimal("0.01"))
+            sync_mempools(self.nodes)
+            mempool_size = self.nodes[0].getmempoolinfo()["size"]
+            tip = self.nodes[0].generate(1)[0]
+            latencies.append(self.wait_for_tip(tip))
+            # Every relayed transaction must have been mined on all nodes
+            for node in self.nodes:
+                assert_equal(node.getmempoolinfo()["size"], 0)
+                assert_equal(len(node.getblock(tip)["tx"]), mempool_size + 1)
+        return latencies
+
+    def run_test(self):
+        print "Measuring propagation with compact blocks..."
+        cmpct = self.measure()
+
+        stop_nodes(self.nodes)
+        wait_bitcreditds()
+        print "Measuring propagation with full blocks..."
+        self.start_line(False)
+        full = self.measure()
+
+        print "Average 3-hop propagation latency over %d blocks of %d txs:" % (ROUNDS, TXS_PER_BLOCK)
+        print "  compact blocks: %.1f ms" % (1000 * sum(cmpct) / len(cmpct))
+        print "  full blocks:    %.1f ms" % (1000 * sum(full) / len(full))
+
+if __name__ == '__main__':
+    CompactBlocksTest().main()
@@ -116,8 +116,46 @@ class ListTransactionsTest(BitcreditTestFramework):
                            {"category":"receive","amount":Decimal("0.1")},
                            {"txid":txid, "account" : "watchonly"} )
 
+        self.run_paging_test()
         self.run_rbf_opt_in_test()
 
+    # Check that paging with cursors lists the same as a single call
+    def run_paging_test(self):
+        node = self.nodes[0]
+        def sorted_entries(entries):
+            return sorted(entries, key=lambda e: (e["txid"], e.get("category"), e["vout"], e["amount"]))
+
+        # listtransactions pages go from newest to oldest, each oldest first
+        everything = node.listtransactions("*", 100000)
+        listed = []
+        cursor = ""
+        while cursor is not None:
+            page = node.listtransactions("*", 7, 0, False, cursor)
+            listed = page["transactions"] + listed
+            cursor = page.get("cursor")
+        assert(len(everything) > 7)
+        assert_equal(listed, everything)
+
+        everything = node.listsinceblock()["transactions"]
+        listed = []
+        cursor = ""
+        while cursor is not None:
+            page = node.listsinceblock("", 1, False, 7, cursor)
+            listed += page["transactions"]
+            cursor = page.get("cursor")
+        assert_equal(sorted_entries(listed), sorted_entries(everything))
+
+        everything = node.listunspent(0)
+        listed = []
+        cursor = ""
+        while cursor is not None:
+            page = node.listunspent(0, 9999999, [], 7, cursor)
+            assert(len(page["unspent"]) <= 7)
+            listed += page["unspent"]
+            cursor = page.get("cursor")
+        assert(len(everything) > 7)
+        assert_equal(sorted_entries(listed), sorted_entries(everything))
+
     # Check that the opt-in-rbf flag works properly, for sent and received
     # transactions.
     def run_rbf_opt_in_test(self):
@@ -0,0 +1,65 @@
+#!/usr/bin/env python2
+# Copyright (c) 2016 The Bitcredit Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that the mempool, with entry times and prioritisations, survives a
+# restart, and that -persistmempool=0 neither loads nor writes mempool.dat
+#
+from test_framework.test_framework import BitcreditTestFramework
+from test_framework.util import *
+import os
+import time
+
+class MempoolPersistTest(BitcreditTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        self.nodes = []
+        self.is_network_split = False
+        self.nodes.append(start_node(0, self.options.tmpdir))
+
+    def wait_for_mempool(self, size):
+        # mempool.dat is loaded in the background, after the RPC server is up
+        for i in range(100):
+            if len(self.nodes[0].getrawmempool()) == size:
+                return
+            time.sleep(0.1)
+        assert_equal(len(self.nodes[0].getrawmempool()), size)
+
+    def run_test(self):
+        self.nodes[0].generate(101)
+        address = self.nodes[0].getnewaddress()
+        txids = []
+        for i in range(5):
+            txids.append(self.nodes[0].sendtoaddress(address, Decimal("1")))
+        self.nodes[0].prioritisetransaction(txids[0], 0, 1000)
+        before = self.nodes[0].getrawmempool(True)
+        assert_equal(len(before), 5)
+
+        # -walletbroadcast=0 keeps the wallet from putting its transactions back itself
+        stop_node(self.nodes[0], 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-walletbroadcast=0"])
+        self.wait_for_mempool(5)
+        after = self.nodes[0].getrawmempool(True)
+        for txid in txids:
+            assert_equal(after[txid]["time"], before[txid]["time"])
+            assert_equal(after[txid]["modifiedfee"], before[txid]["modifiedfee"])
+
+        # Without -persistmempool the pool starts empty, and mempool.dat is left alone
+        mempooldat = os.path.join(self.options.tmpdir, "node0", "regtest", "mempool.dat")
+        stop_node(self.nodes[0], 0)
+        assert(os.path.isfile(mempooldat))
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-walletbroadcast=0", "-persistmempool=0"])
+        time.sleep(1)
+        assert_equal(len(self.nodes[0].getrawmempool()), 0)
+        stop_node(self.nodes[0], 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-walletbroadcast=0"])
+        self.wait_for_mempool(5)
+
+if __name__ == '__main__':
+    MempoolPersistTest().main()
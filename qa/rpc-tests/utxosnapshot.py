@@ -0,0 +1,54 @@
+#!/usr/bin/env python2
+# Copyright (c) 2016 The Bitcredit Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test dumputxoset and starting a new node from the snapshot with -loadutxosnapshot
+#
+from test_framework.test_framework import BitcreditTestFramework
+from test_framework.util import *
+import os
+
+class UtxoSnapshotTest(BitcreditTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = []
+        self.is_network_split = False
+        self.nodes.append(start_node(0, self.options.tmpdir))
+
+    def run_test(self):
+        self.nodes[0].generate(120)
+        address = self.nodes[0].getnewaddress()
+        for i in range(10):
+            self.nodes[0].sendtoaddress(address, Decimal("1"))
+        self.nodes[0].generate(1)
+
+        snapshot = os.path.join(self.options.tmpdir, "utxo.dat")
+        dump = self.nodes[0].dumputxoset(snapshot)
+        assert_equal(dump["bestblock"], self.nodes[0].getbestblockhash())
+        assert_equal(dump["height"], 121)
+        assert_raises(JSONRPCException, self.nodes[0].dumputxoset, snapshot)
+
+        self.nodes.append(start_node(1, self.options.tmpdir, ["-loadutxosnapshot=" + snapshot, "-checkblockindex=1"]))
+        assert_equal(self.nodes[1].getbestblockhash(), dump["bestblock"])
+        info0 = self.nodes[0].gettxoutsetinfo()
+        info1 = self.nodes[1].gettxoutsetinfo()
+        assert_equal(info1["hash_serialized"], info0["hash_serialized"])
+        assert_equal(info1["txouts"], dump["txouts"])
+
+        # The snapshot node follows the chain from there, and keeps doing so after a restart
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.nodes[0].generate(5)
+        sync_blocks(self.nodes)
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-loadutxosnapshot=" + snapshot, "-checkblockindex=1"])
+        assert_equal(self.nodes[1].getblockcount(), 126)
+        assert_equal(self.nodes[1].gettxoutsetinfo()["hash_serialized"], self.nodes[0].gettxoutsetinfo()["hash_serialized"])
+
+if __name__ == '__main__':
+    UtxoSnapshotTest().main()
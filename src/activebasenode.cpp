@@ -455,7 +455,6 @@ bool CActiveBasenode::GetBaseNodeVinForPubKey(std::string collateralAddress, CTx
 vector<COutput> CActiveBasenode::SelectCoinsBasenode()
 {
     vector<COutput> vCoins;
-    vector<COutput> filteredCoins;
     vector<COutPoint> confLockedCoins;
 
     // Temporary unlock MN coins from basenode.conf
@@ -469,8 +468,8 @@ vector<COutput> CActiveBasenode::SelectCoinsBasenode()
         }
     }
 
-    // Retrieve all possible outputs
-    pwalletMain->AvailableCoins(vCoins);
+    // Retrieve all possible outputs of exactly the collateral amount
+    pwalletMain->AvailableCoinsByValue(vCoins, getBasenodeMinimumCollateral() * COIN);
 
 	// Lock MN coins from basenode.conf back if they where temporary unlocked
     if(!confLockedCoins.empty()) {
@@ -478,17 +477,7 @@ vector<COutput> CActiveBasenode::SelectCoinsBasenode()
             pwalletMain->LockCoin(outpoint);
     }
 
-
-    // Filter
-    
-    BOOST_FOREACH(const COutput& out, vCoins)
-        {
-            if(out.tx->vout[out.i].nValue == getBasenodeMinimumCollateral() * COIN) { //exactly
-                filteredCoins.push_back(out);
-            }
-        }
-    
-    return filteredCoins;
+    return vCoins;
 }
 
 // get all possible outputs for running basenode for a specific pubkey
@@ -500,13 +489,13 @@ vector<COutput> CActiveBasenode::SelectCoinsBasenodeForPubKey(std::string collat
     vector<COutput> vCoins;
     vector<COutput> filteredCoins;
 
-    // Retrieve all possible outputs
-    pwalletMain->AvailableCoins(vCoins);
+    // Retrieve all possible outputs of exactly the collateral amount
+    pwalletMain->AvailableCoinsByValue(vCoins, getBasenodeMinimumCollateral() * COIN);
 
     // Filter
     BOOST_FOREACH(const COutput& out, vCoins)
         {
-             if(out.tx->vout[out.i].nValue == getBasenodeMinimumCollateral()*COIN) { //exactly
+            if(out.tx->vout[out.i].scriptPubKey == scriptPubKey) {
                 filteredCoins.push_back(out);
             }
         }
@@ -0,0 +1,92 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "basenode.h"
+#include "chain.h"
+#include "key.h"
+#include "main.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/standard.h"
+#include "wallet/wallet.h"
+
+#include <vector>
+
+// A basenode operator wallet: nTxs confirmed payouts of two outputs of
+// 0.01 to 100 BCR each to the operator's key, and nCollaterals outputs of
+// exactly the collateral among them. All of it is in one block at the tip.
+static void MakeOperatorWallet(CWallet& wallet, CBlockIndex& index, int nTxs, int nCollaterals)
+{
+    seed_insecure_rand(true);
+    CKey key;
+    key.MakeNewKey(true);
+    LOCK2(cs_main, wallet.cs_wallet);
+    wallet.AddKey(key);
+
+    uint256 hashBlock = GetRandHash();
+    index.phashBlock = &mapBlockIndex.insert(std::make_pair(hashBlock, &index)).first->first;
+    chainActive.SetTip(&index);
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(2);
+    for (int i = 0; i < nTxs; i++) {
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        for (int j = 0; j < 2; j++) {
+            tx.vout[j].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+            tx.vout[j].nValue = COIN / 100 + insecure_rand() % (100 * COIN);
+        }
+        if (i < nCollaterals)
+            tx.vout[1].nValue = BASENODE_MINIMUM_COLLATERAL * COIN;
+        CWalletTx wtx(&wallet, tx);
+        wtx.hashBlock = hashBlock;
+        wtx.nIndex = i;
+        wallet.AddToWallet(wtx, true, NULL);
+    }
+    wallet.MarkDirty();
+}
+
+static void ClearOperatorWallet(CBlockIndex& index)
+{
+    LOCK(cs_main);
+    chainActive.SetTip(NULL);
+    mapBlockIndex.erase(index.GetBlockHash());
+}
+
+// How SelectCoinsBasenode found the collateral: all available coins, filtered
+static void BasenodeCoinsScan(benchmark::State& state)
+{
+    CWallet wallet;
+    CBlockIndex index;
+    MakeOperatorWallet(wallet, index, 10000, 5);
+    while (state.KeepRunning()) {
+        std::vector<COutput> vCoins, vCollaterals;
+        wallet.AvailableCoins(vCoins);
+        for (unsigned int i = 0; i < vCoins.size(); i++) {
+            if (vCoins[i].tx->vout[vCoins[i].i].nValue == BASENODE_MINIMUM_COLLATERAL * COIN)
+                vCollaterals.push_back(vCoins[i]);
+        }
+        assert(vCollaterals.size() == 5);
+    }
+    ClearOperatorWallet(index);
+}
+
+// Looking up the collateral amount in the wallet's index of coins by value
+static void BasenodeCoinsByValue(benchmark::State& state)
+{
+    CWallet wallet;
+    CBlockIndex index;
+    MakeOperatorWallet(wallet, index, 10000, 5);
+    while (state.KeepRunning()) {
+        std::vector<COutput> vCollaterals;
+        wallet.AvailableCoinsByValue(vCollaterals, BASENODE_MINIMUM_COLLATERAL * COIN);
+        assert(vCollaterals.size() == 5);
+    }
+    ClearOperatorWallet(index);
+}
+
+BENCHMARK(BasenodeCoinsScan);
+BENCHMARK(BasenodeCoinsByValue);
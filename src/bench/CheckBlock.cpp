@@ -0,0 +1,76 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "arith_uint256.h"
+#include "consensus/consensus.h"
+#include "consensus/merkle.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "version.h"
+
+#include <boost/thread.hpp>
+
+// A block filled up to MAX_BLOCK_SIZE with two-in two-out pay-to-pubkey-hash
+// style transactions (the signatures are not checked by CheckBlock)
+static CBlock MakeMaxSizeBlock()
+{
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1 << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    tx.vout[0].nValue = 50 * COIN;
+    block.vtx.push_back(tx);
+
+    tx.vin.resize(2);
+    tx.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        tx.vin[i].scriptSig = CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2);
+        tx.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 3) << OP_EQUALVERIFY << OP_CHECKSIG;
+        tx.vout[i].nValue = COIN;
+    }
+    unsigned int nBlockSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) + 4;
+    for (uint32_t n = 1; ; n++) {
+        tx.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(n)), 0);
+        tx.vin[1].prevout = COutPoint(ArithToUint256(arith_uint256(n)), 1);
+        unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        if (nBlockSize + nTxSize > MAX_BLOCK_SIZE)
+            break;
+        nBlockSize += nTxSize;
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return block;
+}
+
+static void CheckMaxSizeBlock(benchmark::State& state, int nThreads)
+{
+    static boost::thread_group* threadGroup = NULL;
+    if (nThreads && !threadGroup) {
+        threadGroup = new boost::thread_group();
+        for (int i = 0; i < nThreads - 1; i++)
+            threadGroup->create_thread(&ThreadBlockCheck);
+    }
+
+    CBlock block = MakeMaxSizeBlock();
+    int nThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = nThreads;
+    while (state.KeepRunning()) {
+        CValidationState validationState;
+        bool fValid = CheckBlockContextFree(block, validationState, false, true);
+        assert(fValid);
+    }
+    nScriptCheckThreads = nThreadsOld;
+}
+
+static void CheckBlockSerial(benchmark::State& state) { CheckMaxSizeBlock(state, 0); }
+static void CheckBlockParallel(benchmark::State& state) { CheckMaxSizeBlock(state, 4); }
+
+BENCHMARK(CheckBlockSerial);
+BENCHMARK(CheckBlockParallel);
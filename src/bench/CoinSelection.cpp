@@ -0,0 +1,70 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "utilmoneystr.h"
+#include "wallet/wallet.h"
+
+#include <iostream>
+#include <set>
+#include <vector>
+
+// A wallet of nCoins confirmed coins of 0.001 to 20 BCR, as many of each
+// order of magnitude, like a payout wallet collecting payments of all sizes
+static void MakeCoins(CWallet& wallet, int nCoins, std::vector<COutput>& vCoins)
+{
+    seed_insecure_rand(true);
+    CMutableTransaction tx;
+    tx.vout.resize(1);
+    for (int i = 0; i < nCoins; i++) {
+        tx.nLockTime = i; // so all transactions get different hashes
+        CAmount nValue = COIN / 1000;
+        for (int nDigits = insecure_rand() % 5; nDigits > 0; nDigits--)
+            nValue *= 10;
+        tx.vout[0].nValue = nValue + insecure_rand() % nValue;
+        vCoins.push_back(COutput(new CWalletTx(&wallet, tx), 0, 6 * 24, true));
+    }
+}
+
+// Select coins for a range of payments, and report the inputs, change and
+// the fee for the inputs (at -mintxfee) per selection once done
+static void SelectCoinsBench(benchmark::State& state, int nCoins)
+{
+    CWallet wallet;
+    std::vector<COutput> vCoins;
+    MakeCoins(wallet, nCoins, vCoins);
+    static const CAmount vTargets[] = {COIN / 100, COIN / 3, COIN, 7 * COIN, 25 * COIN, 123456789};
+    static const int nTargets = sizeof(vTargets) / sizeof(vTargets[0]);
+
+    LOCK(wallet.cs_wallet);
+    int64_t nSelections = 0, nInputs = 0;
+    CAmount nChange = 0;
+    while (state.KeepRunning()) {
+        std::set<std::pair<const CWalletTx*, unsigned int> > setCoins;
+        CAmount nValue;
+        CAmount nTarget = vTargets[nSelections % nTargets];
+        bool fFound = wallet.SelectCoinsMinConf(nTarget, 1, 6, vCoins, setCoins, nValue);
+        assert(fFound);
+        nSelections++;
+        nInputs += setCoins.size();
+        nChange += nValue - nTarget;
+    }
+    std::cout << "# " << nCoins << " coins: " << (double)nInputs / nSelections << " inputs, "
+              << FormatMoney(nChange / nSelections) << " change, "
+              << FormatMoney(CWallet::minTxFee.GetFee(nInputs * SELECT_COINS_INPUT_SIZE / nSelections)) << " input fees per selection\n";
+
+    for (unsigned int i = 0; i < vCoins.size(); i++)
+        delete vCoins[i].tx;
+}
+
+static void CoinSelection1k(benchmark::State& state) { SelectCoinsBench(state, 1000); }
+static void CoinSelection10k(benchmark::State& state) { SelectCoinsBench(state, 10000); }
+static void CoinSelection100k(benchmark::State& state) { SelectCoinsBench(state, 100000); }
+
+BENCHMARK(CoinSelection1k);
+BENCHMARK(CoinSelection10k);
+BENCHMARK(CoinSelection100k);
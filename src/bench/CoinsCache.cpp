@@ -0,0 +1,72 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "coins.h"
+#include "random.h"
+#include "script/script.h"
+
+#include <vector>
+
+// Block-sized batch of new coins, as written by ConnectBlock's view into pcoinsTip
+static const int BATCH_COINS = 4000;
+// Coins already in the cache when looking them up
+static const int CACHED_COINS = 200000;
+
+static void AddCoins(CCoinsViewCache& view, const uint256& txid, int nOutputs)
+{
+    CCoinsModifier coins = view.ModifyNewCoins(txid, false);
+    coins->nVersion = 1;
+    coins->nHeight = 100000;
+    coins->vout.resize(nOutputs);
+    for (int i = 0; i < nOutputs; i++) {
+        coins->vout[i].nValue = 50000 + i;
+        coins->vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+}
+
+// Flushing a child cache of dirty coins into a long-lived parent cache
+static void CoinsCacheBatchWrite(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache tip(&base);
+    std::vector<uint256> txids(BATCH_COINS);
+    for (int i = 0; i < BATCH_COINS; i++)
+        txids[i] = GetRandHash();
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&tip);
+        for (int i = 0; i < BATCH_COINS; i++)
+            AddCoins(view, txids[i], 2);
+        view.Flush();
+        // Stand-in for FlushStateToDisk once the parent outgrows -dbcache
+        if (tip.GetCacheSize() > 10 * BATCH_COINS)
+            tip.Flush();
+        txids[insecure_rand() % BATCH_COINS] = GetRandHash();
+    }
+}
+
+// Looking up cached coins, as CheckInputs does for every input
+static void CoinsCacheAccessCoins(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache view(&base);
+    std::vector<uint256> txids(CACHED_COINS);
+    for (int i = 0; i < CACHED_COINS; i++) {
+        txids[i] = GetRandHash();
+        AddCoins(view, txids[i], 2);
+    }
+
+    uint64_t nFound = 0;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            if (view.AccessCoins(txids[insecure_rand() % CACHED_COINS]))
+                nFound++;
+        }
+    }
+    assert(nFound > 0);
+}
+
+BENCHMARK(CoinsCacheBatchWrite);
+BENCHMARK(CoinsCacheAccessCoins);
@@ -0,0 +1,82 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "main.h"
+#include "policy/fees.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "txmempool.h"
+
+#include <list>
+#include <vector>
+
+// A chain of depth transactions, each spending the single output of the previous one
+static std::vector<CTransaction> MakeChain(int depth)
+{
+    std::vector<CTransaction> chain;
+    chain.reserve(depth);
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout = COutPoint(uint256S("0x1"), 0);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    tx.vout[0].nValue = 10 * COIN;
+    for (int i = 0; i < depth; i++) {
+        chain.push_back(tx);
+        tx.vin[0].prevout = COutPoint(chain.back().GetHash(), 0);
+        tx.vout[0].nValue -= 1000;
+    }
+    return chain;
+}
+
+static void AddChain(CTxMemPool& pool, const std::vector<CTransaction>& chain)
+{
+    for (size_t i = 0; i < chain.size(); i++) {
+        CTxMemPoolEntry entry(chain[i], 1000, 0, 10.0, 1, i == 0, 0, false, 1, LockPoints());
+        pool.addUnchecked(chain[i].GetHash(), entry);
+    }
+}
+
+// Add a chain, then evict it from the top (as for a conflict or expiry)
+static void MempoolChainRemove(benchmark::State& state, int depth)
+{
+    CTxMemPool pool(CFeeRate(0));
+    std::vector<CTransaction> chain = MakeChain(depth);
+    while (state.KeepRunning()) {
+        AddChain(pool, chain);
+        std::list<CTransaction> removed;
+        pool.removeRecursive(chain[0], removed);
+        assert(removed.size() == chain.size());
+    }
+}
+
+// Add a chain, then confirm it in a block, parents first
+static void MempoolChainMine(benchmark::State& state, int depth)
+{
+    CTxMemPool pool(CFeeRate(0));
+    std::vector<CTransaction> chain = MakeChain(depth);
+    while (state.KeepRunning()) {
+        AddChain(pool, chain);
+        std::list<CTransaction> conflicts;
+        pool.removeForBlock(chain, 1, conflicts);
+        assert(pool.size() == 0);
+    }
+}
+
+static void MempoolChainRemove25(benchmark::State& state) { MempoolChainRemove(state, 25); }
+static void MempoolChainRemove100(benchmark::State& state) { MempoolChainRemove(state, 100); }
+static void MempoolChainRemove500(benchmark::State& state) { MempoolChainRemove(state, 500); }
+static void MempoolChainMine25(benchmark::State& state) { MempoolChainMine(state, 25); }
+static void MempoolChainMine100(benchmark::State& state) { MempoolChainMine(state, 100); }
+static void MempoolChainMine500(benchmark::State& state) { MempoolChainMine(state, 500); }
+
+BENCHMARK(MempoolChainRemove25);
+BENCHMARK(MempoolChainRemove100);
+BENCHMARK(MempoolChainRemove500);
+BENCHMARK(MempoolChainMine25);
+BENCHMARK(MempoolChainMine100);
+BENCHMARK(MempoolChainMine500);
@@ -0,0 +1,97 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "policy/fees.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/script.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include <vector>
+
+// One block of a mempool trace: the transactions that entered the mempool
+// before it, and the (earlier) transactions it confirmed
+struct CTraceBlock
+{
+    std::vector<CTxMemPoolEntry> vEntered;
+    std::vector<CTxMemPoolEntry> vConfirmed;
+};
+
+// A deterministic trace of nBlocks blocks with nTxPerBlock new transactions
+// each. Transactions pay between 1000 and 100000 per kB, and the ones paying
+// more tend to be confirmed sooner; a few pay no fee and go by priority.
+static std::vector<CTraceBlock> MakeTrace(int nBlocks, int nTxPerBlock)
+{
+    seed_insecure_rand(true);
+    std::vector<CTraceBlock> trace(nBlocks);
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    tx.vout[0].nValue = COIN;
+    uint32_t n = 0;
+    for (int nHeight = 0; nHeight < nBlocks; nHeight++) {
+        for (int i = 0; i < nTxPerBlock; i++) {
+            tx.vin[0].prevout = COutPoint(uint256S("0x1"), n++);
+            unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            bool fFree = insecure_rand() % 20 == 0;
+            CAmount nFeeRate = fFree ? 0 : 1000 + insecure_rand() % 99000;
+            double dPriority = fFree ? 1e8 * (1 + insecure_rand() % 1000) : 0;
+            CTxMemPoolEntry entry(tx, nFeeRate * nSize / 1000, 0, dPriority, nHeight, true, 0, false, 1, LockPoints());
+            trace[nHeight].vEntered.push_back(entry);
+            // Confirmed in 1 to 25 blocks, sooner the higher the fee rate
+            int nDelay = 1 + (fFree ? insecure_rand() % 25 : (100000 - nFeeRate) / 4000 + insecure_rand() % 3);
+            if (nHeight + nDelay < nBlocks)
+                trace[nHeight + nDelay].vConfirmed.push_back(entry);
+        }
+    }
+    return trace;
+}
+
+// Feed a trace to estimator, in the order the mempool would
+static void ReplayTrace(CBlockPolicyEstimator& estimator, std::vector<CTraceBlock>& trace)
+{
+    for (unsigned int nHeight = 0; nHeight < trace.size(); nHeight++) {
+        CTraceBlock& block = trace[nHeight];
+        for (unsigned int i = 0; i < block.vEntered.size(); i++)
+            estimator.processTransaction(block.vEntered[i], true);
+        for (unsigned int i = 0; i < block.vConfirmed.size(); i++)
+            estimator.removeTx(block.vConfirmed[i].GetTx().GetHash());
+        estimator.processBlock(nHeight + 1, block.vConfirmed, true);
+    }
+}
+
+// Replay 200 blocks of 500 transactions through a fresh estimator
+static void PolicyEstimatorReplay(benchmark::State& state)
+{
+    std::vector<CTraceBlock> trace = MakeTrace(200, 500);
+    while (state.KeepRunning()) {
+        CBlockPolicyEstimator estimator(CFeeRate(1000));
+        ReplayTrace(estimator, trace);
+    }
+}
+
+// Ask for the estimates for every target, as estimatefee/estimatesmartfee would
+static void PolicyEstimatorQuery(benchmark::State& state)
+{
+    std::vector<CTraceBlock> trace = MakeTrace(200, 500);
+    CBlockPolicyEstimator estimator(CFeeRate(1000));
+    ReplayTrace(estimator, trace);
+    CTxMemPool pool(CFeeRate(1000));
+    while (state.KeepRunning()) {
+        for (unsigned int nTarget = 1; nTarget <= MAX_BLOCK_CONFIRMS; nTarget++) {
+            int nFoundAt;
+            estimator.estimateFee(nTarget);
+            estimator.estimateSmartFee(nTarget, &nFoundAt, pool);
+            estimator.estimatePriority(nTarget);
+        }
+    }
+}
+
+BENCHMARK(PolicyEstimatorReplay);
+BENCHMARK(PolicyEstimatorQuery);
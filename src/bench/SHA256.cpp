@@ -0,0 +1,74 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "consensus/merkle.h"
+#include "crypto/sha256.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <string>
+#include <vector>
+
+// Each iteration hashes this many 64-byte blobs or block headers, so
+// hashes/s is HASHES_PER_ITERATION divided by the average reported.
+static const size_t HASHES_PER_ITERATION = 1024;
+
+// Double-SHA256 of 64-byte blobs, as done for every inner merkle tree node
+static void HashD64(benchmark::State& state, const std::string& implementation)
+{
+    if (!SHA256UseImplementation(implementation))
+        return;
+    std::vector<unsigned char> in(64 * HASHES_PER_ITERATION, 0);
+    while (state.KeepRunning())
+        SHA256D64(&in[0], &in[0], HASHES_PER_ITERATION);
+    SHA256AutoDetect();
+}
+
+// Double-SHA256 of block headers for consecutive nonces, as done by the miner
+static void HashD80(benchmark::State& state, const std::string& implementation)
+{
+    if (!SHA256UseImplementation(implementation))
+        return;
+    std::vector<unsigned char> header(80, 0);
+    std::vector<unsigned char> out(32 * HASHES_PER_ITERATION);
+    uint32_t nNonce = 0;
+    while (state.KeepRunning()) {
+        SHA256D80Nonces(&out[0], &header[0], nNonce, HASHES_PER_ITERATION);
+        nNonce += HASHES_PER_ITERATION;
+    }
+    SHA256AutoDetect();
+}
+
+static void SHA256D64_1024_Standard(benchmark::State& state) { HashD64(state, "standard"); }
+static void SHA256D64_1024_SHANI(benchmark::State& state) { HashD64(state, "shani"); }
+static void SHA256D64_1024_SSE41(benchmark::State& state) { HashD64(state, "sse4.1"); }
+static void SHA256D64_1024_AVX2(benchmark::State& state) { HashD64(state, "avx2"); }
+static void SHA256D80_1024_Standard(benchmark::State& state) { HashD80(state, "standard"); }
+static void SHA256D80_1024_SHANI(benchmark::State& state) { HashD80(state, "shani"); }
+static void SHA256D80_1024_SSE41(benchmark::State& state) { HashD80(state, "sse4.1"); }
+static void SHA256D80_1024_AVX2(benchmark::State& state) { HashD80(state, "avx2"); }
+
+// Merkle root of a block with 2000 transactions, using the autodetected implementation
+static void MerkleRoot(benchmark::State& state)
+{
+    std::vector<uint256> leaves(2000);
+    for (size_t i = 0; i < leaves.size(); i++)
+        leaves[i] = GetRandHash();
+    while (state.KeepRunning()) {
+        bool mutated = false;
+        uint256 root = ComputeMerkleRoot(leaves, &mutated);
+        leaves[0] = root;
+    }
+}
+
+BENCHMARK(SHA256D64_1024_Standard);
+BENCHMARK(SHA256D64_1024_SHANI);
+BENCHMARK(SHA256D64_1024_SSE41);
+BENCHMARK(SHA256D64_1024_AVX2);
+BENCHMARK(SHA256D80_1024_Standard);
+BENCHMARK(SHA256D80_1024_SHANI);
+BENCHMARK(SHA256D80_1024_SSE41);
+BENCHMARK(SHA256D80_1024_AVX2);
+BENCHMARK(MerkleRoot);
@@ -0,0 +1,79 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "key.h"
+#include "keystore.h"
+#include "primitives/transaction.h"
+#include "script/sign.h"
+#include "script/standard.h"
+
+#include <vector>
+
+#include <boost/thread.hpp>
+
+// A transaction spending nInputs pay-to-pubkey-hash outputs, each to its own key
+static CMutableTransaction MakeSpend(CBasicKeyStore& keystore, int nInputs, std::vector<CScript>& vScriptPubKeys)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(nInputs);
+    vScriptPubKeys.resize(nInputs);
+    for (int i = 0; i < nInputs; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        vScriptPubKeys[i] = GetScriptForDestination(key.GetPubKey().GetID());
+        tx.vin[i].prevout = COutPoint(uint256S("0x1"), i);
+    }
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = vScriptPubKeys[0];
+    tx.vout[0].nValue = nInputs * COIN;
+    return tx;
+}
+
+// Sign all inputs one after the other (nThreads == 0), or through SignInputs()
+// with nThreads threads including the calling one
+static void SignTransaction(benchmark::State& state, int nInputs, int nThreads)
+{
+    static boost::thread_group* threadGroup = NULL;
+    if (nThreads && !threadGroup) {
+        threadGroup = new boost::thread_group();
+        for (int i = 0; i < nThreads - 1; i++)
+            threadGroup->create_thread(&ThreadSignInputs);
+    }
+
+    CBasicKeyStore keystore;
+    std::vector<CScript> vScriptPubKeys;
+    CMutableTransaction tx = MakeSpend(keystore, nInputs, vScriptPubKeys);
+    const CTransaction txToSign(tx);
+    while (state.KeepRunning()) {
+        if (nThreads == 0) {
+            for (int i = 0; i < nInputs; i++) {
+                bool fSigned = SignSignature(keystore, vScriptPubKeys[i], tx, i);
+                assert(fSigned);
+            }
+        } else {
+            std::vector<CInputSigner> vSigners;
+            for (int i = 0; i < nInputs; i++)
+                vSigners.push_back(CInputSigner(&keystore, &txToSign, i, &vScriptPubKeys[i], &tx.vin[i].scriptSig));
+            bool fSigned = SignInputs(vSigners);
+            assert(fSigned);
+        }
+    }
+}
+
+static void SignInputs10Serial(benchmark::State& state) { SignTransaction(state, 10, 0); }
+static void SignInputs100Serial(benchmark::State& state) { SignTransaction(state, 100, 0); }
+static void SignInputs1000Serial(benchmark::State& state) { SignTransaction(state, 1000, 0); }
+static void SignInputs10Parallel(benchmark::State& state) { SignTransaction(state, 10, 4); }
+static void SignInputs100Parallel(benchmark::State& state) { SignTransaction(state, 100, 4); }
+static void SignInputs1000Parallel(benchmark::State& state) { SignTransaction(state, 1000, 4); }
+
+BENCHMARK(SignInputs10Serial);
+BENCHMARK(SignInputs100Serial);
+BENCHMARK(SignInputs1000Serial);
+BENCHMARK(SignInputs10Parallel);
+BENCHMARK(SignInputs100Parallel);
+BENCHMARK(SignInputs1000Parallel);
@@ -0,0 +1,86 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "key.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/standard.h"
+#include "wallet/wallet.h"
+
+#include <vector>
+
+// A synthetic chain of nBlocks blocks of nTxPerBlock two-in two-out
+// transactions to random pay-to-pubkey-hash outputs. One in a hundred pays
+// one of the nKeys keys of wallet instead.
+static std::vector<CBlock> MakeRescanChain(CWallet& wallet, int nKeys, int nBlocks, int nTxPerBlock)
+{
+    seed_insecure_rand(true);
+    std::vector<CKeyID> vKeyIDs;
+    {
+        LOCK(wallet.cs_wallet);
+        for (int i = 0; i < nKeys; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            wallet.AddKey(key);
+            vKeyIDs.push_back(key.GetPubKey().GetID());
+        }
+    }
+
+    std::vector<CBlock> vBlocks(nBlocks);
+    CMutableTransaction tx;
+    tx.vin.resize(2);
+    tx.vout.resize(2);
+    for (int nBlock = 0; nBlock < nBlocks; nBlock++) {
+        for (int i = 0; i < nTxPerBlock; i++) {
+            for (int j = 0; j < 2; j++) {
+                tx.vin[j].prevout = COutPoint(GetRandHash(), j);
+                tx.vin[j].scriptSig = CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2);
+                uint256 hash = GetRandHash();
+                CKeyID keyID = insecure_rand() % 100 == 0 ? vKeyIDs[insecure_rand() % vKeyIDs.size()] : CKeyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20)));
+                tx.vout[j].scriptPubKey = GetScriptForDestination(keyID);
+                tx.vout[j].nValue = COIN;
+            }
+            vBlocks[nBlock].vtx.push_back(tx);
+        }
+    }
+    return vBlocks;
+}
+
+// How the rescan used to find the wallet's transactions, under the wallet lock
+static void RescanMatchIsMine(benchmark::State& state)
+{
+    CWallet wallet;
+    std::vector<CBlock> vBlocks = MakeRescanChain(wallet, 10000, 20, 1000);
+    while (state.KeepRunning()) {
+        LOCK(wallet.cs_wallet);
+        unsigned int nFound = 0;
+        for (unsigned int i = 0; i < vBlocks.size(); i++) {
+            for (unsigned int j = 0; j < vBlocks[i].vtx.size(); j++)
+                nFound += wallet.IsMine(vBlocks[i].vtx[j]) || wallet.IsFromMe(vBlocks[i].vtx[j]);
+        }
+        assert(nFound > 0);
+    }
+}
+
+// Matching against the precomputed filter, as the rescan's reader threads do
+static void RescanMatchFilter(benchmark::State& state)
+{
+    CWallet wallet;
+    std::vector<CBlock> vBlocks = MakeRescanChain(wallet, 10000, 20, 1000);
+    CWalletScriptFilter filter;
+    wallet.GetScriptFilter(filter);
+    while (state.KeepRunning()) {
+        unsigned int nFound = 0;
+        for (unsigned int i = 0; i < vBlocks.size(); i++) {
+            for (unsigned int j = 0; j < vBlocks[i].vtx.size(); j++)
+                nFound += filter.Matches(vBlocks[i].vtx[j]);
+        }
+        assert(nFound > 0);
+    }
+}
+
+BENCHMARK(RescanMatchIsMine);
+BENCHMARK(RescanMatchFilter);
@@ -0,0 +1,124 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "util.h"
+#include "wallet/db.h"
+#include "wallet/wallet.h"
+#include "wallet/walletdb.h"
+
+#include <boost/filesystem.hpp>
+
+// Wallet files go to a fresh data directory under the system temp directory
+static void UseBenchDataDir()
+{
+    static boost::filesystem::path pathBench;
+    if (!pathBench.empty())
+        return;
+    pathBench = boost::filesystem::temp_directory_path() / strprintf("bench_bitcredit_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    boost::filesystem::create_directories(pathBench);
+    mapArgs["-datadir"] = pathBench.string();
+    ClearDatadirCache();
+}
+
+static std::string WalletFile(bool fLog, const std::string& strName)
+{
+    UseBenchDataDir();
+    bitdb.fLogDb = fLog;
+    return strName + (fLog ? "_log.dat" : "_bdb.dat");
+}
+
+// A one-in two-out transaction the size of a typical wallet payment
+static CWalletTx MakeWalletTx(uint32_t n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), n);
+    tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2);
+    tx.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        tx.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 3) << OP_EQUALVERIFY << OP_CHECKSIG;
+        tx.vout[i].nValue = COIN;
+    }
+    CWalletTx wtx(NULL, tx);
+    wtx.nTimeReceived = n;
+    return wtx;
+}
+
+// Open a wallet of 1000 keys and 10000 transactions, with nothing cached
+static void WalletLoad(benchmark::State& state, bool fLog)
+{
+    std::string strFile = WalletFile(fLog, "load");
+    if (!boost::filesystem::exists(GetDataDir() / strFile)) {
+        CWallet wallet(strFile);
+        bool fFirstRun;
+        wallet.LoadWallet(fFirstRun);
+        wallet.TopUpKeyPool(1000);
+        CWalletDB walletdb(strFile);
+        for (uint32_t n = 0; n < 10000; n++) {
+            CWalletTx wtx = MakeWalletTx(n);
+            walletdb.WriteTx(wtx.GetHash(), wtx);
+        }
+    }
+    while (state.KeepRunning()) {
+        bitdb.Flush(true);
+        CWallet wallet(strFile);
+        bool fFirstRun;
+        DBErrors nLoadWalletRet = wallet.LoadWallet(fFirstRun);
+        assert(nLoadWalletRet == DB_LOAD_OK && wallet.mapWallet.size() == 10000);
+    }
+    bitdb.Flush(true);
+}
+
+// Write one wallet transaction after the other, as a busy wallet does
+static void WalletTxWrite(benchmark::State& state, bool fLog)
+{
+    std::string strFile = WalletFile(fLog, "txwrite");
+    {
+        CWalletDB walletdb(strFile, "cr+");
+        uint32_t n = 0;
+        while (state.KeepRunning()) {
+            CWalletTx wtx = MakeWalletTx(n++);
+            bool fWritten = walletdb.WriteTx(wtx.GetHash(), wtx);
+            assert(fWritten);
+        }
+    }
+    bitdb.Flush(true);
+}
+
+// Add 100 keys to the keypool at a time
+static void WalletKeypoolRefill(benchmark::State& state, bool fLog)
+{
+    std::string strFile = WalletFile(fLog, "keypool");
+    {
+        CWallet wallet(strFile);
+        bool fFirstRun;
+        wallet.LoadWallet(fFirstRun);
+        LOCK(wallet.cs_wallet);
+        unsigned int nTarget = wallet.GetKeyPoolSize();
+        while (state.KeepRunning()) {
+            nTarget += 100;
+            bool fToppedUp = wallet.TopUpKeyPool(nTarget);
+            assert(fToppedUp);
+        }
+    }
+    bitdb.Flush(true);
+}
+
+static void WalletLoadBDB(benchmark::State& state) { WalletLoad(state, false); }
+static void WalletLoadLog(benchmark::State& state) { WalletLoad(state, true); }
+static void WalletTxWriteBDB(benchmark::State& state) { WalletTxWrite(state, false); }
+static void WalletTxWriteLog(benchmark::State& state) { WalletTxWrite(state, true); }
+static void WalletKeypoolRefillBDB(benchmark::State& state) { WalletKeypoolRefill(state, false); }
+static void WalletKeypoolRefillLog(benchmark::State& state) { WalletKeypoolRefill(state, true); }
+
+BENCHMARK(WalletLoadBDB);
+BENCHMARK(WalletLoadLog);
+BENCHMARK(WalletTxWriteBDB);
+BENCHMARK(WalletTxWriteLog);
+BENCHMARK(WalletKeypoolRefillBDB);
+BENCHMARK(WalletKeypoolRefillLog);
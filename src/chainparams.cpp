@@ -161,6 +161,9 @@ public:
                         //   (the tx=... number in the SetBestChain debug.log lines)
             60000.0     // * estimated number of transactions per day after checkpoint
         };
+
+        // No UTXO snapshot has been published for this network yet
+        fAcceptAnyUtxoSnapshot = false;
     }
 };
 static CMainParams mainParams;
@@ -226,6 +229,8 @@ public:
             300
         };
 
+        fAcceptAnyUtxoSnapshot = false;
+
     }
 };
 static CTestNetParams testNetParams;
@@ -283,6 +288,7 @@ public:
             0,
             0
         };
+        fAcceptAnyUtxoSnapshot = true;
         base58Prefixes[PUBKEY_ADDRESS] = std::vector<unsigned char>(1,111);
         base58Prefixes[SCRIPT_ADDRESS] = std::vector<unsigned char>(1,196);
         base58Prefixes[SECRET_KEY] =     std::vector<unsigned char>(1,239);
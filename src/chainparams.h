@@ -74,6 +74,10 @@ public:
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
+    /** Checksums, by height, of the UTXO snapshots -loadutxosnapshot accepts */
+    const MapCheckpoints& UtxoSnapshots() const { return mapUtxoSnapshots; }
+    /** Accept any intact UTXO snapshot, known or not (regtest only) */
+    bool AcceptAnyUtxoSnapshot() const { return fAcceptAnyUtxoSnapshot; }
 protected:
     CChainParams() {}
 
@@ -92,6 +96,8 @@ protected:
     bool fMineBlocksOnDemand;
     bool fTestnetToBeDeprecatedFieldRPC;
     CCheckpointData checkpointData;
+    MapCheckpoints mapUtxoSnapshots;
+    bool fAcceptAnyUtxoSnapshot;
 
     void MineNewGenesisBlock();
 };
@@ -9,6 +9,8 @@
 
 #include <assert.h>
 
+#include <algorithm>
+
 /**
  * calculate number of bytes for the bitmask, and its number of non-zero bytes
  * each bit in the bitmask represents the availability of one output, but the
@@ -58,7 +60,7 @@ bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStat
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0), fTrackDirty(false) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -66,7 +68,11 @@ CCoinsViewCache::~CCoinsViewCache()
 }
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
+    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage + memusage::DynamicUsage(vDirty);
+}
+
+size_t CCoinsViewCache::ReusableMemoryUsage() const {
+    return cacheCoins.FreeMemoryUsage();
 }
 
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
@@ -113,6 +119,8 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
         cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
+    if (!(ret.first->second.flags & CCoinsCacheEntry::DIRTY))
+        AddDirty(txid);
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
     return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
@@ -125,6 +133,8 @@ CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid, bool coinbas
     assert(!hasModifier);
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
     ret.first->second.coins.Clear();
+    if (!(ret.first->second.flags & CCoinsCacheEntry::DIRTY))
+        AddDirty(txid);
     if (!coinbase) {
         ret.first->second.flags = CCoinsCacheEntry::FRESH;
     }
@@ -180,6 +190,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     entry.coins.swap(it->second.coins);
                     cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY;
+                    AddDirty(it->first);
                     // We can mark it FRESH in the parent if it was FRESH in the child
                     // Otherwise it might have just been flushed from the parent's cache
                     // and already exist in the grandparent
@@ -199,6 +210,8 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
                     cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+                    if (!(itUs->second.flags & CCoinsCacheEntry::DIRTY))
+                        AddDirty(it->first);
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 }
             }
@@ -214,9 +227,57 @@ bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    std::vector<uint256>().swap(vDirty);
     return fOk;
 }
 
+void CCoinsViewCache::CopyDirty(CCoinsMap &mapDirty, size_t nMaxEntries) {
+    assert(!hasModifier);
+    assert(fTrackDirty);
+    // vDirty is in the order entries became dirty, oldest first
+    std::vector<uint256>::iterator itDirty = vDirty.begin();
+    for (size_t nCopied = 0; itDirty != vDirty.end() && nCopied < nMaxEntries; itDirty++) {
+        const uint256& txid = *itDirty;
+        CCoinsMap::iterator it = cacheCoins.find(txid);
+        // Skip entries that were erased, or listed twice and already copied
+        if (it == cacheCoins.end() || !(it->second.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        nCopied++;
+        CCoinsCacheEntry& entry = mapDirty[txid];
+        entry.flags = CCoinsCacheEntry::DIRTY;
+        if (it->second.coins.IsPruned()) {
+            // Nothing worth keeping warm, the copy (pruned) deletes it from the base
+            cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+            cacheCoins.erase(it);
+        } else {
+            entry.coins = it->second.coins;
+            it->second.flags = 0;
+        }
+    }
+    if (itDirty == vDirty.end())
+        std::vector<uint256>().swap(vDirty);
+    else
+        vDirty.erase(vDirty.begin(), itDirty);
+}
+
+void CCoinsViewCache::Trim(size_t nTargetUsage) {
+    assert(!hasModifier);
+    // Each erased entry gives back its coins and its slot in the map's pool
+    size_t nUsage = DynamicMemoryUsage() - ReusableMemoryUsage();
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ) {
+        if (nUsage <= nTargetUsage)
+            break;
+        if (it->second.flags == 0) {
+            size_t nEntryUsage = it->second.coins.DynamicMemoryUsage();
+            cachedCoinsUsage -= nEntryUsage;
+            nUsage -= std::min(nUsage, nEntryUsage + CCoinsMap::EntryMemoryUsage());
+            cacheCoins.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
 void CCoinsViewCache::Uncache(const uint256& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -226,6 +287,17 @@ void CCoinsViewCache::Uncache(const uint256& hash)
     }
 }
 
+bool CCoinsViewCache::AddPrefetched(const uint256 &txid, CCoins &coins) {
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    if (!ret.second)
+        return false;
+    coins.swap(ret.first->second.coins);
+    if (ret.first->second.coins.IsPruned())
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    cachedCoinsUsage += ret.first->second.coins.DynamicMemoryUsage();
+    return true;
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
@@ -8,6 +8,7 @@
 
 #include "compressor.h"
 #include "core_memusage.h"
+#include "flatmap.h"
 #include "memusage.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -15,6 +16,8 @@
 #include <assert.h>
 #include <stdint.h>
 
+#include <limits>
+
 #include <boost/foreach.hpp>
 #include <boost/unordered_map.hpp>
 
@@ -276,6 +279,7 @@ public:
      * This *must* return size_t. With Boost 1.46 on 32-bit systems the
      * unordered_map will behave unpredictably if the custom hasher returns a
      * uint64_t, resulting in failures when syncing the chain (#4634).
+     * flatmap uses the low bits to pick a slot and the rest as a tag.
      */
     size_t operator()(const uint256& key) const {
         return key.GetHash(salt);
@@ -295,7 +299,7 @@ struct CCoinsCacheEntry
     CCoinsCacheEntry() : coins(), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+typedef flatmap<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
 
 struct CCoinsStats
 {
@@ -394,6 +398,17 @@ protected:
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Whether vDirty is maintained, see TrackDirty(). */
+    bool fTrackDirty;
+
+    /* Entries that became dirty since the last Flush() or CopyDirty(); may contain stale txids. */
+    std::vector<uint256> vDirty;
+
+    void AddDirty(const uint256 &txid) {
+        if (fTrackDirty)
+            vDirty.push_back(txid);
+    }
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -450,12 +465,43 @@ public:
      */
     void Uncache(const uint256 &txid);
 
+    /**
+     * Add coins read from the base view ahead of time, unless an entry for
+     * txid is cached already. Returns whether they were added (and taken
+     * over from coins). The caller must make sure the base view has not
+     * changed since they were read.
+     */
+    bool AddPrefetched(const uint256 &txid, CCoins &coins);
+
+    //! Keep a list of modified entries, needed for CopyDirty()
+    void TrackDirty() { fTrackDirty = true; }
+
+    /**
+     * Copy up to nMaxEntries dirty entries, the ones modified first, into
+     * mapDirty and mark them clean, keeping them cached (pruned ones are
+     * dropped). mapDirty must reach the base view before any data is read
+     * from it again, see CCoinsViewDB::StageCoins.
+     */
+    void CopyDirty(CCoinsMap &mapDirty, size_t nMaxEntries = std::numeric_limits<size_t>::max());
+
+    /**
+     * Evict unmodified entries until DynamicMemoryUsage(), not counting
+     * memory that new entries will reuse, is at most nTargetUsage.
+     */
+    void Trim(size_t nTargetUsage);
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Number of entries modified since the last Flush() or CopyDirty() (upper bound)
+    size_t GetDirtyCount() const { return vDirty.size(); }
+
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
+    //! Part of DynamicMemoryUsage() left by evicted entries, which new entries will reuse (in bytes)
+    size_t ReusableMemoryUsage() const;
+
     /** 
      * Amount of bitcredits coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
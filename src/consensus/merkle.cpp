@@ -4,6 +4,7 @@
 
 #include "merkle.h"
 #include "hash.h"
+#include "crypto/sha256.h"
 #include "utilstrencodings.h"
 
 /*     WARNING! If you're reading this because you're learning about crypto
@@ -130,10 +131,34 @@ static void MerkleComputation(const std::vector<uint256>& leaves, uint256* proot
     if (proot) *proot = h;
 }
 
+/*
+ * Compute the root level by level, in place. Each level is hashed with one
+ * SHA256D64 call, so the 64-byte pairs are double-hashed several at a time by
+ * the multi-way SHA256 implementations where available. Mutation is detected
+ * the same way as in MerkleComputation: two equal hashes being combined.
+ */
+static uint256 ComputeMerkleRootInPlace(std::vector<uint256>& hashes, bool* pmutated) {
+    bool mutated = false;
+    while (hashes.size() > 1) {
+        if (pmutated) {
+            for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+                if (hashes[pos] == hashes[pos + 1]) mutated = true;
+            }
+        }
+        if (hashes.size() & 1) {
+            hashes.push_back(hashes.back());
+        }
+        SHA256D64(hashes[0].begin(), hashes[0].begin(), hashes.size() / 2);
+        hashes.resize(hashes.size() / 2);
+    }
+    if (pmutated) *pmutated = mutated;
+    if (hashes.size() == 0) return uint256();
+    return hashes[0];
+}
+
 uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated) {
-    uint256 hash;
-    MerkleComputation(leaves, &hash, mutated, -1, NULL);
-    return hash;
+    std::vector<uint256> hashes(leaves);
+    return ComputeMerkleRootInPlace(hashes, mutated);
 }
 
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position) {
@@ -158,11 +183,12 @@ uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint2
 uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
 {
     std::vector<uint256> leaves;
+    leaves.reserve(block.vtx.size() + 1); // room for the duplicate on odd levels
     leaves.resize(block.vtx.size());
     for (size_t s = 0; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s].GetHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeMerkleRootInPlace(leaves, mutated);
 }
 
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position)
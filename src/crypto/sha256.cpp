@@ -8,6 +8,36 @@
 
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#if !defined(BUILD_BITCREDIT_INTERNAL) && (defined(ENABLE_SSE41) || defined(ENABLE_AVX2) || defined(ENABLE_SHANI))
+#include <cpuid.h>
+#define USE_CPUID_DETECTION 1
+#endif
+#endif
+
+#if defined(USE_CPUID_DETECTION) && defined(ENABLE_SSE41)
+namespace sha256_sse41
+{
+void TransformD64_4way(unsigned char* out, const unsigned char* in);
+void TransformD80_4way(unsigned char* out, const uint32_t* midstate, const unsigned char* tail, uint32_t nNonce);
+}
+#endif
+
+#if defined(USE_CPUID_DETECTION) && defined(ENABLE_AVX2)
+namespace sha256_avx2
+{
+void TransformD64_8way(unsigned char* out, const unsigned char* in);
+void TransformD80_8way(unsigned char* out, const uint32_t* midstate, const unsigned char* tail, uint32_t nNonce);
+}
+#endif
+
+#if defined(USE_CPUID_DETECTION) && defined(ENABLE_SHANI)
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
+}
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -44,7 +74,7 @@ void inline Initialize(uint32_t* s)
 }
 
 /** Perform one SHA-256 transformation, processing a 64-byte chunk. */
-void Transform(uint32_t* s, const unsigned char* chunk)
+void TransformOne(uint32_t* s, const unsigned char* chunk)
 {
     uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
     uint32_t w0, w1, w2, w3, w4, w5, w6, w7, w8, w9, w10, w11, w12, w13, w14, w15;
@@ -127,9 +157,185 @@ void Transform(uint32_t* s, const unsigned char* chunk)
     s[7] += h;
 }
 
+/** Process a number of consecutive 64-byte chunks. */
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    while (blocks--) {
+        TransformOne(s, chunk);
+        chunk += 64;
+    }
+}
+
 } // namespace sha256
+
+typedef void (*TransformType)(uint32_t*, const unsigned char*, size_t);
+typedef void (*TransformD64Type)(unsigned char*, const unsigned char*);
+typedef void (*TransformD80Type)(unsigned char*, const uint32_t*, const unsigned char*, uint32_t);
+
+/** Single-stream transform, used by CSHA256 and the one-at-a-time paths below. */
+TransformType Transform = sha256::Transform;
+/** Multi-way double hashing of 64-byte inputs and of 80-byte headers; NULL when unavailable. */
+TransformD64Type TransformD64_4way = NULL;
+TransformD64Type TransformD64_8way = NULL;
+TransformD80Type TransformD80_4way = NULL;
+TransformD80Type TransformD80_8way = NULL;
+
+/** Hash the 32-byte result of a first SHA-256 (in state s) again, writing the digest to out. */
+void FinalizeDouble(unsigned char* out, const uint32_t* s)
+{
+    unsigned char buf[64] = {0};
+    for (int i = 0; i < 8; i++)
+        WriteBE32(buf + 4 * i, s[i]);
+    buf[32] = 0x80;
+    WriteBE64(buf + 56, 256);
+    uint32_t t[8];
+    sha256::Initialize(t);
+    Transform(t, buf, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, t[i]);
+}
+
+/** Double-SHA256 of one 64-byte input. out may overlap in. */
+void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    static const unsigned char pad[64] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0x00};
+    uint32_t s[8];
+    sha256::Initialize(s);
+    Transform(s, in, 1);
+    Transform(s, pad, 1);
+    FinalizeDouble(out, s);
+}
+
+/** Double-SHA256 of one 80-byte header, given the state after its first 64 bytes. */
+void TransformD80(unsigned char* out, const uint32_t* midstate, const unsigned char* tail, uint32_t nNonce)
+{
+    unsigned char buf[64] = {0};
+    memcpy(buf, tail, 12);
+    WriteLE32(buf + 12, nNonce);
+    buf[16] = 0x80;
+    WriteBE64(buf + 56, 640);
+    uint32_t s[8];
+    memcpy(s, midstate, sizeof(s));
+    Transform(s, buf, 1);
+    FinalizeDouble(out, s);
+}
+
+#if defined(USE_CPUID_DETECTION)
+void inline cpuid(uint32_t leaf, uint32_t subleaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+}
+
+/** Whether the OS saves the AVX (ymm) registers on context switches. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+
+struct CPUFeatures
+{
+    bool fSSE41;
+    bool fAVX2;
+    bool fSHANI;
+};
+
+CPUFeatures DetectCPUFeatures()
+{
+    CPUFeatures features = {false, false, false};
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, eax, ebx, ecx, edx);
+    uint32_t nMaxLeaf = eax;
+    if (nMaxLeaf < 1)
+        return features;
+    cpuid(1, 0, eax, ebx, ecx, edx);
+    features.fSSE41 = (ecx >> 19) & 1;
+    bool fAVX = ((ecx >> 27) & 1) && ((ecx >> 28) & 1) && AVXEnabled(); // OSXSAVE and AVX
+    if (nMaxLeaf >= 7) {
+        cpuid(7, 0, eax, ebx, ecx, edx);
+        features.fAVX2 = fAVX && ((ebx >> 5) & 1);
+        features.fSHANI = features.fSSE41 && ((ebx >> 29) & 1);
+    }
+    return features;
+}
+#endif
+
+void UseStandard()
+{
+    Transform = sha256::Transform;
+    TransformD64_4way = NULL;
+    TransformD64_8way = NULL;
+    TransformD80_4way = NULL;
+    TransformD80_8way = NULL;
+}
+
 } // namespace
 
+std::string SHA256AutoDetect()
+{
+    std::string ret = "standard";
+    UseStandard();
+#if defined(USE_CPUID_DETECTION)
+    CPUFeatures features = DetectCPUFeatures();
+#if defined(ENABLE_SHANI)
+    if (features.fSHANI) {
+        Transform = sha256_shani::Transform;
+        ret = "shani(1way)";
+    }
+#endif
+#if defined(ENABLE_SSE41)
+    if (features.fSSE41) {
+        TransformD64_4way = sha256_sse41::TransformD64_4way;
+        TransformD80_4way = sha256_sse41::TransformD80_4way;
+        ret += ",sse41(4way)";
+    }
+#endif
+#if defined(ENABLE_AVX2)
+    if (features.fAVX2) {
+        TransformD64_8way = sha256_avx2::TransformD64_8way;
+        TransformD80_8way = sha256_avx2::TransformD80_8way;
+        ret += ",avx2(8way)";
+    }
+#endif
+#endif
+    return ret;
+}
+
+bool SHA256UseImplementation(const std::string& name)
+{
+    UseStandard();
+    if (name == "standard")
+        return true;
+#if defined(USE_CPUID_DETECTION)
+    CPUFeatures features = DetectCPUFeatures();
+#if defined(ENABLE_SHANI)
+    if (name == "shani" && features.fSHANI) {
+        Transform = sha256_shani::Transform;
+        return true;
+    }
+#endif
+#if defined(ENABLE_SSE41)
+    if (name == "sse4.1" && features.fSSE41) {
+        TransformD64_4way = sha256_sse41::TransformD64_4way;
+        TransformD80_4way = sha256_sse41::TransformD80_4way;
+        return true;
+    }
+#endif
+#if defined(ENABLE_AVX2)
+    if (name == "avx2" && features.fAVX2) {
+        TransformD64_8way = sha256_avx2::TransformD64_8way;
+        TransformD80_8way = sha256_avx2::TransformD80_8way;
+        return true;
+    }
+#endif
+#endif
+    return false;
+}
+
 
 ////// SHA-256
 
@@ -147,14 +353,15 @@ CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
         memcpy(buf + bufsize, data, 64 - bufsize);
         bytes += 64 - bufsize;
         data += 64 - bufsize;
-        sha256::Transform(s, buf);
+        Transform(s, buf, 1);
         bufsize = 0;
     }
-    while (end >= data + 64) {
+    if (end - data >= 64) {
         // Process full chunks directly from the source.
-        sha256::Transform(s, data);
-        bytes += 64;
-        data += 64;
+        size_t blocks = (end - data) / 64;
+        Transform(s, data, blocks);
+        bytes += 64 * blocks;
+        data += 64 * blocks;
     }
     if (end > data) {
         // Fill the buffer with what remains.
@@ -187,3 +394,56 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+    if (TransformD64_8way) {
+        while (blocks >= 8) {
+            TransformD64_8way(out, in);
+            out += 256;
+            in += 512;
+            blocks -= 8;
+        }
+    }
+    if (TransformD64_4way) {
+        while (blocks >= 4) {
+            TransformD64_4way(out, in);
+            out += 128;
+            in += 256;
+            blocks -= 4;
+        }
+    }
+    while (blocks--) {
+        TransformD64(out, in);
+        out += 32;
+        in += 64;
+    }
+}
+
+void SHA256D80Nonces(unsigned char* out, const unsigned char* header, uint32_t nNonce, size_t count)
+{
+    uint32_t midstate[8];
+    sha256::Initialize(midstate);
+    Transform(midstate, header, 1);
+    const unsigned char* tail = header + 64;
+    if (TransformD80_8way) {
+        while (count >= 8) {
+            TransformD80_8way(out, midstate, tail, nNonce);
+            out += 256;
+            nNonce += 8;
+            count -= 8;
+        }
+    }
+    if (TransformD80_4way) {
+        while (count >= 4) {
+            TransformD80_4way(out, midstate, tail, nNonce);
+            out += 128;
+            nNonce += 4;
+            count -= 4;
+        }
+    }
+    while (count--) {
+        TransformD80(out, midstate, tail, nNonce++);
+        out += 32;
+    }
+}
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,29 @@ public:
     CSHA256& Reset();
 };
 
+/** Autodetect the best available SHA256 implementation.
+ *  Returns the name of the implementation.
+ */
+std::string SHA256AutoDetect();
+
+/** Use only the named implementation ("standard", "shani", "sse4.1" or
+ *  "avx2") from now on, for tests and benchmarks. Returns false, leaving the
+ *  standard one in place, if it is not compiled in or not supported by the CPU.
+ */
+bool SHA256UseImplementation(const std::string& name);
+
+/** Compute multiple double-SHA256's of 64-byte blobs.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  input:   pointer to a blocks*64 byte input buffer
+ *  blocks:  the number of hashes to compute.
+ *  The output may overlap the input as long as it does not start after it.
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
+/** Compute the double-SHA256's of an 80-byte block header for count
+ *  consecutive nonces, starting at nNonce. The nonce field of header (its
+ *  last 4 bytes) is ignored. output is a count*32 byte buffer.
+ */
+void SHA256D80Nonces(unsigned char* output, const unsigned char* header, uint32_t nNonce, size_t count);
+
 #endif // BITCREDIT_CRYPTO_SHA256_H
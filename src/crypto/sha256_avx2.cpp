@@ -0,0 +1,47 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 8-way SHA-256 using AVX2. This file is compiled with -mavx2, and only
+// called into after a runtime check (see SHA256AutoDetect).
+
+#ifdef ENABLE_AVX2
+
+#include "crypto/sha256_multiway.h"
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace
+{
+struct AVX2Ops
+{
+    typedef __m256i V;
+    enum { LANES = 8 };
+
+    static inline V Set(uint32_t x) { return _mm256_set1_epi32(x); }
+    static inline V Load(const uint32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static inline void Store(uint32_t* p, V x) { _mm256_storeu_si256((__m256i*)p, x); }
+    static inline V Add(V x, V y) { return _mm256_add_epi32(x, y); }
+    static inline V Xor(V x, V y) { return _mm256_xor_si256(x, y); }
+    static inline V And(V x, V y) { return _mm256_and_si256(x, y); }
+    static inline V Or(V x, V y) { return _mm256_or_si256(x, y); }
+    static inline V ShR(V x, int n) { return _mm256_srli_epi32(x, n); }
+    static inline V ShL(V x, int n) { return _mm256_slli_epi32(x, n); }
+};
+} // namespace
+
+namespace sha256_avx2
+{
+void TransformD64_8way(unsigned char* out, const unsigned char* in)
+{
+    SHA256MultiWay<AVX2Ops>::TransformD64(out, in);
+}
+
+void TransformD80_8way(unsigned char* out, const uint32_t* midstate, const unsigned char* tail, uint32_t nNonce)
+{
+    SHA256MultiWay<AVX2Ops>::TransformD80(out, midstate, tail, nNonce);
+}
+} // namespace sha256_avx2
+
+#endif // ENABLE_AVX2
@@ -0,0 +1,175 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Internal header for the SIMD SHA-256 implementations (sha256_sse41.cpp,
+// sha256_avx2.cpp). Everything here has internal linkage, so code compiled
+// with the wider instruction sets never leaks into other translation units.
+
+#ifndef BITCREDIT_CRYPTO_SHA256_MULTIWAY_H
+#define BITCREDIT_CRYPTO_SHA256_MULTIWAY_H
+
+#include "crypto/common.h"
+
+#include <stdint.h>
+
+namespace
+{
+/**
+ * SHA-256 on Ops::LANES independent messages at once. Ops provides a vector
+ * type V holding one 32-bit word per lane, and the operations on it.
+ */
+template<typename Ops>
+struct SHA256MultiWay
+{
+    typedef typename Ops::V V;
+    enum { LANES = Ops::LANES };
+
+    static inline V Add(V x, V y) { return Ops::Add(x, y); }
+    static inline V Rot(V x, int n) { return Ops::Or(Ops::ShR(x, n), Ops::ShL(x, 32 - n)); }
+    static inline V Ch(V x, V y, V z) { return Ops::Xor(z, Ops::And(x, Ops::Xor(y, z))); }
+    static inline V Maj(V x, V y, V z) { return Ops::Or(Ops::And(x, y), Ops::And(z, Ops::Or(x, y))); }
+    static inline V Sigma0(V x) { return Ops::Xor(Ops::Xor(Rot(x, 2), Rot(x, 13)), Rot(x, 22)); }
+    static inline V Sigma1(V x) { return Ops::Xor(Ops::Xor(Rot(x, 6), Rot(x, 11)), Rot(x, 25)); }
+    static inline V sigma0(V x) { return Ops::Xor(Ops::Xor(Rot(x, 7), Rot(x, 18)), Ops::ShR(x, 3)); }
+    static inline V sigma1(V x) { return Ops::Xor(Ops::Xor(Rot(x, 17), Rot(x, 19)), Ops::ShR(x, 10)); }
+
+    /** One round of SHA-256, kw being the round constant plus the message word. */
+    static inline void Round(V a, V b, V c, V& d, V e, V f, V g, V& h, V kw)
+    {
+        V t1 = Add(Add(h, Sigma1(e)), Add(Ch(e, f, g), kw));
+        V t2 = Add(Sigma0(a), Maj(a, b, c));
+        d = Add(d, t1);
+        h = Add(t1, t2);
+    }
+
+    /** Message word i (expanding the schedule in place) plus round constant i. */
+    static inline V KW(V* w, int i)
+    {
+        static const uint32_t K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        if (i >= 16)
+            w[i & 15] = Add(Add(w[i & 15], sigma1(w[(i + 14) & 15])), Add(w[(i + 9) & 15], sigma0(w[(i + 1) & 15])));
+        return Add(Ops::Set(K[i]), w[i & 15]);
+    }
+
+    /** Process one 64-byte chunk per lane: s is the state, w the chunk as big endian words (overwritten). */
+    static void Transform(V* s, V* w)
+    {
+        V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; i += 8) {
+            Round(a, b, c, d, e, f, g, h, KW(w, i + 0));
+            Round(h, a, b, c, d, e, f, g, KW(w, i + 1));
+            Round(g, h, a, b, c, d, e, f, KW(w, i + 2));
+            Round(f, g, h, a, b, c, d, e, KW(w, i + 3));
+            Round(e, f, g, h, a, b, c, d, KW(w, i + 4));
+            Round(d, e, f, g, h, a, b, c, KW(w, i + 5));
+            Round(c, d, e, f, g, h, a, b, KW(w, i + 6));
+            Round(b, c, d, e, f, g, h, a, KW(w, i + 7));
+        }
+        s[0] = Add(s[0], a);
+        s[1] = Add(s[1], b);
+        s[2] = Add(s[2], c);
+        s[3] = Add(s[3], d);
+        s[4] = Add(s[4], e);
+        s[5] = Add(s[5], f);
+        s[6] = Add(s[6], g);
+        s[7] = Add(s[7], h);
+    }
+
+    static inline void Initialize(V* s)
+    {
+        s[0] = Ops::Set(0x6a09e667ul);
+        s[1] = Ops::Set(0xbb67ae85ul);
+        s[2] = Ops::Set(0x3c6ef372ul);
+        s[3] = Ops::Set(0xa54ff53aul);
+        s[4] = Ops::Set(0x510e527ful);
+        s[5] = Ops::Set(0x9b05688cul);
+        s[6] = Ops::Set(0x1f83d9abul);
+        s[7] = Ops::Set(0x5be0cd19ul);
+    }
+
+    /** Hash the 32-byte first hashes in s once more, and write the results to out (LANES * 32 bytes). */
+    static inline void FinalizeDouble(unsigned char* out, const V* s)
+    {
+        V w[16], t[8];
+        for (int i = 0; i < 8; i++)
+            w[i] = s[i];
+        w[8] = Ops::Set(0x80000000ul);
+        for (int i = 9; i < 15; i++)
+            w[i] = Ops::Set(0);
+        w[15] = Ops::Set(256);
+        Initialize(t);
+        Transform(t, w);
+
+        uint32_t words[LANES];
+        for (int i = 0; i < 8; i++) {
+            Ops::Store(words, t[i]);
+            for (int l = 0; l < LANES; l++)
+                WriteBE32(out + 32 * l + 4 * i, words[l]);
+        }
+    }
+
+    /** Double-SHA256 of LANES 64-byte inputs (in: LANES * 64 bytes, out: LANES * 32 bytes, may overlap in). */
+    static void TransformD64(unsigned char* out, const unsigned char* in)
+    {
+        V s[8], w[16];
+        uint32_t words[LANES];
+        for (int i = 0; i < 16; i++) {
+            for (int l = 0; l < LANES; l++)
+                words[l] = ReadBE32(in + 64 * l + 4 * i);
+            w[i] = Ops::Load(words);
+        }
+        Initialize(s);
+        Transform(s, w);
+
+        // Padding chunk of a 64-byte message
+        w[0] = Ops::Set(0x80000000ul);
+        for (int i = 1; i < 15; i++)
+            w[i] = Ops::Set(0);
+        w[15] = Ops::Set(512);
+        Transform(s, w);
+
+        FinalizeDouble(out, s);
+    }
+
+    /**
+     * Double-SHA256 of LANES 80-byte block headers that differ only in their
+     * nonce, nNonce, nNonce + 1, ... midstate is the state after the first 64
+     * bytes, tail points at the next 12 (the nonce follows them).
+     */
+    static void TransformD80(unsigned char* out, const uint32_t* midstate, const unsigned char* tail, uint32_t nNonce)
+    {
+        V s[8], w[16];
+        uint32_t words[LANES];
+        unsigned char nonce[4];
+        for (int l = 0; l < LANES; l++) {
+            WriteLE32(nonce, nNonce + l);
+            words[l] = ReadBE32(nonce);
+        }
+        for (int i = 0; i < 8; i++)
+            s[i] = Ops::Set(midstate[i]);
+        w[0] = Ops::Set(ReadBE32(tail));
+        w[1] = Ops::Set(ReadBE32(tail + 4));
+        w[2] = Ops::Set(ReadBE32(tail + 8));
+        w[3] = Ops::Load(words);
+        w[4] = Ops::Set(0x80000000ul);
+        for (int i = 5; i < 15; i++)
+            w[i] = Ops::Set(0);
+        w[15] = Ops::Set(640);
+        Transform(s, w);
+
+        FinalizeDouble(out, s);
+    }
+};
+
+} // namespace
+
+#endif // BITCREDIT_CRYPTO_SHA256_MULTIWAY_H
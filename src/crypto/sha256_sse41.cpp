@@ -0,0 +1,47 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 4-way SHA-256 using SSE4.1. This file is compiled with -msse4.1, and only
+// called into after a runtime check (see SHA256AutoDetect).
+
+#ifdef ENABLE_SSE41
+
+#include "crypto/sha256_multiway.h"
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace
+{
+struct SSE41Ops
+{
+    typedef __m128i V;
+    enum { LANES = 4 };
+
+    static inline V Set(uint32_t x) { return _mm_set1_epi32(x); }
+    static inline V Load(const uint32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static inline void Store(uint32_t* p, V x) { _mm_storeu_si128((__m128i*)p, x); }
+    static inline V Add(V x, V y) { return _mm_add_epi32(x, y); }
+    static inline V Xor(V x, V y) { return _mm_xor_si128(x, y); }
+    static inline V And(V x, V y) { return _mm_and_si128(x, y); }
+    static inline V Or(V x, V y) { return _mm_or_si128(x, y); }
+    static inline V ShR(V x, int n) { return _mm_srli_epi32(x, n); }
+    static inline V ShL(V x, int n) { return _mm_slli_epi32(x, n); }
+};
+} // namespace
+
+namespace sha256_sse41
+{
+void TransformD64_4way(unsigned char* out, const unsigned char* in)
+{
+    SHA256MultiWay<SSE41Ops>::TransformD64(out, in);
+}
+
+void TransformD80_4way(unsigned char* out, const uint32_t* midstate, const unsigned char* tail, uint32_t nNonce)
+{
+    SHA256MultiWay<SSE41Ops>::TransformD80(out, midstate, tail, nNonce);
+}
+} // namespace sha256_sse41
+
+#endif // ENABLE_SSE41
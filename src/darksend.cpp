@@ -1086,7 +1086,7 @@ bool CDarksendPool::AddEntry(const std::vector<CTxIn>& newInput, const int64_t&
     }
 
     CDarkSendEntry v;
-    v.Add(newInput, nAmount, txCollateral, newOutput);
+    v.Add(newInput, nAmount, txCollateral, newOutput, GetDenominations(newOutput));
     entries.push_back(v);
 
     if(fDebug) LogPrintf("CDarksendPool::AddEntry -- adding %s\n", newInput[0].ToString().c_str());
@@ -1839,10 +1839,11 @@ bool CDarksendPool::CreateDenominated(int64_t nTotalValue)
 */
 bool CDarksendPool::IsCompatibleWithEntries(std::vector<CTxOut> vout)
 {
-    if(GetDenominations(vout) == 0) return false;
+    int nDenom = GetDenominations(vout);
+    if(nDenom == 0) return false;
 
-    BOOST_FOREACH(const CDarkSendEntry v, entries) {
-        LogPrintf(" IsCompatibleWithEntries %d %d\n", GetDenominations(vout), GetDenominations(v.vout));
+    BOOST_FOREACH(const CDarkSendEntry& v, entries) {
+        LogPrintf(" IsCompatibleWithEntries %d %d\n", nDenom, v.nDenom);
 /*
         BOOST_FOREACH(CTxOut o1, vout)
             LogPrintf(" vout 1 - %s\n", o1.ToString().c_str());
@@ -1850,7 +1851,7 @@ bool CDarksendPool::IsCompatibleWithEntries(std::vector<CTxOut> vout)
         BOOST_FOREACH(CTxOut o2, v.vout)
             LogPrintf(" vout 2 - %s\n", o2.ToString().c_str());
 */
-        if(GetDenominations(vout) != GetDenominations(v.vout)) return false;
+        if(nDenom != v.nDenom) return false;
     }
 
     return true;
@@ -1947,41 +1948,35 @@ void CDarksendPool::GetDenominationsToString(int nDenom, std::string& strDenom){
     }
 }
 
+int GetDenominationBit(int64_t nAmount)
+{
+    for (unsigned int i = 0; i < darkSendDenominations.size(); i++)
+        if (darkSendDenominations[i] == nAmount) return i;
+    return -1;
+}
+
 int CDarksendPool::GetDenominations(const std::vector<CTxDSOut>& vout){
-    std::vector<CTxOut> vout2;
+    int denom = 0;
 
-    BOOST_FOREACH(CTxDSOut out, vout)
-        vout2.push_back(out);
+    BOOST_FOREACH(const CTxDSOut& out, vout){
+        int nBit = GetDenominationBit(out.nValue);
+        if(nBit < 0) return 0;
+        denom |= 1 << nBit;
+    }
 
-    return GetDenominations(vout2);
+    return denom;
 }
 
 // return a bitshifted integer representing the denominations in this list
 int CDarksendPool::GetDenominations(const std::vector<CTxOut>& vout){
-    std::vector<pair<int64_t, int> > denomUsed;
-
-    // make a list of denominations, with zero uses
-    BOOST_FOREACH(int64_t d, darkSendDenominations)
-        denomUsed.push_back(make_pair(d, 0));
-
-    // look for denominations and update uses to 1
-    BOOST_FOREACH(CTxOut out, vout){
-        bool found = false;
-        BOOST_FOREACH (PAIRTYPE(int64_t, int)& s, denomUsed){
-            if (out.nValue == s.first){
-                s.second = 1;
-                found = true;
-            }
-        }
-        if(!found) return 0;
-    }
-
     int denom = 0;
-    int c = 0;
-    // if the denomination is used, shift the bit on.
-    // then move to the next
-    BOOST_FOREACH (PAIRTYPE(int64_t, int)& s, denomUsed)
-        denom |= s.second << c++;
+
+    // turn on the bit of each denomination used, any other amount makes the list non-denominated
+    BOOST_FOREACH(const CTxOut& out, vout){
+        int nBit = GetDenominationBit(out.nValue);
+        if(nBit < 0) return 0;
+        denom |= 1 << nBit;
+    }
 
     // Function returns as follows:
     //
@@ -57,6 +57,9 @@ extern CActiveBasenode activeBasenode;
 // get the Darksend chain depth for a given input
 int GetInputDarksendRounds(CTxIn in, int rounds=0);
 
+// get the bit of an amount in denomination bitmasks (its index in darkSendDenominations), -1 if it is not a denomination
+int GetDenominationBit(int64_t nAmount);
+
 /** Holds an Darksend input
  */
 class CTxDSIn : public CTxIn
@@ -100,6 +103,7 @@ public:
     std::vector<CTxDSIn> sev;
     std::vector<CTxDSOut> vout;
     int64_t amount;
+    int nDenom; // denominations of vout, see CDarksendPool::GetDenominations
     CTransaction collateral;
     CTransaction txSupporting;
     int64_t addedTime;
@@ -109,10 +113,11 @@ public:
         isSet = false;
         collateral = CTransaction();
         amount = 0;
+        nDenom = 0;
     }
 
     /// Add entries to use for Darksend
-    bool Add(const std::vector<CTxIn> vinIn, int64_t amountIn, const CTransaction collateralIn, const std::vector<CTxOut> voutIn)
+    bool Add(const std::vector<CTxIn> vinIn, int64_t amountIn, const CTransaction collateralIn, const std::vector<CTxOut> voutIn, int nDenomIn)
     {
         if(isSet){return false;}
 
@@ -123,6 +128,7 @@ public:
             vout.push_back(out);
 
         amount = amountIn;
+        nDenom = nDenomIn;
         collateral = collateralIn;
         isSet = true;
         addedTime = GetTime();
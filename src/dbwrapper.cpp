@@ -7,7 +7,10 @@
 #include "util.h"
 #include "random.h"
 
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -29,14 +32,62 @@ void HandleError(const leveldb::Status& status) throw(dbwrapper_error)
     throw dbwrapper_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+std::string GetDBArg(const std::string& strArg, const std::string& strName, const std::string& strDefault)
+{
+    std::map<std::string, std::vector<std::string> >::const_iterator mi = mapMultiArgs.find(strArg);
+    if (mi == mapMultiArgs.end())
+        return strDefault;
+    std::string strValue = strDefault;
+    bool fNamed = false;
+    BOOST_FOREACH(const std::string& str, mi->second) {
+        size_t nSep = str.find(':');
+        if (nSep == std::string::npos) {
+            if (!fNamed)
+                strValue = str;
+        } else if (!strName.empty() && str.substr(0, nSep) == strName) {
+            strValue = str.substr(nSep + 1);
+            fNamed = true;
+        }
+    }
+    return strValue;
+}
+
+int64_t GetDBArg(const std::string& strArg, const std::string& strName, int64_t nDefault)
+{
+    std::string strValue = GetDBArg(strArg, strName, "");
+    if (strValue.empty())
+        return nDefault;
+    return atoi64(strValue);
+}
+
+bool ParseDBCompression(const std::string& str, leveldb::CompressionType& compression)
+{
+    if (str == "none")
+        compression = leveldb::kNoCompression;
+    else if (str == "snappy")
+        compression = leveldb::kSnappyCompression;
+    else
+        return false;
+    return true;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const std::string& strName, size_t& nBlockCacheSize)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
+    // -dbblockcache and -dbwritebuffer are in MiB; by default nCacheSize is split between them
+    nBlockCacheSize = nCacheSize / 2;
+    int64_t nBlockCacheMiB = GetDBArg("-dbblockcache", strName, (int64_t)0);
+    if (nBlockCacheMiB > 0)
+        nBlockCacheSize = nBlockCacheMiB << 20;
+    options.block_cache = leveldb::NewLRUCache(nBlockCacheSize);
     options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    int64_t nWriteBufferMiB = GetDBArg("-dbwritebuffer", strName, (int64_t)0);
+    if (nWriteBufferMiB > 0)
+        options.write_buffer_size = nWriteBufferMiB << 20;
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    if (!ParseDBCompression(GetDBArg("-dbcompression", strName, DEFAULT_DB_COMPRESSION), options.compression))
+        options.compression = leveldb::kNoCompression;
+    options.max_open_files = std::max((int64_t)20, GetDBArg("-dbmaxopenfiles", strName, (int64_t)DEFAULT_DB_MAX_OPEN_FILES));
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -45,14 +96,15 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const std::string& name)
+    : strName(name), strPath(path.string()), fCompacting(false), pcompactthread(NULL)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, strName, nBlockCacheSize);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -68,7 +120,9 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
-    LogPrintf("Opened LevelDB successfully\n");
+    LogPrintf("Opened LevelDB successfully (block cache %.1fMiB, write buffer %.1fMiB, %s compression, %d open files)\n",
+        nBlockCacheSize * (1.0 / 1024 / 1024), options.write_buffer_size * (1.0 / 1024 / 1024),
+        options.compression == leveldb::kSnappyCompression ? "snappy" : "no", options.max_open_files);
 
     // The base-case obfuscation key, which is a noop.
     obfuscate_key = std::vector<unsigned char>(OBFUSCATE_KEY_NUM_BYTES, '\000');
@@ -92,6 +146,12 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
 
 CDBWrapper::~CDBWrapper()
 {
+    // leveldb's CompactRange cannot be interrupted, wait for it to finish
+    if (pcompactthread) {
+        pcompactthread->join();
+        delete pcompactthread;
+        pcompactthread = NULL;
+    }
     delete pdb;
     pdb = NULL;
     delete options.filter_policy;
@@ -146,6 +206,53 @@ std::string CDBWrapper::GetObfuscateKeyHex() const
     return HexStr(obfuscate_key);
 }
 
+bool CDBWrapper::GetProperty(const std::string& property, std::string& value) const
+{
+    return pdb->GetProperty(property, &value);
+}
+
+uint64_t CDBWrapper::GetApproximateSize() const
+{
+    // All keys start with a serialized type byte, so this covers the whole database
+    const std::string strLimit(1, '\xff');
+    leveldb::Range range("", strLimit);
+    uint64_t nSize = 0;
+    pdb->GetApproximateSizes(&range, 1, &nSize);
+    return nSize;
+}
+
+void CDBWrapper::ThreadCompact()
+{
+    RenameThread("bitcredit-dbcompact");
+    int64_t nStart = GetTimeMillis();
+    LogPrintf("Compacting LevelDB in %s\n", strPath);
+    pdb->CompactRange(NULL, NULL);
+    LogPrintf("Compacted LevelDB in %s in %dms\n", strPath, GetTimeMillis() - nStart);
+    LOCK(cs_compact);
+    fCompacting = false;
+}
+
+bool CDBWrapper::CompactInBackground()
+{
+    LOCK(cs_compact);
+    if (fCompacting)
+        return false;
+    if (pcompactthread) {
+        // the previous compaction is done, reap its thread
+        pcompactthread->join();
+        delete pcompactthread;
+    }
+    fCompacting = true;
+    pcompactthread = new boost::thread(boost::bind(&CDBWrapper::ThreadCompact, this));
+    return true;
+}
+
+bool CDBWrapper::IsCompacting() const
+{
+    LOCK(cs_compact);
+    return fCompacting;
+}
+
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
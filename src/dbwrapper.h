@@ -8,6 +8,7 @@
 #include "clientversion.h"
 #include "serialize.h"
 #include "streams.h"
+#include "sync.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "version.h"
@@ -17,6 +18,15 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+namespace boost {
+    class thread;
+}
+
+//! -dbmaxopenfiles default
+static const int DEFAULT_DB_MAX_OPEN_FILES = 64;
+//! -dbcompression default
+static const char* const DEFAULT_DB_COMPRESSION = "none";
+
 class dbwrapper_error : public std::runtime_error
 {
 public:
@@ -167,6 +177,26 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
+    //! name used to select per-database options ("chainstate", "blockindex"), may be empty
+    std::string strName;
+
+    //! location of the database, for logging
+    std::string strPath;
+
+    //! bytes of block cache handed to leveldb
+    size_t nBlockCacheSize;
+
+    //! protects fCompacting and pcompactthread
+    mutable CCriticalSection cs_compact;
+
+    //! whether a background compaction is in progress
+    bool fCompacting;
+
+    //! thread running (or having run) the last background compaction
+    boost::thread* pcompactthread;
+
+    void ThreadCompact();
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
@@ -175,8 +205,10 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] name        Name under which per-database options (e.g.
+     *                        -dbcompression=chainstate:snappy) are looked up.
      */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const std::string& name = "");
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -274,7 +306,41 @@ public:
      */
     std::string GetObfuscateKeyHex() const;
 
+    const std::string& GetName() const { return strName; }
+    const leveldb::Options& GetLevelDBOptions() const { return options; }
+    size_t GetBlockCacheSize() const { return nBlockCacheSize; }
+
+    /**
+     * Query a leveldb property such as "leveldb.stats".
+     * Returns false if the property is not known to this leveldb version.
+     */
+    bool GetProperty(const std::string& property, std::string& value) const;
+
+    /**
+     * Approximate number of bytes the database occupies on disk.
+     */
+    uint64_t GetApproximateSize() const;
+
+    /**
+     * Compact the whole key range in a background thread.
+     * Returns false if a compaction is already running.
+     */
+    bool CompactInBackground();
+
+    bool IsCompacting() const;
+
 };
 
+/**
+ * Look up a per-database option: "-dbfoo=<name>:<value>" applies to the
+ * database called <name> only and overrides "-dbfoo=<value>", which applies
+ * to every database.
+ */
+std::string GetDBArg(const std::string& strArg, const std::string& strName, const std::string& strDefault);
+int64_t GetDBArg(const std::string& strArg, const std::string& strName, int64_t nDefault);
+
+/** Parse a -dbcompression value, returns false if it is not known */
+bool ParseDBCompression(const std::string& str, leveldb::CompressionType& compression);
+
 #endif // BITCREDIT_DBWRAPPER_H
 
@@ -0,0 +1,356 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCREDIT_FLATMAP_H
+#define BITCREDIT_FLATMAP_H
+
+#include "memusage.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <utility>
+#include <vector>
+
+/** Implements a subset of boost::unordered_map<K, T, Hash> as an
+ *  open-addressing hash table.
+ *
+ *  Lookups probe a flat array of slots (linear probing); every slot carries
+ *  32 bits of the key's hash, so a probe only touches an entry when those
+ *  bits match. The entries themselves live in a pool: chunks of
+ *  geometrically growing size, with erased entries kept on a free list.
+ *  Entries never move once inserted, so, unlike a plain flat table, pointers
+ *  and references to elements stay valid until the element is erased, and
+ *  iterators stay valid across inserts and rehashes, as with a node-based
+ *  map.
+ *
+ *  Erased slots are marked deleted rather than shifting their neighbours,
+ *  so erasing while iterating (erase(it++)) visits every element exactly
+ *  once. Deleted slots are reclaimed on the next rehash, or all at once
+ *  when the map becomes empty.
+ */
+template<typename K, typename T, typename Hash>
+class flatmap {
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+
+private:
+    struct node {
+        value_type value;
+        size_t hash;
+        size_t slot;
+
+        node(const value_type& valueIn, size_t hashIn) : value(valueIn), hash(hashIn), slot(0) {}
+    };
+
+    // Slot states: occupied (nodes[i] != NULL, tags[i] holds hash bits),
+    // empty (NULL, 0) or deleted (NULL, TAG_DELETED).
+    static const uint32_t TAG_DELETED = 1;
+
+    // Pool chunks start small so short-lived maps stay cheap, and double up
+    // to this many entries.
+    static const size_t MIN_CHUNK_NODES = 16;
+    static const size_t MAX_CHUNK_NODES = 4096;
+
+    Hash hasher;
+    size_t nSize;
+    size_t nDeleted;
+    size_t nMask; // capacity - 1, capacity is 0 or a power of two
+    node** nodes;
+    uint32_t* tags;
+
+    std::vector<std::pair<char*, size_t> > vChunks; // (memory, node count)
+    size_t nChunkUsed; // nodes handed out from the last chunk
+    void* pFree; // free list of erased nodes, linked through their first bytes
+    size_t nFree; // length of the free list
+
+    size_t capacity() const { return nodes ? nMask + 1 : 0; }
+
+    static uint32_t tag(size_t hash) { return (uint32_t)((hash >> 16) >> 16) ^ (uint32_t)hash; }
+
+    node* alloc_node(const value_type& value, size_t hash) {
+        void* p;
+        if (pFree) {
+            p = pFree;
+            pFree = *static_cast<void**>(pFree);
+            nFree--;
+        } else {
+            if (vChunks.empty() || nChunkUsed == vChunks.back().second) {
+                size_t n = vChunks.empty() ? MIN_CHUNK_NODES : vChunks.back().second * 2;
+                if (n > MAX_CHUNK_NODES)
+                    n = MAX_CHUNK_NODES;
+                vChunks.push_back(std::make_pair(static_cast<char*>(::operator new(n * sizeof(node))), n));
+                nChunkUsed = 0;
+            }
+            p = vChunks.back().first + sizeof(node) * nChunkUsed++;
+        }
+        return new(p) node(value, hash);
+    }
+
+    void free_node(node* n) {
+        n->~node();
+        *reinterpret_cast<void**>(n) = pFree;
+        pFree = n;
+        nFree++;
+    }
+
+    void release_pool() {
+        for (size_t i = 0; i < vChunks.size(); i++)
+            ::operator delete(vChunks[i].first);
+        std::vector<std::pair<char*, size_t> >().swap(vChunks);
+        nChunkUsed = 0;
+        pFree = NULL;
+        nFree = 0;
+    }
+
+    void release_slots() {
+        delete[] nodes;
+        delete[] tags;
+        nodes = NULL;
+        tags = NULL;
+        nMask = 0;
+        nDeleted = 0;
+    }
+
+    /** Slot holding key, or the slot an insert of key should use (*pfound = false). */
+    size_t probe(const K& key, size_t hash, bool* pfound) const {
+        uint32_t t = tag(hash);
+        size_t nInsert = (size_t)-1;
+        for (size_t i = hash & nMask; ; i = (i + 1) & nMask) {
+            if (nodes[i]) {
+                if (tags[i] == t && nodes[i]->value.first == key) {
+                    *pfound = true;
+                    return i;
+                }
+            } else if (tags[i] == TAG_DELETED) {
+                if (nInsert == (size_t)-1)
+                    nInsert = i;
+            } else {
+                *pfound = false;
+                return nInsert == (size_t)-1 ? i : nInsert;
+            }
+        }
+    }
+
+    void rehash(size_t nNewCapacity) {
+        node** oldnodes = nodes;
+        size_t nOldCapacity = capacity();
+        delete[] tags;
+        nodes = new node*[nNewCapacity];
+        tags = new uint32_t[nNewCapacity];
+        memset(nodes, 0, sizeof(node*) * nNewCapacity);
+        memset(tags, 0, sizeof(uint32_t) * nNewCapacity);
+        nMask = nNewCapacity - 1;
+        nDeleted = 0;
+        for (size_t i = 0; i < nOldCapacity; i++) {
+            node* n = oldnodes[i];
+            if (!n)
+                continue;
+            size_t j = n->hash & nMask;
+            while (nodes[j])
+                j = (j + 1) & nMask;
+            nodes[j] = n;
+            tags[j] = tag(n->hash);
+            n->slot = j;
+        }
+        delete[] oldnodes;
+    }
+
+    /** Make room for one more element, keeping at most 3/4 of the slots in use. Returns whether slots moved. */
+    bool reserve_one() {
+        size_t nCapacity = capacity();
+        if ((nSize + nDeleted + 1) * 4 <= nCapacity * 3)
+            return false;
+        size_t nNewCapacity = std::max(nCapacity, (size_t)8);
+        while ((nSize + 1) * 2 > nNewCapacity)
+            nNewCapacity *= 2;
+        rehash(nNewCapacity);
+        return true;
+    }
+
+    node* first_from(size_t i) const {
+        size_t nCapacity = capacity();
+        for (; i < nCapacity; i++)
+            if (nodes[i])
+                return nodes[i];
+        return NULL;
+    }
+
+    // Not copyable; CCoinsViewCache never copies its map.
+    flatmap(const flatmap&);
+    flatmap& operator=(const flatmap&);
+
+public:
+    template<typename V, typename N>
+    class iterator_base : public std::iterator<std::forward_iterator_tag, V> {
+        friend class flatmap;
+        const flatmap* map;
+        N* n;
+    public:
+        iterator_base() : map(NULL), n(NULL) {}
+        iterator_base(const flatmap* mapIn, N* nIn) : map(mapIn), n(nIn) {}
+        template<typename V2, typename N2>
+        iterator_base(const iterator_base<V2, N2>& other) : map(other.map), n(other.n) {}
+        V& operator*() const { return n->value; }
+        V* operator->() const { return &n->value; }
+        iterator_base& operator++() { n = map->first_from(n->slot + 1); return *this; }
+        iterator_base operator++(int) { iterator_base copy(*this); ++(*this); return copy; }
+        template<typename V2, typename N2>
+        bool operator==(const iterator_base<V2, N2>& other) const { return n == other.n; }
+        template<typename V2, typename N2>
+        bool operator!=(const iterator_base<V2, N2>& other) const { return n != other.n; }
+
+        template<typename V2, typename N2> friend class iterator_base;
+    };
+
+    typedef iterator_base<value_type, node> iterator;
+    typedef iterator_base<const value_type, const node> const_iterator;
+
+    flatmap() : nSize(0), nDeleted(0), nMask(0), nodes(NULL), tags(NULL), nChunkUsed(0), pFree(NULL), nFree(0) {}
+    flatmap(const Hash& hasherIn) : hasher(hasherIn), nSize(0), nDeleted(0), nMask(0), nodes(NULL), tags(NULL), nChunkUsed(0), pFree(NULL), nFree(0) {}
+
+    ~flatmap() {
+        clear();
+    }
+
+    size_type size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator begin() { return iterator(this, first_from(0)); }
+    const_iterator begin() const { return const_iterator(this, first_from(0)); }
+    iterator end() { return iterator(this, NULL); }
+    const_iterator end() const { return const_iterator(this, NULL); }
+
+    iterator find(const K& key) {
+        if (nSize == 0)
+            return end();
+        bool fFound;
+        size_t i = probe(key, hasher(key), &fFound);
+        return iterator(this, fFound ? nodes[i] : NULL);
+    }
+
+    const_iterator find(const K& key) const {
+        if (nSize == 0)
+            return end();
+        bool fFound;
+        size_t i = probe(key, hasher(key), &fFound);
+        return const_iterator(this, fFound ? nodes[i] : NULL);
+    }
+
+    size_type count(const K& key) const { return find(key) != end() ? 1 : 0; }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        size_t hash = hasher(value.first);
+        bool fFound = false;
+        size_t i = 0;
+        if (nodes) {
+            i = probe(value.first, hash, &fFound);
+            if (fFound)
+                return std::make_pair(iterator(this, nodes[i]), false);
+        }
+        if (reserve_one())
+            i = probe(value.first, hash, &fFound);
+        if (tags[i] == TAG_DELETED)
+            nDeleted--;
+        node* n = alloc_node(value, hash);
+        n->slot = i;
+        nodes[i] = n;
+        tags[i] = tag(hash);
+        nSize++;
+        return std::make_pair(iterator(this, n), true);
+    }
+
+    T& operator[](const K& key) {
+        return insert(value_type(key, T())).first->second;
+    }
+
+    void erase(iterator it) {
+        node* n = it.n;
+        nodes[n->slot] = NULL;
+        tags[n->slot] = TAG_DELETED;
+        free_node(n);
+        nSize--;
+        nDeleted++;
+        if (nSize == 0) {
+            // Nothing left to iterate over: drop the tombstones and the pool.
+            memset(tags, 0, sizeof(uint32_t) * capacity());
+            nDeleted = 0;
+            release_pool();
+        }
+    }
+
+    size_type erase(const K& key) {
+        iterator it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    /** Destroy all elements and return all memory, including the slot array. */
+    void clear() {
+        size_t nCapacity = capacity();
+        for (size_t i = 0; i < nCapacity; i++)
+            if (nodes[i])
+                nodes[i]->~node();
+        nSize = 0;
+        release_slots();
+        release_pool();
+    }
+
+    /** Exchange contents. Unlike for node-based maps, this invalidates iterators of both maps. */
+    void swap(flatmap& other) {
+        std::swap(hasher, other.hasher);
+        std::swap(nSize, other.nSize);
+        std::swap(nDeleted, other.nDeleted);
+        std::swap(nMask, other.nMask);
+        std::swap(nodes, other.nodes);
+        std::swap(tags, other.tags);
+        vChunks.swap(other.vChunks);
+        std::swap(nChunkUsed, other.nChunkUsed);
+        std::swap(pFree, other.pFree);
+        std::swap(nFree, other.nFree);
+    }
+
+    size_t bucket_count() const { return capacity(); }
+
+    /** Heap memory used by the map itself, excluding memory owned by the elements. */
+    size_t DynamicMemoryUsage() const {
+        size_t nCapacity = capacity();
+        size_t ret = memusage::MallocUsage(sizeof(node*) * nCapacity) + memusage::MallocUsage(sizeof(uint32_t) * nCapacity);
+        for (size_t i = 0; i < vChunks.size(); i++)
+            ret += memusage::MallocUsage(sizeof(node) * vChunks[i].second);
+        return ret + memusage::DynamicUsage(vChunks);
+    }
+
+    /** Part of DynamicMemoryUsage() taken by erased entries, which new entries will reuse. */
+    size_t FreeMemoryUsage() const {
+        return nFree * sizeof(node);
+    }
+
+    /** What erasing one entry adds to FreeMemoryUsage(). */
+    static size_t EntryMemoryUsage() {
+        return sizeof(node);
+    }
+};
+
+namespace memusage
+{
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const flatmap<X, Y, Z>& m)
+{
+    return m.DynamicMemoryUsage();
+}
+
+}
+
+#endif // BITCREDIT_FLATMAP_H
@@ -19,6 +19,7 @@
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
 #include "darksend.h"
 #include "httpserver.h"
 #include "httprpc.h"
@@ -30,6 +31,7 @@
 #include "rpc/server.h"
 #include "script/standard.h"
 #include "script/sigcache.h"
+#include "script/sign.h"
 #include "scheduler.h"
 #include "spork.h"
 #include "torcontrol.h"
@@ -39,6 +41,7 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utxosnapshot.h"
 #include "version.h"
 #include "validationinterface.h"
 #ifdef ENABLE_WALLET
@@ -165,7 +168,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -208,6 +210,9 @@ void Shutdown()
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
 
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+        DumpMempool();
+
     if (fFeeEstimatesInitialized)
     {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -338,9 +343,18 @@ std::string HelpMessage(HelpMessageMode mode)
 #endif
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
+    strUsage += HelpMessageOpt("-dbbackgroundflush", strprintf(_("Write the chainstate to disk from a background thread in batches of -dbflushbatch modified records, keeping the coins cache warm (default: %u)"), DEFAULT_DB_BACKGROUND_FLUSH));
+    strUsage += HelpMessageOpt("-dbblockcache=[<db>:]<n>", _("Use <n> megabytes of leveldb block cache for <db> (chainstate or blockindex, default: all databases) instead of a share of -dbcache"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dbcompression=[<db>:]<type>", strprintf(_("Compress newly written leveldb tables of <db> (chainstate or blockindex, default: all databases); <type> can be snappy or none (default: %s)"), DEFAULT_DB_COMPRESSION));
+    strUsage += HelpMessageOpt("-dbflushbatch=<n>", strprintf(_("With -dbbackgroundflush, start writing the chainstate once <n> coin records are modified (default: %u)"), DEFAULT_DB_FLUSH_BATCH));
+    strUsage += HelpMessageOpt("-dbmaxopenfiles=[<db>:]<n>", strprintf(_("Let leveldb keep at most <n> table files of <db> open (default: %u)"), DEFAULT_DB_MAX_OPEN_FILES));
+    strUsage += HelpMessageOpt("-dbwritebuffer=[<db>:]<n>", _("Use <n> megabytes of leveldb write buffer for <db> instead of a share of -dbcache"));
     strUsage += HelpMessageOpt("-feefilter", strprintf(_("Tell other nodes to filter invs to us by our mempool min fee (default: %u)"), DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-loadutxosnapshot=<file>", _("Start a new data directory from a UTXO snapshot written by dumputxoset; blocks up to the snapshot are not downloaded. Only snapshots known to this network are accepted. This mode is incompatible with -txindex"));
+    strUsage += HelpMessageOpt("-maxorphansize=<n>", strprintf(_("Keep unconnectable transactions below <n> megabytes of memory (default: %u)"), DEFAULT_MAX_ORPHAN_SIZE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
@@ -349,6 +363,9 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCREDIT_PID_FILENAME));
 #endif
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
+    strUsage += HelpMessageOpt("-prevalidationthreads=<n>", strprintf(_("Set the number of threads checking relayed transactions before they are added to the mempool (0 to %d, 0 = check them on the network thread, default: %d)"),
+        MAX_PREVALIDATION_THREADS, DEFAULT_PREVALIDATION_THREADS));
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode is incompatible with -txindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
@@ -386,6 +403,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
+    strUsage += HelpMessageOpt("-cmpctblocks", strprintf(_("Relay and download blocks using BIP152 compact blocks (default: %u)"), DEFAULT_CMPCTBLOCKS));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), Params(CBaseChainParams::MAIN).GetDefaultPort(), Params(CBaseChainParams::TESTNET).GetDefaultPort()));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
@@ -437,7 +455,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
     }
-    string debugCategories = "addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, mempoolrej, net, proxy, prune, http, libevent, tor, zmq"; // Don't translate these and qt below
+    string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, lock, rand, rpc, selectcoins, mempool, mempoolrej, net, proxy, prune, http, libevent, tor, zmq"; // Don't translate these and qt below
     if (mode == HMM_BITCREDIT_QT)
         debugCategories += ", qt";
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
@@ -642,6 +660,9 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+        LoadMempool();
 }
 
 /** Sanity checks
@@ -855,6 +876,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #endif
     }
 
+    if (mapArgs.count("-loadutxosnapshot")) {
+        if (chainparams.UtxoSnapshots().empty() && !chainparams.AcceptAnyUtxoSnapshot())
+            return InitError(_("-loadutxosnapshot is not available on this network."));
+        if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
+            return InitError(_("-loadutxosnapshot is incompatible with -txindex."));
+        if (GetBoolArg("-reindex", false))
+            return InitError(_("-loadutxosnapshot cannot be combined with -reindex."));
+    }
+
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
@@ -917,6 +947,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nPreValidationThreads = std::max(0, std::min((int)GetArg("-prevalidationthreads", DEFAULT_PREVALIDATION_THREADS), MAX_PREVALIDATION_THREADS));
+
     fServer = GetBoolArg("-server", false);
 
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
@@ -1039,6 +1071,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
+    // Select the fastest SHA256 implementation this CPU supports
+    std::string strSHA256Implementation = SHA256AutoDetect();
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1084,14 +1119,23 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using data directory %s\n", strDataDir);
     LogPrintf("Using config file %s\n", GetConfigFile().string());
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
+    LogPrintf("Using the '%s' SHA256 implementation\n", strSHA256Implementation);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for script and block verification and signing\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadBlockCheck);
+            threadGroup.create_thread(&ThreadCoinsPrefetch);
+            threadGroup.create_thread(&ThreadSignInputs);
+        }
     }
 
+    LogPrintf("Using %u threads for transaction pre-validation\n", nPreValidationThreads);
+    for (int i = 0; i < nPreValidationThreads; i++)
+        threadGroup.create_thread(&ThreadTxPreValidation);
+
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
@@ -1320,6 +1364,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    BOOST_FOREACH(const std::string& strCompression, mapMultiArgs["-dbcompression"]) {
+        leveldb::CompressionType compression;
+        if (!ParseDBCompression(strCompression.substr(strCompression.find(':') + 1), compression))
+            return InitError(strprintf(_("Unknown -dbcompression value: '%s'"), strCompression));
+    }
+
     // cache size calculations
     int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
@@ -1331,6 +1381,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    fCoinsBackgroundFlush = GetBoolArg("-dbbackgroundflush", DEFAULT_DB_BACKGROUND_FLUSH);
+    nCoinsFlushBatch = std::max((int64_t)1, GetArg("-dbflushbatch", DEFAULT_DB_FLUSH_BATCH));
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
@@ -1356,6 +1408,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                if (fCoinsBackgroundFlush)
+                    pcoinsTip->TrackDirty();
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1386,9 +1440,21 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                if (mapArgs.count("-loadutxosnapshot")) {
+                    if (chainActive.Height() == 0) {
+                        uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+                        CUtxoSnapshotStats stats;
+                        std::string strError;
+                        if (!LoadUtxoSnapshot(GetArg("-loadutxosnapshot", ""), stats, strError))
+                            return InitError(strprintf(_("Error loading UTXO snapshot: %s"), strError));
+                    } else {
+                        LogPrintf("Chain already past the genesis block, ignoring -loadutxosnapshot\n");
+                    }
+                }
+
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
-                // in the past, but is now trying to run unpruned.
-                if (fHavePruned && !fPruneMode) {
+                // in the past, but is now trying to run unpruned. (A snapshot chain was never downloaded at all.)
+                if (fHavePruned && !fPruneMode && !fUtxoSnapshot) {
                     strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode.  This will redownload the entire blockchain");
                     break;
                 }
@@ -1487,6 +1553,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // if pruning, unset the service bit and perform the initial blockstore prune
     // after any wallet rescanning has taken place.
+    if (fUtxoSnapshot && !fPruneMode) {
+        LogPrintf("Unsetting NODE_NETWORK, blocks up to the UTXO snapshot are not available\n");
+        nLocalServices &= ~NODE_NETWORK;
+    }
     if (fPruneMode) {
         LogPrintf("Unsetting NODE_NETWORK on prune mode\n");
         nLocalServices &= ~NODE_NETWORK;
@@ -1624,6 +1694,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                                          boost::ref(cs_main), boost::cref(pindexBestHeader), nPowTargetSpacing);
     scheduler.scheduleEvery(f, nPowTargetSpacing);
 
+    // Keep mempool.dat reasonably fresh in case we don't shut down cleanly
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+        scheduler.scheduleEvery(boost::bind(&DumpMempool), MEMPOOL_DUMP_INTERVAL);
+
     // Generate coins in the background
     GenerateBitcredits(GetBoolArg("-gen", DEFAULT_GENERATE), GetArg("-genproclimit", DEFAULT_GENERATE_THREADS), chainparams);
 
@@ -1639,6 +1713,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
         // Run a thread to flush wallet periodically
         threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, boost::ref(pwalletMain->strWalletFile)));
+
+        // Run a thread to keep the keypool topped up
+        threadGroup.create_thread(boost::bind(&ThreadTopUpKeyPool, pwalletMain));
     }
 #endif
 
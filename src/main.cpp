@@ -9,12 +9,15 @@
 #include "arith_uint256.h"
 #include "base58.h"
 #include "basenodeman.h"
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "core_memusage.h"
+#include "crypto/sha256.h"
 #include "darksend.h"
 #include "hash.h"
 #include "init.h"
@@ -69,17 +72,21 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nPreValidationThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
+bool fUtxoSnapshot = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 unsigned int nBytesPerSigOp = DEFAULT_BYTES_PER_SIGOP;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+bool fCoinsBackgroundFlush = DEFAULT_DB_BACKGROUND_FLUSH;
+unsigned int nCoinsFlushBatch = DEFAULT_DB_FLUSH_BATCH;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
@@ -93,9 +100,20 @@ FeeFilterRounder filterRounder(::minRelayTxFee);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    size_t nUsage;
+};
+/** The orphans one peer sent us, oldest first, and the memory they use */
+struct COrphanPeer {
+    set<pair<int64_t, uint256> > setOrphans;
+    size_t nUsage;
+
+    COrphanPeer() : nUsage(0) {}
 };
 map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
+map<COutPoint, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
+map<NodeId, COrphanPeer> mapOrphanTransactionsByPeer GUARDED_BY(cs_main);
+size_t nOrphanTransactionsUsage GUARDED_BY(cs_main) = 0;
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 /**
@@ -204,12 +222,16 @@ namespace {
         int64_t nTime;  //! Time of "getdata" request in microseconds.
         bool fValidatedHeaders;  //! Whether this block has validated headers at the time of request.
         int64_t nTimeDisconnect; //! The timeout for this block request (for disconnecting a slow peer)
+        boost::shared_ptr<PartiallyDownloadedBlock> partialBlock;  //! Optional, used for CMPCTBLOCK downloads
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
     /** Number of blocks in flight with validated headers. */
     int nQueuedValidatedHeaders = 0;
 
+    /** Stack of nodes which we have set to announce using compact blocks */
+    list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
     /** Number of preferable block download peers. */
     int nPreferredDownload = 0;
 
@@ -271,6 +293,10 @@ struct CNodeState {
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
     bool fPreferHeaders;
+    //! Whether this peer wants invs or cmpctblocks (when possible) for block announcements.
+    bool fPreferHeaderAndIDs;
+    //! Whether this peer will send us cmpctblocks if we request them
+    bool fProvidesHeaderAndIDs;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -286,6 +312,8 @@ struct CNodeState {
         nBlocksInFlightValidHeaders = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
+        fPreferHeaderAndIDs = false;
+        fProvidesHeaderAndIDs = false;
     }
 };
 
@@ -346,6 +374,7 @@ void FinalizeNode(NodeId nodeid) {
     }
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
     mapNodeState.erase(nodeid);
 }
@@ -368,20 +397,65 @@ bool MarkBlockAsReceived(const uint256& hash) {
 }
 
 // Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL) {
+// returns false, still setting pit, if the block was already in flight from the same peer
+// pit will only be valid as long as the same cs_main lock is being held
+bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL, list<QueuedBlock>::iterator **pit = NULL) {
     CNodeState *state = State(nodeid);
     assert(state != NULL);
 
+    // Short-circuit most stuff in case its from the same node
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == nodeid) {
+        if (pit)
+            *pit = &itInFlight->second.second;
+        return false;
+    }
+
     // Make sure it's not listed somewhere already.
     MarkBlockAsReceived(hash);
 
     int64_t nNow = GetTimeMicros();
-    QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams)};
+    QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams),
+                            boost::shared_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)};
     nQueuedValidatedHeaders += newentry.fValidatedHeaders;
     list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += newentry.fValidatedHeaders;
-    mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
+    itInFlight = mapBlocksInFlight.insert(std::make_pair(hash, std::make_pair(nodeid, it))).first;
+    if (pit)
+        *pit = &itInFlight->second.second;
+    return true;
+}
+
+/**
+ * When a peer has just given us a new block, ask it to announce future blocks
+ * with cmpctblock directly. At most three peers are kept in high-bandwidth
+ * mode; the oldest one is demoted when a fourth delivers a block first.
+ */
+void MaybeSetPeerAsAnnouncingHeaderAndIDs(const CNodeState* nodestate, CNode* pfrom) {
+    if (!nodestate->fProvidesHeaderAndIDs)
+        return;
+    BOOST_FOREACH(const NodeId nodeid, lNodesAnnouncingHeaderAndIDs)
+        if (nodeid == pfrom->GetId())
+            return;
+    bool fAnnounceUsingCMPCTBLOCK = false;
+    uint64_t nCMPCTBLOCKVersion = 1;
+    if (lNodesAnnouncingHeaderAndIDs.size() >= 3) {
+        // As per BIP152, we only get 3 of our peers to announce
+        // blocks using compact encodings.
+        NodeId nodeStop = lNodesAnnouncingHeaderAndIDs.front();
+        lNodesAnnouncingHeaderAndIDs.pop_front();
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes) {
+            if (pnode->GetId() == nodeStop) {
+                pnode->PushMessage(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+                break;
+            }
+        }
+    }
+    fAnnounceUsingCMPCTBLOCK = true;
+    pfrom->PushMessage(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+    lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
 }
 
 /** Check whether the last unknown block a peer advertised is not yet known. */
@@ -588,6 +662,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -605,22 +680,33 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
     // large transaction with a missing parent then we assume
     // it will rebroadcast it later, after the parent transaction(s)
     // have been mined or received.
-    // 10,000 orphans, each of which is at most 5,000 bytes big is
-    // at most 500 megabytes of orphans:
     unsigned int sz = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
-    if (sz > 5000)
+    if (sz > MAX_ORPHAN_TX_SIZE)
     {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    // The transaction itself, and its entries in the map and the indexes
+    static const set<uint256> setHashesEmpty;
+    COrphanPeer& orphanPeer = mapOrphanTransactionsByPeer[peer];
+    size_t nUsage = RecursiveDynamicUsage(tx) + memusage::IncrementalDynamicUsage(mapOrphanTransactions) +
+        memusage::IncrementalDynamicUsage(orphanPeer.setOrphans) +
+        tx.vin.size() * (memusage::IncrementalDynamicUsage(mapOrphanTransactionsByPrev) + memusage::IncrementalDynamicUsage(setHashesEmpty));
+
+    COrphanTx& orphan = mapOrphanTransactions[hash];
+    orphan.tx = tx;
+    orphan.fromPeer = peer;
+    orphan.nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
+    orphan.nUsage = nUsage;
     FOREACH_TXIN(txin, tx)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
+        mapOrphanTransactionsByPrev[txin.prevout].insert(hash);
+    orphanPeer.setOrphans.insert(make_pair(orphan.nTimeExpire, hash));
+    orphanPeer.nUsage += orphan.nUsage;
+    nOrphanTransactionsUsage += orphan.nUsage;
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u outsz %u, %u bytes)\n", hash.ToString(),
+             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanTransactionsUsage);
     return true;
 }
 
@@ -629,46 +715,70 @@ void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
     if (it == mapOrphanTransactions.end())
         return;
-     FOREACH_TXIN(txin, it->second.tx)
+    FOREACH_TXIN(txin, it->second.tx)
     {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
+        map<COutPoint, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
         itPrev->second.erase(hash);
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+    map<NodeId, COrphanPeer>::iterator itPeer = mapOrphanTransactionsByPeer.find(it->second.fromPeer);
+    assert(itPeer != mapOrphanTransactionsByPeer.end());
+    itPeer->second.setOrphans.erase(make_pair(it->second.nTimeExpire, hash));
+    itPeer->second.nUsage -= it->second.nUsage;
+    if (itPeer->second.setOrphans.empty())
+        mapOrphanTransactionsByPeer.erase(itPeer);
+    nOrphanTransactionsUsage -= it->second.nUsage;
     mapOrphanTransactions.erase(it);
 }
 
 void EraseOrphansFor(NodeId peer)
 {
     int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
+    // EraseOrphanTx drops the peer's entry along with its last orphan
+    map<NodeId, COrphanPeer>::iterator itPeer;
+    while ((itPeer = mapOrphanTransactionsByPeer.find(peer)) != mapOrphanTransactionsByPeer.end())
     {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
-        }
+        EraseOrphanTx(itPeer->second.setOrphans.begin()->second);
+        ++nErased;
     }
     if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
 }
 
-
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphansUsage) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+
+    // Sweep out expired orphans, at most every ORPHAN_TX_EXPIRE_INTERVAL
+    static int64_t nNextSweep;
+    int64_t nNow = GetTime();
+    if (nNextSweep <= nNow) {
+        vector<uint256> vExpired;
+        for (map<NodeId, COrphanPeer>::const_iterator itPeer = mapOrphanTransactionsByPeer.begin(); itPeer != mapOrphanTransactionsByPeer.end(); ++itPeer) {
+            set<pair<int64_t, uint256> >::const_iterator it = itPeer->second.setOrphans.begin();
+            for (; it != itPeer->second.setOrphans.end() && it->first <= nNow; ++it)
+                vExpired.push_back(it->second);
+        }
+        BOOST_FOREACH(const uint256& hash, vExpired)
+            EraseOrphanTx(hash);
+        nEvicted += vExpired.size();
+        nNextSweep = nNow + ORPHAN_TX_EXPIRE_INTERVAL;
+        if (!vExpired.empty())
+            LogPrint("mempool", "Erased %u expired orphan tx\n", vExpired.size());
+    }
+
+    // Then evict the oldest orphans of whichever peer uses the most memory,
+    // so one peer flooding us with orphans only pushes out its own
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanTransactionsUsage > nMaxOrphansUsage)
     {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        map<NodeId, COrphanPeer>::const_iterator itLargest = mapOrphanTransactionsByPeer.begin();
+        for (map<NodeId, COrphanPeer>::const_iterator itPeer = itLargest; itPeer != mapOrphanTransactionsByPeer.end(); ++itPeer) {
+            if (itPeer->second.nUsage > itLargest->second.nUsage)
+                itLargest = itPeer;
+        }
+        EraseOrphanTx(itLargest->second.setOrphans.begin()->second);
         ++nEvicted;
     }
     return nEvicted;
@@ -969,13 +1079,15 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state)
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-txouttotal-toolarge");
     }
 
-    // Check for duplicate inputs
-    set<COutPoint> vInOutPoints;
-    FOREACH_TXIN(txin, tx)
-    {
-        if (vInOutPoints.count(txin.prevout))
+    // Check for duplicate inputs, as equal neighbours once sorted
+    if (tx.vin.size() > 1) {
+        std::vector<COutPoint> vInOutPoints;
+        vInOutPoints.reserve(tx.vin.size());
+        FOREACH_TXIN(txin, tx)
+            vInOutPoints.push_back(txin.prevout);
+        std::sort(vInOutPoints.begin(), vInOutPoints.end());
+        if (std::adjacent_find(vInOutPoints.begin(), vInOutPoints.end()) != vInOutPoints.end())
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputs-duplicate");
-        vInOutPoints.insert(txin.prevout);
     }
 
     if (tx.IsCoinBase())
@@ -1013,15 +1125,11 @@ std::string FormatStateMessage(const CValidationState &state)
         state.GetRejectCode());
 }
 
-bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
-                              bool* pfMissingInputs, CFeeRate* txFeeRate, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
-                              std::vector<uint256>& vHashTxnToUncache)
-{
-    const uint256 hash = tx.GetHash();
-    AssertLockHeld(cs_main);
-    if (pfMissingInputs)
-        *pfMissingInputs = false;
+static bool CheckInputScripts(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks);
 
+/** The checks of AcceptToMemoryPool that need neither the chain nor the mempool */
+static bool CheckTransactionContextFree(const CTransaction& tx, CValidationState& state)
+{
     if (!CheckTransaction(tx, state))
         return false; // state filled in by CheckTransaction
 
@@ -1034,6 +1142,114 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     if (fRequireStandard && !IsStandardTx(tx, reason))
         return state.DoS(0, false, REJECT_NONSTANDARD, reason);
 
+    return true;
+}
+
+/**
+ * What a pre-validation thread found out about a relayed transaction before
+ * taking cs_main. AcceptToMemoryPoolWorker only relies on the script checks
+ * if the inputs it resolves under the lock spend the same outputs.
+ */
+struct CTxPreValidation
+{
+    /** Whether CheckTransactionContextFree passed; if not, state says why */
+    bool fContextFree;
+    CValidationState state;
+    unsigned int nLegacySigOps;
+    /** Whether the scripts passed with the standard and the mandatory flags, spending vSpent */
+    bool fScripts;
+    /** The output spent by each input, from the coins and mempool snapshot */
+    std::vector<CTxOut> vSpent;
+    /** Inputs the lookup pulled into pcoinsTip, to evict again if the transaction is rejected */
+    std::vector<uint256> vHashTxnToUncache;
+
+    CTxPreValidation() : fContextFree(false), nLegacySigOps(0), fScripts(false) {}
+};
+
+/** Whether the inputs of tx still spend the outputs the pre-validation checked its scripts against */
+static bool SpendsPreValidatedOutputs(const CTransaction& tx, const CCoinsViewCache& view, const CTxPreValidation& prevalidation)
+{
+    if (!prevalidation.fScripts)
+        return false;
+    for (unsigned int i = tx.GetFirstInputPos(); i < tx.vin.size(); i++) {
+        const COutPoint &prevout = tx.vin[i].prevout;
+        const CCoins* coins = view.AccessCoins(prevout.hash);
+        if (!coins || !coins->IsAvailable(prevout.n) || !(coins->vout[prevout.n] == prevalidation.vSpent[i]))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Everything AcceptToMemoryPool can do without cs_main: the context-free
+ * checks, and the scripts against the inputs as they are now. Only the lookup
+ * of the inputs takes cs_main and mempool.cs, briefly.
+ */
+static void PreValidateTransaction(const CTransaction& tx, CTxPreValidation& prevalidation)
+{
+    prevalidation.fContextFree = CheckTransactionContextFree(tx, prevalidation.state);
+    if (!prevalidation.fContextFree)
+        return;
+    prevalidation.nLegacySigOps = GetLegacySigOpCount(tx);
+
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    {
+        LOCK2(cs_main, mempool.cs);
+        if (mempool.exists(tx.GetHash()))
+            return;
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        view.SetBackend(viewMemPool);
+
+        // Missing and spent inputs are left for AcceptToMemoryPool to report
+        std::vector<uint256>& vHashTxnToUncache = prevalidation.vHashTxnToUncache;
+        bool fHaveInputs = true;
+        for (unsigned int i = tx.GetFirstInputPos(); i < tx.vin.size() && fHaveInputs; i++) {
+            if (!pcoinsTip->HaveCoinsInCache(tx.vin[i].prevout.hash))
+                vHashTxnToUncache.push_back(tx.vin[i].prevout.hash);
+            fHaveInputs = view.HaveCoins(tx.vin[i].prevout.hash);
+        }
+        fHaveInputs = fHaveInputs && view.HaveInputs(tx);
+        view.SetBackend(dummy);
+        if (!fHaveInputs) {
+            BOOST_FOREACH(const uint256& hashTx, vHashTxnToUncache)
+                pcoinsTip->Uncache(hashTx);
+            vHashTxnToUncache.clear();
+            return;
+        }
+    }
+
+    prevalidation.vSpent.resize(tx.vin.size());
+    for (unsigned int i = tx.GetFirstInputPos(); i < tx.vin.size(); i++) {
+        const COutPoint &prevout = tx.vin[i].prevout;
+        prevalidation.vSpent[i] = view.AccessCoins(prevout.hash)->vout[prevout.n];
+    }
+
+    // Failures are not kept: AcceptToMemoryPool runs the scripts again, so
+    // the cheaper checks still decide the reject reason
+    CValidationState stateScripts;
+    prevalidation.fScripts = CheckInputScripts(tx, stateScripts, view, STANDARD_SCRIPT_VERIFY_FLAGS, true, NULL) &&
+                             CheckInputScripts(tx, stateScripts, view, MANDATORY_SCRIPT_VERIFY_FLAGS, true, NULL);
+}
+
+bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
+                              bool* pfMissingInputs, CFeeRate* txFeeRate, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
+                              const CTxPreValidation* pprevalidation, std::vector<uint256>& vHashTxnToUncache)
+{
+    const uint256 hash = tx.GetHash();
+    AssertLockHeld(cs_main);
+    if (pfMissingInputs)
+        *pfMissingInputs = false;
+
+    if (pprevalidation) {
+        if (!pprevalidation->fContextFree) {
+            state = pprevalidation->state;
+            return false;
+        }
+    } else if (!CheckTransactionContextFree(tx, state)) {
+        return false; // state filled in by CheckTransactionContextFree
+    }
+
     // Only accept nLockTime-using transactions that can be mined in the next
     // block; we don't want our mempool filled up with transactions that can't
     // be mined yet.
@@ -1145,7 +1361,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         if (fRequireStandard && !AreInputsStandard(tx, view))
             return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
 
-        unsigned int nSigOps = GetLegacySigOpCount(tx);
+        unsigned int nSigOps = pprevalidation ? pprevalidation->nLegacySigOps : GetLegacySigOpCount(tx);
         nSigOps += GetP2SHSigOpCount(tx, view);
 
         CAmount nValueOut = tx.GetValueOut();
@@ -1169,7 +1385,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             }
         }
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOps, lp);
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOps, lp);
         unsigned int nSize = entry.GetTxSize();
         if (txFeeRate) {
             *txFeeRate = CFeeRate(nFees, nSize);
@@ -1221,21 +1437,21 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
                 strprintf("%d > %d", nFees, nAbsurdFee));
 
         // Calculate in-mempool ancestors, up to a limit.
-        CTxMemPool::setEntries setAncestors;
+        CTxMemPool::vecEntries vAncestors;
         size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
         size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
         size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
         size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
         std::string errString;
-        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+        if (!pool.CalculateMemPoolAncestors(entry, vAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
             return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
         }
 
         // A transaction that spends outputs that would be replaced by it is invalid. Now
         // that we have the set of all ancestors we can detect this
-        // pathological case by making sure setConflicts and setAncestors don't
+        // pathological case by making sure setConflicts and vAncestors don't
         // intersect.
-        BOOST_FOREACH(CTxMemPool::txiter ancestorIt, setAncestors)
+        BOOST_FOREACH(CTxMemPool::txiter ancestorIt, vAncestors)
         {
             const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
             if (setConflicts.count(hashAncestor))
@@ -1374,9 +1590,13 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             }
         }
 
+        // Scripts a pre-validation thread already checked against these very
+        // outputs need not run again under the lock
+        bool fScriptsChecked = pprevalidation && SpendsPreValidatedOutputs(tx, view, *pprevalidation);
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckInputs(tx, state, view, !fScriptsChecked, STANDARD_SCRIPT_VERIFY_FLAGS, true))
             return false; // state filled in by CheckInputs
 
         // Check again against just the consensus-critical mandatory script
@@ -1388,7 +1608,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        if (!fScriptsChecked && !CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
         {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
@@ -1406,7 +1626,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         pool.RemoveStaged(allConflicting, false);
 
         // Store transaction in memory
-        pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
+        pool.addUnchecked(hash, entry, vAncestors, !IsInitialBlockDownload());
 
         // trim mempool and check if tx was trimmed
         if (!fOverrideMempoolLimit) {
@@ -1421,18 +1641,191 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     return true;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, CFeeRate* txFeeRate, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+static bool AcceptToMemoryPoolPreValidated(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, CFeeRate* txFeeRate, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount nAbsurdFee,
+                        const CTxPreValidation* pprevalidation)
 {
     std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, txFeeRate, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, txFeeRate, nAcceptTime, fOverrideMempoolLimit, nAbsurdFee, pprevalidation, vHashTxToUncache);
     if (!res) {
+        // The pre-validation already pulled in the inputs, so the worker
+        // found them cached and did not list them itself
+        if (pprevalidation)
+            vHashTxToUncache.insert(vHashTxToUncache.end(), pprevalidation->vHashTxnToUncache.begin(), pprevalidation->vHashTxnToUncache.end());
         BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
             pcoinsTip->Uncache(hashTx);
     }
     return res;
 }
 
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, CFeeRate* txFeeRate, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+{
+    return AcceptToMemoryPoolPreValidated(pool, state, tx, fLimitFree, pfMissingInputs, txFeeRate, nAcceptTime, fOverrideMempoolLimit, nAbsurdFee, NULL);
+}
+
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, CFeeRate* txFeeRate, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, txFeeRate, GetTime(), fOverrideMempoolLimit, nAbsurdFee);
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+/** Serializes dumps, and guards fMempoolLoaded */
+static CCriticalSection csMempoolDump;
+/** Whether LoadMempool has completed; until then, dumping would lose transactions */
+static bool fMempoolLoaded = false;
+
+/** Orders mempool entries by their number of in-mempool ancestors */
+struct CompareByAncestorCount
+{
+    bool operator()(const std::pair<uint64_t, CTxMemPool::txiter>& a, const std::pair<uint64_t, CTxMemPool::txiter>& b) const
+    {
+        return a.first < b.first;
+    }
+};
+
+static void MarkMempoolLoaded()
+{
+    LOCK(csMempoolDump);
+    fMempoolLoaded = true;
+}
+
+/*
+ * mempool.dat holds the transactions, parents before children, each with the
+ * time it entered the pool, followed by mapDeltas. Everything is read before
+ * the first transaction is accepted, and cs_main is taken per transaction, so
+ * RPC and network processing carry on while the pool fills.
+ */
+bool LoadMempool()
+{
+    const int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    boost::filesystem::path path = GetDataDir() / "mempool.dat";
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        MarkMempoolLoaded();
+        return false;
+    }
+
+    int64_t nStart = GetTimeMicros();
+    std::vector<std::pair<CTransaction, int64_t> > vTxs;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    long nBytes = 0;
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION) {
+            LogPrintf("Unknown mempool file version %u. Continuing anyway.\n", nVersion);
+            MarkMempoolLoaded();
+            return false;
+        }
+        uint64_t nCount;
+        file >> nCount;
+        while (nCount--) {
+            vTxs.push_back(std::make_pair(CTransaction(), 0));
+            file >> vTxs.back().first;
+            file >> vTxs.back().second;
+        }
+        file >> mapDeltas;
+        nBytes = ftell(file.Get());
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        MarkMempoolLoaded();
+        return false;
+    }
+    file.fclose();
+    int64_t nRead = GetTimeMicros();
+
+    // Deltas go first, so prioritised transactions are accepted as such.
+    for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+        mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+    int nAccepted = 0, nFailed = 0, nExpired = 0, nKnown = 0;
+    const int64_t nNow = GetTime();
+    for (size_t i = 0; i < vTxs.size(); i++) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            return false;
+        const CTransaction& tx = vTxs[i].first;
+        const int64_t nTime = vTxs[i].second;
+        if (nTime + nExpiryTimeout <= nNow) {
+            nExpired++;
+            continue;
+        }
+
+        CValidationState state;
+        LOCK(cs_main);
+        if (mempool.exists(tx.GetHash())) {
+            nKnown++;
+            continue;
+        }
+        // These were accepted once already; don't rate-limit them again.
+        if (AcceptToMemoryPoolWithTime(mempool, state, tx, false, NULL, NULL, nTime))
+            nAccepted++;
+        else
+            nFailed++;
+    }
+
+    int64_t nEnd = GetTimeMicros();
+    double dSeconds = std::max(nEnd - nStart, (int64_t)1) * 0.000001;
+    LogPrintf("Imported mempool transactions from disk: %d succeeded, %d failed, %d expired, %d already there\n", nAccepted, nFailed, nExpired, nKnown);
+    LogPrintf("Mempool load: %.2f MB read in %.3fs, %.3fs to accept, %.0f tx/s\n",
+        nBytes * (1.0 / (1 << 20)), (nRead - nStart) * 0.000001, (nEnd - nRead) * 0.000001, vTxs.size() / dSeconds);
+    MarkMempoolLoaded();
+    return true;
+}
+
+bool DumpMempool()
+{
+    LOCK(csMempoolDump);
+    if (!fMempoolLoaded)
+        return false;
+
+    int64_t nStart = GetTimeMicros();
+    std::vector<std::pair<uint64_t, CTxMemPool::txiter> > vOrder;
+    std::vector<std::pair<CTransaction, int64_t> > vTxs;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        // A transaction has more in-mempool ancestors than any of its parents
+        vOrder.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+            vOrder.push_back(std::make_pair(it->GetCountWithAncestors(), it));
+        std::sort(vOrder.begin(), vOrder.end(), CompareByAncestorCount());
+        vTxs.reserve(vOrder.size());
+        for (size_t i = 0; i < vOrder.size(); i++)
+            vTxs.push_back(std::make_pair(vOrder[i].second->GetTx(), vOrder[i].second->GetTime()));
+    }
+    int64_t nCopied = GetTimeMicros();
+
+    try {
+        boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+        CAutoFile file(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return error("%s: Failed to open %s", __func__, pathTmp.string());
+
+        file << MEMPOOL_DUMP_VERSION;
+        file << (uint64_t)vTxs.size();
+        for (size_t i = 0; i < vTxs.size(); i++) {
+            file << vTxs[i].first;
+            file << vTxs[i].second;
+        }
+        file << mapDeltas;
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, GetDataDir() / "mempool.dat"))
+            return error("%s: Failed to rename %s", __func__, pathTmp.string());
+    } catch (const std::exception& e) {
+        return error("%s: Failed to dump mempool: %s", __func__, e.what());
+    }
+    LogPrint("mempool", "Dumped mempool: %u transactions, %.3fs to copy, %.3fs to write\n",
+        vTxs.size(), (nCopied - nStart) * 0.000001, (GetTimeMicros() - nCopied) * 0.000001);
+    return true;
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1992,6 +2385,49 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
+/** The script checks of CheckInputs. Needs no locks, as long as nobody else uses inputs. */
+static bool CheckInputScripts(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
+{
+    if (pvChecks)
+        pvChecks->reserve(tx.vin.size());
+
+    for (unsigned int i = tx.GetFirstInputPos(); i < tx.vin.size(); i++) {
+        const COutPoint &prevout = tx.vin[i].prevout;
+        const CCoins* coins = inputs.AccessCoins(prevout.hash);
+        assert(coins);
+
+        // Verify signature
+        CScriptCheck check(*coins, tx, i, flags, cacheStore);
+        if (pvChecks) {
+            pvChecks->push_back(CScriptCheck());
+            check.swap(pvChecks->back());
+        } else if (!check()) {
+            if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+                // Check whether the failure was caused by a
+                // non-mandatory script verification check, such as
+                // non-standard DER encodings or non-null dummy
+                // arguments; if so, don't trigger DoS protection to
+                // avoid splitting the network between upgraded and
+                // non-upgraded nodes.
+                CScriptCheck check2(*coins, tx, i,
+                        flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                if (check2())
+                    return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
+            }
+            // Failures of other flags indicate a transaction that is
+            // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
+            // such nodes as they are not following the protocol. That
+            // said during an upgrade careful thought should be taken
+            // as to the correct behavior - we may want to continue
+            // peering with non-upgraded nodes even after a soft-fork
+            // super-majority vote has passed.
+            return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+        }
+    }
+
+    return true;
+}
+
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase())
@@ -1999,9 +2435,6 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (!Consensus::CheckTxInputs(tx, state, inputs, GetSpendHeight(inputs)))
             return false;
 
-        if (pvChecks)
-            pvChecks->reserve(tx.vin.size());
-
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
@@ -2012,41 +2445,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // and any change will be caught at the next checkpoint. Of course, if
         // the checkpoint is for a chain that's invalid due to false scriptSigs
         // this optimisation would allow an invalid chain to be accepted.
-        if (fScriptChecks) {
-            for (unsigned int i = tx.GetFirstInputPos(); i < tx.vin.size(); i++) {
-                const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
-
-                // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
-                if (pvChecks) {
-                    pvChecks->push_back(CScriptCheck());
-                    check.swap(pvChecks->back());
-                } else if (!check()) {
-                    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // non-standard DER encodings or non-null dummy
-                        // arguments; if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
-                        if (check2())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after a soft-fork
-                    // super-majority vote has passed.
-                    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
-                }
-            }
-        }
+        if (fScriptChecks && !CheckInputScripts(tx, state, inputs, flags, cacheStore, pvChecks))
+            return false;
     }
 
     return true;
@@ -2261,6 +2661,122 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CBlockCheck> blockcheckqueue(128);
+/** Taken by whoever uses blockcheckqueue, as blocks are checked without cs_main too */
+static CCriticalSection cs_blockcheckqueue;
+
+/** Number of merkle tree node pairs hashed by one CBlockCheck */
+static const size_t MERKLE_CHECK_PAIRS = 64;
+
+void ThreadBlockCheck() {
+    RenameThread("bitcredit-blockch");
+    blockcheckqueue.Thread();
+}
+
+bool CBlockCheck::operator()() {
+    if (ptx) {
+        CValidationState state;
+        if (!CheckTransaction(*ptx, state))
+            return false;
+        *pnSigOps = GetLegacySigOpCount(*ptx);
+        return true;
+    }
+    SHA256D64(pout->begin(), pin->begin(), nPairs);
+    return true;
+}
+
+static CCheckQueue<CCoinsPrefetch> coinsprefetchqueue(128);
+/** Taken by whoever uses coinsprefetchqueue */
+static CCriticalSection cs_coinsprefetchqueue;
+
+void ThreadCoinsPrefetch() {
+    RenameThread("bitcredit-prefetch");
+    coinsprefetchqueue.Thread();
+}
+
+bool CCoinsPrefetch::operator()() {
+    try {
+        *pfFound = pview->GetCoins(*ptxid, *pcoins);
+    } catch (const std::exception& e) {
+        // Left to ConnectBlock to read again, and to fail properly
+        LogPrint("bench", "%s: %s\n", __func__, e.what());
+        *pfFound = false;
+    }
+    return true;
+}
+
+/** The txids whose coins block spends, excluding those it creates itself, without duplicates */
+static void GetSpentTxids(const CBlock& block, std::vector<uint256>& vTxid)
+{
+    std::set<uint256> setCreated;
+    vTxid.clear();
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        setCreated.insert(tx.GetHash());
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            vTxid.push_back(txin.prevout.hash);
+    }
+    std::sort(vTxid.begin(), vTxid.end());
+    vTxid.erase(std::unique(vTxid.begin(), vTxid.end()), vTxid.end());
+    std::vector<uint256>::iterator itEnd = vTxid.begin();
+    for (std::vector<uint256>::iterator it = vTxid.begin(); it != vTxid.end(); it++) {
+        if (!setCreated.count(*it))
+            *itEnd++ = *it;
+    }
+    vTxid.erase(itEnd, vTxid.end());
+}
+
+/**
+ * Coins spent by a new block, read from pcoinsdbview on the prefetch threads
+ * while the block is being checked, before cs_main is taken. They are still
+ * current if pcoinsdbview was not written to since nWriteCount, and pcoinsTip
+ * has no entry of its own for them (only unmodified entries ever leave it).
+ */
+struct CBlockCoinsPrefetch
+{
+    std::vector<uint256> vTxid;
+    std::vector<CCoins> vCoins;
+    std::vector<char> vFound;
+    unsigned int nWriteCount;
+    int64_t nTimeStart;
+};
+
+static void StartPrefetchBlockCoins(const CBlock& block, CBlockCoinsPrefetch& prefetch, CCheckQueueControl<CCoinsPrefetch>& control)
+{
+    prefetch.nTimeStart = GetTimeMicros();
+    GetSpentTxids(block, prefetch.vTxid);
+    prefetch.vCoins.resize(prefetch.vTxid.size());
+    prefetch.vFound.assign(prefetch.vTxid.size(), false);
+    prefetch.nWriteCount = pcoinsdbview->GetWriteCount();
+    std::vector<CCoinsPrefetch> vPrefetch;
+    vPrefetch.reserve(prefetch.vTxid.size());
+    for (size_t i = 0; i < prefetch.vTxid.size(); i++)
+        vPrefetch.push_back(CCoinsPrefetch(pcoinsdbview, &prefetch.vTxid[i], &prefetch.vCoins[i], &prefetch.vFound[i]));
+    control.Add(vPrefetch);
+}
+
+static void AddPrefetchedBlockCoins(CBlockCoinsPrefetch& prefetch)
+{
+    AssertLockHeld(cs_main);
+    if (prefetch.vTxid.empty())
+        return;
+    if (pcoinsdbview->GetWriteCount() != prefetch.nWriteCount) {
+        LogPrint("bench", "  - Prefetch coins: %u txids discarded, coin database written meanwhile\n", (unsigned int)prefetch.vTxid.size());
+        return;
+    }
+    unsigned int nFound = 0, nAdded = 0;
+    for (size_t i = 0; i < prefetch.vTxid.size(); i++) {
+        if (!prefetch.vFound[i])
+            continue;
+        nFound++;
+        if (pcoinsTip->AddPrefetched(prefetch.vTxid[i], prefetch.vCoins[i]))
+            nAdded++;
+    }
+    LogPrint("bench", "  - Prefetch coins: %u of %u spent txids found, %u not cached yet: %.2fms\n",
+        nFound, (unsigned int)prefetch.vTxid.size(), nAdded, 0.001 * (GetTimeMicros() - prefetch.nTimeStart));
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2641,7 +3157,8 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     if (nLastSetChain == 0) {
         nLastSetChain = nNow;
     }
-    size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    // Memory left behind by evicted coins is reused before the cache grows again.
+    size_t cacheSize = pcoinsTip->DynamicMemoryUsage() - pcoinsTip->ReusableMemoryUsage();
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
     // The cache is over the limit, we have to write now.
@@ -2650,10 +3167,12 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
     // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
+    // In background mode, enough coins have been modified to start writing them, or some are staged already, and the previous write is done.
+    bool fTrickle = fCoinsBackgroundFlush && mode != FLUSH_STATE_NONE && (pcoinsTip->GetDirtyCount() >= nCoinsFlushBatch || pcoinsdbview->HasStagedCoins()) && !pcoinsdbview->IsWriting();
     // Combine all conditions that result in a full cache flush.
     bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
     // Write blocks and block index to disk.
-    if (fDoFullFlush || fPeriodicWrite) {
+    if (fDoFullFlush || fPeriodicWrite || fTrickle) {
         // Depend on nMinDiskSpace to ensure we can write block index
         if (!CheckDiskSpace(0))
             return state.Error("out of disk space");
@@ -2683,17 +3202,40 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
-    if (fDoFullFlush) {
+    if (fDoFullFlush || fTrickle) {
         // Typical CCoins structures on disk are around 128 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(128 * 2 * 2 * (fCoinsBackgroundFlush ? pcoinsTip->GetDirtyCount() : pcoinsTip->GetCacheSize())))
             return state.Error("out of disk space");
-        // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
-            return AbortNode(state, "Failed to write to coin database");
+        if (fCoinsBackgroundFlush) {
+            // Copy the modified coins out of the cache, keeping them cached, at most
+            // -dbflushbatch of them per call and the oldest first, so cs_main is only
+            // held briefly; a full flush takes them all. They are staged until none
+            // are left, then handed, together with the block they belong to, to a
+            // background write (committed atomically after the previous one). Only
+            // wait for it when the caller needs the state on disk.
+            CCoinsMap mapDirty;
+            pcoinsTip->CopyDirty(mapDirty, fDoFullFlush ? std::numeric_limits<size_t>::max() : nCoinsFlushBatch);
+            if (pcoinsTip->GetDirtyCount() > 0) {
+                pcoinsdbview->StageCoins(mapDirty);
+            } else {
+                if (!pcoinsdbview->WriteInBackground(mapDirty, pcoinsTip->GetBestBlock()))
+                    return AbortNode(state, "Failed to write to coin database");
+                if ((mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsdbview->WaitForWrite())
+                    return AbortNode(state, "Failed to write to coin database");
+            }
+            // Now that what it copied is clean, make room by evicting unmodified coins,
+            // well below the limit so this doesn't happen again on the next block.
+            if (cacheSize * (10.0/9) > nCoinCacheUsage)
+                pcoinsTip->Trim(nCoinCacheUsage / 10 * 8);
+        } else {
+            // Flush the chainstate (which may refer to block index entries).
+            if (!pcoinsTip->Flush())
+                return AbortNode(state, "Failed to write to coin database");
+        }
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2851,6 +3393,14 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    if (LogAcceptCategory("bench")) {
+        std::vector<uint256> vTxid;
+        GetSpentTxids(*pblock, vTxid);
+        unsigned int nCached = 0;
+        BOOST_FOREACH(const uint256& txid, vTxid)
+            nCached += pcoinsTip->HaveCoinsInCache(txid);
+        LogPrint("bench", "  - Spent coins cached: %u of %u txids (%.1f%%)\n", nCached, (unsigned int)vTxid.size(), vTxid.empty() ? 100.0 : 100.0 * nCached / vTxid.size());
+    }
     {
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(*pblock, state, pindexNew, view);
@@ -3524,7 +4074,66 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
+/**
+ * BlockMerkleRoot, with each level of the tree hashed in chunks on the block
+ * check threads. Mutation is detected the same way, as two equal hashes
+ * being combined.
+ */
+static uint256 BlockMerkleRootParallel(const CBlock& block, bool* pmutated)
+{
+    std::vector<uint256> hashes(block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        hashes[i] = block.vtx[i].GetHash();
+
+    LOCK(cs_blockcheckqueue);
+    CCheckQueueControl<CBlockCheck> control(&blockcheckqueue);
+    bool mutated = false;
+    std::vector<uint256> next;
+    while (hashes.size() > 1) {
+        for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+            if (hashes[pos] == hashes[pos + 1])
+                mutated = true;
+        }
+        if (hashes.size() & 1)
+            hashes.push_back(hashes.back());
+        size_t nPairs = hashes.size() / 2;
+        next.resize(nPairs);
+        std::vector<CBlockCheck> vChecks;
+        for (size_t pos = 0; pos < nPairs; pos += MERKLE_CHECK_PAIRS)
+            vChecks.push_back(CBlockCheck(&hashes[2 * pos], &next[pos], std::min(MERKLE_CHECK_PAIRS, nPairs - pos)));
+        control.Add(vChecks);
+        control.Wait();
+        hashes.swap(next);
+    }
+    *pmutated = mutated;
+    return hashes.empty() ? uint256() : hashes[0];
+}
+
+/**
+ * Run CheckTransaction on all transactions of block on the block check
+ * threads, and count their legacy sigops. Only tells whether they all passed.
+ */
+static bool CheckBlockTransactionsParallel(const CBlock& block, unsigned int& nSigOps)
+{
+    std::vector<unsigned int> vSigOps(block.vtx.size(), 0);
+    std::vector<CBlockCheck> vChecks;
+    vChecks.reserve(block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        vChecks.push_back(CBlockCheck(block.vtx[i], &vSigOps[i]));
+    {
+        LOCK(cs_blockcheckqueue);
+        CCheckQueueControl<CBlockCheck> control(&blockcheckqueue);
+        control.Add(vChecks);
+        if (!control.Wait())
+            return false;
+    }
+    nSigOps = 0;
+    for (size_t i = 0; i < vSigOps.size(); i++)
+        nSigOps += vSigOps[i];
+    return true;
+}
+
+bool CheckBlockContextFree(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
 
@@ -3536,10 +4145,13 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     if (!CheckBlockHeader(block, state, fCheckPOW))
         return false;
 
+    // Small blocks are not worth waking up the block check threads for
+    bool fParallel = nScriptCheckThreads && block.vtx.size() > MERKLE_CHECK_PAIRS;
+
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
-        uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
+        uint256 hashMerkleRoot2 = fParallel ? BlockMerkleRootParallel(block, &mutated) : BlockMerkleRoot(block, &mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, false, REJECT_INVALID, "bad-txnmrklroot", true, "hashMerkleRoot mismatch");
 
@@ -3565,6 +4177,33 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         if (block.vtx[i].IsCoinBase())
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
+    // Check transactions. The parallel check does not say which transaction
+    // failed, so on failure the serial one runs to report it.
+    unsigned int nSigOps = 0;
+    if (!fParallel || !CheckBlockTransactionsParallel(block, nSigOps)) {
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            if (!CheckTransaction(tx, state))
+                return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", tx.GetHash().ToString(), state.GetDebugMessage()));
+
+        nSigOps = 0;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        {
+            nSigOps += GetLegacySigOpCount(tx);
+        }
+    }
+    if (nSigOps > MAX_BLOCK_SIGOPS)
+        return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
+
+    if (fCheckPOW && fCheckMerkleRoot)
+        block.fChecked = true;
+
+    return true;
+}
+
+/** Check the basenode payment in the coinbase of block, if it builds on the current tip */
+static bool CheckBlockBasenodePayments(const CBlock& block, CValidationState& state)
+{
 	// ----------- basenode payments -----------
 
 	bool BasenodePayments = false;
@@ -3655,24 +4294,16 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 			LogPrintf("CheckBlock() : skipping basenode payment checks\n");
 	}
 
-    // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state))
-            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx.GetHash().ToString(), state.GetDebugMessage()));
-
-    unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-    {
-        nSigOps += GetLegacySigOpCount(tx);
-    }
-    if (nSigOps > MAX_BLOCK_SIGOPS)
-        return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
+	return true;
+}
 
-    if (fCheckPOW && fCheckMerkleRoot)
-        block.fChecked = true;
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
+{
+    if (!CheckBlockContextFree(block, state, fCheckPOW, fCheckMerkleRoot))
+        return false;
 
-    return true;
+    // The basenode payment depends on the tip, so it is not covered by fChecked
+    return CheckBlockBasenodePayments(block, state);
 }
 
 static bool CheckIndexAgainstCheckpoint(const CBlockIndex* pindexPrev, CValidationState& state, const CChainParams& chainparams, const uint256& hash)
@@ -3865,8 +4496,25 @@ static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned
 
 bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, CDiskBlockPos* dbp)
 {
+    // Do the context-free checks before taking cs_main, so that AcceptBlock
+    // finds the block checked already. A failure is left to AcceptBlock to
+    // report, as it marks the block index accordingly. Meanwhile, the coins
+    // the block spends are read from the coin database, for ConnectBlock.
+    CBlockCoinsPrefetch prefetch;
+    {
+        bool fPrefetch = nScriptCheckThreads && pblock->vtx.size() > 1;
+        LOCK(cs_coinsprefetchqueue);
+        CCheckQueueControl<CCoinsPrefetch> control(fPrefetch ? &coinsprefetchqueue : NULL);
+        if (fPrefetch)
+            StartPrefetchBlockCoins(*pblock, prefetch, control);
+        CValidationState stateContextFree;
+        CheckBlockContextFree(*pblock, stateContextFree);
+        control.Wait();
+    }
+
     {
         LOCK(cs_main);
+        AddPrefetchedBlockCoins(prefetch);
         bool fRequested = MarkBlockAsReceived(pblock->GetHash());
         fRequested |= fForceProcessing;
 
@@ -4170,6 +4818,18 @@ bool static LoadBlockIndexDB()
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
+    // Check whether the chainstate came from a UTXO snapshot, and whether loading it completed
+    bool fLoadingSnapshot = false;
+    pblocktree->ReadFlag("loadingutxosnapshot", fLoadingSnapshot);
+    if (fLoadingSnapshot)
+        return error("%s: loading a UTXO snapshot did not complete, the chainstate is incomplete", __func__);
+    pblocktree->ReadFlag("utxosnapshot", fUtxoSnapshot);
+    if (fUtxoSnapshot) {
+        LogPrintf("%s: chainstate was loaded from a UTXO snapshot\n", __func__);
+        // Blocks below the snapshot have no data, just like pruned ones
+        fHavePruned = true;
+    }
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -4229,6 +4889,9 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        // Blocks up to a UTXO snapshot were never downloaded
+        if (fUtxoSnapshot && !(pindex->nStatus & BLOCK_HAVE_DATA))
+            break;
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
@@ -4294,6 +4957,8 @@ void UnloadBlockIndex()
     mempool.clear();
     mapOrphanTransactions.clear();
     mapOrphanTransactionsByPrev.clear();
+    mapOrphanTransactionsByPeer.clear();
+    nOrphanTransactionsUsage = 0;
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -4317,6 +4982,49 @@ void UnloadBlockIndex()
     }
     mapBlockIndex.clear();
     fHavePruned = false;
+    fUtxoSnapshot = false;
+}
+
+bool AcceptSnapshotHeader(const CBlockHeader& block, unsigned int nTx, CValidationState& state)
+{
+    AssertLockHeld(cs_main);
+    CBlockIndex* pindex = NULL;
+    if (!AcceptBlockHeader(block, state, Params(), &pindex))
+        return false;
+    // Snapshot headers come in chain order, so the parent must already be linked
+    if (nTx == 0 || pindex->pprev == NULL || pindex->pprev->nChainTx == 0)
+        return state.Invalid(error("%s: header %s does not extend the snapshot chain", __func__, pindex->GetBlockHash().ToString()), 0, "bad-snapshot");
+    if (pindex->nTx == 0) {
+        pindex->nTx = nTx;
+        pindex->nChainTx = pindex->pprev->nChainTx + nTx;
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindex->nSequenceId = nBlockSequenceId++;
+        }
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindex);
+    }
+    return true;
+}
+
+bool ActivateSnapshotTip(const uint256& hash, CValidationState& state)
+{
+    AssertLockHeld(cs_main);
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
+    if (mi == mapBlockIndex.end() || !mi->second->IsValid(BLOCK_VALID_SCRIPTS) || mi->second->nChainTx == 0)
+        return state.Error(strprintf("%s: snapshot block %s is not in the block index", __func__, hash.ToString()));
+    CBlockIndex* pindex = mi->second;
+
+    fUtxoSnapshot = true;
+    fHavePruned = true;
+    if (!pblocktree->WriteFlag("utxosnapshot", true))
+        return state.Error("failed to write utxosnapshot flag");
+
+    pcoinsTip->SetBestBlock(hash);
+    chainActive.SetTip(pindex);
+    setBlockIndexCandidates.insert(pindex);
+    PruneBlockIndexCandidates();
+    return FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
 bool LoadBlockIndex()
@@ -4764,7 +5472,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -4806,6 +5514,18 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
                         pfrom->PushMessage(NetMsgType::BLOCK, block);
+                    else if (inv.type == MSG_CMPCT_BLOCK)
+                    {
+                        // If a peer is asking for old blocks, we're almost guaranteed
+                        // they wont have a useful mempool to match against a compact block,
+                        // and we don't feel like constructing the object for them, so
+                        // instead we respond with the full, non-compact block.
+                        if (mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                            CBlockHeaderAndShortTxIDs cmpctblock(block);
+                            pfrom->PushMessage(NetMsgType::CMPCTBLOCK, cmpctblock);
+                        } else
+                            pfrom->PushMessage(NetMsgType::BLOCK, block);
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
@@ -4907,7 +5627,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -4926,6 +5646,207 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     }
 }
 
+/**
+ * Try to add a transaction relayed by pfrom to the mempool, along with any
+ * orphans it completes, and relay or reject it. pprevalidation, if not NULL,
+ * holds what a pre-validation thread already checked.
+ */
+static void ProcessTransaction(CNode* pfrom, const std::string& strCommand, const CTransaction& tx, const CTxPreValidation* pprevalidation)
+{
+    AssertLockHeld(cs_main);
+    CInv inv(MSG_TX, tx.GetHash());
+    vector<uint256> vWorkQueue;
+    bool fMissingInputs = false;
+    CValidationState state;
+
+    mapAlreadyAskedFor.erase(inv);
+
+    CFeeRate txFeeRate = CFeeRate(0);
+    if (!AlreadyHave(inv) && AcceptToMemoryPoolPreValidated(mempool, state, tx, true, &fMissingInputs, &txFeeRate, GetTime(), false, 0, pprevalidation)) {
+        mempool.check(pcoinsTip);
+        RelayTransaction(tx, txFeeRate);
+        vWorkQueue.push_back(inv.hash);
+
+        LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
+            pfrom->id,
+            tx.GetHash().ToString(),
+            mempool.size(), mempool.DynamicMemoryUsage() / 1000);
+
+        // Recursively process any orphan transactions that depended on this
+        // one, one newly accepted parent at a time. Orphans leave the pool as
+        // soon as they are accepted or rejected, so none is tried twice.
+        set<NodeId> setMisbehaving;
+        for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+        {
+            // The orphans spending any output of this parent
+            set<uint256> setOrphans;
+            map<COutPoint, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.lower_bound(COutPoint(vWorkQueue[i], 0));
+            for (; itByPrev != mapOrphanTransactionsByPrev.end() && itByPrev->first.hash == vWorkQueue[i]; ++itByPrev)
+                setOrphans.insert(itByPrev->second.begin(), itByPrev->second.end());
+
+            BOOST_FOREACH(const uint256& orphanHash, setOrphans)
+            {
+                map<uint256, COrphanTx>::iterator itOrphan = mapOrphanTransactions.find(orphanHash);
+                if (itOrphan == mapOrphanTransactions.end())
+                    continue;
+                const CTransaction orphanTx = itOrphan->second.tx;
+                NodeId fromPeer = itOrphan->second.fromPeer;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+                if (setMisbehaving.count(fromPeer))
+                    continue;
+                CFeeRate orphanFeeRate = CFeeRate(0);
+                if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2, &orphanFeeRate)) {
+                    LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                    RelayTransaction(orphanTx, orphanFeeRate);
+                    vWorkQueue.push_back(orphanHash);
+                    EraseOrphanTx(orphanHash);
+                }
+                else if (!fMissingInputs2)
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                    EraseOrphanTx(orphanHash);
+                    assert(recentRejects);
+                    recentRejects->insert(orphanHash);
+                }
+                mempool.check(pcoinsTip);
+            }
+        }
+    }
+    else if (fMissingInputs)
+    {
+        AddOrphanTx(tx, pfrom->GetId());
+
+        // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+        unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+        size_t nMaxOrphanSize = (size_t)std::max((int64_t)0, GetArg("-maxorphansize", DEFAULT_MAX_ORPHAN_SIZE)) * 1000000;
+        unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, nMaxOrphanSize);
+        if (nEvicted > 0)
+            LogPrint("mempool", "orphan pool full or expired, removed %u tx\n", nEvicted);
+    } else {
+        assert(recentRejects);
+        recentRejects->insert(tx.GetHash());
+
+        if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
+            // Always relay transactions received from whitelisted peers, even
+            // if they were already in the mempool or rejected from it due
+            // to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that we would assign a non-zero DoS
+            // score for, as we expect peers to do the same with us in that
+            // case.
+            int nDoS = 0;
+            if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
+                RelayTransaction(tx, txFeeRate);
+            } else {
+                LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
+            }
+        }
+    }
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint("mempoolrej", "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
+            pfrom->id,
+            FormatStateMessage(state));
+        if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
+            pfrom->PushMessage(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
+                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+    FlushStateToDisk(state, FLUSH_STATE_PERIODIC);
+}
+
+/** A relayed transaction waiting for a pre-validation thread */
+struct CTxPreValidationJob
+{
+    CNode* pfrom;
+    std::string strCommand;
+    CTransaction tx;
+};
+
+static boost::mutex csTxPreValidation;
+static boost::condition_variable cvTxPreValidation;
+static std::deque<CTxPreValidationJob> queueTxPreValidation;
+
+/**
+ * Hand a relayed transaction to the pre-validation threads. Returns false if
+ * there are none, or too many transactions are already waiting, in which case
+ * the caller validates it itself.
+ */
+static bool QueueTxPreValidation(CNode* pfrom, const std::string& strCommand, const CTransaction& tx)
+{
+    if (nPreValidationThreads == 0)
+        return false;
+    {
+        boost::lock_guard<boost::mutex> lock(csTxPreValidation);
+        if (queueTxPreValidation.size() >= MAX_PREVALIDATION_QUEUE)
+            return false;
+        queueTxPreValidation.push_back(CTxPreValidationJob());
+        CTxPreValidationJob& job = queueTxPreValidation.back();
+        job.strCommand = strCommand;
+        job.tx = tx;
+        {
+            LOCK(cs_vNodes);
+            job.pfrom = pfrom->AddRef();
+        }
+        LOCK(pfrom->cs_txPreValidating);
+        pfrom->nTxPreValidating++;
+    }
+    cvTxPreValidation.notify_one();
+    return true;
+}
+
+void ThreadTxPreValidation()
+{
+    RenameThread("bitcredit-txcheck");
+    while (true) {
+        CTxPreValidationJob job;
+        {
+            boost::unique_lock<boost::mutex> lock(csTxPreValidation);
+            while (queueTxPreValidation.empty())
+                cvTxPreValidation.wait(lock);
+            job = queueTxPreValidation.front();
+            queueTxPreValidation.pop_front();
+        }
+
+        CTxPreValidation prevalidation;
+        PreValidateTransaction(job.tx, prevalidation);
+        {
+            LOCK(cs_main);
+            ProcessTransaction(job.pfrom, job.strCommand, job.tx, &prevalidation);
+        }
+
+        // Let the message handler get on with this peer's other messages
+        {
+            LOCK(job.pfrom->cs_txPreValidating);
+            job.pfrom->nTxPreValidating--;
+        }
+        {
+            LOCK(cs_vNodes);
+            job.pfrom->Release();
+        }
+        messageHandlerCondition.notify_one();
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     const CChainParams& chainparams = Params();
@@ -5094,6 +6015,17 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // nodes)
             pfrom->PushMessage(NetMsgType::SENDHEADERS);
         }
+        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION && GetBoolArg("-cmpctblocks", DEFAULT_CMPCTBLOCKS)) {
+            // Tell our peer we are willing to provide version-1 cmpctblocks.
+            // However, we do not request new block announcements using
+            // cmpctblock messages until the peer has shown us it is fast
+            // (see MaybeSetPeerAsAnnouncingHeaderAndIDs).
+            // We send this to non-NODE NETWORK peers as well, because
+            // they may wish to request compact blocks from us
+            bool fAnnounceUsingCMPCTBLOCK = false;
+            uint64_t nCMPCTBLOCKVersion = 1;
+            pfrom->PushMessage(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+        }
     }
 
 
@@ -5169,6 +6101,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         State(pfrom->GetId())->fPreferHeaders = true;
     }
 
+    else if (strCommand == NetMsgType::SENDCMPCT)
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 1;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == 1 && GetBoolArg("-cmpctblocks", DEFAULT_CMPCTBLOCKS)) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fProvidesHeaderAndIDs = true;
+            State(pfrom->GetId())->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
 
     else if (strCommand == NetMsgType::INV)
     {
@@ -5266,6 +6210,50 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == NetMsgType::GETBLOCKTXN)
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+        if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (it->second->nHeight < chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+            // If an older block is requested (should never happen in practice,
+            // but can happen in tests) send a block response instead of a
+            // blocktxn response. Sending a full block response instead of a
+            // small blocktxn response is preferable in the case where a peer
+            // might maliciously send lots of getblocktxn requests to trigger
+            // expensive disk reads, because it will require the peer to
+            // actually receive all the data read from disk over the network.
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_CMPCTBLOCK_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom, chainparams.GetConsensus());
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+                return true;
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage(NetMsgType::BLOCKTXN, resp);
+    }
+
+
     else if (strCommand == NetMsgType::GETBLOCKS)
     {
         CBlockLocator locator;
@@ -5359,7 +6347,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == NetMsgType::TX && strCommand == NetMsgType::DSTX)
+    else if (strCommand == NetMsgType::TX || strCommand == NetMsgType::DSTX)
     {
         // Stop processing the transaction early if
         // We are in blocks only mode and peer is either not whitelisted or whitelistrelay is off
@@ -5369,10 +6357,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
-        vRecv >> tx;
 
 			//basenode signed transaction
 			//bool allowFree = false;
@@ -5424,124 +6409,15 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
-
-        LOCK(cs_main);
-
-        bool fMissingInputs = false;
-        CValidationState state;
-
         pfrom->setAskFor.erase(inv.hash);
-        mapAlreadyAskedFor.erase(inv);
-
-        CFeeRate txFeeRate = CFeeRate(0);
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, &txFeeRate)) {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx, txFeeRate);
-            vWorkQueue.push_back(inv.hash);
-
-            LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
-                pfrom->id,
-                tx.GetHash().ToString(),
-                mempool.size(), mempool.DynamicMemoryUsage() / 1000);
-
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    CFeeRate orphanFeeRate = CFeeRate(0);
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2, &orphanFeeRate)) {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx, orphanFeeRate);
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        assert(recentRejects);
-                        recentRejects->insert(orphanHash);
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        else if (fMissingInputs)
-        {
-            AddOrphanTx(tx, pfrom->GetId());
 
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-            if (nEvicted > 0)
-                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
-        } else {
-            assert(recentRejects);
-            recentRejects->insert(tx.GetHash());
+        // Validate it off this thread if we can, so a flood of transactions
+        // doesn't hold up blocks
+        if (QueueTxPreValidation(pfrom, strCommand, tx))
+            return true;
 
-            if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
-                    RelayTransaction(tx, txFeeRate);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
-                }
-            }
-        }
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-        {
-            LogPrint("mempoolrej", "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
-                pfrom->id,
-                FormatStateMessage(state));
-            if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
-                pfrom->PushMessage(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
-                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
-        }
-        FlushStateToDisk(state, FLUSH_STATE_PERIODIC);
+        LOCK(cs_main);
+        ProcessTransaction(pfrom, strCommand, tx, NULL);
     }
 
 
@@ -5638,6 +6514,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                             pindexLast->GetBlockHash().ToString(), pindexLast->nHeight);
                 }
                 if (vGetData.size() > 0) {
+                    if (nodestate->fProvidesHeaderAndIDs && vGetData.size() == 1 && mapBlocksInFlight.size() == 1 && pindexLast->pprev->IsValid(BLOCK_VALID_CHAIN)) {
+                        // We seem to be rather well-synced, so it appears pfrom was the first to provide us
+                        // with this block! Let's get them to announce using compact blocks in the future.
+                        MaybeSetPeerAsAnnouncingHeaderAndIDs(nodestate, pfrom);
+                        // In any case, we want to download using a compact block, not a regular one
+                        vGetData[0] = CInv(MSG_CMPCT_BLOCK, vGetData[0].hash);
+                    }
                     pfrom->PushMessage(NetMsgType::GETDATA, vGetData);
                 }
             }
@@ -5646,6 +6529,186 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CheckBlockIndex(chainparams.GetConsensus());
     }
 
+    else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        LOCK(cs_main);
+
+        if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+            // Doesn't connect (or is genesis), instead of DoSing in AcceptBlockHeader, request deeper headers
+            if (!IsInitialBlockDownload())
+                pfrom->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), uint256());
+            return true;
+        }
+
+        CBlockIndex *pindex = NULL;
+        CValidationState state;
+        if (!AcceptBlockHeader(cmpctblock.header, state, chainparams, &pindex)) {
+            int nDoS;
+            if (state.IsInvalid(nDoS)) {
+                if (nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                LogPrintf("Peer %d sent us invalid header via cmpctblock\n", pfrom->id);
+                return true;
+            }
+        }
+
+        // If AcceptBlockHeader returned true, it set pindex
+        assert(pindex);
+        UpdateBlockAvailability(pfrom->GetId(), pindex->GetBlockHash());
+
+        map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator blockInFlightIt = mapBlocksInFlight.find(pindex->GetBlockHash());
+        bool fAlreadyInFlight = blockInFlightIt != mapBlocksInFlight.end();
+
+        if (pindex->nStatus & BLOCK_HAVE_DATA) // Nothing to do here
+            return true;
+
+        if (pindex->nChainWork <= chainActive.Tip()->nChainWork || // We know something better
+                pindex->nTx != 0) { // We had this block at some point, but pruned it
+            if (fAlreadyInFlight) {
+                // We requested this block for some reason, but our mempool will probably be useless
+                // so we just grab the block via normal getdata
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, cmpctblock.header.GetHash()));
+                pfrom->PushMessage(NetMsgType::GETDATA, vInv);
+            }
+            return true;
+        }
+
+        // If we're not close to tip yet, give up and let parallel block fetch work its magic
+        if (!fAlreadyInFlight && !CanDirectFetch(chainparams.GetConsensus()))
+            return true;
+
+        CNodeState *nodestate = State(pfrom->GetId());
+
+        // We want to be a bit conservative just to be extra careful about DoS
+        // possibilities in compact block processing...
+        if (pindex->nHeight <= chainActive.Height() + 2) {
+            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) ||
+                 (fAlreadyInFlight && blockInFlightIt->second.first == pfrom->GetId())) {
+                list<QueuedBlock>::iterator *queuedBlockIt = NULL;
+                if (!MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), chainparams.GetConsensus(), pindex, &queuedBlockIt)) {
+                    if (!(*queuedBlockIt)->partialBlock)
+                        (*queuedBlockIt)->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+                    else {
+                        // The block was already in flight using compact blocks from the same peer
+                        LogPrint("net", "Peer sent us compact block we were already syncing!\n");
+                        return true;
+                    }
+                }
+
+                PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
+                ReadStatus status = partialBlock.InitData(cmpctblock);
+                if (status == READ_STATUS_INVALID) {
+                    MarkBlockAsReceived(pindex->GetBlockHash()); // Reset in-flight state in case of whitelist
+                    Misbehaving(pfrom->GetId(), 100);
+                    LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+                    return true;
+                } else if (status == READ_STATUS_FAILED) {
+                    // Duplicate txindexes, the block is now in-flight, so just request it
+                    vector<CInv> vInv(1, CInv(MSG_BLOCK, cmpctblock.header.GetHash()));
+                    pfrom->PushMessage(NetMsgType::GETDATA, vInv);
+                    return true;
+                }
+
+                if (!fAlreadyInFlight && mapBlocksInFlight.size() == 1 && pindex->pprev->IsValid(BLOCK_VALID_CHAIN)) {
+                    // We seem to be rather well-synced, so it appears pfrom was the first to provide us
+                    // with this block! Let's get them to announce using compact blocks in the future.
+                    MaybeSetPeerAsAnnouncingHeaderAndIDs(nodestate, pfrom);
+                }
+
+                BlockTransactionsRequest req;
+                for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                    if (!partialBlock.IsTxAvailable(i))
+                        req.indexes.push_back(i);
+                }
+                LogPrint("cmpctblock", "cmpctblock %s from peer=%d: %u prefilled, %u from mempool, %u to request\n",
+                    pindex->GetBlockHash().ToString(), pfrom->id, partialBlock.GetPrefilledCount(),
+                    partialBlock.GetMempoolCount(), req.indexes.size());
+                if (req.indexes.empty()) {
+                    // Nothing is missing: jump straight to the BLOCKTXN code with an empty response
+                    BlockTransactions txn;
+                    txn.blockhash = cmpctblock.header.GetHash();
+                    CDataStream blockTxnMsg(SER_NETWORK, PROTOCOL_VERSION);
+                    blockTxnMsg << txn;
+                    return ProcessMessage(pfrom, NetMsgType::BLOCKTXN, blockTxnMsg, nTimeReceived);
+                } else {
+                    req.blockhash = pindex->GetBlockHash();
+                    pfrom->PushMessage(NetMsgType::GETBLOCKTXN, req);
+                }
+            }
+        } else {
+            if (fAlreadyInFlight) {
+                // We requested this block, but its far into the future, so our
+                // mempool will probably be useless - request the block normally
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, cmpctblock.header.GetHash()));
+                pfrom->PushMessage(NetMsgType::GETDATA, vInv);
+                return true;
+            } else {
+                // If this was an announce-cmpctblock, we want the same treatment as a header message
+                vector<CBlock> headers;
+                headers.push_back(cmpctblock.header);
+                CDataStream vHeadersMsg(SER_NETWORK, PROTOCOL_VERSION);
+                vHeadersMsg << headers;
+                return ProcessMessage(pfrom, NetMsgType::HEADERS, vHeadersMsg, nTimeReceived);
+            }
+        }
+
+        CheckBlockIndex(chainparams.GetConsensus());
+    }
+
+    else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        bool fBlockRead = false;
+        {
+            LOCK(cs_main);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+            if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock ||
+                    it->second.first != pfrom->GetId()) {
+                LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            PartiallyDownloadedBlock& partialBlock = *it->second.second->partialBlock;
+            int64_t nTimeRequested = it->second.second->nTime;
+            ReadStatus status = partialBlock.FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash); // Reset in-flight state in case of whitelist
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Might have collided, fall back to getdata now :(
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, resp.blockhash));
+                pfrom->PushMessage(NetMsgType::GETDATA, vInv);
+            } else {
+                fBlockRead = true;
+                LogPrint("bench", "    - Compact block %s reconstructed from peer=%d: %.2fms after request (%u txn fetched)\n",
+                    resp.blockhash.ToString(), pfrom->id, (GetTimeMicros() - nTimeRequested) * 0.001, resp.txn.size());
+            }
+        } // Don't hold cs_main when we call into ProcessNewBlock
+        if (fBlockRead) {
+            CValidationState state;
+            ProcessNewBlock(state, chainparams, pfrom, &block, false, NULL);
+            int nDoS;
+            if (state.IsInvalid(nDoS)) {
+                assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
+                pfrom->PushMessage(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
+                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+                if (nDoS > 0) {
+                    LOCK(cs_main);
+                    Misbehaving(pfrom->GetId(), nDoS);
+                }
+            }
+        }
+    }
+
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlock block;
@@ -5954,6 +7017,11 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
+        // Answer nothing out of order while this peer's transactions are
+        // being pre-validated; ThreadTxPreValidation wakes us when they are done
+        if (pfrom->IsTxPreValidating() && msg.hdr.GetCommand() != NetMsgType::TX && msg.hdr.GetCommand() != NetMsgType::DSTX)
+            break;
+
         // at this point, any failure means we can delete the current message
         it++;
 
@@ -6174,7 +7242,9 @@ bool SendMessages(CNode* pto)
             // add all to the inv queue.
             LOCK(pto->cs_inventory);
             vector<CBlock> vHeaders;
-            bool fRevertToInv = (!state.fPreferHeaders || pto->vBlockHashesToAnnounce.size() > MAX_BLOCKS_TO_ANNOUNCE);
+            bool fRevertToInv = ((!state.fPreferHeaders &&
+                                 (!state.fPreferHeaderAndIDs || pto->vBlockHashesToAnnounce.size() > 1)) ||
+                                pto->vBlockHashesToAnnounce.size() > MAX_BLOCKS_TO_ANNOUNCE);
             CBlockIndex *pBestIndex = NULL; // last header queued for delivery
             ProcessBlockAvailability(pto->id); // ensure pindexBestKnownBlock is up-to-date
 
@@ -6239,7 +7309,18 @@ bool SendMessages(CNode* pto)
                             pto->id, hashToAnnounce.ToString());
                     }
                 }
-            } else if (!vHeaders.empty()) {
+            } else if (!vHeaders.empty() && vHeaders.size() == 1 && state.fPreferHeaderAndIDs) {
+                // We only send up to 1 block as header-and-ids, as otherwise
+                // probably means we're doing an initial-ish-sync or they're slow
+                LogPrint("net", "%s: sending header-and-ids %s to peer=%d\n", __func__,
+                        vHeaders.front().GetHash().ToString(), pto->id);
+                CBlock block;
+                if (!ReadBlockFromDisk(block, pBestIndex, consensusParams))
+                    assert(!"cannot load block from disk");
+                CBlockHeaderAndShortTxIDs cmpctblock(block);
+                pto->PushMessage(NetMsgType::CMPCTBLOCK, cmpctblock);
+                state.pindexBestHeaderSent = pBestIndex;
+            } else if (!vHeaders.empty() && state.fPreferHeaders) {
                 if (vHeaders.size() > 1) {
                     LogPrint("net", "%s: %u headers, range (%s, %s), to peer=%d\n", __func__,
                             vHeaders.size(),
@@ -6436,5 +7517,7 @@ public:
         // orphan transactions
         mapOrphanTransactions.clear();
         mapOrphanTransactionsByPrev.clear();
+        mapOrphanTransactionsByPeer.clear();
+        nOrphanTransactionsUsage = 0;
     }
 } instance_of_cmaincleanup;
@@ -31,6 +31,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CBloomFilter;
 class CChainParams;
 class CInv;
@@ -58,6 +59,14 @@ static const CAmount HIGH_TX_FEE_PER_KB = 0.01 * COIN;
 static const CAmount HIGH_MAX_TX_FEE = 100 * HIGH_TX_FEE_PER_KB;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxorphansize, maximum memory used by orphan transactions in megabytes */
+static const unsigned int DEFAULT_MAX_ORPHAN_SIZE = 5;
+/** Larger orphan transactions are not kept, in bytes */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** Seconds an orphan transaction is kept waiting for its parents */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+/** Minimum seconds between sweeps for expired orphan transactions */
+static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default for -limitancestorcount, max number of in-mempool ancestors */
 static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
 /** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
@@ -68,6 +77,10 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Seconds between dumps of the mempool to mempool.dat while running */
+static const int64_t MEMPOOL_DUMP_INTERVAL = 15 * 60;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -79,6 +92,12 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of transaction pre-validation threads allowed */
+static const int MAX_PREVALIDATION_THREADS = 16;
+/** -prevalidationthreads default (threads checking relayed transactions before they take cs_main) */
+static const int DEFAULT_PREVALIDATION_THREADS = 2;
+/** Relayed transactions that may wait for a pre-validation thread; beyond that they are validated inline */
+static const unsigned int MAX_PREVALIDATION_QUEUE = 1000;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -95,6 +114,10 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Default for -dbbackgroundflush, write the chainstate from a background thread and keep the coins cache warm */
+static const bool DEFAULT_DB_BACKGROUND_FLUSH = false;
+/** Default for -dbflushbatch, number of modified coin records that starts a background chainstate write */
+static const unsigned int DEFAULT_DB_FLUSH_BATCH = 50000;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Average delay between local address broadcasts in seconds. */
@@ -129,7 +152,12 @@ static const bool DEFAULT_FEEFILTER = true;
 /** Maximum number of headers to announce when relaying blocks with headers message.*/
 static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
 
+/** Maximum depth (below the tip) of a block we serve as a cmpctblock or answer getblocktxn for. */
+static const int MAX_CMPCTBLOCK_DEPTH = 10;
+
 static const bool DEFAULT_PEERBLOOMFILTERS = true;
+/** Default for -cmpctblocks */
+static const bool DEFAULT_CMPCTBLOCKS = true;
 
 struct BlockHasher
 {
@@ -150,6 +178,7 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nPreValidationThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
@@ -157,6 +186,10 @@ extern unsigned int nBytesPerSigOp;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+/** Write the chainstate from a background thread instead of wiping the coins cache */
+extern bool fCoinsBackgroundFlush;
+/** Number of modified coin records that starts a background chainstate write */
+extern unsigned int nCoinsFlushBatch;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -178,6 +211,8 @@ extern bool fHavePruned;
 extern bool fPruneMode;
 /** Number of MiB of block files that we're trying to stay below. */
 extern uint64_t nPruneTarget;
+/** True if the chainstate was loaded from a UTXO snapshot (-loadutxosnapshot): blocks up to the snapshot were never downloaded. */
+extern bool fUtxoSnapshot;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
@@ -228,6 +263,10 @@ bool InitBlockIndex(const CChainParams& chainparams);
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/** Add a header from a UTXO snapshot to the block index, as a fully validated block with nTx transactions whose data we don't have */
+bool AcceptSnapshotHeader(const CBlockHeader& block, unsigned int nTx, CValidationState& state);
+/** Make the snapshot block hash, whose coins are already in pcoinsdbview, the tip of the active chain */
+bool ActivateSnapshotTip(const uint256& hash, CValidationState& state);
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
 /**
@@ -238,6 +277,12 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread doing the context-free checks of blocks */
+void ThreadBlockCheck();
+/** Run an instance of the thread reading the coins spent by new blocks ahead of time */
+void ThreadCoinsPrefetch();
+/** Run an instance of the thread that checks relayed transactions before they take cs_main */
+void ThreadTxPreValidation();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -289,10 +334,17 @@ void Misbehaving(NodeId nodeid, int howmuch);
 void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
+/** Write the mempool to mempool.dat. Does nothing before LoadMempool has completed. */
+bool DumpMempool();
+/** Load mempool.dat into the mempool, holding cs_main for one transaction at a time. */
+bool LoadMempool();
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, CFeeRate* txFeeRate, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
+/** (try to) add transaction to memory pool, as if it arrived at nAcceptTime **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, CFeeRate* txFeeRate, int64_t nAcceptTime, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 bool AcceptableInputs(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool ignoreFees=true);
 CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowFree);
 
@@ -441,6 +493,67 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing one piece of the context-free checks of a block:
+ * either CheckTransaction on one transaction, also counting its legacy
+ * sigops, or hashing nPairs pairs of merkle tree nodes into the next level.
+ * Like CScriptCheck, it stores pointers into data that must outlive it.
+ */
+class CBlockCheck
+{
+private:
+    const CTransaction *ptx;
+    unsigned int *pnSigOps;
+    const uint256 *pin;
+    uint256 *pout;
+    size_t nPairs;
+
+public:
+    CBlockCheck(): ptx(NULL), pnSigOps(NULL), pin(NULL), pout(NULL), nPairs(0) {}
+    CBlockCheck(const CTransaction& txIn, unsigned int *pnSigOpsIn) :
+        ptx(&txIn), pnSigOps(pnSigOpsIn), pin(NULL), pout(NULL), nPairs(0) {}
+    CBlockCheck(const uint256 *pinIn, uint256 *poutIn, size_t nPairsIn) :
+        ptx(NULL), pnSigOps(NULL), pin(pinIn), pout(poutIn), nPairs(nPairsIn) {}
+
+    bool operator()();
+
+    void swap(CBlockCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(pnSigOps, check.pnSigOps);
+        std::swap(pin, check.pin);
+        std::swap(pout, check.pout);
+        std::swap(nPairs, check.nPairs);
+    }
+};
+
+/**
+ * Closure reading the coins of one txid from a view into *pcoins, setting
+ * *pfFound to whether there were any. Used to read the coins spent by a
+ * block from the coin database ahead of ConnectBlock.
+ */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView *pview;
+    const uint256 *ptxid;
+    CCoins *pcoins;
+    char *pfFound;
+
+public:
+    CCoinsPrefetch(): pview(NULL), ptxid(NULL), pcoins(NULL), pfFound(NULL) {}
+    CCoinsPrefetch(const CCoinsView *pviewIn, const uint256 *ptxidIn, CCoins *pcoinsIn, char *pfFoundIn) :
+        pview(pviewIn), ptxid(ptxidIn), pcoins(pcoinsIn), pfFound(pfFoundIn) {}
+
+    bool operator()();
+
+    void swap(CCoinsPrefetch &prefetch) {
+        std::swap(pview, prefetch.pview);
+        std::swap(ptxid, prefetch.ptxid);
+        std::swap(pcoins, prefetch.pcoins);
+        std::swap(pfFound, prefetch.pfFound);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
@@ -451,6 +564,13 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
+/**
+ * The checks of CheckBlock that do not need cs_main: everything except the
+ * basenode payment, which is checked against the current tip. The
+ * transactions and the merkle tree are checked on the block check threads,
+ * if there are any.
+ */
+bool CheckBlockContextFree(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
 /** Context-dependent validity checks.
@@ -554,6 +674,9 @@ extern CCoinsViewCache *pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Global variable that points to the coin database backing pcoinsTip */
+extern CCoinsViewDB *pcoinsdbview;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -5,6 +5,8 @@
 #ifndef BITCREDIT_MEMUSAGE_H
 #define BITCREDIT_MEMUSAGE_H
 
+#include "prevector.h"
+
 #include <stdlib.h>
 
 #include <map>
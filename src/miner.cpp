@@ -14,6 +14,7 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
 #include "hash.h"
 #include "main.h"
 #include "net.h"
@@ -81,37 +82,63 @@ string convertAddress(const char address[], char newVersionByte){
     return result;
 }
 
-CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+/**
+ * Build the coinbase of a block at nHeight collecting nFees: the bank gets a
+ * fifth, the bidders in bidtracker share 40% of the rest, the miner (paid to
+ * scriptPubKeyIn) gets what is left.
+ */
+static CMutableTransaction CreateCoinbase(const CScript& scriptPubKeyIn, const std::map<std::string,double>& bidtracker,
+                                          int nHeight, CAmount nFees, const Consensus::Params& consensusParams)
 {
-    // Create new block
-    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if(!pblocktemplate.get())
-        return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+    std::map<std::string,double>::const_iterator balit;
 
-	double bidstotal= 0;
-
-	std::map<std::string,double> bidtracker = getbidtracker();
-	std::map<std::string,double>::iterator balit;
-
-    // Create coinbase tx
     CMutableTransaction txNew;
     txNew.vin.resize(1);
     txNew.vin[0].prevout.SetNull();
-    txNew.vout.resize(bidtracker.size()+ 2);
+    txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    txNew.vout.resize(bidtracker.size() + 2);
     txNew.vout[0].scriptPubKey = scriptPubKeyIn;
-	txNew.vout[1].scriptPubKey = BANK_SCRIPT;    
-
-	if (bidtracker.size()>0){
-		int i = 2;
-		for(balit = bidtracker.begin(); balit != bidtracker.end();balit++){
-			CBitcreditAddress address(convertAddress(balit->first.c_str(),0x0c));
-			CTxDestination dest = address.Get();
-			txNew.vout[i].scriptPubKey= GetScriptForDestination(dest);
-			bidstotal+=balit->second;
-			i++;
-		}
-	}
+    txNew.vout[1].scriptPubKey = BANK_SCRIPT;
+
+    CAmount totalvalue = nFees + GetBlockSubsidy(nHeight, consensusParams);
+    txNew.vout[1].nValue = 0.2 * totalvalue;
+    totalvalue -= (0.2 * totalvalue);
+
+    if (bidtracker.size() > 0) {
+        int i = 2;
+        unsigned long int py = 0.4 * totalvalue;
+        for (balit = bidtracker.begin(); balit != bidtracker.end(); balit++) {
+            CBitcreditAddress address(convertAddress(balit->first.c_str(), 0x0c));
+            txNew.vout[i].scriptPubKey = GetScriptForDestination(address.Get());
+            unsigned long int bb = (balit->second) * py;
+            txNew.vout[i].nValue = bb;
+            totalvalue -= bb;
+            i++;
+        }
+    }
+    txNew.vout[0].nValue = totalvalue;
+
+    if (fDebug) { //debug payouts
+        LogPrintf(" Bidtracker size:  %ld\n", bidtracker.size());
+        for (unsigned int i = 0; i < txNew.vout.size(); i++) {
+            CAmount payout = txNew.vout[i].nValue;
+            CTxDestination address;
+            ExtractDestination(txNew.vout[i].scriptPubKey, address);
+            string receiveAddress = CBitcreditAddress(address).ToString().c_str();
+            LogPrintf(" Payouts: %s :-, %ld\n", receiveAddress, payout);
+        }
+    }
+
+    return txNew;
+}
+
+static CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn, const std::map<std::string,double>& bidtracker)
+{
+    // Create new block
+    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    if(!pblocktemplate.get())
+        return NULL;
+    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
 
     // Add dummy coinbase tx as first transaction
     pblock->vtx.push_back(CTransaction());
@@ -304,37 +331,9 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
         LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOps);
 
         // Compute final coinbase transaction.
-        CAmount totalvalue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
-        txNew.vout[1].nValue = 0.2* totalvalue;
-        totalvalue -= (0.2* totalvalue);
-       
-		if (bidtracker.size()>0){
-			int i=2;
-			unsigned long int py = 0.4*totalvalue;	
-			for(balit = bidtracker.begin(); balit != bidtracker.end();balit++){
-				unsigned long int bb =(balit->second)* py;
-				txNew.vout[i].nValue = bb ;
-				totalvalue -= bb;			
-				i++;
-			}
-		}
-				
-        txNew.vout[0].nValue = totalvalue;
-        txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
-        pblock->vtx[0] = txNew;
+        pblock->vtx[0] = CreateCoinbase(scriptPubKeyIn, bidtracker, nHeight, nFees, chainparams.GetConsensus());
         pblocktemplate->vTxFees[0] = -nFees;
 
-		if (fDebug){//debug payouts
-			LogPrintf(" Bidtracker size:  %ld\n",bidtracker.size());
-			for(unsigned int i=0; i < txNew.vout.size();i++){
-				CAmount payout = txNew.vout[i].nValue;
-				CTxDestination address;
-				ExtractDestination(txNew.vout[i].scriptPubKey, address);
-				string receiveAddress = CBitcreditAddress( address ).ToString().c_str();
-				LogPrintf(" Payouts: %s :-, %ld\n",receiveAddress,payout);
-				}
-		}
-
         // Fill in header
         pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
         UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
@@ -351,6 +350,237 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
     return pblocktemplate.release();
 }
 
+CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    return CreateNewBlock(chainparams, scriptPubKeyIn, getbidtracker());
+}
+
+void CTemplateLatencyStats::Add(int64_t nMicros)
+{
+    nCount++;
+    nTotalMicros += nMicros;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+    int nBucket = 0;
+    while (nBucket < BUCKETS - 1 && nMicros >= ((int64_t)1000 << nBucket))
+        nBucket++;
+    vBuckets[nBucket]++;
+}
+
+CBlockTemplateCache::CBlockTemplateCache() :
+    pblocktemplate(NULL), pindexPrev(NULL), nTransactionsUpdatedLast(0), nTimeFull(0),
+    nBlockSize(0), nBlockSigOps(0), nFees(0), nLockTimeCutoff(0)
+{
+}
+
+CBlockTemplateCache::~CBlockTemplateCache()
+{
+    delete pblocktemplate;
+}
+
+void CBlockTemplateCache::BuildFull(const CChainParams& chainparams)
+{
+    // Clear pindexPrev so future calls make a new block, despite any failures from here on
+    pindexPrev = NULL;
+    delete pblocktemplate;
+    pblocktemplate = NULL;
+
+    bidtracker = getbidtracker();
+
+    LOCK(mempool.cs);
+    // The new template reflects the whole pool; changes so far are of no use.
+    std::vector<uint256> vAdded, vRemoved;
+    mempool.TrackChanges();
+    mempool.TakeChanges(vAdded, vRemoved);
+    nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+    CBlockIndex* pindexPrevNew = chainActive.Tip();
+
+    pblocktemplate = CreateNewBlock(chainparams, scriptPubKey, bidtracker);
+    if (!pblocktemplate)
+        return;
+
+    const CBlock& block = pblocktemplate->block;
+    vTxSizes.assign(1, 0);
+    setInBlock.clear();
+    nBlockSize = 1000;
+    nBlockSigOps = 100;
+    nFees = -pblocktemplate->vTxFees[0];
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        unsigned int nTxSize = ::GetSerializeSize(block.vtx[i], SER_NETWORK, PROTOCOL_VERSION);
+        vTxSizes.push_back(nTxSize);
+        setInBlock.insert(block.vtx[i].GetHash());
+        nBlockSize += nTxSize;
+        nBlockSigOps += pblocktemplate->vTxSigOps[i];
+    }
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                      ? pindexPrevNew->GetMedianTimePast()
+                      : block.GetBlockTime();
+    nTimeFull = GetTime();
+
+    // Need to update only after we know CreateNewBlock succeeded
+    pindexPrev = pindexPrevNew;
+}
+
+bool CBlockTemplateCache::ApplyChanges(const CChainParams& chainparams, const std::vector<uint256>& vAdded, const std::vector<uint256>& vRemoved)
+{
+    AssertLockHeld(mempool.cs);
+    CBlock& block = pblocktemplate->block;
+    std::vector<CAmount>& vTxFees = pblocktemplate->vTxFees;
+    std::vector<int64_t>& vTxSigOps = pblocktemplate->vTxSigOps;
+
+    // Drop removed transactions, and whatever in the template spends them
+    // (the mempool removes those too, but possibly in a later change).
+    std::set<uint256> setDropped;
+    BOOST_FOREACH(const uint256& hash, vRemoved) {
+        if (setInBlock.count(hash))
+            setDropped.insert(hash);
+    }
+    if (!setDropped.empty()) {
+        unsigned int j = 1;
+        for (unsigned int i = 1; i < block.vtx.size(); i++) {
+            const uint256& hash = block.vtx[i].GetHash();
+            bool fDrop = setDropped.count(hash);
+            BOOST_FOREACH(const CTxIn& txin, block.vtx[i].vin) {
+                if (fDrop)
+                    break;
+                fDrop = setDropped.count(txin.prevout.hash);
+            }
+            if (fDrop) {
+                setDropped.insert(hash);
+                setInBlock.erase(hash);
+                nBlockSize -= vTxSizes[i];
+                nBlockSigOps -= vTxSigOps[i];
+                nFees -= vTxFees[i];
+                continue;
+            }
+            if (j != i) {
+                block.vtx[j] = block.vtx[i];
+                vTxFees[j] = vTxFees[i];
+                vTxSigOps[j] = vTxSigOps[i];
+                vTxSizes[j] = vTxSizes[i];
+            }
+            j++;
+        }
+        block.vtx.resize(j);
+        vTxFees.resize(j);
+        vTxSigOps.resize(j);
+        vTxSizes.resize(j);
+    }
+
+    // Append new transactions, with the limits CreateNewBlock applies
+    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+    const int nHeight = pindexPrev->nHeight + 1;
+
+    BOOST_FOREACH(const uint256& hash, vAdded) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end() || setInBlock.count(hash))
+            continue;
+
+        // Children of transactions left out wait for the next full assembly
+        bool fMissingParent = false;
+        BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(it)) {
+            if (!setInBlock.count(parent->GetTx().GetHash())) {
+                fMissingParent = true;
+                break;
+            }
+        }
+        if (fMissingParent)
+            continue;
+
+        unsigned int nTxSize = it->GetTxSize();
+        if (it->GetModifiedFee() < ::minRelayTxFee.GetFee(nTxSize) && nBlockSize >= nBlockMinSize)
+            continue;
+
+        unsigned int nTxSigOps = it->GetSigOpCount();
+        if (nBlockSize + nTxSize >= nBlockMaxSize || nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS) {
+            // It doesn't fit. If it pays better than something already in,
+            // the template is worth assembling again.
+            CFeeRate feeRate(it->GetModifiedFee(), nTxSize);
+            for (unsigned int i = 1; i < block.vtx.size(); i++) {
+                if (CFeeRate(vTxFees[i], vTxSizes[i]) < feeRate)
+                    return false;
+            }
+            continue;
+        }
+
+        const CTransaction& tx = it->GetTx();
+        if (!IsFinalTx(tx, nHeight, nLockTimeCutoff))
+            continue;
+
+        block.vtx.push_back(tx);
+        vTxFees.push_back(it->GetFee());
+        vTxSigOps.push_back(nTxSigOps);
+        vTxSizes.push_back(nTxSize);
+        setInBlock.insert(hash);
+        nBlockSize += nTxSize;
+        nBlockSigOps += nTxSigOps;
+        nFees += it->GetFee();
+    }
+    return true;
+}
+
+void CBlockTemplateCache::UpdateCoinbase(const CChainParams& chainparams)
+{
+    CBlock& block = pblocktemplate->block;
+    block.vtx[0] = CreateCoinbase(scriptPubKey, bidtracker, pindexPrev->nHeight + 1, nFees, chainparams.GetConsensus());
+    pblocktemplate->vTxFees[0] = -nFees;
+    pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(block.vtx[0]);
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    nLastBlockTx = block.vtx.size() - 1;
+    nLastBlockSize = nBlockSize;
+}
+
+CBlockTemplate* CBlockTemplateCache::Get(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    AssertLockHeld(cs_main);
+    int64_t nTimeStart = GetTimeMicros();
+
+    if (pblocktemplate && pindexPrev == chainActive.Tip() && scriptPubKeyIn == scriptPubKey) {
+        if (mempool.GetTransactionsUpdated() == nTransactionsUpdatedLast)
+            return pblocktemplate;
+
+        if (GetTime() - nTimeFull <= BLOCK_TEMPLATE_MAX_INCREMENTAL_AGE) {
+            bool fApplied;
+            {
+                LOCK(mempool.cs);
+                nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+                std::vector<uint256> vAdded, vRemoved;
+                fApplied = mempool.TakeChanges(vAdded, vRemoved) && ApplyChanges(chainparams, vAdded, vRemoved);
+            }
+            if (fApplied) {
+                UpdateCoinbase(chainparams);
+                int64_t nTime = GetTimeMicros() - nTimeStart;
+                statsIncremental.Add(nTime);
+                LogPrint("bench", "Block template updated: %u txs, %.2fms\n", pblocktemplate->block.vtx.size() - 1, nTime * 0.001);
+                return pblocktemplate;
+            }
+        }
+    }
+
+    scriptPubKey = scriptPubKeyIn;
+    BuildFull(chainparams);
+    if (!pblocktemplate)
+        return NULL;
+    pblocktemplate->block.hashMerkleRoot = BlockMerkleRoot(pblocktemplate->block);
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    statsFull.Add(nTime);
+    LogPrint("bench", "Block template assembled: %u txs, %.2fms\n", pblocktemplate->block.vtx.size() - 1, nTime * 0.001);
+    return pblocktemplate;
+}
+
+static void SetExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int nExtraNonce)
+{
+    unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
+    CMutableTransaction txCoinbase(pblock->vtx[0]);
+    txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
+    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
+
+    pblock->vtx[0] = txCoinbase;
+    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -361,13 +591,7 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
         hashPrevBlock = pblock->hashPrevBlock;
     }
     ++nExtraNonce;
-    unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
-    CMutableTransaction txCoinbase(pblock->vtx[0]);
-    txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
-    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
-
-    pblock->vtx[0] = txCoinbase;
-    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    SetExtraNonce(pblock, pindexPrev, nExtraNonce);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -375,6 +599,9 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 // Internal miner
 //
 
+/** Number of nonces ScanHash hashes per call into the SHA256 code */
+static const unsigned int SCANHASH_BATCH = 64;
+
 //
 // ScanHash scans nonces looking for a hash with at least some zero bits.
 // The nonce is usually preserved between calls, but periodically or if the
@@ -383,28 +610,34 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 //
 bool static ScanHash(const CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash)
 {
-    // Write the first 76 bytes of the block header to a double-SHA256 state.
-    CHash256 hasher;
+    // Serialize the block header once; SHA256D80Nonces reuses the state after
+    // its first 64 bytes and only fills in the nonce (the last 4 bytes).
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << *pblock;
     assert(ss.size() == 80);
-    hasher.Write((unsigned char*)&ss[0], 76);
 
+    unsigned char hashes[SCANHASH_BATCH * 32];
     while (true) {
-        nNonce++;
-
-        // Write the last 4 bytes of the block header (the nonce) to a copy of
-        // the double-SHA256 state, and compute the result.
-        CHash256(hasher).Write((unsigned char*)&nNonce, 4).Finalize((unsigned char*)phash);
-
-        // Return the nonce if the hash has at least some zero bits,
-        // caller will check if it has enough to reach the target
-        if (((uint16_t*)phash)[15] == 0)
-            return true;
+        // Hash a batch of consecutive nonces at once, which lets the
+        // multi-way SHA256 implementations work on several of them in parallel.
+        uint32_t nFirst = nNonce + 1;
+        SHA256D80Nonces(hashes, (unsigned char*)&ss[0], nFirst, SCANHASH_BATCH);
+
+        for (unsigned int i = 0; i < SCANHASH_BATCH; i++) {
+            nNonce = nFirst + i;
+            const unsigned char* hash = hashes + 32 * i;
+
+            // Return the nonce if the hash has at least some zero bits,
+            // caller will check if it has enough to reach the target
+            if (hash[30] == 0 && hash[31] == 0) {
+                memcpy(phash->begin(), hash, 32);
+                return true;
+            }
 
-        // If nothing found after trying for a while, return -1
-        if ((nNonce & 0xfff) == 0)
-            return false;
+            // If nothing found after trying for a while, return -1
+            if ((nNonce & 0xfff) == 0)
+                return false;
+        }
     }
 }
 
@@ -431,24 +664,90 @@ static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainpar
     return true;
 }
 
-void static BitcreditMiner(const CChainParams& chainparams)
+//
+// The internal miner runs one template thread and a pool of hashing workers.
+// Only the template thread assembles blocks, and so takes cs_main and
+// mempool.cs. It publishes every new template by swapping pMinerWork and
+// bumping nMinerWorkGeneration; the workers check that counter between
+// ScanHash calls without taking a lock, and only lock csMinerWork to pick up
+// the new template. Worker i of n uses the extranonces i + 1, i + 1 + n,
+// i + 1 + 2n, ..., so no two workers ever hash the same header.
+//
+
+/** A block template published to the miner workers */
+struct CMinerWork
 {
-    LogPrintf("BitcreditMiner started\n");
-    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-    RenameThread("bitcredit-miner");
+    CBlock block;
+    const CBlockIndex* pindexPrev;
+    unsigned int nGeneration;
+};
+
+static boost::mutex csMinerWork;
+static boost::condition_variable cvMinerWork;
+static boost::shared_ptr<const CMinerWork> pMinerWork;
+/** Generation of pMinerWork, written under csMinerWork but read by the workers without it */
+static volatile unsigned int nMinerWorkGeneration = 0;
+/** Coinbase script of the running miner, shared by all its threads */
+static boost::shared_ptr<CReserveScript> minerCoinbaseScript;
+
+static CCriticalSection csMinerStats;
+static std::vector<CMinerThreadStats> vMinerStats;
+
+/** Hand a new template (or none, if pindexPrev is NULL) to the workers, and make them drop the current one */
+static void PublishMinerWork(const CBlock* pblock, const CBlockIndex* pindexPrev)
+{
+    boost::shared_ptr<CMinerWork> pwork;
+    if (pindexPrev) {
+        pwork.reset(new CMinerWork());
+        pwork->block = *pblock;
+        pwork->pindexPrev = pindexPrev;
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(csMinerWork);
+        nMinerWorkGeneration = nMinerWorkGeneration + 1;
+        if (pwork)
+            pwork->nGeneration = nMinerWorkGeneration;
+        pMinerWork = pwork;
+    }
+    cvMinerWork.notify_all();
+}
+
+/** Wait for a template other than generation nGeneration */
+static boost::shared_ptr<const CMinerWork> WaitForMinerWork(unsigned int nGeneration)
+{
+    boost::unique_lock<boost::mutex> lock(csMinerWork);
+    while (!pMinerWork || pMinerWork->nGeneration == nGeneration)
+        cvMinerWork.wait(lock);
+    return pMinerWork;
+}
 
-    unsigned int nExtraNonce = 0;
+static void ReportMinerHashes(int nThread, uint64_t nHashes, double dHashesPerSec)
+{
+    LOCK(csMinerStats);
+    if (nThread < (int)vMinerStats.size()) {
+        vMinerStats[nThread].nHashes += nHashes;
+        vMinerStats[nThread].dHashesPerSec = dHashesPerSec;
+    }
+}
+
+std::vector<CMinerThreadStats> GetMinerThreadStats()
+{
+    LOCK(csMinerStats);
+    return vMinerStats;
+}
+
+void static BitcreditMinerTemplates(const CChainParams& chainparams)
+{
+    LogPrintf("BitcreditMiner template thread started\n");
+    RenameThread("bitcredit-minertpl");
 
     boost::shared_ptr<CReserveScript> coinbaseScript;
-    GetMainSignals().ScriptForMining(coinbaseScript);
+    {
+        boost::lock_guard<boost::mutex> lock(csMinerWork);
+        coinbaseScript = minerCoinbaseScript;
+    }
 
     try {
-        // Throw an error if no script was provided.  This can happen
-        // due to some internal error but also if the keypool is empty.
-        // In the latter case, already the pointer is NULL.
-        if (!coinbaseScript || coinbaseScript->reserveScript.empty())
-            throw std::runtime_error("No coinbase script available (mining requires a wallet)");
-
         while (true) {
             if (chainparams.MiningRequiresPeers()) {
                 // Busy-wait for the network to come online so we don't waste time mining
@@ -469,43 +768,102 @@ void static BitcreditMiner(const CChainParams& chainparams)
             // Create new block
             //
             unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-            CBlockIndex* pindexPrev = chainActive.Tip();
-
-            auto_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(chainparams, coinbaseScript->reserveScript));
+            CBlockIndex* pindexPrev;
+            auto_ptr<CBlockTemplate> pblocktemplate;
+            {
+                LOCK(cs_main);
+                pindexPrev = chainActive.Tip();
+                pblocktemplate.reset(CreateNewBlock(chainparams, coinbaseScript->reserveScript));
+            }
             if (!pblocktemplate.get())
             {
                 LogPrintf("Error in BitcreditMiner: Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
+                PublishMinerWork(NULL, NULL);
                 return;
             }
-            CBlock *pblock = &pblocktemplate->block;
-            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
 
-            LogPrintf("Running BitcreditMiner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
-                ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
+            LogPrintf("Running BitcreditMiner with %u transactions in block (%u bytes)\n", pblocktemplate->block.vtx.size(),
+                ::GetSerializeSize(pblocktemplate->block, SER_NETWORK, PROTOCOL_VERSION));
+            PublishMinerWork(&pblocktemplate->block, pindexPrev);
 
-            //
-            // Search
-            //
+            // Sleep until there is a new tip, or until the mempool has changed
+            // and the template is a minute old.
             int64_t nStart = GetTime();
-            arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
-            uint256 hash;
-            uint32_t nNonce = 0;
-            while (true) {
-                // Check if something found
-                if (ScanHash(pblock, nNonce, &hash))
-                {
-                    if (UintToArith256(hash) <= hashTarget)
+            boost::unique_lock<boost::mutex> lock(csBestBlock);
+            while (chainActive.Tip() == pindexPrev) {
+                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
+                    break;
+                // Regtest mode doesn't require peers
+                if (vNodes.empty() && chainparams.MiningRequiresPeers()) {
+                    PublishMinerWork(NULL, NULL);
+                    break;
+                }
+                cvBlockChange.timed_wait(lock, boost::get_system_time() + boost::posix_time::seconds(1));
+            }
+        }
+    }
+    catch (const boost::thread_interrupted&)
+    {
+        LogPrintf("BitcreditMiner template thread terminated\n");
+        throw;
+    }
+    catch (const std::runtime_error &e)
+    {
+        LogPrintf("BitcreditMiner runtime error: %s\n", e.what());
+        return;
+    }
+}
+
+void static BitcreditMinerWorker(const CChainParams& chainparams, int nThread, int nThreads)
+{
+    LogPrintf("BitcreditMiner worker %d started\n", nThread);
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("bitcredit-miner");
+
+    int64_t nWindowStart = GetTimeMillis();
+    int64_t nLastReport = nWindowStart;
+    uint64_t nWindowHashes = 0;
+    uint64_t nUnreported = 0;
+
+    try {
+        unsigned int nGeneration = 0;
+        while (true) {
+            boost::shared_ptr<const CMinerWork> pwork = WaitForMinerWork(nGeneration);
+            nGeneration = pwork->nGeneration;
+            const CBlockIndex* pindexPrev = pwork->pindexPrev;
+
+            // Work through this thread's extranonces until the template is replaced
+            for (unsigned int nExtraNonce = nThread + 1; nGeneration == nMinerWorkGeneration; nExtraNonce += nThreads) {
+                CBlock block(pwork->block);
+                SetExtraNonce(&block, pindexPrev, nExtraNonce);
+
+                //
+                // Search
+                //
+                arith_uint256 hashTarget = arith_uint256().SetCompact(block.nBits);
+                uint256 hash;
+                uint32_t nNonce = 0;
+                while (true) {
+                    uint32_t nNonceStart = nNonce;
+                    bool fFound = ScanHash(&block, nNonce, &hash);
+                    nUnreported += nNonce - nNonceStart;
+
+                    // Check if something found
+                    if (fFound && UintToArith256(hash) <= hashTarget)
                     {
                         // Found a solution
-                        pblock->nNonce = nNonce;
-                        assert(hash == pblock->GetHash());
+                        block.nNonce = nNonce;
+                        assert(hash == block.GetHash());
 
                         SetThreadPriority(THREAD_PRIORITY_NORMAL);
                         LogPrintf("BitcreditMiner:\n");
                         LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hash.GetHex(), hashTarget.GetHex());
-                        ProcessBlockFound(pblock, chainparams);
+                        ProcessBlockFound(&block, chainparams);
                         SetThreadPriority(THREAD_PRIORITY_LOWEST);
-                        coinbaseScript->KeepScript();
+                        {
+                            boost::lock_guard<boost::mutex> lock(csMinerWork);
+                            minerCoinbaseScript->KeepScript();
+                        }
 
                         // In regression test mode, stop mining after a block is found.
                         if (chainparams.MineBlocksOnDemand())
@@ -513,35 +871,43 @@ void static BitcreditMiner(const CChainParams& chainparams)
 
                         break;
                     }
-                }
 
-                // Check for stop or if block needs to be rebuilt
-                boost::this_thread::interruption_point();
-                // Regtest mode doesn't require peers
-                if (vNodes.empty() && chainparams.MiningRequiresPeers())
-                    break;
-                if (nNonce >= 0xffff0000)
-                    break;
-                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
-                    break;
-                if (pindexPrev != chainActive.Tip())
-                    break;
+                    int64_t nNow = GetTimeMillis();
+                    if (nNow - nLastReport >= 1000) {
+                        nWindowHashes += nUnreported;
+                        ReportMinerHashes(nThread, nUnreported, nWindowHashes * 1000.0 / (nNow - nWindowStart));
+                        nUnreported = 0;
+                        nLastReport = nNow;
+                        if (nNow - nWindowStart >= MINER_HASHRATE_WINDOW * 1000) {
+                            nWindowStart = nNow;
+                            nWindowHashes = 0;
+                        }
+                    }
+
+                    // Check for stop or if the template was replaced
+                    boost::this_thread::interruption_point();
+                    if (nGeneration != nMinerWorkGeneration)
+                        break;
+                    // Move on to the next extranonce
+                    if (nNonce >= 0xffff0000)
+                        break;
 
-                // Update nTime every few seconds
-                if (UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev) < 0)
-                    break; // Recreate the block if the clock has run backwards,
-                           // so that we can use the correct time.
-                if (chainparams.GetConsensus().fPowAllowMinDifficultyBlocks)
-                {
-                    // Changing pblock->nTime can change work required on testnet:
-                    hashTarget.SetCompact(pblock->nBits);
+                    // Update nTime every few seconds
+                    if (UpdateTime(&block, chainparams.GetConsensus(), pindexPrev) < 0)
+                        break; // Start over if the clock has run backwards,
+                               // so that we can use the correct time.
+                    if (chainparams.GetConsensus().fPowAllowMinDifficultyBlocks)
+                    {
+                        // Changing block.nTime can change work required on testnet:
+                        hashTarget.SetCompact(block.nBits);
+                    }
                 }
             }
         }
     }
     catch (const boost::thread_interrupted&)
     {
-        LogPrintf("BitcreditMiner terminated\n");
+        LogPrintf("BitcreditMiner worker %d terminated\n", nThread);
         throw;
     }
     catch (const std::runtime_error &e)
@@ -560,15 +926,51 @@ void GenerateBitcredits(bool fGenerate, int nThreads, const CChainParams& chainp
 
     if (minerThreads != NULL)
     {
+        // Wait for the threads, they share the state reset below
         minerThreads->interrupt_all();
+        minerThreads->join_all();
         delete minerThreads;
         minerThreads = NULL;
     }
 
+    PublishMinerWork(NULL, NULL);
+    {
+        boost::lock_guard<boost::mutex> lock(csMinerWork);
+        minerCoinbaseScript.reset();
+    }
+    {
+        LOCK(csMinerStats);
+        vMinerStats.clear();
+    }
+
     if (nThreads == 0 || !fGenerate)
         return;
 
+    // Throw an error if no script was provided.  This can happen
+    // due to some internal error but also if the keypool is empty.
+    // In the latter case, already the pointer is NULL.
+    boost::shared_ptr<CReserveScript> coinbaseScript;
+    GetMainSignals().ScriptForMining(coinbaseScript);
+    if (!coinbaseScript || coinbaseScript->reserveScript.empty())
+    {
+        LogPrintf("BitcreditMiner runtime error: No coinbase script available (mining requires a wallet)\n");
+        return;
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(csMinerWork);
+        minerCoinbaseScript = coinbaseScript;
+    }
+    {
+        LOCK(csMinerStats);
+        vMinerStats.resize(nThreads);
+        for (int i = 0; i < nThreads; i++) {
+            vMinerStats[i].nThread = i;
+            vMinerStats[i].nThreads = nThreads;
+        }
+    }
+
     minerThreads = new boost::thread_group();
+    minerThreads->create_thread(boost::bind(&BitcreditMinerTemplates, boost::cref(chainparams)));
     for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(boost::bind(&BitcreditMiner, boost::cref(chainparams)));
+        minerThreads->create_thread(boost::bind(&BitcreditMinerWorker, boost::cref(chainparams), i, nThreads));
 }
@@ -9,6 +9,10 @@
 #include "primitives/block.h"
 
 #include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 
 class CBlockIndex;
 class CChainParams;
@@ -21,6 +25,10 @@ static const bool DEFAULT_GENERATE = false;
 static const int DEFAULT_GENERATE_THREADS = 1;
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Seconds a block template is updated incrementally before it is assembled from scratch again */
+static const int64_t BLOCK_TEMPLATE_MAX_INCREMENTAL_AGE = 60;
+/** Seconds over which the hash rate of a miner thread is averaged */
+static const int64_t MINER_HASHRATE_WINDOW = 10;
 
 struct CBlockTemplate
 {
@@ -29,8 +37,102 @@ struct CBlockTemplate
     std::vector<int64_t> vTxSigOps;
 };
 
-/** Run the miner threads */
+/** Template build times, counted in power-of-two millisecond buckets */
+class CTemplateLatencyStats
+{
+public:
+    /** Buckets count builds taking under 1, 2, 4, ... 1024 ms, the last one longer builds */
+    static const int BUCKETS = 12;
+
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    uint64_t vBuckets[BUCKETS];
+
+    CTemplateLatencyStats() : nCount(0), nTotalMicros(0), nMaxMicros(0)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+            vBuckets[i] = 0;
+    }
+
+    void Add(int64_t nMicros);
+};
+
+/**
+ * Keeps the last block template handed out by getblocktemplate, and brings it
+ * up to date from the mempool changes since (see CTxMemPool::TakeChanges)
+ * instead of assembling a new one. Removed transactions are dropped along
+ * with their in-template descendants; new ones are appended if their
+ * in-mempool parents are in the template and they fit. After that, only the
+ * coinbase and merkle root are recomputed, outside mempool.cs.
+ *
+ * The template is assembled from scratch with CreateNewBlock when the tip
+ * changes, when the changes are incomplete, when a new transaction would
+ * displace cheaper ones from a full template, and when the template is older
+ * than BLOCK_TEMPLATE_MAX_INCREMENTAL_AGE. Callers must hold cs_main.
+ */
+class CBlockTemplateCache
+{
+private:
+    CBlockTemplate* pblocktemplate;
+    CBlockIndex* pindexPrev;
+    CScript scriptPubKey;
+    std::map<std::string,double> bidtracker;
+    unsigned int nTransactionsUpdatedLast;
+    int64_t nTimeFull;
+
+    // Selection state of the template, maintained by the incremental updates
+    std::vector<unsigned int> vTxSizes;
+    std::set<uint256> setInBlock;
+    uint64_t nBlockSize;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+    int64_t nLockTimeCutoff;
+
+    CTemplateLatencyStats statsFull;
+    CTemplateLatencyStats statsIncremental;
+
+    void BuildFull(const CChainParams& chainparams);
+    /** Apply mempool changes; returns false if the template must be assembled from scratch */
+    bool ApplyChanges(const CChainParams& chainparams, const std::vector<uint256>& vAdded, const std::vector<uint256>& vRemoved);
+    void UpdateCoinbase(const CChainParams& chainparams);
+
+public:
+    CBlockTemplateCache();
+    ~CBlockTemplateCache();
+
+    /**
+     * Return a template paying to scriptPubKeyIn on top of the current tip.
+     * It remains owned by the cache and valid until the next call.
+     */
+    CBlockTemplate* Get(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
+    /** The block the last template builds on */
+    CBlockIndex* GetPrev() const { return pindexPrev; }
+    /** Mempool GetTransactionsUpdated() as of the last template */
+    unsigned int GetTransactionsUpdated() const { return nTransactionsUpdatedLast; }
+    const CTemplateLatencyStats& GetFullStats() const { return statsFull; }
+    const CTemplateLatencyStats& GetIncrementalStats() const { return statsIncremental; }
+};
+
+/** Hash rate of one miner worker thread */
+struct CMinerThreadStats
+{
+    int nThread;
+    /** Extranonce values used by the thread are nThread + k * nThreads */
+    int nThreads;
+    uint64_t nHashes;
+    double dHashesPerSec;
+
+    CMinerThreadStats() : nThread(0), nThreads(0), nHashes(0), dHashesPerSec(0) {}
+};
+
+/**
+ * Run the miner threads: one thread builds the block templates and
+ * publishes them, nThreads workers hash on them.
+ */
 void GenerateBitcredits(bool fGenerate, int nThreads, const CChainParams& chainparams);
+/** Hash rates of the running miner worker threads (empty if not mining) */
+std::vector<CMinerThreadStats> GetMinerThreadStats();
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
 /** Modify the extranonce in a block */
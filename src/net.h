@@ -169,6 +169,9 @@ extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
 extern std::vector<std::string> vAddedNodes;
 extern CCriticalSection cs_vAddedNodes;
 
+/** Wakes the message handler thread, e.g. when a peer has new messages to process */
+extern CConditionVariable messageHandlerCondition;
+
 extern NodeId nLastNodeId;
 extern CCriticalSection cs_nLastNodeId;
 
@@ -364,6 +367,10 @@ public:
     CBloomFilter* pfilter;
     int nRefCount;
     NodeId id;
+    // Transactions from this node still with the pre-validation threads. Its
+    // other messages wait for them, so replies keep the order of requests.
+    int nTxPreValidating;
+    CCriticalSection cs_txPreValidating;
 protected:
 
     // Denial-of-service detection/prevention
@@ -509,6 +516,12 @@ public:
     }
 
 
+    bool IsTxPreValidating()
+    {
+        LOCK(cs_txPreValidating);
+        return nTxPreValidating > 0;
+    }
+
     void AddInventoryKnown(const CInv& inv)
     {
         {
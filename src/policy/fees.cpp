@@ -13,6 +13,8 @@
 #include "txmempool.h"
 #include "util.h"
 
+#include <algorithm>
+
 //#include "uint256.h"
 
 uint256 feeAssetID;
@@ -24,7 +26,6 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
     dataTypeString = _dataTypeString;
     for (unsigned int i = 0; i < defaultBuckets.size(); i++) {
         buckets.push_back(defaultBuckets[i]);
-        bucketMap[defaultBuckets[i]] = i;
     }
     confAvg.resize(maxConfirms);
     curBlockConf.resize(maxConfirms);
@@ -40,6 +41,18 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
     txCtAvg.resize(buckets.size());
     curBlockVal.resize(buckets.size());
     avg.resize(buckets.size());
+
+    estimates.assign(maxConfirms, -1);
+    smartTargets.assign(maxConfirms, maxConfirms);
+}
+
+unsigned int TxConfirmStats::FindBucketIndex(double val) const
+{
+    // The last bucket is unbounded (INF_FEERATE or INF_PRIORITY)
+    std::vector<double>::const_iterator it = std::lower_bound(buckets.begin(), buckets.end(), val);
+    if (it == buckets.end())
+        --it;
+    return it - buckets.begin();
 }
 
 // Zero out the data for the current block
@@ -61,10 +74,9 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     // blocksToConfirm is 1-based
     if (blocksToConfirm < 1)
         return;
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
-        curBlockConf[i - 1][bucketindex]++;
-    }
+    unsigned int bucketindex = FindBucketIndex(val);
+    if ((unsigned int)blocksToConfirm <= curBlockConf.size())
+        curBlockConf[blocksToConfirm - 1][bucketindex]++;
     curBlockTxCt[bucketindex]++;
     curBlockVal[bucketindex] += val;
 }
@@ -72,8 +84,12 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
 void TxConfirmStats::UpdateMovingAverages()
 {
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
+        // Everything confirmed within i blocks was confirmed within i + 1 blocks as well
+        int nConfirmed = 0;
+        for (unsigned int i = 0; i < confAvg.size(); i++) {
+            nConfirmed += curBlockConf[i][j];
+            confAvg[i][j] = confAvg[i][j] * decay + nConfirmed;
+        }
         avg[j] = avg[j] * decay + curBlockVal[j];
         txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
     }
@@ -178,16 +194,69 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     return median;
 }
 
+void TxConfirmStats::UpdateEstimates(double sufficientTxVal, double minSuccess, unsigned int nBlockHeight)
+{
+    unsigned int maxConfirms = GetMaxConfirms();
+    estimates.resize(maxConfirms);
+    smartTargets.resize(maxConfirms);
+    for (unsigned int i = 0; i < maxConfirms; i++)
+        estimates[i] = EstimateMedianVal(i + 1, sufficientTxVal, minSuccess, true, nBlockHeight);
+
+    unsigned int nextTarget = maxConfirms;
+    for (unsigned int i = maxConfirms; i > 0; i--) {
+        if (estimates[i - 1] >= 0)
+            nextTarget = i;
+        smartTargets[i - 1] = nextTarget;
+    }
+}
+
+double TxConfirmStats::GetEstimate(int confTarget) const
+{
+    if (confTarget <= 0 || (unsigned int)confTarget > estimates.size())
+        return -1;
+    return estimates[confTarget - 1];
+}
+
+double TxConfirmStats::GetSmartEstimate(int confTarget, int *answerFoundAtTarget) const
+{
+    if (confTarget <= 0 || (unsigned int)confTarget > smartTargets.size())
+        return -1;
+    unsigned int target = smartTargets[confTarget - 1];
+    if (answerFoundAtTarget)
+        *answerFoundAtTarget = target;
+    return estimates[target - 1];
+}
+
+// The averages are written as floats, their precision is well beyond what the estimates need
+static void WriteAverages(CAutoFile& fileout, const std::vector<double>& vAvg)
+{
+    std::vector<float> vFloat(vAvg.begin(), vAvg.end());
+    fileout << vFloat;
+}
+
+static void ReadAverages(CAutoFile& filein, std::vector<double>& vAvg, bool fCompact)
+{
+    if (!fCompact) {
+        filein >> vAvg;
+        return;
+    }
+    std::vector<float> vFloat;
+    filein >> vFloat;
+    vAvg.assign(vFloat.begin(), vFloat.end());
+}
+
 void TxConfirmStats::Write(CAutoFile& fileout)
 {
     fileout << decay;
     fileout << buckets;
-    fileout << avg;
-    fileout << txCtAvg;
-    fileout << confAvg;
+    WriteAverages(fileout, avg);
+    WriteAverages(fileout, txCtAvg);
+    WriteCompactSize(fileout, confAvg.size());
+    for (unsigned int i = 0; i < confAvg.size(); i++)
+        WriteAverages(fileout, confAvg[i]);
 }
 
-void TxConfirmStats::Read(CAutoFile& filein)
+void TxConfirmStats::Read(CAutoFile& filein, bool fCompact)
 {
     // Read data file into temporary variables and do some very basic sanity checking
     std::vector<double> fileBuckets;
@@ -205,17 +274,18 @@ void TxConfirmStats::Read(CAutoFile& filein)
     numBuckets = fileBuckets.size();
     if (numBuckets <= 1 || numBuckets > 1000)
         throw std::runtime_error("Corrupt estimates file. Must have between 2 and 1000 fee/pri buckets");
-    filein >> fileAvg;
+    ReadAverages(filein, fileAvg, fCompact);
     if (fileAvg.size() != numBuckets)
         throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri average bucket count");
-    filein >> fileTxCtAvg;
+    ReadAverages(filein, fileTxCtAvg, fCompact);
     if (fileTxCtAvg.size() != numBuckets)
         throw std::runtime_error("Corrupt estimates file. Mismatch in tx count bucket count");
-    filein >> fileConfAvg;
-    maxConfirms = fileConfAvg.size();
+    maxConfirms = ReadCompactSize(filein);
     if (maxConfirms <= 0 || maxConfirms > 6 * 24 * 7) // one week
         throw std::runtime_error("Corrupt estimates file.  Must maintain estimates for between 1 and 1008 (one week) confirms");
+    fileConfAvg.resize(maxConfirms);
     for (unsigned int i = 0; i < maxConfirms; i++) {
+        ReadAverages(filein, fileConfAvg[i], fCompact);
         if (fileConfAvg[i].size() != numBuckets)
             throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri conf average bucket count");
     }
@@ -226,7 +296,6 @@ void TxConfirmStats::Read(CAutoFile& filein)
     avg = fileAvg;
     confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
-    bucketMap.clear();
 
     // Resize the current block variables which aren't stored in the data file
     // to match the number of confirms and buckets
@@ -243,16 +312,13 @@ void TxConfirmStats::Read(CAutoFile& filein)
     }
     oldUnconfTxs.resize(buckets.size());
 
-    for (unsigned int i = 0; i < buckets.size(); i++)
-        bucketMap[buckets[i]] = i;
-
     LogPrint("estimatefee", "Reading estimates: %u %s buckets counting confirms up to %u blocks\n",
              numBuckets, dataTypeString, maxConfirms);
 }
 
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
+    unsigned int bucketindex = FindBucketIndex(val);
     unsigned int blockIndex = nBlockHeight % unconfTxs.size();
     unconfTxs[blockIndex][bucketindex]++;
     LogPrint("estimatefee", "adding to %s", dataTypeString);
@@ -299,8 +365,9 @@ void CBlockPolicyEstimator::removeTx(uint256 hash)
     unsigned int entryHeight = pos->second.blockHeight;
     unsigned int bucketIndex = pos->second.bucketIndex;
 
-    if (stats != NULL)
+    if (stats != NULL) {
         stats->removeTx(entryHeight, nBestSeenHeight, bucketIndex);
+    }
     mapMemPoolTxs.erase(hash);
 }
 
@@ -453,8 +520,10 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
 
     // Only want to be updating estimates when our blockchain is synced,
     // otherwise we'll miscalculate how many blocks its taking to get included.
-    if (!fCurrentEstimate)
+    if (!fCurrentEstimate) {
+        UpdateEstimates();
         return;
+    }
 
     // Update the dynamic cutoffs
     // a fee/priority is "likely" the reason your tx was included in a block if >85% of such tx's
@@ -492,17 +561,25 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     feeStats.UpdateMovingAverages();
     priStats.UpdateMovingAverages();
 
+    UpdateEstimates();
+
     LogPrint("estimatefee", "Blockpolicy after updating estimates for %u confirmed entries, new mempool map size %u\n",
              entries.size(), mapMemPoolTxs.size());
 }
 
+void CBlockPolicyEstimator::UpdateEstimates()
+{
+    feeStats.UpdateEstimates(SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, nBestSeenHeight);
+    priStats.UpdateEstimates(SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, nBestSeenHeight);
+}
+
 CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
 {
     // Return failure if trying to analyze a target we're not tracking
     if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
         return CFeeRate(0);
 
-    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    double median = feeStats.GetEstimate(confTarget);
 
     if (median < 0)
         return CFeeRate(0);
@@ -518,13 +595,7 @@ CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoun
     if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
         return CFeeRate(0);
 
-    double median = -1;
-    while (median < 0 && (unsigned int)confTarget <= feeStats.GetMaxConfirms()) {
-        median = feeStats.EstimateMedianVal(confTarget++, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
-    }
-
-    if (answerFoundAtTarget)
-        *answerFoundAtTarget = confTarget - 1;
+    double median = feeStats.GetSmartEstimate(confTarget, answerFoundAtTarget);
 
     // If mempool is limiting txs , return at least the min fee from the mempool
     CAmount minPoolFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
@@ -543,7 +614,7 @@ double CBlockPolicyEstimator::estimatePriority(int confTarget)
     if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
         return -1;
 
-    return priStats.EstimateMedianVal(confTarget, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    return priStats.GetEstimate(confTarget);
 }
 
 double CBlockPolicyEstimator::estimateSmartPriority(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool)
@@ -559,15 +630,7 @@ double CBlockPolicyEstimator::estimateSmartPriority(int confTarget, int *answerF
     if (minPoolFee > 0)
         return INF_PRIORITY;
 
-    double median = -1;
-    while (median < 0 && (unsigned int)confTarget <= priStats.GetMaxConfirms()) {
-        median = priStats.EstimateMedianVal(confTarget++, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
-    }
-
-    if (answerFoundAtTarget)
-        *answerFoundAtTarget = confTarget - 1;
-
-    return median;
+    return priStats.GetSmartEstimate(confTarget, answerFoundAtTarget);
 }
 
 void CBlockPolicyEstimator::Write(CAutoFile& fileout)
@@ -577,13 +640,15 @@ void CBlockPolicyEstimator::Write(CAutoFile& fileout)
     priStats.Write(fileout);
 }
 
-void CBlockPolicyEstimator::Read(CAutoFile& filein)
+void CBlockPolicyEstimator::Read(CAutoFile& filein, int nFileVersion)
 {
     int nFileBestSeenHeight;
     filein >> nFileBestSeenHeight;
-    feeStats.Read(filein);
-    priStats.Read(filein);
+    bool fCompact = nFileVersion >= FEE_ESTIMATES_COMPACT_VERSION;
+    feeStats.Read(filein, fCompact);
+    priStats.Read(filein, fCompact);
     nBestSeenHeight = nFileBestSeenHeight;
+    UpdateEstimates();
 }
 
 FeeFilterRounder::FeeFilterRounder(const CFeeRate& minIncrementalFee)
@@ -57,8 +57,9 @@ extern uint256 feeAssetID;
  * paid in each bucket. Then we calculate how many blocks Y it took each
  * transaction to be mined and we track an array of counters in each bucket
  * for how long it to took transactions to get confirmed from 1 to a max of 25
- * and we increment all the counters from Y up to 25. This is because for any
- * number Z>=Y the transaction was successfully mined within Z blocks.  We
+ * and we increment the counter for Y only.  When the block has been processed
+ * the counters are added up into the moving averages cumulatively, because for
+ * any number Z>=Y the transaction was successfully mined within Z blocks.  We
  * want to save a history of this information, so at any time we have a
  * counter of the total number of transactions that happened in a given fee
  * bucket and the total number that were confirmed in each number 1-25 blocks
@@ -69,6 +70,11 @@ extern uint256 feeAssetID;
  * the number of transactions we've seen in that fee bucket when calculating
  * an estimate for any number of confirmations below the number of blocks
  * they've been outstanding.
+ *
+ * The estimates for every target are calculated together into a lookup table
+ * once per block, after the block's transactions have been recorded, so that
+ * estimatefee and estimatesmartfee only look up the table. Mempool
+ * transactions arriving between blocks are counted at the next block.
  */
 
 /**
@@ -85,7 +91,6 @@ class TxConfirmStats
 private:
     //Define the buckets we will group transactions into (both fee buckets and priority buckets)
     std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive)
-    std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
 
     // For each bucket X:
     // Count the total # of txs in each bucket
@@ -97,7 +102,8 @@ private:
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
     std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calculate the totals for the current block to update the moving averages
+    // and count the txs confirmed in exactly Y blocks in the current block, which are
+    // added up for all Y' <= Y when updating the moving averages
     std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
 
     // Sum the total priority/fee of all tx's in each bucket
@@ -119,6 +125,14 @@ private:
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    // Estimates for each confirmation target Y, as of the last UpdateEstimates (-1 if there is none)
+    std::vector<double> estimates;
+    // Lowest target >= Y that has an estimate (or the max number of confirms if none has)
+    std::vector<unsigned int> smartTargets;
+
+    /** Index of the bucket val falls into */
+    unsigned int FindBucketIndex(double val) const;
+
 public:
     /**
      * Initialize the data structures.  This is called by BlockPolicyEstimator's
@@ -152,6 +166,21 @@ public:
         with the data gathered from the current block */
     void UpdateMovingAverages();
 
+    /**
+     * Recalculate the lookup table of estimates for every confirmation target,
+     * see EstimateMedianVal for the parameters.
+     */
+    void UpdateEstimates(double sufficientTxVal, double minSuccess, unsigned int nBlockHeight);
+
+    /** Return the estimate for confTarget from the lookup table, or -1 */
+    double GetEstimate(int confTarget) const;
+
+    /**
+     * Return the estimate for the lowest target >= confTarget that has one, or -1.
+     * answerFoundAtTarget is set to that target (or the max number of confirms).
+     */
+    double GetSmartEstimate(int confTarget, int *answerFoundAtTarget) const;
+
     /**
      * Calculate a fee or priority estimate.  Find the lowest value bucket (or range of buckets
      * to make sure we have enough data points) whose transactions still have sufficient likelihood
@@ -169,18 +198,21 @@ public:
     /** Return the max number of confirms we're tracking */
     unsigned int GetMaxConfirms() { return confAvg.size(); }
 
-    /** Write state of estimation data to a file*/
+    /** Write state of estimation data to a file, with the averages as 32-bit floats */
     void Write(CAutoFile& fileout);
 
     /**
      * Read saved state of estimation data from a file and replace all internal data structures and
-     * variables with this state.
+     * variables with this state. fCompact is false for files that store the averages as doubles.
      */
-    void Read(CAutoFile& filein);
+    void Read(CAutoFile& filein, bool fCompact);
 };
 
 
 
+/** Version required to read fee_estimates.dat files storing the averages as floats */
+static const int FEE_ESTIMATES_COMPACT_VERSION = 129900;
+
 /** Track confirm delays up to 25 blocks, can't estimate beyond that */
 static const unsigned int MAX_BLOCK_CONFIRMS = 25;
 
@@ -265,8 +297,8 @@ public:
     /** Write estimation data to a file */
     void Write(CAutoFile& fileout);
 
-    /** Read estimation data from a file */
-    void Read(CAutoFile& filein);
+    /** Read estimation data from a file, written by a client requiring nFileVersion */
+    void Read(CAutoFile& filein, int nFileVersion);
 
 private:
     CFeeRate minTrackedFee; //! Passed to constructor to avoid dependency on main
@@ -289,6 +321,9 @@ private:
     /** Breakpoints to help determine whether a transaction was confirmed by priority or Fee */
     CFeeRate feeLikely, feeUnlikely;
     double priLikely, priUnlikely;
+
+    /** Recalculate the lookup tables of estimates, once per block */
+    void UpdateEstimates();
 };
 
 class FeeFilterRounder
@@ -18,7 +18,7 @@ bool IsRBFOptIn(const CTxMemPoolEntry &entry, CTxMemPool &pool)
 {
     AssertLockHeld(pool.cs);
 
-    CTxMemPool::setEntries setAncestors;
+    CTxMemPool::vecEntries vAncestors;
 
     // First check the transaction itself.
     if (SignalsOptInRBF(entry.GetTx())) {
@@ -35,9 +35,9 @@ bool IsRBFOptIn(const CTxMemPoolEntry &entry, CTxMemPool &pool)
     // signaled for RBF if any unconfirmed parents have signaled.
     uint64_t noLimit = std::numeric_limits<uint64_t>::max();
     std::string dummy;
-    pool.CalculateMemPoolAncestors(entry, setAncestors, noLimit, noLimit, noLimit, noLimit, dummy, false);
+    pool.CalculateMemPoolAncestors(entry, vAncestors, noLimit, noLimit, noLimit, noLimit, dummy, false);
 
-    BOOST_FOREACH(CTxMemPool::txiter it, setAncestors) {
+    BOOST_FOREACH(CTxMemPool::txiter it, vAncestors) {
         if (SignalsOptInRBF(it->GetTx())) {
             return true;
         }
@@ -35,6 +35,10 @@ const char *FILTERCLEAR="filterclear";
 const char *REJECT="reject";
 const char *SENDHEADERS="sendheaders";
 const char *FEEFILTER="feefilter";
+const char *SENDCMPCT="sendcmpct";
+const char *CMPCTBLOCK="cmpctblock";
+const char *GETBLOCKTXN="getblocktxn";
+const char *BLOCKTXN="blocktxn";
 const char *DSTX="dstx";
 const char *TXLVOTE="txlvote";
 const char *TXLREQ="txlreq";
@@ -49,7 +53,13 @@ static const char* ppszTypeName[] =
     "ERROR", // Should never occur
     NetMsgType::TX,
     NetMsgType::BLOCK,
-    "filtered block" // Should never occur
+    "filtered block", // Should never occur
+    NetMsgType::TXLREQ,
+    NetMsgType::TXLVOTE,
+    NetMsgType::SPORK,
+    NetMsgType::MNW,
+    NetMsgType::MNSE,
+    NetMsgType::CMPCTBLOCK // Only in getdata
 };
 
 /** All known message types. Keep this in the same order as the list of
@@ -78,6 +88,10 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::REJECT,
     NetMsgType::SENDHEADERS,
     NetMsgType::FEEFILTER,
+    NetMsgType::SENDCMPCT,
+    NetMsgType::CMPCTBLOCK,
+    NetMsgType::GETBLOCKTXN,
+    NetMsgType::BLOCKTXN,
     NetMsgType::DSTX,
     NetMsgType::TXLVOTE,
     NetMsgType::TXLREQ,
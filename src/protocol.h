@@ -217,6 +217,32 @@ extern const char *SENDHEADERS;
  * @since protocol version 70013 as described by BIP133
  */
 extern const char *FEEFILTER;
+/**
+ * Contains a 1-byte bool and 8-byte LE version number.
+ * Indicates that a node is willing to provide blocks via "cmpctblock" messages.
+ * May indicate that a node prefers to receive new block announcements via a
+ * "cmpctblock" message rather than an "inv", depending on message contents.
+ * @since protocol version 70014 as described by BIP 152
+ */
+extern const char *SENDCMPCT;
+/**
+ * Contains a CBlockHeaderAndShortTxIDs object - providing a header and
+ * list of "short txids".
+ * @since protocol version 70014 as described by BIP 152
+ */
+extern const char *CMPCTBLOCK;
+/**
+ * Contains a BlockTransactionsRequest
+ * Peer should respond with "blocktxn" message.
+ * @since protocol version 70014 as described by BIP 152
+ */
+extern const char *GETBLOCKTXN;
+/**
+ * Contains a BlockTransactions.
+ * Sent in response to a "getblocktxn" message.
+ * @since protocol version 70014 as described by BIP 152
+ */
+extern const char *BLOCKTXN;
 extern const char *DSTX;
 extern const char *TXLVOTE;
 extern const char *TXLREQ;
@@ -326,7 +352,10 @@ enum {
     MSG_TXLOCK_VOTE,
     MSG_SPORK,
     MSG_BASENODE_WINNER,
-    MSG_BASENODE_SCANNING_ERROR
+    MSG_BASENODE_SCANNING_ERROR,
+    // Defined in BIP152 (as type 4, which Bitcredit already uses for
+    // MSG_TXLOCK_REQUEST). Only valid in getdata; never appears in invs.
+    MSG_CMPCT_BLOCK
 };
 
 #endif // BITCREDIT_PROTOCOL_H
@@ -15,9 +15,11 @@
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "utxosnapshot.h"
 
 #include <stdint.h>
 
@@ -466,6 +468,159 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+static void GetDatabases(const std::string& strName, std::vector<CDBWrapper*>& vDB)
+{
+    if (!pcoinsdbview || !pblocktree)
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Databases are not open");
+    if (strName == "" || strName == "chainstate")
+        vDB.push_back(&pcoinsdbview->GetDB());
+    if (strName == "" || strName == "blockindex")
+        vDB.push_back(pblocktree);
+    if (vDB.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown database, expected chainstate or blockindex");
+}
+
+UniValue getdbstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getdbstats ( \"database\" )\n"
+            "\nReturns leveldb statistics of the chainstate and block index databases.\n"
+            "\nArguments:\n"
+            "1. \"database\"     (string, optional) chainstate or blockindex (default: both)\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {\n"
+            "    \"compression\": \"type\",       (string) compression of newly written tables (snappy or none)\n"
+            "    \"blockcache\": n,               (numeric) block cache size in bytes\n"
+            "    \"writebuffer\": n,              (numeric) write buffer size in bytes\n"
+            "    \"maxopenfiles\": n,             (numeric) maximum number of open table files\n"
+            "    \"approximate_memory_usage\": n, (numeric, optional) memory used by leveldb in bytes, if this leveldb version reports it\n"
+            "    \"approximate_size\": n,         (numeric) approximate size on disk in bytes\n"
+            "    \"files_per_level\": [n,...],    (array) number of table files on each level\n"
+            "    \"compacting\": true|false,      (boolean) whether a compactdb is in progress\n"
+            "    \"stats\": \"...\"                (string) the leveldb.stats compaction table\n"
+            "  },\n"
+            "  \"blockindex\": {\n"
+            "    ...                             (same fields as chainstate)\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleCli("getdbstats", "\"chainstate\"")
+            + HelpExampleRpc("getdbstats", "\"chainstate\"")
+        );
+
+    LOCK(cs_main);
+    std::vector<CDBWrapper*> vDB;
+    GetDatabases(params.size() > 0 ? params[0].get_str() : "", vDB);
+
+    UniValue ret(UniValue::VOBJ);
+    BOOST_FOREACH(CDBWrapper* pdb, vDB) {
+        const leveldb::Options& options = pdb->GetLevelDBOptions();
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("compression", options.compression == leveldb::kSnappyCompression ? "snappy" : "none"));
+        obj.push_back(Pair("blockcache", (uint64_t)pdb->GetBlockCacheSize()));
+        obj.push_back(Pair("writebuffer", (uint64_t)options.write_buffer_size));
+        obj.push_back(Pair("maxopenfiles", options.max_open_files));
+        std::string strValue;
+        // Only reported by leveldb 1.19 and later
+        if (pdb->GetProperty("leveldb.approximate-memory-usage", strValue))
+            obj.push_back(Pair("approximate_memory_usage", atoi64(strValue)));
+        obj.push_back(Pair("approximate_size", pdb->GetApproximateSize()));
+        UniValue files(UniValue::VARR);
+        for (int nLevel = 0; pdb->GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), strValue); nLevel++)
+            files.push_back(atoi(strValue));
+        obj.push_back(Pair("files_per_level", files));
+        obj.push_back(Pair("compacting", pdb->IsCompacting()));
+        if (pdb->GetProperty("leveldb.stats", strValue))
+            obj.push_back(Pair("stats", strValue));
+        ret.push_back(Pair(pdb->GetName(), obj));
+    }
+    return ret;
+}
+
+UniValue compactdb(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "compactdb ( \"database\" )\n"
+            "\nCompacts the whole key range of the chainstate and/or block index database in a background thread.\n"
+            "Tables are rewritten using the current -dbcompression setting. Use getdbstats to follow progress.\n"
+            "\nArguments:\n"
+            "1. \"database\"     (string, optional) chainstate or blockindex (default: both)\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": true|false,   (boolean) whether a compaction was started, false if one was already running\n"
+            "  \"blockindex\": true|false\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("compactdb", "")
+            + HelpExampleCli("compactdb", "\"chainstate\"")
+            + HelpExampleRpc("compactdb", "\"chainstate\"")
+        );
+
+    LOCK(cs_main);
+    std::vector<CDBWrapper*> vDB;
+    GetDatabases(params.size() > 0 ? params[0].get_str() : "", vDB);
+
+    // Make sure everything the coins cache holds ends up in the compacted tables
+    FlushStateToDisk();
+
+    UniValue ret(UniValue::VOBJ);
+    BOOST_FOREACH(CDBWrapper* pdb, vDB)
+        ret.push_back(Pair(pdb->GetName(), pdb->CompactInBackground()));
+    return ret;
+}
+
+UniValue dumputxoset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumputxoset \"filename\"\n"
+            "\nWrites the unspent transaction output set at the current tip, with the headers leading to it and\n"
+            "the ratings database, to a checksummed snapshot file. A new node can start from it with -loadutxosnapshot.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The file to write, relative to the data directory unless absolute; must not exist\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filename\": \"path\",      (string) the absolute path of the snapshot\n"
+            "  \"bestblock\": \"hash\",     (string) the block the snapshot was taken at\n"
+            "  \"height\": n,             (numeric) its height\n"
+            "  \"transactions\": n,       (numeric) the number of transactions with unspent outputs\n"
+            "  \"txouts\": n,             (numeric) the number of unspent transaction outputs\n"
+            "  \"addresses\": n,          (numeric) the number of addresses in the ratings database\n"
+            "  \"bytes\": n,              (numeric) the size of the file\n"
+            "  \"checksum\": \"hash\"       (string) the checksum stored at the end of the file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumputxoset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumputxoset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path(params[0].get_str());
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("%s already exists", path.string()));
+
+    CUtxoSnapshotStats stats;
+    std::string strError;
+    if (!DumpUtxoSnapshot(path, stats, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filename", path.string()));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("height", stats.nHeight));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("addresses", (int64_t)stats.nAddresses));
+    ret.push_back(Pair("bytes", (int64_t)stats.nBytes));
+    ret.push_back(Pair("checksum", stats.hashChecksum.GetHex()));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
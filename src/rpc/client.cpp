@@ -63,9 +63,12 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblocktemplate", 0 },
     { "listsinceblock", 1 },
     { "listsinceblock", 2 },
+    { "listsinceblock", 3 },
     { "sendmany", 1 },
     { "sendmany", 2 },
     { "sendmany", 4 },
+    { "createbatchpayouts", 0 },
+    { "createbatchpayouts", 1 },
     { "addmultisigaddress", 0 },
     { "addmultisigaddress", 1 },
     { "createmultisig", 0 },
@@ -73,6 +76,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listunspent", 0 },
     { "listunspent", 1 },
     { "listunspent", 2 },
+    { "listunspent", 3 },
     { "getblock", 1 },
     { "getblockheader", 1 },
     { "gettransaction", 1 },
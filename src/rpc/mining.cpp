@@ -30,6 +30,9 @@
 
 using namespace std;
 
+/** Templates handed out by getblocktemplate, protected by cs_main */
+static CBlockTemplateCache blockTemplateCache;
+
 /**
  * Return average network hashes per second based on the last 'lookup' blocks,
  * or from the last difficulty change if 'lookup' is nonpositive.
@@ -232,6 +235,19 @@ UniValue generatetoaddress(const UniValue& params, bool fHelp)
     return generateBlocks(coinbaseScript, nGenerate, nMaxTries, false);
 }
 
+static UniValue TemplateLatencyToJSON(const CTemplateLatencyStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", stats.nCount));
+    obj.push_back(Pair("average_ms", stats.nCount ? stats.nTotalMicros * 0.001 / stats.nCount : 0.0));
+    obj.push_back(Pair("max_ms", stats.nMaxMicros * 0.001));
+    UniValue buckets(UniValue::VARR);
+    for (int i = 0; i < CTemplateLatencyStats::BUCKETS; i++)
+        buckets.push_back(stats.vBuckets[i]);
+    obj.push_back(Pair("histogram", buckets));
+    return obj;
+}
+
 UniValue getmininginfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -247,9 +263,30 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
             "  \"errors\": \"...\"          (string) Current errors\n"
             "  \"generate\": true|false     (boolean) If the generation is on or off (see getgenerate or setgenerate calls)\n"
             "  \"genproclimit\": n          (numeric) The processor limit for generation. -1 if no generation. (see getgenerate or setgenerate calls)\n"
+            "  \"hashespersec\": x.xx       (numeric) The hash rate of the internal miner, over all its threads\n"
+            "  \"minerthreads\": [          (array) The internal miner worker threads, empty if not generating\n"
+            "    {\n"
+            "      \"id\": n,               (numeric) thread number\n"
+            "      \"extranonce\": \"i+k*n\", (string) the extranonces the thread works on, i + k * n for k = 0, 1, ...\n"
+            "      \"hashes\": n,           (numeric) hashes computed since the thread started\n"
+            "      \"hashespersec\": x.xx   (numeric) recent hash rate of the thread\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
+            "  \"templatestats\": {         (json object) getblocktemplate build times\n"
+            "    \"full\": {                (json object) templates assembled from scratch\n"
+            "      \"count\": n,            (numeric) number of templates\n"
+            "      \"average_ms\": x.xx,    (numeric) average build time in milliseconds\n"
+            "      \"max_ms\": x.xx,        (numeric) longest build time in milliseconds\n"
+            "      \"histogram\": [n,...]   (array) builds taking under 1, 2, 4, ... 1024 ms, and longer\n"
+            "    },\n"
+            "    \"incremental\": {         (json object) templates updated from mempool changes\n"
+            "      ...                      (same fields as full)\n"
+            "    }\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmininginfo", "")
@@ -271,6 +308,24 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("testnet",          Params().TestnetToBeDeprecatedFieldRPC()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
     obj.push_back(Pair("generate",         getgenerate(params, false)));
+    UniValue minerthreads(UniValue::VARR);
+    double dHashesPerSec = 0;
+    std::vector<CMinerThreadStats> vStats = GetMinerThreadStats();
+    BOOST_FOREACH(const CMinerThreadStats& stats, vStats) {
+        UniValue thread(UniValue::VOBJ);
+        thread.push_back(Pair("id", stats.nThread));
+        thread.push_back(Pair("extranonce", strprintf("%d+k*%d", stats.nThread + 1, stats.nThreads)));
+        thread.push_back(Pair("hashes", stats.nHashes));
+        thread.push_back(Pair("hashespersec", stats.dHashesPerSec));
+        minerthreads.push_back(thread);
+        dHashesPerSec += stats.dHashesPerSec;
+    }
+    obj.push_back(Pair("hashespersec",     dHashesPerSec));
+    obj.push_back(Pair("minerthreads",     minerthreads));
+    UniValue templatestats(UniValue::VOBJ);
+    templatestats.push_back(Pair("full", TemplateLatencyToJSON(blockTemplateCache.GetFullStats())));
+    templatestats.push_back(Pair("incremental", TemplateLatencyToJSON(blockTemplateCache.GetIncrementalStats())));
+    obj.push_back(Pair("templatestats", templatestats));
     return obj;
 }
 
@@ -494,35 +549,13 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
 
-    // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        // Create new block
-        if(pblocktemplate)
-        {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
-        }
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = CreateNewBlock(Params(), scriptDummy);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
+    // Update block, incrementally where possible
+    CScript scriptDummy = CScript() << OP_TRUE;
+    CBlockTemplate* pblocktemplate = blockTemplateCache.Get(Params(), scriptDummy);
+    if (!pblocktemplate)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+    CBlockIndex* pindexPrev = blockTemplateCache.GetPrev();
+    nTransactionsUpdatedLast = blockTemplateCache.GetTransactionsUpdated();
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
 
     // Update nTime
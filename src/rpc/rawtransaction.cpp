@@ -742,20 +742,36 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
     // Script verification errors
     UniValue vErrors(UniValue::VARR);
 
-    // Sign what we can:
+    // Sign what we can, all inputs at once. The signers read a copy of the
+    // transaction taken before any input is signed; a signature does not
+    // cover the other scriptSigs, so this signs as one input after the other would.
+    vector<CScript> vPrevPubKeys(mergedTx.vin.size());
+    vector<bool> vfHaveCoins(mergedTx.vin.size(), false);
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
         const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
-            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
+        if (coins == NULL || !coins->IsAvailable(txin.prevout.n))
             continue;
-        }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-
+        vfHaveCoins[i] = true;
+        vPrevPubKeys[i] = coins->vout[txin.prevout.n].scriptPubKey;
         txin.scriptSig.clear();
+    }
+    const CTransaction txToSign(mergedTx);
+    vector<CInputSigner> vSigners;
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
-        if (!fHashSingle || (i < mergedTx.vout.size()))
-            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
+        if (vfHaveCoins[i] && (!fHashSingle || (i < mergedTx.vout.size())))
+            vSigners.push_back(CInputSigner(&keystore, &txToSign, i, &vPrevPubKeys[i], &mergedTx.vin[i].scriptSig, nHashType, true));
+    }
+    SignInputs(vSigners);
+
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+        CTxIn& txin = mergedTx.vin[i];
+        if (!vfHaveCoins[i]) {
+            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
+            continue;
+        }
+        const CScript& prevPubKey = vPrevPubKeys[i];
 
         // ... and merge in other signatures:
         BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
@@ -8,9 +8,12 @@
 #include "key.h"
 #include "keystore.h"
 #include "policy/policy.h"
+#include "checkqueue.h"
 #include "primitives/transaction.h"
 #include "script/standard.h"
+#include "sync.h"
 #include "uint256.h"
+#include "util.h"
 
 #include <boost/foreach.hpp>
 
@@ -137,6 +140,35 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CMutabl
     return ProduceSignature(creator, fromPubKey, txin.scriptSig);
 }
 
+bool CInputSigner::operator()()
+{
+    TransactionSignatureCreator creator(keystore, txTo, nIn, nHashType);
+    return ProduceSignature(creator, *scriptPubKey, *pscriptSig) || fPartial;
+}
+
+static CCheckQueue<CSigningTask> signqueue(16);
+/** Taken by whoever uses signqueue, as it serves one batch at a time */
+static CCriticalSection cs_signqueue;
+
+void ThreadSignInputs() {
+    RenameThread("bitcredit-sign");
+    signqueue.Thread();
+}
+
+bool RunSigningTasks(std::vector<CSigningTask>& vTasks)
+{
+    LOCK(cs_signqueue);
+    CCheckQueueControl<CSigningTask> control(&signqueue);
+    control.Add(vTasks);
+    return control.Wait();
+}
+
+bool SignInputs(std::vector<CInputSigner>& vSigners)
+{
+    std::vector<CSigningTask> vTasks(vSigners.begin(), vSigners.end());
+    return RunSigningTasks(vTasks);
+}
+
 bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CMutableTransaction& txTo, unsigned int nIn, int nHashType)
 {
     assert(nIn < txTo.vin.size());
@@ -8,6 +8,8 @@
 
 #include "script/interpreter.h"
 
+#include <boost/function.hpp>
+
 class CKeyID;
 class CKeyStore;
 class CScript;
@@ -58,6 +60,53 @@ bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& script
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CMutableTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CMutableTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 
+/**
+ * Closure signing input nIn of *txTo, spending scriptPubKey, into *pscriptSig.
+ * It only reads *txTo, so the inputs of a transaction can be signed in
+ * parallel and their scriptSigs put in place afterwards. A partial signer
+ * does not fail its batch if it can only sign part of the input, as more
+ * signatures may be combined in later.
+ */
+class CInputSigner
+{
+private:
+    const CKeyStore *keystore;
+    const CTransaction *txTo;
+    unsigned int nIn;
+    const CScript *scriptPubKey;
+    int nHashType;
+    CScript *pscriptSig;
+    bool fPartial;
+
+public:
+    CInputSigner(): keystore(NULL), txTo(NULL), nIn(0), scriptPubKey(NULL), nHashType(0), pscriptSig(NULL), fPartial(false) {}
+    CInputSigner(const CKeyStore *keystoreIn, const CTransaction *txToIn, unsigned int nInIn, const CScript *scriptPubKeyIn, CScript *pscriptSigIn,
+                 int nHashTypeIn=SIGHASH_ALL, bool fPartialIn=false) :
+        keystore(keystoreIn), txTo(txToIn), nIn(nInIn), scriptPubKey(scriptPubKeyIn), nHashType(nHashTypeIn), pscriptSig(pscriptSigIn), fPartial(fPartialIn) {}
+
+    bool operator()();
+};
+
+/** A piece of work for the signing threads, which returns false if it failed */
+typedef boost::function<bool()> CSigningTask;
+
+/**
+ * Run vTasks, spread over the signing threads (and the calling thread), one
+ * batch at a time. Returns false if any of them failed.
+ */
+bool RunSigningTasks(std::vector<CSigningTask>& vTasks);
+
+/**
+ * Run vSigners, spread over the signing threads (and the calling thread).
+ * Every signer writes to its own scriptSig only, so the result does not
+ * depend on the number of threads. Returns false if any input could not
+ * be signed.
+ */
+bool SignInputs(std::vector<CInputSigner>& vSigners);
+
+/** Run an instance of the signing thread */
+void ThreadSignInputs();
+
 /** Combine two script signatures using a generic signature checker, intelligently, possibly with OP_0 placeholders. */
 CScript CombineSignatures(const CScript& scriptPubKey, const BaseSignatureChecker& checker, const CScript& scriptSig1, const CScript& scriptSig2);
 
@@ -25,13 +25,16 @@
 // Tests this internal-to-main.cpp method:
 extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphansUsage);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    size_t nUsage;
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
+extern std::map<COutPoint, std::set<uint256> > mapOrphanTransactionsByPrev;
+extern size_t nOrphanTransactionsUsage;
 
 CService ip(uint32_t i)
 {
@@ -183,16 +186,63 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         size_t sizeBefore = mapOrphanTransactions.size();
         EraseOrphansFor(i);
         BOOST_CHECK(mapOrphanTransactions.size() < sizeBefore);
+        BOOST_FOREACH(const PAIRTYPE(uint256, COrphanTx)& orphan, mapOrphanTransactions)
+            BOOST_CHECK(orphan.second.fromPeer != i);
     }
 
-    // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    // The memory accounting adds up
+    size_t nUsage = 0;
+    BOOST_FOREACH(const PAIRTYPE(uint256, COrphanTx)& orphan, mapOrphanTransactions)
+        nUsage += orphan.second.nUsage;
+    BOOST_CHECK_EQUAL(nUsage, nOrphanTransactionsUsage);
+
+    // Test LimitOrphanTxSize() function, by count and by memory:
+    LimitOrphanTxSize(40, nOrphanTransactionsUsage);
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+    LimitOrphanTxSize(10, nOrphanTransactionsUsage);
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+    size_t nMaxUsage = nOrphanTransactionsUsage / 2;
+    LimitOrphanTxSize(10, nMaxUsage);
+    BOOST_CHECK(nOrphanTransactionsUsage <= nMaxUsage);
+    BOOST_CHECK(!mapOrphanTransactions.empty());
+    LimitOrphanTxSize(0, nOrphanTransactionsUsage);
     BOOST_CHECK(mapOrphanTransactions.empty());
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK_EQUAL(nOrphanTransactionsUsage, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_mapOrphans_expiry)
+{
+    int64_t nStartTime = GetTime();
+    SetMockTime(nStartTime);
+
+    for (int i = 0; i < 10; i++)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = 0;
+        tx.vin[0].prevout.hash = GetRandHash();
+        tx.vin[0].scriptSig << OP_1;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1*CENT;
+        tx.vout[0].scriptPubKey = CScript() << OP_1;
+        BOOST_CHECK(AddOrphanTx(tx, i % 2));
+    }
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 10U);
+
+    // Nothing has expired yet
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_TIME - 1);
+    LimitOrphanTxSize(100, nOrphanTransactionsUsage);
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 10U);
+
+    // Once expired, they go at the next sweep
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_TIME + ORPHAN_TX_EXPIRE_INTERVAL);
+    BOOST_CHECK_EQUAL(LimitOrphanTxSize(100, nOrphanTransactionsUsage), 10U);
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK_EQUAL(nOrphanTransactionsUsage, 0U);
+
+    SetMockTime(0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
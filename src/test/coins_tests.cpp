@@ -7,6 +7,7 @@
 #include "uint256.h"
 #include "test/test_bitcredit.h"
 #include "main.h"
+#include "txdb.h"
 #include "consensus/validation.h"
 
 #include <vector>
@@ -347,4 +348,242 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
+BOOST_AUTO_TEST_CASE(coins_cache_copy_dirty)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    cache.TrackDirty();
+
+    std::vector<uint256> txids;
+    for (int i = 0; i < 100; i++) {
+        txids.push_back(GetRandHash());
+        CCoinsModifier coins = cache.ModifyNewCoins(txids[i], false);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = i + 1;
+    }
+    // A fresh coin that gets spent never needs writing
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txids[0]);
+        coins->Spend(0);
+    }
+    BOOST_CHECK_EQUAL(cache.GetDirtyCount(), 100U);
+
+    CCoinsMap mapDirty;
+    cache.CopyDirty(mapDirty);
+    BOOST_CHECK_EQUAL(mapDirty.size(), 99U);
+    BOOST_CHECK_EQUAL(cache.GetDirtyCount(), 0U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 99U);
+    cache.SelfTest();
+    BOOST_CHECK(base.BatchWrite(mapDirty, uint256()));
+
+    // Everything is clean now, so it can all be evicted and read back from the base
+    cache.Trim(0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    for (int i = 1; i < 100; i++) {
+        const CCoins* coins = cache.AccessCoins(txids[i]);
+        BOOST_CHECK(coins && coins->vout[0].nValue == i + 1);
+    }
+
+    // Spending a coin the base has leaves a pruned entry, which is copied and dropped
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txids[1]);
+        coins->Spend(0);
+    }
+    cache.CopyDirty(mapDirty);
+    BOOST_CHECK_EQUAL(mapDirty.size(), 1U);
+    BOOST_CHECK(mapDirty.begin()->second.coins.IsPruned());
+    BOOST_CHECK(!cache.HaveCoinsInCache(txids[1]));
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_copy_dirty_oldest_first)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    cache.TrackDirty();
+
+    std::vector<uint256> txids;
+    for (int i = 0; i < 10; i++) {
+        txids.push_back(GetRandHash());
+        CCoinsModifier coins = cache.ModifyNewCoins(txids[i], false);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = i + 1;
+    }
+
+    // Batches are capped, and taken in the order the entries became dirty
+    CCoinsMap mapDirty;
+    cache.CopyDirty(mapDirty, 4);
+    BOOST_CHECK_EQUAL(mapDirty.size(), 4U);
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK(mapDirty.count(txids[i]));
+    BOOST_CHECK_EQUAL(cache.GetDirtyCount(), 6U);
+
+    // Modified again, an entry that was copied goes to the back of the queue
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txids[0]);
+        coins->vout[0].nValue = 100;
+    }
+    mapDirty.clear();
+    cache.CopyDirty(mapDirty, 6);
+    BOOST_CHECK_EQUAL(mapDirty.size(), 6U);
+    BOOST_CHECK(!mapDirty.count(txids[0]));
+    mapDirty.clear();
+    cache.CopyDirty(mapDirty, 6);
+    BOOST_CHECK_EQUAL(mapDirty.size(), 1U);
+    BOOST_CHECK_EQUAL(mapDirty[txids[0]].coins.vout[0].nValue, 100);
+    BOOST_CHECK_EQUAL(cache.GetDirtyCount(), 0U);
+    cache.SelfTest();
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_background_write, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    uint256 txid = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+
+    CCoinsMap mapCoins;
+    CCoinsCacheEntry& entry = mapCoins[txid];
+    entry.flags = CCoinsCacheEntry::DIRTY;
+    entry.coins.nVersion = 1;
+    entry.coins.vout.resize(1);
+    entry.coins.vout[0].nValue = 5;
+    BOOST_CHECK(db.WriteInBackground(mapCoins, hashBlock));
+    BOOST_CHECK(mapCoins.empty());
+
+    // Visible right away, whether or not the write has finished
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK_EQUAL(coins.vout[0].nValue, 5);
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    BOOST_CHECK(db.WaitForWrite());
+    BOOST_CHECK(!db.IsWriting());
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+
+    // A pruned entry deletes the coins, again before the write is done
+    mapCoins[txid].flags = CCoinsCacheEntry::DIRTY;
+    BOOST_CHECK(db.WriteInBackground(mapCoins, hashBlock));
+    BOOST_CHECK(!db.HaveCoins(txid));
+    BOOST_CHECK(db.WaitForWrite());
+    BOOST_CHECK(!db.HaveCoins(txid));
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_staged_write, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    uint256 txidA = GetRandHash();
+    uint256 txidB = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+
+    // Staged coins are served right away, but the best block stays until the write
+    CCoinsMap mapCoins;
+    mapCoins[txidA].flags = CCoinsCacheEntry::DIRTY;
+    mapCoins[txidA].coins.nVersion = 1;
+    mapCoins[txidA].coins.vout.resize(1);
+    mapCoins[txidA].coins.vout[0].nValue = 1;
+    db.StageCoins(mapCoins);
+    BOOST_CHECK(mapCoins.empty());
+    BOOST_CHECK(db.HasStagedCoins());
+    BOOST_CHECK(db.HaveCoins(txidA));
+    BOOST_CHECK(db.GetBestBlock().IsNull());
+
+    // Later entries replace staged ones, and all go into the one write
+    mapCoins[txidA].flags = CCoinsCacheEntry::DIRTY;
+    mapCoins[txidA].coins.nVersion = 1;
+    mapCoins[txidA].coins.vout.resize(1);
+    mapCoins[txidA].coins.vout[0].nValue = 2;
+    db.StageCoins(mapCoins);
+    mapCoins[txidB].flags = CCoinsCacheEntry::DIRTY;
+    mapCoins[txidB].coins.nVersion = 1;
+    mapCoins[txidB].coins.vout.resize(1);
+    mapCoins[txidB].coins.vout[0].nValue = 3;
+    BOOST_CHECK(db.WriteInBackground(mapCoins, hashBlock));
+    BOOST_CHECK(!db.HasStagedCoins());
+    BOOST_CHECK(db.WaitForWrite());
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(txidA, coins));
+    BOOST_CHECK_EQUAL(coins.vout[0].nValue, 2);
+    BOOST_CHECK(db.GetCoins(txidB, coins));
+    BOOST_CHECK_EQUAL(coins.vout[0].nValue, 3);
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_cursor, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    uint256 hashBlock = GetRandHash();
+
+    std::vector<std::pair<uint256, CCoins> > vCoins(100);
+    for (size_t i = 0; i < vCoins.size(); i++) {
+        vCoins[i].first = GetRandHash();
+        vCoins[i].second.nVersion = 1;
+        vCoins[i].second.vout.resize(1);
+        vCoins[i].second.vout[0].nValue = i + 1;
+    }
+    BOOST_CHECK(db.WriteCoins(vCoins, hashBlock));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+
+    // The cursor returns every coin, in txid order
+    std::map<uint256, CAmount> mapExpected;
+    for (size_t i = 0; i < vCoins.size(); i++)
+        mapExpected[vCoins[i].first] = vCoins[i].second.vout[0].nValue;
+    boost::scoped_ptr<CCoinsViewDBCursor> pcursor(db.Cursor());
+    std::map<uint256, CAmount>::const_iterator it = mapExpected.begin();
+    for (; pcursor->Valid(); pcursor->Next(), it++) {
+        BOOST_REQUIRE(it != mapExpected.end());
+        BOOST_CHECK(pcursor->GetKey() == it->first);
+        CCoins coins;
+        BOOST_CHECK(pcursor->GetValue(coins));
+        BOOST_CHECK_EQUAL(coins.vout[0].nValue, it->second);
+    }
+    BOOST_CHECK(it == mapExpected.end());
+
+    BOOST_CHECK(db.EraseAllCoins());
+    BOOST_CHECK(db.GetBestBlock().IsNull());
+    BOOST_CHECK(!db.HaveCoins(vCoins[0].first));
+    pcursor.reset(db.Cursor());
+    BOOST_CHECK(!pcursor->Valid());
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_cache_prefetch, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    std::vector<std::pair<uint256, CCoins> > vCoins(3);
+    for (size_t i = 0; i < vCoins.size(); i++) {
+        vCoins[i].first = GetRandHash();
+        vCoins[i].second.nVersion = 1;
+        vCoins[i].second.vout.resize(1);
+        vCoins[i].second.vout[0].nValue = i + 1;
+    }
+    unsigned int nWriteCount = db.GetWriteCount();
+    BOOST_CHECK(db.WriteCoins(vCoins, uint256()));
+    BOOST_CHECK(db.GetWriteCount() != nWriteCount);
+    nWriteCount = db.GetWriteCount();
+
+    CCoinsViewCacheTest cache(&db);
+    {
+        CCoinsModifier coins = cache.ModifyCoins(vCoins[1].first);
+        coins->Spend(0);
+    }
+
+    // Prefetched coins are added unless the cache has its own entry
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(vCoins[0].first, coins));
+    BOOST_CHECK(cache.AddPrefetched(vCoins[0].first, coins));
+    BOOST_CHECK(db.GetCoins(vCoins[1].first, coins));
+    BOOST_CHECK(!cache.AddPrefetched(vCoins[1].first, coins));
+    BOOST_CHECK(db.GetWriteCount() == nWriteCount);
+    BOOST_CHECK(cache.HaveCoinsInCache(vCoins[0].first));
+    BOOST_CHECK_EQUAL(cache.AccessCoins(vCoins[0].first)->vout[0].nValue, 1);
+    BOOST_CHECK(!cache.HaveCoins(vCoins[1].first));
+    cache.SelfTest();
+
+    // They are clean, so flushing writes only the spent coins
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.GetWriteCount() != nWriteCount);
+    BOOST_CHECK(db.HaveCoins(vCoins[0].first));
+    BOOST_CHECK(!db.HaveCoins(vCoins[1].first));
+    BOOST_CHECK(db.HaveCoins(vCoins[2].first));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
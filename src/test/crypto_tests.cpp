@@ -2,12 +2,14 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "crypto/common.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcredit.h"
@@ -131,6 +133,56 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+static void TestSHA256D64(size_t blocks) {
+    std::vector<unsigned char> in(64 * blocks), out(32 * blocks), expected(32 * blocks);
+    for (size_t i = 0; i < in.size(); i++)
+        in[i] = insecure_rand();
+    for (size_t i = 0; i < blocks; i++)
+        CHash256().Write(&in[64 * i], 64).Finalize(&expected[32 * i]);
+    if (blocks == 0)
+        return;
+    SHA256D64(&out[0], &in[0], blocks);
+    BOOST_CHECK(out == expected);
+    // In place, as the merkle root computation uses it.
+    SHA256D64(&in[0], &in[0], blocks);
+    BOOST_CHECK(std::vector<unsigned char>(in.begin(), in.begin() + 32 * blocks) == expected);
+}
+
+static void TestSHA256D80Nonces(uint32_t nNonce, size_t count) {
+    std::vector<unsigned char> header(80), out(32 * count), expected(32 * count);
+    for (size_t i = 0; i < header.size(); i++)
+        header[i] = insecure_rand();
+    for (size_t i = 0; i < count; i++) {
+        uint32_t n = nNonce + i;
+        WriteLE32(&header[76], n);
+        CHash256().Write(&header[0], 80).Finalize(&expected[32 * i]);
+    }
+    if (count == 0)
+        return;
+    SHA256D80Nonces(&out[0], &header[0], nNonce, count);
+    BOOST_CHECK(out == expected);
+}
+
+BOOST_AUTO_TEST_CASE(sha256_implementations) {
+    const char* implementations[] = {"standard", "shani", "sse4.1", "avx2"};
+    for (size_t i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++) {
+        if (!SHA256UseImplementation(implementations[i])) {
+            BOOST_TEST_MESSAGE("SHA256 implementation " << implementations[i] << " not available");
+            continue;
+        }
+        TestSHA256("abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        TestSHA256(std::string(1000000, 'a'),
+                   "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+        for (size_t blocks = 0; blocks <= 33; blocks++)
+            TestSHA256D64(blocks);
+        for (size_t count = 0; count <= 33; count++)
+            TestSHA256D80Nonces(insecure_rand(), count);
+        // Nonces wrapping around within one batch.
+        TestSHA256D80Nonces(0xfffffffa, 16);
+    }
+    SHA256AutoDetect();
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
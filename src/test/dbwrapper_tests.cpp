@@ -204,4 +204,64 @@ BOOST_AUTO_TEST_CASE(existing_data_reindex)
     BOOST_CHECK_EQUAL(res3.ToString(), in2.ToString());
 }
  
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    mapMultiArgs["-dbcompression"].push_back("snappy");
+    mapMultiArgs["-dbcompression"].push_back("blockindex:none");
+    mapMultiArgs["-dbwritebuffer"].push_back("chainstate:3");
+    mapMultiArgs["-dbwritebuffer"].push_back("5");
+
+    // A named value wins over an unnamed one, whatever the order
+    BOOST_CHECK_EQUAL(GetDBArg("-dbcompression", "chainstate", "none"), "snappy");
+    BOOST_CHECK_EQUAL(GetDBArg("-dbcompression", "blockindex", "none"), "none");
+    BOOST_CHECK_EQUAL(GetDBArg("-dbwritebuffer", "chainstate", (int64_t)0), 3);
+    BOOST_CHECK_EQUAL(GetDBArg("-dbwritebuffer", "blockindex", (int64_t)0), 5);
+    BOOST_CHECK_EQUAL(GetDBArg("-dbwritebuffer", "", (int64_t)0), 5);
+    BOOST_CHECK_EQUAL(GetDBArg("-dbmaxopenfiles", "chainstate", (int64_t)64), 64);
+
+    leveldb::CompressionType compression;
+    BOOST_CHECK(ParseDBCompression("snappy", compression) && compression == leveldb::kSnappyCompression);
+    BOOST_CHECK(ParseDBCompression("none", compression) && compression == leveldb::kNoCompression);
+    BOOST_CHECK(!ParseDBCompression("zlib", compression));
+
+    path ph = temp_directory_path() / unique_path();
+    {
+        CDBWrapper dbw(ph, (1 << 20), true, false, false, "chainstate");
+        BOOST_CHECK(dbw.GetLevelDBOptions().compression == leveldb::kSnappyCompression);
+        BOOST_CHECK_EQUAL(dbw.GetLevelDBOptions().write_buffer_size, (size_t)3 << 20);
+        BOOST_CHECK_EQUAL(dbw.GetBlockCacheSize(), (size_t)1 << 19);
+    }
+    {
+        CDBWrapper dbw(ph, (1 << 20), true, false, false, "blockindex");
+        BOOST_CHECK(dbw.GetLevelDBOptions().compression == leveldb::kNoCompression);
+        BOOST_CHECK_EQUAL(dbw.GetLevelDBOptions().write_buffer_size, (size_t)5 << 20);
+    }
+
+    mapMultiArgs.erase("-dbcompression");
+    mapMultiArgs.erase("-dbwritebuffer");
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_compact)
+{
+    path ph = temp_directory_path() / unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, false);
+    for (int i = 0; i < 1000; i++)
+        BOOST_CHECK(dbw.Write(std::make_pair('k', i), GetRandHash()));
+
+    std::string stats;
+    BOOST_CHECK(dbw.GetProperty("leveldb.stats", stats));
+    BOOST_CHECK(!dbw.GetProperty("leveldb.no-such-property", stats));
+
+    BOOST_CHECK(dbw.CompactInBackground());
+    for (int i = 0; i < 1000 && dbw.IsCompacting(); i++)
+        MilliSleep(10);
+    BOOST_CHECK(!dbw.IsCompacting());
+
+    // Everything is still there, and a second compaction can be started
+    uint256 res;
+    BOOST_CHECK(dbw.Read(std::make_pair('k', 999), res));
+    BOOST_CHECK(dbw.CompactInBackground());
+    // The destructor waits for the running compaction
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,93 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flatmap.h"
+#include "random.h"
+
+#include "test/test_bitcredit.h"
+
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(flatmap_tests, BasicTestingSetup)
+
+namespace {
+// Deliberately weak hash, so that long probe sequences get exercised
+struct WeakHasher {
+    size_t operator()(int key) const { return (size_t)(key % 97); }
+};
+
+typedef flatmap<int, int, WeakHasher> testmap;
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_random)
+{
+    for (int round = 0; round < 20; round++) {
+        testmap fmap;
+        std::map<int, int> real;
+        int range = 1 + insecure_rand() % 2000;
+        for (int op = 0; op < 5000; op++) {
+            int key = insecure_rand() % range;
+            switch (insecure_rand() % 4) {
+            case 0: {
+                std::pair<testmap::iterator, bool> ret = fmap.insert(std::make_pair(key, op));
+                BOOST_CHECK_EQUAL(ret.second, real.insert(std::make_pair(key, op)).second);
+                BOOST_CHECK_EQUAL(ret.first->second, real[key]);
+                break;
+            }
+            case 1:
+                BOOST_CHECK_EQUAL(fmap.erase(key), real.erase(key));
+                break;
+            case 2:
+                fmap[key]++;
+                real[key]++;
+                break;
+            case 3:
+                BOOST_CHECK_EQUAL(fmap.count(key), real.count(key));
+                break;
+            }
+            BOOST_CHECK_EQUAL(fmap.size(), real.size());
+        }
+
+        // Erasing while iterating visits every element exactly once
+        size_t nVisited = 0;
+        for (testmap::iterator it = fmap.begin(); it != fmap.end(); nVisited++) {
+            BOOST_CHECK_EQUAL(it->second, real[it->first]);
+            if (insecure_rand() % 2)
+                fmap.erase(it++);
+            else
+                ++it;
+        }
+        BOOST_CHECK_EQUAL(nVisited, real.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_stability)
+{
+    testmap fmap;
+    int* pFirst = &fmap[-1];
+    *pFirst = 42;
+    testmap::iterator itFirst = fmap.find(-1);
+    for (int i = 0; i < 10000; i++)
+        fmap[i] = i;
+    // Elements never move, and iterators survive rehashing
+    BOOST_CHECK(&fmap[-1] == pFirst);
+    BOOST_CHECK(itFirst == fmap.find(-1));
+    BOOST_CHECK_EQUAL(itFirst->second, 42);
+
+    size_t nUsage = memusage::DynamicUsage(fmap);
+    BOOST_CHECK(nUsage >= fmap.bucket_count() * (sizeof(void*) + sizeof(uint32_t)) + fmap.size() * sizeof(testmap::value_type));
+
+    // Emptying the map returns the pool, clearing it also the slots
+    for (int i = -1; i < 10000; i++)
+        fmap.erase(i);
+    BOOST_CHECK(fmap.empty());
+    BOOST_CHECK(memusage::DynamicUsage(fmap) < nUsage);
+    fmap.clear();
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(fmap), 0U);
+    BOOST_CHECK(fmap.begin() == fmap.end());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
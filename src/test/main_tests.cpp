@@ -3,6 +3,9 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "consensus/consensus.h"
+#include "consensus/merkle.h"
+#include "consensus/validation.h"
 #include "main.h"
 
 #include "test/test_bitcredit.h"
@@ -72,4 +75,71 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+// A block of nTx transactions (nTime 0, so without basenode payment)
+static CBlock MakeCheckBlock(int nTx)
+{
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1 << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    tx.vout[0].nValue = COIN;
+    block.vtx.push_back(tx);
+    for (int i = 1; i < nTx; i++) {
+        tx.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(i)), 0);
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return block;
+}
+
+static std::string CheckBlockResult(const CBlock& block, int nThreads)
+{
+    int nThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = nThreads;
+    CValidationState state;
+    bool fValid = CheckBlock(block, state, false, true);
+    nScriptCheckThreads = nThreadsOld;
+    return fValid ? "valid" : state.GetRejectReason();
+}
+
+BOOST_AUTO_TEST_CASE(checkblock_parallel_test)
+{
+    // Whether the checks run on the block check threads or not, the outcome is the same
+    for (int nThreads = 0; nThreads <= 3; nThreads += 3) {
+        CBlock block = MakeCheckBlock(301);
+        BOOST_CHECK_EQUAL(CheckBlockResult(block, nThreads), "valid");
+
+        block.hashMerkleRoot = uint256();
+        BOOST_CHECK_EQUAL(CheckBlockResult(block, nThreads), "bad-txnmrklroot");
+
+        // Repeating the last transaction keeps the merkle root
+        block = MakeCheckBlock(301);
+        block.vtx.push_back(block.vtx.back());
+        BOOST_CHECK_EQUAL(CheckBlockResult(block, nThreads), "bad-txns-duplicate");
+
+        block = MakeCheckBlock(301);
+        CMutableTransaction tx(block.vtx[150]);
+        tx.vin.push_back(tx.vin[0]);
+        block.vtx[150] = tx;
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+        BOOST_CHECK_EQUAL(CheckBlockResult(block, nThreads), "bad-txns-inputs-duplicate");
+
+        // Each OP_CHECKMULTISIG counts 20 legacy sigops, one such transaction
+        // stays below MAX_BLOCK_SIGOPS and two go over it
+        block = MakeCheckBlock(301);
+        tx = block.vtx[200];
+        for (unsigned int i = 0; i < MAX_BLOCK_SIGOPS * 3 / 5 / 20; i++)
+            tx.vout[0].scriptPubKey << OP_CHECKMULTISIG;
+        block.vtx[200] = tx;
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+        BOOST_CHECK_EQUAL(CheckBlockResult(block, nThreads), "valid");
+        tx.vin[0].prevout.n = 1;
+        block.vtx[201] = tx;
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+        BOOST_CHECK_EQUAL(CheckBlockResult(block, nThreads), "bad-blk-sigops");
+    }
+}
 BOOST_AUTO_TEST_SUITE_END()
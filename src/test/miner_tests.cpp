@@ -124,6 +124,60 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     BOOST_CHECK(pblocktemplate = CreateNewBlock(chainparams, scriptPubKey));
     delete pblocktemplate;
 
+    // Templates kept by CBlockTemplateCache follow the mempool incrementally
+    {
+        CBlockTemplateCache cache;
+        BOOST_CHECK(pblocktemplate = cache.Get(chainparams, scriptPubKey));
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+        BOOST_CHECK(cache.Get(chainparams, scriptPubKey) == pblocktemplate);
+        BOOST_CHECK_EQUAL(cache.GetFullStats().nCount, 1);
+        BOOST_CHECK_EQUAL(cache.GetIncrementalStats().nCount, 0);
+        CAmount nValueEmpty = pblocktemplate->block.vtx[0].vout[0].nValue;
+
+        CMutableTransaction txParent, txChild;
+        txParent.vin.resize(1);
+        txParent.vin[0].prevout = COutPoint(txFirst[0]->GetHash(), 0);
+        txParent.vin[0].scriptSig = CScript() << OP_1;
+        txParent.vout.resize(1);
+        txParent.vout[0].nValue = txFirst[0]->vout[0].nValue - 1000000;
+        txParent.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        txChild.vin.resize(1);
+        txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+        txChild.vout.resize(1);
+        txChild.vout[0].nValue = txParent.vout[0].nValue - 1000000;
+        txChild.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        mempool.addUnchecked(txParent.GetHash(), entry.Fee(1000000).Time(GetTime()).SpendsCoinbase(true).FromTx(txParent));
+        mempool.addUnchecked(txChild.GetHash(), entry.Fee(1000000).Time(GetTime()).SpendsCoinbase(false).FromTx(txChild));
+
+        BOOST_CHECK(pblocktemplate = cache.Get(chainparams, scriptPubKey));
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+        BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txParent.GetHash());
+        BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == txChild.GetHash());
+        BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -2000000);
+        BOOST_CHECK(pblocktemplate->block.vtx[0].vout[0].nValue > nValueEmpty);
+        BOOST_CHECK(pblocktemplate->block.hashMerkleRoot == BlockMerkleRoot(pblocktemplate->block));
+        BOOST_CHECK_EQUAL(cache.GetFullStats().nCount, 1);
+        BOOST_CHECK_EQUAL(cache.GetIncrementalStats().nCount, 1);
+
+        // Removing the parent takes its child out of the template too
+        std::list<CTransaction> removed;
+        mempool.removeRecursive(txParent, removed);
+        BOOST_CHECK(pblocktemplate = cache.Get(chainparams, scriptPubKey));
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+        BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], 0);
+        BOOST_CHECK(pblocktemplate->block.vtx[0].vout[0].nValue == nValueEmpty);
+        BOOST_CHECK_EQUAL(cache.GetIncrementalStats().nCount, 2);
+
+        // Reprioritising invalidates the recorded changes
+        mempool.addUnchecked(txParent.GetHash(), entry.Fee(1000000).Time(GetTime()).SpendsCoinbase(true).FromTx(txParent));
+        mempool.PrioritiseTransaction(txParent.GetHash(), txParent.GetHash().ToString(), 0, 1000);
+        BOOST_CHECK(pblocktemplate = cache.Get(chainparams, scriptPubKey));
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+        BOOST_CHECK_EQUAL(cache.GetFullStats().nCount, 2);
+        mempool.ClearPrioritisation(txParent.GetHash());
+        mempool.clear();
+    }
+
     // block sigops > limit: 1000 CHECKMULTISIG + 1
     tx.vin.resize(1);
     // NOTE: OP_NOP is used to force 20 SigOps for the CHECKMULTISIG
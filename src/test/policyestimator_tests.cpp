@@ -2,7 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "policy/fees.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
@@ -205,6 +207,18 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
         BOOST_CHECK(mpool.estimateSmartFee(i).GetFeePerK() >= mpool.GetMinFee(1).GetFeePerK());
         BOOST_CHECK(mpool.estimateSmartPriority(i) == INF_PRIORITY);
     }
+
+    // The estimates survive a round trip through the (compact) estimates file
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(mpool.WriteFeeEstimates(file));
+    rewind(file.Get());
+    CTxMemPool mpoolRead(CFeeRate(1000));
+    BOOST_CHECK(mpoolRead.ReadFeeEstimates(file));
+    for (int i = 1; i < 10; i++) {
+        CAmount feeDiff = mpoolRead.estimateFee(i).GetFeePerK() - mpool.estimateFee(i).GetFeePerK();
+        BOOST_CHECK(feeDiff >= -1 && feeDiff <= 1);
+        BOOST_CHECK_CLOSE(mpoolRead.estimatePriority(i), mpool.estimatePriority(i), 0.001);
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
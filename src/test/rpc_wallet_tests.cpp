@@ -115,6 +115,12 @@ BOOST_AUTO_TEST_CASE(rpc_wallet)
     BOOST_CHECK_THROW(CallRPC("listunspent 0 1 [] extra"), runtime_error);
     BOOST_CHECK_NO_THROW(r = CallRPC("listunspent 0 1 []"));
     BOOST_CHECK(r.get_array().empty());
+    BOOST_CHECK_NO_THROW(r = CallRPC("listunspent 0 1 [] 5"));
+    BOOST_CHECK(find_value(r.get_obj(), "unspent").get_array().empty());
+    BOOST_CHECK(find_value(r.get_obj(), "cursor").isNull());
+    BOOST_CHECK_THROW(CallRPC("listunspent 0 1 [] 0"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("listunspent 0 1 [] 5 not_a_cursor"), runtime_error);
+    BOOST_CHECK_NO_THROW(CallRPC("listunspent 0 1 [] 5 " + uint256().GetHex() + ":0"));
 
     /*********************************
      * 		listreceivedbyaddress
@@ -140,6 +146,10 @@ BOOST_AUTO_TEST_CASE(rpc_wallet)
      *          listsinceblock
      *********************************/
     BOOST_CHECK_NO_THROW(CallRPC("listsinceblock"));
+    BOOST_CHECK_NO_THROW(r = CallRPC("listsinceblock 0 1 false 5"));
+    BOOST_CHECK(find_value(r.get_obj(), "transactions").isArray());
+    BOOST_CHECK_THROW(CallRPC("listsinceblock 0 1 false 0"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("listsinceblock 0 1 false 5 -1"), runtime_error);
 
     /*********************************
      *          listtransactions
@@ -149,6 +159,10 @@ BOOST_AUTO_TEST_CASE(rpc_wallet)
     BOOST_CHECK_NO_THROW(CallRPC("listtransactions " + demoAddress.ToString() + " 20"));
     BOOST_CHECK_NO_THROW(CallRPC("listtransactions " + demoAddress.ToString() + " 20 0"));
     BOOST_CHECK_THROW(CallRPC("listtransactions " + demoAddress.ToString() + " not_int"), runtime_error);
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions * 20 0 false 1000"));
+    BOOST_CHECK(find_value(r.get_obj(), "transactions").isArray());
+    BOOST_CHECK_THROW(CallRPC("listtransactions * 20 1 false 1000"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("listtransactions * 20 0 false not_a_cursor"), runtime_error);
 
     /*********************************
      *          listlockunspent
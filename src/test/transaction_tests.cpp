@@ -15,6 +15,8 @@
 #include "policy/policy.h"
 #include "script/script.h"
 #include "script/script_error.h"
+#include "script/sign.h"
+#include "script/standard.h"
 #include "utilstrencodings.h"
 
 #include <map>
@@ -404,4 +406,43 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!IsStandardTx(t, reason));
 }
 
+BOOST_AUTO_TEST_CASE(test_SignInputs)
+{
+    // Signing all inputs in one batch must give what signing them one by one does
+    CBasicKeyStore keystore;
+    CMutableTransaction tx;
+    std::vector<CScript> vScriptPubKeys;
+    for (int i = 0; i < 20; i++) {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        keystore.AddKey(key);
+        vScriptPubKeys.push_back(i % 3 ? GetScriptForDestination(key.GetPubKey().GetID()) : GetScriptForRawPubKey(key.GetPubKey()));
+        tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), i)));
+    }
+    tx.vout.push_back(CTxOut(COIN, vScriptPubKeys[0]));
+
+    CMutableTransaction txSerial(tx);
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+        BOOST_CHECK(SignSignature(keystore, vScriptPubKeys[i], txSerial, i));
+
+    const CTransaction txToSign(tx);
+    std::vector<CInputSigner> vSigners;
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+        vSigners.push_back(CInputSigner(&keystore, &txToSign, i, &vScriptPubKeys[i], &tx.vin[i].scriptSig));
+    BOOST_CHECK(SignInputs(vSigners));
+    BOOST_CHECK(CTransaction(tx) == CTransaction(txSerial));
+
+    // An input we have no key for fails the batch, unless the signer is partial
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CScript scriptOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    CScript scriptSig;
+    vSigners.clear();
+    vSigners.push_back(CInputSigner(&keystore, &txToSign, 0, &scriptOther, &scriptSig));
+    BOOST_CHECK(!SignInputs(vSigners));
+    vSigners.clear();
+    vSigners.push_back(CInputSigner(&keystore, &txToSign, 0, &scriptOther, &scriptSig, SIGHASH_ALL, true));
+    BOOST_CHECK(SignInputs(vSigners));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -14,6 +14,7 @@
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -29,19 +30,74 @@ static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, "chainstate"), fWriting(false), fWriteFailed(false), pwritethread(NULL), nWriteCount(0)
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    WaitForWrite();
+}
+
+/** Move the entries of mapFrom into mapTo, replacing those it has already */
+static void MergeCoins(CCoinsMap &mapTo, CCoinsMap &mapFrom)
+{
+    if (mapTo.empty()) {
+        mapTo.swap(mapFrom);
+        return;
+    }
+    for (CCoinsMap::iterator it = mapFrom.begin(); it != mapFrom.end(); it++) {
+        CCoinsCacheEntry& entry = mapTo[it->first];
+        entry.flags = it->second.flags;
+        entry.coins.swap(it->second.coins);
+    }
+    mapFrom.clear();
+}
+
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        LOCK(cs_pending);
+        CCoinsMap::const_iterator itStaged = mapStaged.find(txid);
+        if (itStaged != mapStaged.end()) {
+            if (itStaged->second.coins.IsPruned())
+                return false;
+            coins = itStaged->second.coins;
+            return true;
+        }
+        if (fWriting) {
+            CCoinsMap::const_iterator it = mapPending.find(txid);
+            if (it != mapPending.end()) {
+                if (it->second.coins.IsPruned())
+                    return false;
+                coins = it->second.coins;
+                return true;
+            }
+        }
+    }
     return db.Read(make_pair(DB_COINS, txid), coins);
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
+    {
+        LOCK(cs_pending);
+        CCoinsMap::const_iterator itStaged = mapStaged.find(txid);
+        if (itStaged != mapStaged.end())
+            return !itStaged->second.coins.IsPruned();
+        if (fWriting) {
+            CCoinsMap::const_iterator it = mapPending.find(txid);
+            if (it != mapPending.end())
+                return !it->second.coins.IsPruned();
+        }
+    }
     return db.Exists(make_pair(DB_COINS, txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        LOCK(cs_pending);
+        if (fWriting && !hashPending.IsNull())
+            return hashPending;
+    }
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
@@ -49,9 +105,26 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    // Writes must reach the database in order
+    if (!WaitForWrite())
+        return false;
+    CCoinsMap mapCoinsStaged;
+    {
+        LOCK(cs_pending);
+        nWriteCount++;
+        mapCoinsStaged.swap(mapStaged);
+    }
     CDBBatch batch(&db.GetObfuscateKey());
     size_t count = 0;
     size_t changed = 0;
+    // Staged coins are older, so mapCoins goes in after them
+    for (CCoinsMap::const_iterator it = mapCoinsStaged.begin(); it != mapCoinsStaged.end(); it++) {
+        if (it->second.coins.IsPruned())
+            batch.Erase(make_pair(DB_COINS, it->first));
+        else
+            batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+        changed++;
+    }
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             if (it->second.coins.IsPruned())
@@ -71,7 +144,160 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+void CCoinsViewDB::ThreadWrite() {
+    RenameThread("bitcredit-coinsflush");
+    int64_t nStart = GetTimeMicros();
+    bool fOk = true;
+    // mapPending is left alone by everyone else while fWriting is set, no need to lock it here
+    CDBBatch batch(&db.GetObfuscateKey());
+    for (CCoinsMap::const_iterator it = mapPending.begin(); it != mapPending.end(); it++) {
+        if (it->second.coins.IsPruned())
+            batch.Erase(make_pair(DB_COINS, it->first));
+        else
+            batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+    }
+    if (!hashPending.IsNull())
+        batch.Write(DB_BEST_BLOCK, hashPending);
+    try {
+        db.WriteBatch(batch);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        fOk = false;
+    }
+    LogPrint("coindb", "Committed %u changed transactions to coin database in the background (%.2fms)\n", (unsigned int)mapPending.size(), 0.001 * (GetTimeMicros() - nStart));
+
+    LOCK(cs_pending);
+    mapPending.clear();
+    fWriteFailed = !fOk;
+    fWriting = false;
+}
+
+bool CCoinsViewDB::WriteInBackground(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (!WaitForWrite())
+        return false;
+    LOCK(cs_pending);
+    nWriteCount++;
+    MergeCoins(mapStaged, mapCoins);
+    mapPending.swap(mapStaged);
+    mapStaged.clear();
+    hashPending = hashBlock;
+    fWriting = true;
+    pwritethread = new boost::thread(boost::bind(&CCoinsViewDB::ThreadWrite, this));
+    return true;
+}
+
+void CCoinsViewDB::StageCoins(CCoinsMap &mapCoins) {
+    LOCK(cs_pending);
+    // Readers now see newer coins than the database has
+    nWriteCount++;
+    MergeCoins(mapStaged, mapCoins);
+}
+
+bool CCoinsViewDB::HasStagedCoins() const {
+    LOCK(cs_pending);
+    return !mapStaged.empty();
+}
+
+bool CCoinsViewDB::WaitForWrite() {
+    boost::thread* pthread;
+    {
+        LOCK(cs_pending);
+        pthread = pwritethread;
+        pwritethread = NULL;
+    }
+    if (pthread) {
+        pthread->join();
+        delete pthread;
+    }
+    LOCK(cs_pending);
+    return !fWriteFailed;
+}
+
+bool CCoinsViewDB::IsWriting() const {
+    LOCK(cs_pending);
+    return fWriting;
+}
+
+unsigned int CCoinsViewDB::GetWriteCount() const {
+    LOCK(cs_pending);
+    return nWriteCount;
+}
+
+CCoinsViewDBCursor* CCoinsViewDB::Cursor() {
+    WaitForWrite();
+    CCoinsViewDBCursor* pcursor = new CCoinsViewDBCursor(db.NewIterator());
+    pcursor->pcursor->Seek(DB_COINS);
+    pcursor->ReadKey();
+    return pcursor;
+}
+
+bool CCoinsViewDB::WriteCoins(const std::vector<std::pair<uint256, CCoins> >& vCoins, const uint256& hashBlock) {
+    if (!WaitForWrite())
+        return false;
+    {
+        LOCK(cs_pending);
+        nWriteCount++;
+    }
+    CDBBatch batch(&db.GetObfuscateKey());
+    for (std::vector<std::pair<uint256, CCoins> >::const_iterator it = vCoins.begin(); it != vCoins.end(); it++)
+        batch.Write(make_pair(DB_COINS, it->first), it->second);
+    if (!hashBlock.IsNull())
+        batch.Write(DB_BEST_BLOCK, hashBlock);
+    return db.WriteBatch(batch);
+}
+
+bool CCoinsViewDB::EraseAllCoins() {
+    if (!WaitForWrite())
+        return false;
+    {
+        LOCK(cs_pending);
+        nWriteCount++;
+        mapStaged.clear();
+    }
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(DB_COINS);
+    bool fDone = false;
+    while (!fDone) {
+        // Erase in batches of bounded size; the iterator keeps seeing the data as of its creation
+        CDBBatch batch(&db.GetObfuscateKey());
+        for (size_t count = 0; count < 10000; count++, pcursor->Next()) {
+            std::pair<char, uint256> key;
+            if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COINS) {
+                fDone = true;
+                break;
+            }
+            batch.Erase(key);
+        }
+        if (fDone)
+            batch.Erase(DB_BEST_BLOCK);
+        if (!db.WriteBatch(batch))
+            return false;
+    }
+    return true;
+}
+
+CCoinsViewDBCursor::CCoinsViewDBCursor(CDBIterator* pcursorIn) : pcursor(pcursorIn), fValid(false)
+{
+}
+
+void CCoinsViewDBCursor::ReadKey() {
+    fValid = pcursor->Valid() && pcursor->GetKey(keyTmp) && keyTmp.first == DB_COINS;
+}
+
+bool CCoinsViewDBCursor::GetValue(CCoins& coins) {
+    return pcursor->GetValue(coins);
+}
+
+unsigned int CCoinsViewDBCursor::GetValueSize() {
+    return pcursor->GetValueSize();
+}
+
+void CCoinsViewDBCursor::Next() {
+    pcursor->Next();
+    ReadKey();
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, "blockindex") {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
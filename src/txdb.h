@@ -14,6 +14,8 @@
 #include <utility>
 #include <vector>
 
+#include <boost/scoped_ptr.hpp>
+
 class CBlockFileInfo;
 class CBlockIndex;
 struct CDiskTxPos;
@@ -26,19 +28,107 @@ static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
 
-/** CCoinsView backed by the coin database (chainstate/) */
+class CCoinsViewDBCursor;
+
+/**
+ * CCoinsView backed by the coin database (chainstate/).
+ *
+ * Besides BatchWrite, coins can be committed by WriteInBackground: the map
+ * is then written by a separate thread in one atomic leveldb batch together
+ * with its best block, and served to readers until it is committed. Coins
+ * can be handed over in parts beforehand with StageCoins; they go into the
+ * same batch.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+    //! protects the members below
+    mutable CCriticalSection cs_pending;
+    //! coins being written by pwritethread; not modified until the write finishes
+    CCoinsMap mapPending;
+    //! coins for the next background write, newer than mapPending
+    CCoinsMap mapStaged;
+    uint256 hashPending;
+    bool fWriting;
+    bool fWriteFailed;
+    boost::thread* pwritethread;
+    //! number of writes started, see GetWriteCount()
+    unsigned int nWriteCount;
+
+    void ThreadWrite();
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+
+    /**
+     * Start writing mapCoins (taken over, mapCoins is left empty) and
+     * hashBlock in a background thread, after any write still running.
+     * Returns false if the previous background write failed.
+     */
+    bool WriteInBackground(CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    /**
+     * Take over mapCoins (left empty) as part of the next WriteInBackground
+     * or BatchWrite, and serve them to readers until then. Coins staged later
+     * replace those staged earlier.
+     */
+    void StageCoins(CCoinsMap &mapCoins);
+
+    //! Whether StageCoins was called since the last write
+    bool HasStagedCoins() const;
+
+    //! Wait for the running background write, returns false if it failed
+    bool WaitForWrite();
+
+    bool IsWriting() const;
+
+    /**
+     * Number of writes started so far. Coins read while it stays the same
+     * are still current, as far as this view is concerned.
+     */
+    unsigned int GetWriteCount() const;
+
+    //! Cursor over all coins in the database, as of now (waits for a background write first)
+    CCoinsViewDBCursor* Cursor();
+
+    //! Write a run of coins, sorted by txid, in one batch; hashBlock is written along if not null
+    bool WriteCoins(const std::vector<std::pair<uint256, CCoins> >& vCoins, const uint256& hashBlock);
+
+    //! Remove all coins and the best block marker
+    bool EraseAllCoins();
+
+    //! The underlying database, for statistics and maintenance (getdbstats, compactdb)
+    CDBWrapper& GetDB() { return db; }
+};
+
+/** Iterates over the coins in a CCoinsViewDB in txid order (see CCoinsViewDB::Cursor) */
+class CCoinsViewDBCursor
+{
+public:
+    bool Valid() const { return fValid; }
+    const uint256& GetKey() const { return keyTmp.second; }
+    bool GetValue(CCoins& coins);
+    unsigned int GetValueSize();
+    void Next();
+
+private:
+    CCoinsViewDBCursor(CDBIterator* pcursorIn);
+
+    boost::scoped_ptr<CDBIterator> pcursor;
+    std::pair<char, uint256> keyTmp;
+    bool fValid;
+
+    void ReadKey();
+
+    friend class CCoinsViewDB;
 };
 
 /** Access to the block database (blocks/index/) */
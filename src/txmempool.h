@@ -103,6 +103,10 @@ private:
     CAmount nModFeesWithAncestors;
     unsigned int nSigOpCountWithAncestors;
 
+    //! Last CTxMemPool traversal that visited this entry, see CTxMemPool::NewEpoch
+    mutable uint64_t nEpoch;
+    friend class CTxMemPool;
+
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                     int64_t _nTime, double _entryPriority, unsigned int _entryHeight,
@@ -319,6 +323,9 @@ public:
     size_t DynamicMemoryUsage() const { return 0; }
 };
 
+/** Changes recorded for TakeChanges before giving up and reporting an overflow */
+static const size_t MEMPOOL_MAX_TRACKED_CHANGES = 100000;
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -408,6 +415,11 @@ private:
 
     CFeeRate minReasonableRelayFee;
 
+    bool fTrackChanges; //! whether to record entries added and removed, see TrackChanges
+    bool fChangesOverflowed;
+    std::vector<uint256> vChangesAdded;
+    std::vector<uint256> vChangesRemoved;
+
     mutable int64_t lastRollingFeeUpdate;
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
@@ -459,11 +471,12 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    typedef std::vector<txiter> vecEntries;
 
     const setEntries & GetMemPoolParents(txiter entry) const;
     const setEntries & GetMemPoolChildren(txiter entry) const;
 private:
-    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
+    typedef std::map<txiter, vecEntries, CompareIteratorByHash> cacheMap;
 
     struct TxLinks {
         setEntries parents;
@@ -473,6 +486,24 @@ private:
     typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
     txlinksMap mapLinks;
 
+    mutable uint64_t nEpoch; //! last traversal started, see NewEpoch
+    vecEntries vTraversalScratch; //! reused by UpdateForRemoveFromMempool and PrioritiseTransaction
+
+    /**
+     * Start a traversal of the pool. Entries are marked visited by setting
+     * their nEpoch to the returned value, so no set of visited entries needs
+     * to be built; in turn, traversals must not be nested.
+     */
+    uint64_t NewEpoch() const { return ++nEpoch; }
+    /** Mark it visited in the given traversal; returns whether it already was */
+    static bool Visited(txiter it, uint64_t epoch)
+    {
+        if (it->nEpoch == epoch)
+            return true;
+        it->nEpoch = epoch;
+        return false;
+    }
+
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
@@ -503,6 +534,7 @@ public:
     // then invoke the second version.
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate = true);
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, setEntries &setAncestors, bool fCurrentEstimate = true);
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, const vecEntries &vAncestors, bool fCurrentEstimate = true);
 
     void removeRecursive(const CTransaction &tx, std::list<CTransaction>& removed);
     void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
@@ -515,6 +547,20 @@ public:
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
+
+    /**
+     * Start recording the txids of entries added to and removed from the
+     * pool, for incremental block template assembly.
+     */
+    void TrackChanges();
+    /**
+     * Move the changes recorded since the previous call into vAdded and
+     * vRemoved, each in the order they happened. Returns false if they are
+     * incomplete: more than MEMPOOL_MAX_TRACKED_CHANGES were made, the pool was
+     * cleared, or a transaction was reprioritised. Callers must then start
+     * over from the whole pool.
+     */
+    bool TakeChanges(std::vector<uint256>& vAdded, std::vector<uint256>& vRemoved);
     /**
      * Check that none of this transactions inputs are in the mempool, and thus
      * the tx is not dependent on other mempool transactions to be included in a block.
@@ -535,6 +581,8 @@ public:
      *  that any in-mempool descendants have their ancestor state updated.
      */
     void RemoveStaged(setEntries &stage, bool updateDescendants);
+    /** Same, for a stage without duplicates, as built by CalculateDescendants */
+    void RemoveStaged(const vecEntries &stage, bool updateDescendants);
 
     /** When adding transactions from a disconnected block back to the mempool,
      *  new mempool entries may have children in the mempool (which is generally
@@ -558,11 +606,18 @@ public:
      *    look up parents from mapLinks. Must be true for entries not in the mempool
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
+    /** Same, replacing the contents of vAncestors with the ancestors, nearest first */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, vecEntries &vAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
     /** Populate setDescendants with all in-mempool descendants of hash.
      *  Assumes that setDescendants includes all in-mempool descendants of anything
      *  already in it.  */
     void CalculateDescendants(txiter it, setEntries &setDescendants);
+    /** Replace the contents of vDescendants with the entries in vRoots and all
+     *  their in-mempool descendants, each once, parents before children. */
+    void CalculateDescendants(const vecEntries &vRoots, vecEntries &vDescendants) const;
+    /** Same, for the single root entryit */
+    void CalculateDescendants(txiter entryit, vecEntries &vDescendants) const;
 
     /** The minimum fee to get into the mempool, which may itself not be enough
       *  for larger-sized transactions.
@@ -644,15 +699,17 @@ private:
             cacheMap &cachedDescendants,
             const std::set<uint256> &setExclude);
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
-    void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors);
+    void UpdateAncestorsOf(bool add, txiter hash, const vecEntries &vAncestors);
     /** Set ancestor state for an entry */
-    void UpdateEntryForAncestors(txiter it, const setEntries &setAncestors);
+    void UpdateEntryForAncestors(txiter it, const vecEntries &vAncestors);
     /** For each transaction being removed, update ancestors and any direct children.
       * If updateDescendants is true, then also update in-mempool descendants'
       * ancestor state. */
-    void UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants);
+    void UpdateForRemoveFromMempool(const vecEntries &entriesToRemove, bool updateDescendants);
     /** Sever link between specified transaction and direct children. */
     void UpdateChildrenForRemoval(txiter entry);
+    /** Append the unvisited descendants of the entries in vDescendants to it */
+    void AddDescendants(vecEntries &vDescendants, uint64_t epoch) const;
 
     /** Before calling removeUnchecked for a given transaction,
      *  UpdateForRemoveFromMempool must be called on the entire (dependent) set
@@ -663,6 +720,8 @@ private:
      *  removal.
      */
     void removeUnchecked(txiter entry);
+    /** Record an entry added or removed, for TakeChanges */
+    void RecordChange(const uint256& hash, bool fAdded);
 };
 
 /** 
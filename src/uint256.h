@@ -132,6 +132,12 @@ public:
      * @note This hash is not stable between little and big endian.
      */
     uint64_t GetHash(const uint256& salt) const;
+
+    /** Return the pos-th little-endian 64-bit word of the blob (pos in [0, 3]). */
+    uint64_t GetUint64(int pos) const
+    {
+        return ReadLE64(data + pos * 8);
+    }
 };
 
 /* uint256 from const char *.
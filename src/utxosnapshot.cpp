@@ -0,0 +1,557 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "utxosnapshot.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "hash.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "sync.h"
+#include "trust.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <fstream>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <sqlite3.h>
+
+//! Coin records written to the chainstate per leveldb batch while loading
+static const size_t UTXO_SNAPSHOT_LOAD_BATCH = 20000;
+
+namespace {
+
+/** Header of a block up to the snapshot, with its transaction count */
+class CSnapshotBlock
+{
+public:
+    CBlockHeader header;
+    unsigned int nTx;
+
+    CSnapshotBlock() : nTx(0) {}
+    CSnapshotBlock(const CBlockHeader& headerIn, unsigned int nTxIn) : header(headerIn), nTx(nTxIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(header);
+        READWRITE(VARINT(nTx));
+    }
+};
+
+/** Row of the ratings RAWDATA table */
+class CSnapshotAddress
+{
+public:
+    std::string strAddress;
+    int64_t nBalance;
+    int64_t nFirstSeen;
+    int64_t nTxInCount;
+    int64_t nTxOutCount;
+    int64_t nTotalIn;
+    int64_t nTotalOut;
+
+    CSnapshotAddress() : nBalance(0), nFirstSeen(0), nTxInCount(0), nTxOutCount(0), nTotalIn(0), nTotalOut(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(strAddress);
+        READWRITE(nBalance);
+        READWRITE(nFirstSeen);
+        READWRITE(nTxInCount);
+        READWRITE(nTxOutCount);
+        READWRITE(nTotalIn);
+        READWRITE(nTotalOut);
+    }
+};
+
+/** Row of the ratings BLOCKS table */
+class CSnapshotBlockRow
+{
+public:
+    int64_t nId;
+    std::string strHash;
+    int64_t nTime;
+    std::string strMiner;
+
+    CSnapshotBlockRow() : nId(0), nTime(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nId);
+        READWRITE(strHash);
+        READWRITE(nTime);
+        READWRITE(strMiner);
+    }
+};
+
+/** Reads from or writes to a CAutoFile, hashing everything that passes through */
+class CHashedFile
+{
+private:
+    CAutoFile& file;
+    CHashWriter hasher;
+
+public:
+    CHashedFile(CAutoFile& fileIn) : file(fileIn), hasher(fileIn.GetType(), fileIn.GetVersion()) {}
+
+    int GetType() const { return file.GetType(); }
+    int GetVersion() const { return file.GetVersion(); }
+
+    CHashedFile& read(char* pch, size_t nSize) {
+        file.read(pch, nSize);
+        hasher.write(pch, nSize);
+        return *this;
+    }
+
+    CHashedFile& write(const char* pch, size_t nSize) {
+        file.write(pch, nSize);
+        hasher.write(pch, nSize);
+        return *this;
+    }
+
+    template<typename T>
+    CHashedFile& operator<<(const T& obj) {
+        ::Serialize(*this, obj, GetType(), GetVersion());
+        return *this;
+    }
+
+    template<typename T>
+    CHashedFile& operator>>(T& obj) {
+        ::Unserialize(*this, obj, GetType(), GetVersion());
+        return *this;
+    }
+
+    // invalidates the object
+    uint256 GetHash() { return hasher.GetHash(); }
+};
+
+typedef std::vector<std::pair<uint256, CCoins> > CoinsChunk;
+
+std::string ColumnText(sqlite3_stmt* stmt, int nColumn)
+{
+    const unsigned char* pszText = sqlite3_column_text(stmt, nColumn);
+    return pszText ? std::string((const char*)pszText) : std::string();
+}
+
+bool ReadRatings(std::vector<CSnapshotAddress>& vAddresses, std::vector<CSnapshotBlockRow>& vBlockRows, std::string& strError)
+{
+    sqlite3* rawdb;
+    if (sqlite3_open((GetDataDir() / "ratings/rawdata.db").string().c_str(), &rawdb) != SQLITE_OK) {
+        strError = strprintf("Cannot open the ratings database: %s", sqlite3_errmsg(rawdb));
+        sqlite3_close(rawdb);
+        return false;
+    }
+
+    sqlite3_stmt* stmt = NULL;
+    bool fOk = sqlite3_prepare_v2(rawdb, "SELECT ADDRESS, BALANCE, FIRSTSEEN, TXINCOUNT, TXOUTCOUNT, TOTALIN, TOTALOUT FROM RAWDATA", -1, &stmt, NULL) == SQLITE_OK;
+    while (fOk && sqlite3_step(stmt) == SQLITE_ROW) {
+        CSnapshotAddress row;
+        row.strAddress = ColumnText(stmt, 0);
+        row.nBalance = sqlite3_column_int64(stmt, 1);
+        row.nFirstSeen = sqlite3_column_int64(stmt, 2);
+        row.nTxInCount = sqlite3_column_int64(stmt, 3);
+        row.nTxOutCount = sqlite3_column_int64(stmt, 4);
+        row.nTotalIn = sqlite3_column_int64(stmt, 5);
+        row.nTotalOut = sqlite3_column_int64(stmt, 6);
+        vAddresses.push_back(row);
+    }
+    sqlite3_finalize(stmt);
+
+    stmt = NULL;
+    fOk = fOk && sqlite3_prepare_v2(rawdb, "SELECT ID, HASH, TIME, MINER FROM BLOCKS ORDER BY ID", -1, &stmt, NULL) == SQLITE_OK;
+    while (fOk && sqlite3_step(stmt) == SQLITE_ROW) {
+        CSnapshotBlockRow row;
+        row.nId = sqlite3_column_int64(stmt, 0);
+        row.strHash = ColumnText(stmt, 1);
+        row.nTime = sqlite3_column_int64(stmt, 2);
+        row.strMiner = ColumnText(stmt, 3);
+        vBlockRows.push_back(row);
+    }
+    sqlite3_finalize(stmt);
+
+    if (!fOk)
+        strError = strprintf("Cannot read the ratings database: %s", sqlite3_errmsg(rawdb));
+    sqlite3_close(rawdb);
+    return fOk;
+}
+
+bool WriteRatings(const std::vector<CSnapshotAddress>& vAddresses, const std::vector<CSnapshotBlockRow>& vBlockRows, std::string& strError)
+{
+    boost::filesystem::path trustdb = GetDataDir() / "ratings/rawdata.db";
+    if (!boost::filesystem::exists(trustdb)) {
+        TrustEngine db;
+        db.createdb();
+    }
+
+    sqlite3* rawdb;
+    if (sqlite3_open(trustdb.string().c_str(), &rawdb) != SQLITE_OK) {
+        strError = strprintf("Cannot open the ratings database: %s", sqlite3_errmsg(rawdb));
+        sqlite3_close(rawdb);
+        return false;
+    }
+    sqlite3_exec(rawdb, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
+
+    // Replace whatever connecting the genesis block put there, in one transaction
+    bool fOk = sqlite3_exec(rawdb, "BEGIN TRANSACTION", NULL, NULL, NULL) == SQLITE_OK &&
+               sqlite3_exec(rawdb, "DELETE FROM RAWDATA", NULL, NULL, NULL) == SQLITE_OK &&
+               sqlite3_exec(rawdb, "DELETE FROM BLOCKS", NULL, NULL, NULL) == SQLITE_OK;
+
+    sqlite3_stmt* stmt = NULL;
+    fOk = fOk && sqlite3_prepare_v2(rawdb, "INSERT INTO RAWDATA (ADDRESS, BALANCE, FIRSTSEEN, TXINCOUNT, TXOUTCOUNT, TOTALIN, TOTALOUT) VALUES (?, ?, ?, ?, ?, ?, ?)", -1, &stmt, NULL) == SQLITE_OK;
+    for (size_t i = 0; fOk && i < vAddresses.size(); i++) {
+        const CSnapshotAddress& row = vAddresses[i];
+        sqlite3_bind_text(stmt, 1, row.strAddress.data(), row.strAddress.size(), SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, row.nBalance);
+        sqlite3_bind_int64(stmt, 3, row.nFirstSeen);
+        sqlite3_bind_int64(stmt, 4, row.nTxInCount);
+        sqlite3_bind_int64(stmt, 5, row.nTxOutCount);
+        sqlite3_bind_int64(stmt, 6, row.nTotalIn);
+        sqlite3_bind_int64(stmt, 7, row.nTotalOut);
+        fOk = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    stmt = NULL;
+    fOk = fOk && sqlite3_prepare_v2(rawdb, "INSERT INTO BLOCKS (ID, HASH, TIME, MINER) VALUES (?, ?, ?, ?)", -1, &stmt, NULL) == SQLITE_OK;
+    for (size_t i = 0; fOk && i < vBlockRows.size(); i++) {
+        const CSnapshotBlockRow& row = vBlockRows[i];
+        sqlite3_bind_int64(stmt, 1, row.nId);
+        sqlite3_bind_text(stmt, 2, row.strHash.data(), row.strHash.size(), SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 3, row.nTime);
+        sqlite3_bind_text(stmt, 4, row.strMiner.data(), row.strMiner.size(), SQLITE_STATIC);
+        fOk = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    if (!fOk)
+        strError = strprintf("Cannot restore the ratings database: %s", sqlite3_errmsg(rawdb));
+    sqlite3_exec(rawdb, fOk ? "COMMIT" : "ROLLBACK", NULL, NULL, NULL);
+    sqlite3_close(rawdb);
+    return fOk;
+}
+
+bool WriteBalances(const std::map<std::string, int64_t>& mapBalances)
+{
+    std::ofstream addrdb((GetDataDir() / "ratings/balances.dat").string().c_str(), std::ofstream::trunc);
+    for (std::map<std::string, int64_t>::const_iterator it = mapBalances.begin(); it != mapBalances.end(); ++it)
+        addrdb << it->first << "," << it->second << std::endl;
+    addrdb.close();
+    return !addrdb.fail();
+}
+
+/**
+ * Read the coins section of a snapshot from s, checking that it is in txid
+ * order. With pview set, the coins are written to it in batches of
+ * UTXO_SNAPSHOT_LOAD_BATCH records; otherwise they are only counted.
+ */
+template<typename Stream>
+bool ReadSnapshotCoins(Stream& s, CCoinsViewDB* pview, CUtxoSnapshotStats& stats, std::string& strError)
+{
+    // Coins come in txid order, i.e. in database key order, so every
+    // batch is one sorted run of keys.
+    CoinsChunk vBatch;
+    CoinsChunk vChunk;
+    uint256 hashLast;
+    stats.nTransactions = 0;
+    stats.nTransactionOutputs = 0;
+    while (true) {
+        boost::this_thread::interruption_point();
+        s >> vChunk;
+        if (vChunk.empty())
+            break;
+        for (CoinsChunk::iterator it = vChunk.begin(); it != vChunk.end(); it++) {
+            if (stats.nTransactions > 0 && !(hashLast < it->first)) {
+                strError = "UTXO snapshot coins are not sorted";
+                return false;
+            }
+            hashLast = it->first;
+            stats.nTransactions++;
+            for (unsigned int i = 0; i < it->second.vout.size(); i++)
+                if (!it->second.vout[i].IsNull())
+                    stats.nTransactionOutputs++;
+            if (pview) {
+                vBatch.push_back(std::make_pair(it->first, CCoins()));
+                vBatch.back().second.swap(it->second);
+            }
+        }
+        if (vBatch.size() >= UTXO_SNAPSHOT_LOAD_BATCH) {
+            if (!pview->WriteCoins(vBatch, uint256())) {
+                strError = "Cannot write to the chainstate";
+                return false;
+            }
+            vBatch.clear();
+            LogPrint("coindb", "Loaded %u transactions from UTXO snapshot\n", stats.nTransactions);
+        }
+    }
+    // The best block goes in with the last batch
+    if (pview && !pview->WriteCoins(vBatch, stats.hashBlock)) {
+        strError = "Cannot write to the chainstate";
+        return false;
+    }
+    return true;
+}
+
+} // anon namespace
+
+bool DumpUtxoSnapshot(const boost::filesystem::path& path, CUtxoSnapshotStats& stats, std::string& strError)
+{
+    int64_t nStart = GetTimeMillis();
+    CUtxoSnapshotHeader header;
+    std::vector<CSnapshotBlock> vBlocks;
+    std::vector<CSnapshotAddress> vAddresses;
+    std::vector<CSnapshotBlockRow> vBlockRows;
+    std::map<std::string, int64_t> mapBalances;
+    boost::scoped_ptr<CCoinsViewDBCursor> pcursor;
+    {
+        // The ratings data is only modified in ConnectTip, and the cursor
+        // sees the chainstate as of its creation: taking both under cs_main
+        // gives a consistent snapshot, the coins can be streamed afterwards.
+        LOCK(cs_main);
+        FlushStateToDisk();
+        CBlockIndex* pindex = chainActive.Tip();
+        if (pindex == NULL || pcoinsdbview->GetBestBlock() != pindex->GetBlockHash()) {
+            strError = "Cannot write the chainstate to disk";
+            return false;
+        }
+        pcursor.reset(pcoinsdbview->Cursor());
+
+        memcpy(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart));
+        header.hashBlock = pindex->GetBlockHash();
+        header.nHeight = pindex->nHeight;
+        vBlocks.resize(pindex->nHeight);
+        for (; pindex->pprev; pindex = pindex->pprev)
+            vBlocks[pindex->nHeight - 1] = CSnapshotBlock(pindex->GetBlockHeader(), pindex->nTx);
+
+        if (!ReadRatings(vAddresses, vBlockRows, strError))
+            return false;
+        mapBalances = getbalances();
+    }
+
+    stats.hashBlock = header.hashBlock;
+    stats.nHeight = header.nHeight;
+    stats.nAddresses = vAddresses.size();
+    stats.nBlockRows = vBlockRows.size();
+    stats.nBalances = mapBalances.size();
+
+    // Write to a temporary file first, so an interrupted dump never looks complete
+    boost::filesystem::path pathTmp = path.string() + ".incomplete";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        strError = strprintf("Cannot open %s for writing", pathTmp.string());
+        return false;
+    }
+
+    try {
+        CHashedFile hashedout(fileout);
+        hashedout << header << vBlocks << vAddresses << vBlockRows << mapBalances;
+
+        CoinsChunk vChunk;
+        vChunk.reserve(UTXO_SNAPSHOT_CHUNK);
+        while (true) {
+            boost::this_thread::interruption_point();
+            if (pcursor->Valid()) {
+                vChunk.push_back(std::make_pair(pcursor->GetKey(), CCoins()));
+                CCoins& coins = vChunk.back().second;
+                if (!pcursor->GetValue(coins)) {
+                    strError = "Cannot read coins from the chainstate";
+                    fileout.fclose();
+                    boost::filesystem::remove(pathTmp);
+                    return false;
+                }
+                for (unsigned int i = 0; i < coins.vout.size(); i++)
+                    if (!coins.vout[i].IsNull())
+                        stats.nTransactionOutputs++;
+                pcursor->Next();
+                if (vChunk.size() < UTXO_SNAPSHOT_CHUNK)
+                    continue;
+            }
+            // Write a full chunk, the last partial one, or the empty one ending the coins
+            bool fEnd = vChunk.empty();
+            hashedout << vChunk;
+            stats.nTransactions += vChunk.size();
+            vChunk.clear();
+            if (fEnd)
+                break;
+        }
+
+        hashedout << stats.nTransactions;
+        stats.hashChecksum = hashedout.GetHash();
+        fileout << stats.hashChecksum;
+        FileCommit(fileout.Get());
+        fileout.fclose();
+    } catch (const std::exception& e) {
+        strError = strprintf("Error writing %s: %s", pathTmp.string(), e.what());
+        fileout.fclose();
+        boost::filesystem::remove(pathTmp);
+        return false;
+    }
+
+    if (!RenameOver(pathTmp, path)) {
+        strError = strprintf("Cannot rename %s to %s", pathTmp.string(), path.string());
+        return false;
+    }
+    stats.nBytes = boost::filesystem::file_size(path);
+    LogPrintf("Wrote UTXO snapshot of block %s (height %d, %u transactions, %u ratings addresses) to %s in %dms\n",
+        stats.hashBlock.ToString(), stats.nHeight, stats.nTransactions, stats.nAddresses, path.string(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool LoadUtxoSnapshot(const boost::filesystem::path& path, CUtxoSnapshotStats& stats, std::string& strError)
+{
+    int64_t nStart = GetTimeMillis();
+    FILE* file = fopen(path.string().c_str(), "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = strprintf("Cannot open UTXO snapshot %s", path.string());
+        return false;
+    }
+
+    LOCK(cs_main);
+    if (chainActive.Height() != 0) {
+        strError = "A UTXO snapshot can only be loaded into a new data directory";
+        return false;
+    }
+
+    try {
+        // First pass: read the whole file and check its checksum against the
+        // ones this network accepts, before anything in the data directory
+        // is touched. The coins are only counted; everything else is kept.
+        CUtxoSnapshotHeader header;
+        std::vector<CSnapshotBlock> vBlocks;
+        std::vector<CSnapshotAddress> vAddresses;
+        std::vector<CSnapshotBlockRow> vBlockRows;
+        std::map<std::string, int64_t> mapBalances;
+        long nCoinsPos;
+        {
+            CHashedFile hashedin(filein);
+            hashedin >> header;
+            if (header.nMagic != CUtxoSnapshotHeader::MAGIC) {
+                strError = strprintf("%s is not a UTXO snapshot", path.string());
+                return false;
+            }
+            if (header.nVersion > UTXO_SNAPSHOT_VERSION) {
+                strError = strprintf("UTXO snapshot version %d is not supported", header.nVersion);
+                return false;
+            }
+            if (memcmp(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart)) != 0) {
+                strError = "UTXO snapshot is for a different network";
+                return false;
+            }
+            stats.hashBlock = header.hashBlock;
+            stats.nHeight = header.nHeight;
+
+            hashedin >> vBlocks >> vAddresses >> vBlockRows >> mapBalances;
+            stats.nAddresses = vAddresses.size();
+            stats.nBlockRows = vBlockRows.size();
+            stats.nBalances = mapBalances.size();
+
+            nCoinsPos = ftell(filein.Get());
+            if (nCoinsPos < 0 || !ReadSnapshotCoins(hashedin, NULL, stats, strError))
+                return false;
+
+            uint64_t nTransactions;
+            hashedin >> nTransactions;
+            stats.hashChecksum = hashedin.GetHash();
+            uint256 hashFile;
+            filein >> hashFile;
+            if (nTransactions != stats.nTransactions || hashFile != stats.hashChecksum) {
+                strError = "UTXO snapshot checksum mismatch";
+                return false;
+            }
+        }
+
+        // The checksum above only shows that the file is intact. Whether its
+        // coins are the real ones at that height is taken on trust, so only
+        // snapshots known to the chain parameters are accepted.
+        const MapCheckpoints& mapSnapshots = Params().UtxoSnapshots();
+        MapCheckpoints::const_iterator itSnapshot = mapSnapshots.find(header.nHeight);
+        if (!Params().AcceptAnyUtxoSnapshot() && (itSnapshot == mapSnapshots.end() || itSnapshot->second != stats.hashChecksum)) {
+            strError = strprintf("UTXO snapshot %s at height %d is not a known snapshot", stats.hashChecksum.ToString(), header.nHeight);
+            return false;
+        }
+
+        if (vBlocks.size() != (size_t)header.nHeight || vBlocks.empty() || vBlocks.back().header.GetHash() != header.hashBlock) {
+            strError = "UTXO snapshot headers do not lead to its block";
+            return false;
+        }
+
+        // Start from an empty coins cache, before the block index gets dirty
+        FlushStateToDisk();
+
+        {
+            CValidationState state;
+            for (size_t i = 0; i < vBlocks.size(); i++) {
+                if (!AcceptSnapshotHeader(vBlocks[i].header, vBlocks[i].nTx, state)) {
+                    strError = strprintf("Invalid UTXO snapshot header at height %u: %s", i + 1, FormatStateMessage(state));
+                    return false;
+                }
+            }
+            std::vector<CSnapshotBlock>().swap(vBlocks);
+        }
+
+        // Until the flag is cleared, the chainstate on disk is incomplete and
+        // startup refuses to use it.
+        if (!pblocktree->WriteFlag("loadingutxosnapshot", true) || !pcoinsdbview->EraseAllCoins()) {
+            strError = "Cannot write to the chainstate";
+            return false;
+        }
+
+        // Second pass: write the coins, from the file that is still held open.
+        // The counts must come out the same as in the first pass.
+        CUtxoSnapshotStats statsCoins;
+        statsCoins.hashBlock = header.hashBlock;
+        if (fseek(filein.Get(), nCoinsPos, SEEK_SET) != 0) {
+            strError = strprintf("Cannot seek in UTXO snapshot %s", path.string());
+            return false;
+        }
+        if (!ReadSnapshotCoins(filein, pcoinsdbview, statsCoins, strError))
+            return false;
+        if (statsCoins.nTransactions != stats.nTransactions || statsCoins.nTransactionOutputs != stats.nTransactionOutputs) {
+            strError = strprintf("UTXO snapshot %s changed while loading", path.string());
+            return false;
+        }
+
+        if (!WriteRatings(vAddresses, vBlockRows, strError))
+            return false;
+        if (!WriteBalances(mapBalances)) {
+            strError = "Cannot write ratings/balances.dat";
+            return false;
+        }
+
+        CValidationState state;
+        if (!ActivateSnapshotTip(header.hashBlock, state) || !pblocktree->WriteFlag("loadingutxosnapshot", false)) {
+            strError = strprintf("Cannot activate the UTXO snapshot: %s", FormatStateMessage(state));
+            return false;
+        }
+        stats.nBytes = boost::filesystem::file_size(path);
+    } catch (const std::exception& e) {
+        strError = strprintf("Error reading UTXO snapshot %s: %s", path.string(), e.what());
+        return false;
+    }
+
+    LogPrintf("Loaded UTXO snapshot of block %s (height %d, %u transactions, %u ratings addresses) in %dms\n",
+        stats.hashBlock.ToString(), stats.nHeight, stats.nTransactions, stats.nAddresses, GetTimeMillis() - nStart);
+    return true;
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCREDIT_UTXOSNAPSHOT_H
+#define BITCREDIT_UTXOSNAPSHOT_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+/** Current version of the UTXO snapshot file format */
+static const int UTXO_SNAPSHOT_VERSION = 1;
+/** Number of coin records per chunk in a snapshot file */
+static const unsigned int UTXO_SNAPSHOT_CHUNK = 1000;
+
+/**
+ * Header of a UTXO snapshot file, as written by dumputxoset and loaded with
+ * -loadutxosnapshot. It is followed by:
+ * - the headers of the chain up to hashBlock, from height 1, each with its
+ *   transaction count;
+ * - the ratings database (RAWDATA and BLOCKS rows) and balances.dat;
+ * - the coins, in txid order, in chunks of at most UTXO_SNAPSHOT_CHUNK
+ *   records, ending with an empty chunk;
+ * - the number of coin records, and the double SHA256 of everything before
+ *   the hash itself.
+ */
+class CUtxoSnapshotHeader
+{
+public:
+    static const uint32_t MAGIC = 0x6f787475; // "utxo"
+
+    uint32_t nMagic;
+    int nVersion;
+    unsigned char pchMessageStart[4];
+    uint256 hashBlock;
+    int nHeight;
+
+    CUtxoSnapshotHeader() : nMagic(MAGIC), nVersion(UTXO_SNAPSHOT_VERSION), nHeight(0)
+    {
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nMagic);
+        READWRITE(this->nVersion);
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+    }
+};
+
+/** What a snapshot contains, as reported by dumputxoset and logged by -loadutxosnapshot */
+struct CUtxoSnapshotStats
+{
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nAddresses;
+    uint64_t nBlockRows;
+    uint64_t nBalances;
+    uint64_t nBytes;
+    uint256 hashChecksum;
+
+    CUtxoSnapshotStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nAddresses(0), nBlockRows(0), nBalances(0), nBytes(0) {}
+};
+
+/** Write the chainstate at the current tip, with its headers and the ratings data, to path */
+bool DumpUtxoSnapshot(const boost::filesystem::path& path, CUtxoSnapshotStats& stats, std::string& strError);
+
+/**
+ * Load a snapshot written by DumpUtxoSnapshot into a chainstate that holds
+ * only the genesis block, and make its block the tip. The headers are
+ * validated, the blocks themselves are treated like pruned ones. The file is
+ * checked in full, and its checksum must be one of Params().UtxoSnapshots(),
+ * before the chainstate is modified.
+ */
+bool LoadUtxoSnapshot(const boost::filesystem::path& path, CUtxoSnapshotStats& stats, std::string& strError);
+
+#endif // BITCREDIT_UTXOSNAPSHOT_H
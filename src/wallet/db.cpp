@@ -54,13 +54,16 @@ void CDBEnv::Reset()
     fMockDb = false;
 }
 
-CDBEnv::CDBEnv() : dbenv(NULL)
+CDBEnv::CDBEnv() : dbenv(NULL), fLogDb(false)
 {
     Reset();
 }
 
 CDBEnv::~CDBEnv()
 {
+    for (map<string, CLogDB*>::iterator it = mapLogDb.begin(); it != mapLogDb.end(); ++it)
+        delete it->second;
+    mapLogDb.clear();
     EnvShutdown();
     delete dbenv;
     dbenv = NULL;
@@ -233,6 +236,13 @@ bool CDBEnv::Salvage(const std::string& strFile, bool fAggressive, std::vector<C
 
 void CDBEnv::CheckpointLSN(const std::string& strFile)
 {
+    if (fLogDb) {
+        // A wallet log is self contained once committed to disk
+        map<string, CLogDB*>::iterator mi = mapLogDb.find(strFile);
+        if (mi != mapLogDb.end() && mi->second)
+            mi->second->Flush();
+        return;
+    }
     dbenv->txn_checkpoint(0, 0, 0);
     if (fMockDb)
         return;
@@ -240,7 +250,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), plog(NULL), activeTxn(NULL), fLogTxn(false)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -249,6 +259,34 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
         return;
 
     bool fCreate = strchr(pszMode, 'c') != NULL;
+    if (bitdb.fLogDb) {
+        LOCK(bitdb.cs_db);
+        strFile = strFilename;
+        ++bitdb.mapFileUseCount[strFile];
+        plog = bitdb.mapLogDb[strFile];
+        if (plog == NULL) {
+            // Logs stay open until shutdown, as opening one reads all of it
+            plog = new CLogDB(bitdb.IsMock() ? boost::filesystem::path() : GetDataDir() / strFile);
+            if (!plog->Open(fCreate)) {
+                delete plog;
+                plog = NULL;
+                --bitdb.mapFileUseCount[strFile];
+                strFile = "";
+                throw runtime_error(strprintf("CDB: can't open wallet log %s", strFilename));
+            }
+
+            if (fCreate && !Exists(string("version"))) {
+                bool fTmp = fReadOnly;
+                fReadOnly = false;
+                WriteVersion(CLIENT_VERSION);
+                fReadOnly = fTmp;
+            }
+
+            bitdb.mapLogDb[strFile] = plog;
+        }
+        return;
+    }
+
     unsigned int nFlags = DB_THREAD;
     if (fCreate)
         nFlags |= DB_CREATE;
@@ -301,8 +339,12 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
 
 void CDB::Flush()
 {
-    if (activeTxn)
+    if (activeTxn || fLogTxn)
         return;
+    if (plog) {
+        plog->Flush();
+        return;
+    }
 
     // Flush database activity from memory pool to disk log
     unsigned int nMinutes = 0;
@@ -314,15 +356,18 @@ void CDB::Flush()
 
 void CDB::Close()
 {
-    if (!pdb)
+    if (!pdb && !plog)
         return;
     if (activeTxn)
         activeTxn->abort();
     activeTxn = NULL;
+    logTxn.clear();
+    fLogTxn = false;
     pdb = NULL;
 
     if (fFlushOnClose)
         Flush();
+    plog = NULL;
 
     {
         LOCK(bitdb.cs_db);
@@ -353,8 +398,91 @@ bool CDBEnv::RemoveDb(const string& strFile)
     return (rc == 0);
 }
 
+bool CDB::LogRead(const CDataStream& ssKey, CDataStream& ssValue)
+{
+    CSerializeData vKey(ssKey.begin(), ssKey.end());
+    CLogBatch::const_iterator it = logTxn.find(vKey);
+    if (it != logTxn.end()) {
+        if (it->second.first)
+            return false;
+        ssValue = CDataStream(it->second.second, SER_DISK, CLIENT_VERSION);
+        return true;
+    }
+    CSerializeData vValue;
+    if (!plog->Read(vKey, vValue))
+        return false;
+    ssValue = CDataStream(vValue, SER_DISK, CLIENT_VERSION);
+    return true;
+}
+
+bool CDB::LogWrite(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite)
+{
+    if (!fOverwrite && LogExists(ssKey))
+        return false;
+    CSerializeData vKey(ssKey.begin(), ssKey.end());
+    CSerializeData vValue(ssValue.begin(), ssValue.end());
+    if (fLogTxn) {
+        logTxn[vKey] = make_pair(false, vValue);
+        return true;
+    }
+    return plog->Write(vKey, vValue);
+}
+
+bool CDB::LogErase(const CDataStream& ssKey)
+{
+    CSerializeData vKey(ssKey.begin(), ssKey.end());
+    if (fLogTxn) {
+        logTxn[vKey] = make_pair(true, CSerializeData());
+        return true;
+    }
+    return plog->Erase(vKey);
+}
+
+bool CDB::LogExists(const CDataStream& ssKey)
+{
+    CSerializeData vKey(ssKey.begin(), ssKey.end());
+    CLogBatch::const_iterator it = logTxn.find(vKey);
+    if (it != logTxn.end())
+        return !it->second.first;
+    return plog->Exists(vKey);
+}
+
+int CDB::ReadAtLogCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+{
+    // The wallet only walks its records with DB_NEXT, from the start or from
+    // a DB_SET_RANGE, so that is all a log cursor does
+    CSerializeData vKey, vValue;
+    bool fInclusive;
+    if (fFlags == DB_SET_RANGE) {
+        vKey.assign(ssKey.begin(), ssKey.end());
+        fInclusive = true;
+    } else if (fFlags == DB_NEXT) {
+        vKey = pcursor->vKey;
+        fInclusive = !pcursor->fStarted;
+    } else {
+        return EINVAL;
+    }
+    if (!pcursor->plog->Seek(vKey, vValue, fInclusive))
+        return DB_NOTFOUND;
+    pcursor->vKey = vKey;
+    pcursor->fStarted = true;
+
+    ssKey = CDataStream(vKey, SER_DISK, CLIENT_VERSION);
+    ssValue = CDataStream(vValue, SER_DISK, CLIENT_VERSION);
+    return 0;
+}
+
 bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 {
+    if (bitdb.fLogDb) {
+        // Compacting leaves out the dead records, and what is skipped
+        LogPrintf("CDB::Rewrite: Rewriting %s...\n", strFile);
+        CDB db(strFile, "r+");
+        bool fSuccess = db.plog->Compact(pszSkip) && db.WriteVersion(CLIENT_VERSION);
+        if (!fSuccess)
+            LogPrintf("CDB::Rewrite: Failed to rewrite wallet log %s\n", strFile);
+        return fSuccess;
+    }
     while (true) {
         {
             LOCK(bitdb.cs_db);
@@ -382,7 +510,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess) {
                             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -442,6 +570,20 @@ void CDBEnv::Flush(bool fShutdown)
     int64_t nStart = GetTimeMillis();
     // Flush log data to the actual data file on all files that are not in use
     LogPrint("db", "CDBEnv::Flush: Flush(%s)%s\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " database not started");
+    if (!mapLogDb.empty()) {
+        LOCK(cs_db);
+        map<string, CLogDB*>::iterator it = mapLogDb.begin();
+        while (it != mapLogDb.end()) {
+            if (it->second)
+                it->second->Flush();
+            if (fShutdown && (!mapFileUseCount.count(it->first) || mapFileUseCount[it->first] == 0)) {
+                delete it->second;
+                mapFileUseCount.erase(it->first);
+                mapLogDb.erase(it++);
+            } else
+                it++;
+        }
+    }
     if (!fDbEnvInit)
         return;
     {
@@ -0,0 +1,535 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/logdb.h"
+
+#include "compat.h"
+#include "crypto/common.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdexcept>
+#include <string.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/version.hpp>
+
+using namespace std;
+
+/** Start of every log file, followed by the format version */
+static const char LOGDB_MAGIC[8] = {'\0', 'b', 'c', 'r', 'w', 'l', 'o', 'g'};
+static const uint32_t LOGDB_VERSION = 1;
+static const unsigned int LOGDB_HEADER_SIZE = 12;
+
+/** Record types; LOG_BATCH is set on writes and erases that wait for the next LOG_COMMIT */
+enum
+{
+    LOG_WRITE = 1,
+    LOG_ERASE = 2,
+    LOG_COMMIT = 3,
+    LOG_BATCH = 0x80
+};
+
+//! A record is its type (1), key size (4), value size (4), key, value and a CRC32C of all that (4)
+static const unsigned int LOGDB_RECORD_OVERHEAD = 13;
+//! Compaction writes the new log in pieces of about this size
+static const size_t LOGDB_COMPACT_CHUNK = 1 << 20;
+
+static uint32_t crc32c_table[256];
+
+static class CCRC32CInit
+{
+public:
+    CCRC32CInit()
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++)
+                crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            crc32c_table[i] = crc;
+        }
+    }
+} instance_of_ccrc32cinit;
+
+static uint32_t CRC32C(const unsigned char* p, size_t n)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    while (n--)
+        crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void AddHeader(CSerializeData& vLog)
+{
+    unsigned char version[4];
+    WriteLE32(version, LOGDB_VERSION);
+    vLog.insert(vLog.end(), LOGDB_MAGIC, LOGDB_MAGIC + sizeof(LOGDB_MAGIC));
+    vLog.insert(vLog.end(), version, version + sizeof(version));
+}
+
+static void AddRecord(CSerializeData& vLog, unsigned char nType, const CSerializeData& key, const CSerializeData& value)
+{
+    size_t nStart = vLog.size();
+    size_t nCRCPos = 9 + key.size() + value.size();
+    vLog.resize(nStart + nCRCPos + 4);
+    unsigned char* p = (unsigned char*)&vLog[nStart];
+    p[0] = nType;
+    WriteLE32(p + 1, key.size());
+    WriteLE32(p + 5, value.size());
+    if (!key.empty())
+        memcpy(p + 9, &key[0], key.size());
+    if (!value.empty())
+        memcpy(p + 9 + key.size(), &value[0], value.size());
+    WriteLE32(p + nCRCPos, CRC32C(p, nCRCPos));
+}
+
+bool CLogKeyCompare::operator()(const CSerializeData& a, const CSerializeData& b) const
+{
+    size_t n = std::min(a.size(), b.size());
+    int c = n ? memcmp(&a[0], &b[0], n) : 0;
+    return c < 0 || (c == 0 && a.size() < b.size());
+}
+
+CLogDB::CLogDB(const boost::filesystem::path& pathIn) :
+    path(pathIn), file(NULL), nSize(0), pMap(NULL), nMapSize(0), nLiveBytes(0), nDeadBytes(0), fDirty(false)
+{
+}
+
+CLogDB::~CLogDB()
+{
+    Close();
+}
+
+bool CLogDB::Map()
+{
+    Unmap();
+#ifndef WIN32
+    if (nSize == 0)
+        return true;
+    void* p = mmap(NULL, nSize, PROT_READ, MAP_SHARED, fileno(file), 0);
+    if (p == MAP_FAILED)
+        return error("CLogDB::Map: mapping %s failed: %s", path.string(), strerror(errno));
+    pMap = (const char*)p;
+    nMapSize = nSize;
+#endif
+    return true;
+}
+
+void CLogDB::Unmap()
+{
+#ifndef WIN32
+    if (pMap)
+        munmap((void*)pMap, nMapSize);
+#endif
+    pMap = NULL;
+    nMapSize = 0;
+}
+
+void CLogDB::Apply(bool fErase, const CSerializeData& key, const CLogPos& pos)
+{
+    Index::iterator it = mapIndex.find(key);
+    if (it != mapIndex.end()) {
+        nLiveBytes -= it->second.nRecordSize;
+        nDeadBytes += it->second.nRecordSize;
+        if (fErase)
+            mapIndex.erase(it);
+        else
+            it->second = pos;
+    } else if (!fErase) {
+        mapIndex.insert(make_pair(key, pos));
+    }
+    if (fErase)
+        nDeadBytes += pos.nRecordSize;
+    else
+        nLiveBytes += pos.nRecordSize;
+}
+
+void CLogDB::ApplyRecord(const unsigned char* pRecord, uint64_t nPos)
+{
+    uint32_t nKeySize = ReadLE32(pRecord + 1);
+    CLogPos pos;
+    pos.nValuePos = nPos + 9 + nKeySize;
+    pos.nValueSize = ReadLE32(pRecord + 5);
+    pos.nRecordSize = LOGDB_RECORD_OVERHEAD + nKeySize + pos.nValueSize;
+    Apply((pRecord[0] & ~LOG_BATCH) == LOG_ERASE, CSerializeData(pRecord + 9, pRecord + 9 + nKeySize), pos);
+}
+
+bool CLogDB::Load(const char* pbegin, uint64_t nFileSize)
+{
+    const unsigned char* p = (const unsigned char*)pbegin;
+    if (nFileSize < LOGDB_HEADER_SIZE || memcmp(p, LOGDB_MAGIC, sizeof(LOGDB_MAGIC)) != 0)
+        return error("CLogDB::Load: %s is not a wallet log", path.string());
+    if (ReadLE32(p + sizeof(LOGDB_MAGIC)) > LOGDB_VERSION)
+        return error("CLogDB::Load: %s was written by a newer version", path.string());
+
+    // Positions of the records of the batch being read, applied at its commit
+    std::vector<uint64_t> vBatch;
+    bool fCorrupt = false;
+    uint64_t nPos = LOGDB_HEADER_SIZE;
+    nSize = LOGDB_HEADER_SIZE;
+    while (nFileSize - nPos >= LOGDB_RECORD_OVERHEAD) {
+        const unsigned char* pRecord = p + nPos;
+        uint64_t nRecordSize = LOGDB_RECORD_OVERHEAD + (uint64_t)ReadLE32(pRecord + 1) + ReadLE32(pRecord + 5);
+        if (nRecordSize > nFileSize - nPos)
+            break; // cut short
+        if (ReadLE32(pRecord + nRecordSize - 4) != CRC32C(pRecord, nRecordSize - 4)) {
+            fCorrupt = true;
+            break;
+        }
+        unsigned char nType = pRecord[0];
+        if (nType == LOG_COMMIT) {
+            BOOST_FOREACH(uint64_t nBatchPos, vBatch)
+                ApplyRecord(p + nBatchPos, nBatchPos);
+            vBatch.clear();
+            nDeadBytes += nRecordSize;
+            nSize = nPos + nRecordSize;
+        } else if (nType == (LOG_WRITE | LOG_BATCH) || nType == (LOG_ERASE | LOG_BATCH)) {
+            vBatch.push_back(nPos);
+        } else if ((nType == LOG_WRITE || nType == LOG_ERASE) && vBatch.empty()) {
+            ApplyRecord(pRecord, nPos);
+            nSize = nPos + nRecordSize;
+        } else {
+            fCorrupt = true;
+            break;
+        }
+        nPos += nRecordSize;
+    }
+
+    if (nSize < nFileSize) {
+        if (fCorrupt) {
+            // Keep what follows the bad record, for whoever wants to dig into it
+            boost::filesystem::path pathBak = path.string() + strprintf(".%d.bak", GetTime());
+            try {
+                boost::filesystem::copy_file(path, pathBak);
+                LogPrintf("CLogDB::Load: bad record in %s at %u, copied it to %s\n", path.string(), nPos, pathBak.string());
+            } catch (const boost::filesystem::filesystem_error& e) {
+                return error("CLogDB::Load: bad record in %s at %u, and copying it failed: %s", path.string(), nPos, e.what());
+            }
+        }
+        LogPrintf("CLogDB::Load: dropping the last %u bytes of %s\n", nFileSize - nSize, path.string());
+    }
+    return true;
+}
+
+bool CLogDB::Open(bool fCreate)
+{
+    LOCK(cs);
+    if (path.empty()) {
+        if (vMemory.empty()) {
+            AddHeader(vMemory);
+            nSize = vMemory.size();
+            return true;
+        }
+        mapIndex.clear();
+        return Load(&vMemory[0], vMemory.size());
+    }
+    if (file)
+        return true;
+
+    file = fopen(path.string().c_str(), "rb+");
+    if (!file) {
+        if (!fCreate)
+            return error("CLogDB::Open: cannot open %s", path.string());
+        file = fopen(path.string().c_str(), "wb+");
+        if (!file)
+            return error("CLogDB::Open: cannot create %s", path.string());
+        CSerializeData vHeader;
+        AddHeader(vHeader);
+        nSize = 0;
+        if (!Append(vHeader)) {
+            Close();
+            return false;
+        }
+        return Flush();
+    }
+
+    int64_t nStart = GetTimeMillis();
+    if (fseek(file, 0, SEEK_END) != 0) {
+        Close();
+        return error("CLogDB::Open: cannot seek in %s", path.string());
+    }
+    uint64_t nFileSize = ftell(file);
+    nSize = nFileSize;
+    bool fLoaded;
+#ifndef WIN32
+    fLoaded = Map() && Load(pMap, nFileSize);
+#else
+    CSerializeData vFile(nFileSize);
+    rewind(file);
+    fLoaded = fread(&vFile[0], 1, nFileSize, file) == nFileSize && Load(&vFile[0], nFileSize);
+#endif
+    if (!fLoaded) {
+        Close();
+        return false;
+    }
+    if (nSize < nFileSize) {
+        Unmap();
+        if (!TruncateFile(file, nSize)) {
+            Close();
+            return error("CLogDB::Open: cannot truncate %s", path.string());
+        }
+    }
+    LogPrint("db", "CLogDB::Open: %u records, %u of %u bytes live, loaded from %s in %dms\n",
+             mapIndex.size(), nLiveBytes, nSize, path.string(), GetTimeMillis() - nStart);
+    return true;
+}
+
+void CLogDB::Close()
+{
+    LOCK(cs);
+    // An in-memory log is kept, and read back by the next Open()
+    Unmap();
+    if (file) {
+        if (fDirty)
+            FileCommit(file);
+        fclose(file);
+        file = NULL;
+    }
+    fDirty = false;
+    mapIndex.clear();
+    nSize = 0;
+    nLiveBytes = 0;
+    nDeadBytes = 0;
+}
+
+bool CLogDB::ReadAt(const CLogPos& pos, CSerializeData& value)
+{
+    if (path.empty()) {
+        value.assign(vMemory.begin() + pos.nValuePos, vMemory.begin() + pos.nValuePos + pos.nValueSize);
+        return true;
+    }
+    if (pos.nValuePos + pos.nValueSize > nMapSize)
+        Map();
+    if (pos.nValuePos + pos.nValueSize <= nMapSize) {
+        value.assign(pMap + pos.nValuePos, pMap + pos.nValuePos + pos.nValueSize);
+        return true;
+    }
+
+    // Not mapped (there is no mmap on Windows): read it from the file
+    value.resize(pos.nValueSize);
+    if (fseek(file, pos.nValuePos, SEEK_SET) != 0 ||
+        (pos.nValueSize > 0 && fread(&value[0], 1, pos.nValueSize, file) != pos.nValueSize))
+        return error("CLogDB::ReadAt: read from %s failed", path.string());
+    return true;
+}
+
+bool CLogDB::Append(const CSerializeData& vRecords)
+{
+    if (path.empty()) {
+        vMemory.insert(vMemory.end(), vRecords.begin(), vRecords.end());
+        nSize = vMemory.size();
+        return true;
+    }
+    if (fseek(file, nSize, SEEK_SET) != 0 ||
+        fwrite(&vRecords[0], 1, vRecords.size(), file) != vRecords.size() ||
+        fflush(file) != 0) {
+        // Cut off whatever part made it, or the records appended after it would be lost too
+        Unmap();
+        TruncateFile(file, nSize);
+        return error("CLogDB::Append: write to %s failed", path.string());
+    }
+    nSize += vRecords.size();
+    fDirty = true;
+    return true;
+}
+
+bool CLogDB::WriteRecords(const CLogBatch& batch, bool fBatch)
+{
+    CSerializeData vRecords;
+    std::vector<size_t> vOffsets;
+    for (CLogBatch::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+        vOffsets.push_back(vRecords.size());
+        AddRecord(vRecords, (it->second.first ? LOG_ERASE : LOG_WRITE) | (fBatch ? LOG_BATCH : 0), it->first, it->second.second);
+    }
+    if (fBatch)
+        AddRecord(vRecords, LOG_COMMIT, CSerializeData(), CSerializeData());
+
+    uint64_t nPos = nSize;
+    if (!Append(vRecords))
+        return false;
+    BOOST_FOREACH(size_t nOffset, vOffsets)
+        ApplyRecord((const unsigned char*)&vRecords[nOffset], nPos + nOffset);
+    if (fBatch)
+        nDeadBytes += LOGDB_RECORD_OVERHEAD;
+    return true;
+}
+
+bool CLogDB::Read(const CSerializeData& key, CSerializeData& value)
+{
+    LOCK(cs);
+    Index::const_iterator it = mapIndex.find(key);
+    if (it == mapIndex.end())
+        return false;
+    return ReadAt(it->second, value);
+}
+
+bool CLogDB::Exists(const CSerializeData& key)
+{
+    LOCK(cs);
+    return mapIndex.count(key) > 0;
+}
+
+bool CLogDB::Write(const CSerializeData& key, const CSerializeData& value, bool fOverwrite)
+{
+    LOCK(cs);
+    if (!fOverwrite && mapIndex.count(key))
+        return false;
+    CLogBatch batch;
+    batch[key] = make_pair(false, value);
+    return WriteRecords(batch, false);
+}
+
+bool CLogDB::Erase(const CSerializeData& key)
+{
+    LOCK(cs);
+    if (!mapIndex.count(key))
+        return true;
+    CLogBatch batch;
+    batch[key] = make_pair(true, CSerializeData());
+    return WriteRecords(batch, false);
+}
+
+bool CLogDB::WriteBatch(const CLogBatch& batch)
+{
+    LOCK(cs);
+    if (batch.empty())
+        return true;
+    // A single record is written whole or not at all anyway
+    return WriteRecords(batch, batch.size() > 1);
+}
+
+bool CLogDB::Seek(CSerializeData& key, CSerializeData& value, bool fInclusive)
+{
+    LOCK(cs);
+    Index::const_iterator it = fInclusive ? mapIndex.lower_bound(key) : mapIndex.upper_bound(key);
+    if (it == mapIndex.end())
+        return false;
+    key = it->first;
+    return ReadAt(it->second, value);
+}
+
+bool CLogDB::Flush()
+{
+    LOCK(cs);
+    if (!file)
+        return true;
+    if (nSize > LOGDB_COMPACT_MIN_SIZE && nDeadBytes > nLiveBytes)
+        return Compact();
+    if (fDirty) {
+        FileCommit(file);
+        fDirty = false;
+    }
+    return true;
+}
+
+bool CLogDB::Compact(const char* pszSkip)
+{
+    LOCK(cs);
+    int64_t nStart = GetTimeMillis();
+    uint64_t nSizeBefore = nSize;
+    boost::filesystem::path pathNew = path.string() + ".compact";
+    FILE* fileNew = NULL;
+    if (!path.empty()) {
+        fileNew = fopen(pathNew.string().c_str(), "wb");
+        if (!fileNew)
+            return error("CLogDB::Compact: cannot create %s", pathNew.string());
+    }
+
+    // Write the live records in key order, buffering up to a chunk at a time
+    CSerializeData vLog;
+    AddHeader(vLog);
+    uint64_t nWritten = 0;
+    Index mapIndexNew;
+    bool fSuccess = true;
+    for (Index::const_iterator it = mapIndex.begin(); it != mapIndex.end() && fSuccess; ++it) {
+        const CSerializeData& key = it->first;
+        if (pszSkip && !key.empty() && strncmp(&key[0], pszSkip, std::min(key.size(), strlen(pszSkip))) == 0)
+            continue;
+        CSerializeData value;
+        if (!ReadAt(it->second, value)) {
+            fSuccess = false;
+            break;
+        }
+        CLogPos pos;
+        pos.nValuePos = nWritten + vLog.size() + 9 + key.size();
+        pos.nValueSize = value.size();
+        pos.nRecordSize = LOGDB_RECORD_OVERHEAD + key.size() + value.size();
+        AddRecord(vLog, LOG_WRITE, key, value);
+        mapIndexNew.insert(make_pair(key, pos));
+        if (fileNew && vLog.size() >= LOGDB_COMPACT_CHUNK) {
+            fSuccess = fwrite(&vLog[0], 1, vLog.size(), fileNew) == vLog.size();
+            nWritten += vLog.size();
+            vLog.clear();
+        }
+    }
+
+    if (path.empty()) {
+        vMemory.swap(vLog);
+        nSize = vMemory.size();
+    } else {
+        if (fSuccess && !vLog.empty()) {
+            fSuccess = fwrite(&vLog[0], 1, vLog.size(), fileNew) == vLog.size();
+            nWritten += vLog.size();
+        }
+        if (fSuccess)
+            FileCommit(fileNew);
+        fclose(fileNew);
+        if (!fSuccess) {
+            boost::filesystem::remove(pathNew);
+            return error("CLogDB::Compact: writing %s failed", pathNew.string());
+        }
+
+        Unmap();
+        fclose(file);
+        bool fRenamed = RenameOver(pathNew, path);
+        file = fopen(path.string().c_str(), "rb+");
+        if (!file)
+            throw runtime_error(strprintf("CLogDB::Compact: cannot reopen %s", path.string()));
+        if (!fRenamed) {
+            // Carry on with the old log, which is still in place
+            boost::filesystem::remove(pathNew);
+            return error("CLogDB::Compact: cannot replace %s", path.string());
+        }
+        nSize = nWritten;
+    }
+    mapIndex.swap(mapIndexNew);
+    nLiveBytes = nSize - LOGDB_HEADER_SIZE;
+    nDeadBytes = 0;
+    fDirty = false;
+    LogPrint("db", "CLogDB::Compact: %s from %u to %u bytes in %dms\n", path.string(), nSizeBefore, nSize, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CLogDB::Backup(const boost::filesystem::path& pathDest)
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+    if (fDirty) {
+        FileCommit(file);
+        fDirty = false;
+    }
+    try {
+#if BOOST_VERSION >= 104000
+        boost::filesystem::copy_file(path, pathDest, boost::filesystem::copy_option::overwrite_if_exists);
+#else
+        boost::filesystem::copy_file(path, pathDest);
+#endif
+    } catch (const boost::filesystem::filesystem_error& e) {
+        return error("CLogDB::Backup: copying %s to %s failed: %s", path.string(), pathDest.string(), e.what());
+    }
+    return true;
+}
+
+bool CLogDB::IsLogFile(const boost::filesystem::path& pathFile)
+{
+    FILE* f = fopen(pathFile.string().c_str(), "rb");
+    if (!f)
+        return false;
+    char header[sizeof(LOGDB_MAGIC)];
+    bool fLog = fread(header, 1, sizeof(header), f) == sizeof(header) && memcmp(header, LOGDB_MAGIC, sizeof(header)) == 0;
+    fclose(f);
+    return fLog;
+}
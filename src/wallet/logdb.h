@@ -0,0 +1,118 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCREDIT_WALLET_LOGDB_H
+#define BITCREDIT_WALLET_LOGDB_H
+
+#include "support/allocators/zeroafterfree.h"
+#include "sync.h"
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <utility>
+
+#include <boost/filesystem/path.hpp>
+
+//! Logs smaller than this are never compacted
+static const uint64_t LOGDB_COMPACT_MIN_SIZE = 1 << 20;
+
+/** Orders keys as unsigned bytes, like the Berkeley DB btree does */
+struct CLogKeyCompare
+{
+    bool operator()(const CSerializeData& a, const CSerializeData& b) const;
+};
+
+/** Writes applied at once by CLogDB::WriteBatch: key -> (fErase, value) */
+typedef std::map<CSerializeData, std::pair<bool, CSerializeData>, CLogKeyCompare> CLogBatch;
+
+/**
+ * A key/value database kept as an append-only log of records, the storage of
+ * wallet files with -walletstorage=log.
+ *
+ * Every write or erase appends a record holding the key, the value and a
+ * CRC32C of both; the last record of a key wins. The records of a batch are
+ * followed by a commit record, and only take effect with it, so a batch that
+ * was cut short by a crash is dropped when the log is opened again. Opening
+ * maps the file into memory and scans it once, keeping the position of the
+ * value of every live key; values are read from the mapping after that.
+ * Flush() rewrites the log with only its live records once they are less
+ * than half of it.
+ *
+ * A log with an empty path lives in memory only, for mock databases.
+ */
+class CLogDB
+{
+private:
+    /** Where the value of a key is in the log, and how large its record is */
+    struct CLogPos
+    {
+        uint64_t nValuePos;
+        uint32_t nValueSize;
+        uint64_t nRecordSize;
+    };
+    typedef std::map<CSerializeData, CLogPos, CLogKeyCompare> Index;
+
+    CCriticalSection cs;
+    const boost::filesystem::path path;
+    FILE* file;
+    //! The log of an in-memory database
+    CSerializeData vMemory;
+    //! Size of the log, up to the end of the last complete record
+    uint64_t nSize;
+    //! The mapped start of the log file, and how much of it is mapped
+    const char* pMap;
+    uint64_t nMapSize;
+    Index mapIndex;
+    //! Bytes of records that are still the last of their key, and of all others
+    uint64_t nLiveBytes;
+    uint64_t nDeadBytes;
+    //! Whether there are appends that were not committed to disk yet
+    bool fDirty;
+
+    bool Map();
+    void Unmap();
+    bool Load(const char* pbegin, uint64_t nFileSize);
+    bool ReadAt(const CLogPos& pos, CSerializeData& value);
+    bool Append(const CSerializeData& vRecords);
+    void Apply(bool fErase, const CSerializeData& key, const CLogPos& pos);
+    void ApplyRecord(const unsigned char* pRecord, uint64_t nPos);
+    bool WriteRecords(const CLogBatch& batch, bool fBatch);
+
+    CLogDB(const CLogDB&);
+    void operator=(const CLogDB&);
+
+public:
+    explicit CLogDB(const boost::filesystem::path& pathIn);
+    ~CLogDB();
+
+    /** Open (or if fCreate, create) the log and load its index; false if it is not a wallet log */
+    bool Open(bool fCreate);
+    void Close();
+
+    bool Read(const CSerializeData& key, CSerializeData& value);
+    bool Exists(const CSerializeData& key);
+    bool Write(const CSerializeData& key, const CSerializeData& value, bool fOverwrite = true);
+    bool Erase(const CSerializeData& key);
+    /** Apply all writes of batch, or none of them if it cannot be logged */
+    bool WriteBatch(const CLogBatch& batch);
+
+    /**
+     * Read the record with the first key after key (at or after it, if
+     * fInclusive) into key and value. Returns false past the last key.
+     */
+    bool Seek(CSerializeData& key, CSerializeData& value, bool fInclusive);
+
+    /** Commit the log to disk, and compact it if most of it is dead */
+    bool Flush();
+    /** Rewrite the log with only the live records, leaving out the keys starting with pszSkip */
+    bool Compact(const char* pszSkip = NULL);
+    /** Copy the log, committed to disk first, to pathDest */
+    bool Backup(const boost::filesystem::path& pathDest);
+
+    /** Whether the file at pathFile starts like a wallet log */
+    static bool IsLogFile(const boost::filesystem::path& pathFile);
+};
+
+#endif // BITCREDIT_WALLET_LOGDB_H
@@ -133,9 +133,6 @@ UniValue getnewaddress(const UniValue& params, bool fHelp)
     if (params.size() > 0)
         strAccount = AccountFromValue(params[0]);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
-
     // Generate a new key that is added to wallet
     CPubKey newKey;
     if (!pwalletMain->GetKeyFromPool(newKey))
@@ -235,9 +232,6 @@ UniValue getrawchangeaddress(const UniValue& params, bool fHelp)
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
-
     CReserveKey reservekey(pwalletMain);
     CPubKey vchPubKey;
     if (!reservekey.GetReservedKey(vchPubKey))
@@ -1048,6 +1042,117 @@ UniValue sendmany(const UniValue& params, bool fHelp)
     return wtx.GetHash().GetHex();
 }
 
+UniValue createbatchpayouts(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "createbatchpayouts {\"address\":amount,...} ( maxoutputs \"comment\" )\n"
+            "\nPay many recipients in as few transactions as needed, with at most maxoutputs recipients each.\n"
+            "The coins are listed once for all transactions, and their inputs are signed together."
+            + HelpRequiringPassphrase() + "\n"
+            "\nArguments:\n"
+            "1. \"amounts\"             (string, required) A json object with addresses and amounts\n"
+            "    {\n"
+            "      \"address\":amount   (numeric or string) The bitcredit address is the key, the numeric amount (can be string) in " + CURRENCY_UNIT + " is the value\n"
+            "      ,...\n"
+            "    }\n"
+            "2. maxoutputs              (numeric, optional, default=" + strprintf("%u", DEFAULT_BATCH_PAYOUT_OUTPUTS) + ") The most recipients per transaction\n"
+            "3. \"comment\"             (string, optional) A comment stored with every transaction\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txids\": [             (array of string) The ids of the transactions, in the order of the recipients they pay\n"
+            "    \"transactionid\"\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"rejected\": [          (array of string) The ids of the transactions the mempool refused. They are\n"
+            "    \"transactionid\"      in the wallet all the same, and are broadcast again later\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"fee\": x.xxx           (numeric) The total fee paid in " + CURRENCY_UNIT + "\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("createbatchpayouts", "\"{\\\"1D1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XZ\\\":0.01,\\\"1353tsE8YMTA4EuV7dgUXGjNFf9KpVvKHz\\\":0.02}\"") +
+            "\nPay at most 100 recipients per transaction:\n"
+            + HelpExampleCli("createbatchpayouts", "\"{\\\"1D1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XZ\\\":0.01,\\\"1353tsE8YMTA4EuV7dgUXGjNFf9KpVvKHz\\\":0.02}\" 100 \"payouts\"") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("createbatchpayouts", "\"{\\\"1D1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XZ\\\":0.01,\\\"1353tsE8YMTA4EuV7dgUXGjNFf9KpVvKHz\\\":0.02}\", 100, \"payouts\"")
+        );
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    UniValue sendTo = params[0].get_obj();
+    int nMaxOutputs = DEFAULT_BATCH_PAYOUT_OUTPUTS;
+    if (params.size() > 1)
+        nMaxOutputs = params[1].get_int();
+    if (nMaxOutputs <= 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, maxoutputs must be positive");
+    string strComment;
+    if (params.size() > 2 && !params[2].isNull())
+        strComment = params[2].get_str();
+
+    set<CBitcreditAddress> setAddress;
+    vector<CRecipient> vecSend;
+
+    CAmount totalAmount = 0;
+    vector<string> keys = sendTo.getKeys();
+    BOOST_FOREACH(const string& name_, keys)
+    {
+        CBitcreditAddress address(name_);
+        if (!address.IsValid())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, string("Invalid Bitcredit address: ")+name_);
+
+        if (setAddress.count(address))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, duplicated address: ")+name_);
+        setAddress.insert(address);
+
+        CScript scriptPubKey = GetScriptForDestination(address.Get());
+        CAmount nAmount = AmountFromValue(sendTo[name_]);
+        if (nAmount <= 0)
+            throw JSONRPCError(RPC_TYPE_ERROR, "Invalid amount for send");
+        totalAmount += nAmount;
+
+        CRecipient recipient = {scriptPubKey, nAmount, false};
+        vecSend.push_back(recipient);
+    }
+    if (vecSend.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, no recipients");
+
+    EnsureWalletIsUnlocked();
+
+    // Check funds
+    if (totalAmount > pwalletMain->GetBalance())
+        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Insufficient funds");
+
+    // Send
+    vector<CWalletTx> vwtx;
+    vector<boost::shared_ptr<CReserveKey> > vKeyChange;
+    CAmount nFeeRequired = 0;
+    string strFailReason;
+    if (!pwalletMain->CreateBatchTransactions(vecSend, nMaxOutputs, vwtx, vKeyChange, nFeeRequired, strFailReason))
+        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, strFailReason);
+    if (!strComment.empty())
+        BOOST_FOREACH(CWalletTx& wtx, vwtx)
+            wtx.mapValue["comment"] = strComment;
+    vector<uint256> vRejected;
+    if (!pwalletMain->CommitBatchTransactions(vwtx, vKeyChange, vRejected))
+        throw JSONRPCError(RPC_WALLET_ERROR, "Transaction commit failed");
+
+    UniValue txids(UniValue::VARR);
+    BOOST_FOREACH(const CWalletTx& wtx, vwtx)
+        txids.push_back(wtx.GetHash().GetHex());
+    UniValue rejected(UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, vRejected)
+        rejected.push_back(hash.GetHex());
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txids", txids));
+    result.push_back(Pair("rejected", rejected));
+    result.push_back(Pair("fee", ValueFromAmount(nFeeRequired)));
+    return result;
+}
+
 // Defined in rpc/misc.cpp
 extern CScript _createmultisig_redeemScript(const UniValue& params);
 
@@ -1408,20 +1513,35 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Un
     }
 }
 
+/** The wallet order position a listtransactions or listsinceblock cursor stopped at, -1 for none */
+static int64_t ParseOrderPosCursor(const UniValue& value)
+{
+    const string& strCursor = value.get_str();
+    if (strCursor.empty())
+        return -1;
+    int64_t nOrderPos;
+    if (!ParseInt64(strCursor, &nOrderPos) || nOrderPos < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    return nOrderPos;
+}
+
 UniValue listtransactions(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() > 4)
+    if (fHelp || params.size() > 5)
         throw runtime_error(
-            "listtransactions ( \"account\" count from includeWatchonly)\n"
+            "listtransactions ( \"account\" count from includeWatchonly \"cursor\")\n"
             "\nReturns up to 'count' most recent transactions skipping the first 'from' transactions for account 'account'.\n"
             "\nArguments:\n"
             "1. \"account\"    (string, optional) DEPRECATED. The account name. Should be \"*\".\n"
             "2. count          (numeric, optional, default=10) The number of transactions to return\n"
             "3. from           (numeric, optional, default=0) The number of transactions to skip\n"
             "4. includeWatchonly (bool, optional, default=false) Include transactions to watchonly addresses (see 'importaddress')\n"
+            "5. \"cursor\"     (string, optional) Page through the transactions instead of skipping 'from' of them: \"\" for the\n"
+            "                  most recent page, or the cursor of the previous page for the next older one. Pages hold whole\n"
+            "                  wallet transactions, so they can have a few more than 'count' entries.\n"
             "\nResult:\n"
             "[\n"
             "  {\n"
@@ -1462,11 +1582,19 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
             "  }\n"
             "]\n"
 
+            "\nResult with a cursor:\n"
+            "{\n"
+            "  \"transactions\": [ ... ],     (array) As above, oldest to newest\n"
+            "  \"cursor\": \"cursor\"          (string) The cursor of the next older page, absent on the last one\n"
+            "}\n"
+
             "\nExamples:\n"
             "\nList the most recent 10 transactions in the systems\n"
             + HelpExampleCli("listtransactions", "") +
             "\nList transactions 100 to 120\n"
             + HelpExampleCli("listtransactions", "\"*\" 20 100") +
+            "\nList all transactions, 1000 at a time\n"
+            + HelpExampleCli("listtransactions", "\"*\" 1000 0 false \"\"") +
             "\nAs a json rpc call\n"
             + HelpExampleRpc("listtransactions", "\"*\", 20, 100")
         );
@@ -1496,6 +1624,40 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
 
     const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
 
+    if (params.size() > 4)
+    {
+        if (nFrom != 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot skip transactions with a cursor");
+        if (nCount == 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Count must be positive with a cursor");
+
+        // Positions in wtxOrdered are unique and persistent, a page goes on
+        // below the last one the previous page listed
+        int64_t nCursor = ParseOrderPosCursor(params[4]);
+        CWallet::TxItems::const_reverse_iterator it(nCursor < 0 ? txOrdered.end() : txOrdered.lower_bound(nCursor));
+        for (; it != txOrdered.rend() && (int)ret.size() < nCount; ++it)
+        {
+            CWalletTx *const pwtx = (*it).second.first;
+            if (pwtx != 0)
+                ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
+            CAccountingEntry *const pacentry = (*it).second.second;
+            if (pacentry != 0)
+                AcentryToJSON(*pacentry, strAccount, ret);
+            nCursor = (*it).first;
+        }
+
+        vector<UniValue> arrTmp = ret.getValues();
+        std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
+        UniValue transactions(UniValue::VARR);
+        transactions.push_backV(arrTmp);
+
+        UniValue result(UniValue::VOBJ);
+        result.push_back(Pair("transactions", transactions));
+        if (it != txOrdered.rend())
+            result.push_back(Pair("cursor", i64tostr(nCursor)));
+        return result;
+    }
+
     // iterate backwards until we have nCount items to return:
     for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
     {
@@ -1620,12 +1782,14 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
 
     if (fHelp)
         throw runtime_error(
-            "listsinceblock ( \"blockhash\" target-confirmations includeWatchonly)\n"
+            "listsinceblock ( \"blockhash\" target-confirmations includeWatchonly count \"cursor\")\n"
             "\nGet all transactions in blocks since block [blockhash], or all transactions if omitted\n"
             "\nArguments:\n"
             "1. \"blockhash\"   (string, optional) The block hash to list transactions since\n"
             "2. target-confirmations:    (numeric, optional) The confirmations required, must be 1 or more\n"
-            "3. includeWatchonly:        (bool, optional, default=false) Include transactions to watchonly addresses (see 'importaddress')"
+            "3. includeWatchonly:        (bool, optional, default=false) Include transactions to watchonly addresses (see 'importaddress')\n"
+            "4. count:                   (numeric, optional) List them a page of about 'count' entries at a time, oldest first\n"
+            "5. \"cursor\"                 (string, optional) The cursor of the previous page, \"\" or omitted for the first one"
             "\nResult:\n"
             "{\n"
             "  \"transactions\": [\n"
@@ -1647,7 +1811,8 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
             "    \"label\" : \"label\"       (string) A comment for the address/transaction, if any\n"
             "    \"to\": \"...\",            (string) If a comment to is associated with the transaction.\n"
              "  ],\n"
-            "  \"lastblock\": \"lastblockhash\"     (string) The hash of the last block\n"
+            "  \"lastblock\": \"lastblockhash\"     (string) The hash of the last block. When paging, use the one of the last page.\n"
+            "  \"cursor\": \"cursor\"     (string) With a count, the cursor of the next page, absent on the last one\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("listsinceblock", "")
@@ -1683,16 +1848,45 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
         if(params[2].get_bool())
             filter = filter | ISMINE_WATCH_ONLY;
 
+    int nCount = 0;
+    if (params.size() > 3)
+    {
+        nCount = params[3].get_int();
+        if (nCount <= 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Count must be positive");
+    }
+
     int depth = pindex ? (1 + chainActive.Height() - pindex->nHeight) : -1;
 
     UniValue transactions(UniValue::VARR);
+    string strCursor;
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+    if (nCount > 0)
+    {
+        // Transactions that arrive while paging get later positions in
+        // wtxOrdered, so the last pages still list them
+        const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
+        int64_t nCursor = params.size() > 4 ? ParseOrderPosCursor(params[4]) : -1;
+        CWallet::TxItems::const_iterator it = nCursor < 0 ? txOrdered.begin() : txOrdered.upper_bound(nCursor);
+        for (; it != txOrdered.end() && (int)transactions.size() < nCount; ++it)
+        {
+            const CWalletTx *pwtx = (*it).second.first;
+            if (pwtx != 0 && (depth == -1 || pwtx->GetDepthInMainChain() < depth))
+                ListTransactions(*pwtx, "*", 0, true, transactions, filter);
+            nCursor = (*it).first;
+        }
+        if (it != txOrdered.end())
+            strCursor = i64tostr(nCursor);
+    }
+    else
     {
-        CWalletTx tx = (*it).second;
+        for (map<uint256, CWalletTx>::const_iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+        {
+            const CWalletTx& tx = (*it).second;
 
-        if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions, filter);
+            if (depth == -1 || tx.GetDepthInMainChain() < depth)
+                ListTransactions(tx, "*", 0, true, transactions, filter);
+        }
     }
 
     CBlockIndex *pblockLast = chainActive[chainActive.Height() + 1 - target_confirms];
@@ -1701,6 +1895,8 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("transactions", transactions));
     ret.push_back(Pair("lastblock", lastblock.GetHex()));
+    if (!strCursor.empty())
+        ret.push_back(Pair("cursor", strCursor));
 
     return ret;
 }
@@ -2295,6 +2491,68 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
     return obj;
 }
 
+UniValue getrescaninfo(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrescaninfo\n"
+            "Returns the progress of the running wallet rescan, if any.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"scanning\": true|false,     (boolean) whether a rescan is running; the fields below are only there if so\n"
+            "  \"startheight\": n,           (numeric) the height the rescan started at\n"
+            "  \"height\": n,                (numeric) the height of the last block scanned\n"
+            "  \"tipheight\": n,             (numeric) the height of the active chain's tip\n"
+            "  \"progress\": x.xxx,          (numeric) the fraction of the work done, from 0 to 1\n"
+            "  \"duration\": n,              (numeric) seconds since the rescan started\n"
+            "  \"eta\": n,                   (numeric) estimated seconds left, if known\n"
+            "  \"found\": n,                 (numeric) transactions added or updated so far\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrescaninfo", "")
+            + HelpExampleRpc("getrescaninfo", "")
+        );
+
+    CWalletRescanInfo info = pwalletMain->GetRescanInfo();
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("scanning", info.fScanning));
+    if (!info.fScanning)
+        return obj;
+    int64_t nDuration = GetTimeMillis() - info.nTimeStart;
+    obj.push_back(Pair("startheight", info.nStartHeight));
+    obj.push_back(Pair("height", info.nHeight));
+    obj.push_back(Pair("tipheight", info.nTipHeight));
+    obj.push_back(Pair("progress", info.dProgress));
+    obj.push_back(Pair("duration", nDuration / 1000));
+    if (info.dProgress > 0)
+        obj.push_back(Pair("eta", (int64_t)(nDuration * (1 - info.dProgress) / info.dProgress / 1000)));
+    obj.push_back(Pair("found", info.nFound));
+    return obj;
+}
+
+UniValue abortrescan(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "abortrescan\n"
+            "Stops the running wallet rescan, e.g. one started by importprivkey, after the block it is at.\n"
+            "Transactions found so far stay in the wallet.\n"
+            "\nResult:\n"
+            "true|false    (boolean) whether a rescan was running\n"
+            "\nExamples:\n"
+            + HelpExampleCli("abortrescan", "")
+            + HelpExampleRpc("abortrescan", "")
+        );
+
+    return pwalletMain->AbortRescan();
+}
+
 UniValue resendwallettransactions(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -2320,14 +2578,56 @@ UniValue resendwallettransactions(const UniValue& params, bool fHelp)
     return result;
 }
 
+// Add out to results if it has between nMinDepth and nMaxDepth confirmations and pays to setAddress
+static void ListUnspent(const COutput& out, int nMinDepth, int nMaxDepth, const set<CBitcreditAddress>& setAddress, UniValue& results)
+{
+    if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
+        return;
+
+    if (setAddress.size()) {
+        CTxDestination address;
+        if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
+            return;
+
+        if (!setAddress.count(address))
+            return;
+    }
+
+    CAmount nValue = out.tx->vout[out.i].nValue;
+    const CScript& pk = out.tx->vout[out.i].scriptPubKey;
+    UniValue entry(UniValue::VOBJ);
+    entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
+    entry.push_back(Pair("vout", out.i));
+    CTxDestination address;
+    if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
+        entry.push_back(Pair("address", CBitcreditAddress(address).ToString()));
+        if (pwalletMain->mapAddressBook.count(address))
+            entry.push_back(Pair("account", pwalletMain->mapAddressBook[address].name));
+    }
+    entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
+    if (pk.IsPayToScriptHash()) {
+        CTxDestination address;
+        if (ExtractDestination(pk, address)) {
+            const CScriptID& hash = boost::get<CScriptID>(address);
+            CScript redeemScript;
+            if (pwalletMain->GetCScript(hash, redeemScript))
+                entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
+        }
+    }
+    entry.push_back(Pair("amount",ValueFromAmount(nValue)));
+    entry.push_back(Pair("confirmations",out.nDepth));
+    entry.push_back(Pair("spendable", out.fSpendable));
+    results.push_back(entry);
+}
+
 UniValue listunspent(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() > 3)
+    if (fHelp || params.size() > 5)
         throw runtime_error(
-            "listunspent ( minconf maxconf  [\"address\",...] )\n"
+            "listunspent ( minconf maxconf  [\"address\",...] count \"cursor\" )\n"
             "\nReturns array of unspent transaction outputs\n"
             "with between minconf and maxconf (inclusive) confirmations.\n"
             "Optionally filter to only include txouts paid to specified addresses.\n"
@@ -2341,6 +2641,8 @@ UniValue listunspent(const UniValue& params, bool fHelp)
             "      \"address\"   (string) bitcredit address\n"
             "      ,...\n"
             "    ]\n"
+            "4. count            (numeric, optional) List them 'count' at a time, in the order of their transaction ids\n"
+            "5. \"cursor\"       (string, optional) The cursor of the previous page, \"\" or omitted for the first one\n"
             "\nResult\n"
             "[                   (array of json object)\n"
             "  {\n"
@@ -2354,6 +2656,11 @@ UniValue listunspent(const UniValue& params, bool fHelp)
             "  }\n"
             "  ,...\n"
             "]\n"
+            "\nResult with a count\n"
+            "{\n"
+            "  \"unspent\": [ ... ],      (array of json object) As above\n"
+            "  \"cursor\": \"cursor\"      (string) The cursor of the next page, absent on the last one\n"
+            "}\n"
 
             "\nExamples\n"
             + HelpExampleCli("listunspent", "")
@@ -2361,7 +2668,7 @@ UniValue listunspent(const UniValue& params, bool fHelp)
             + HelpExampleRpc("listunspent", "6, 9999999 \"[\\\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\\\",\\\"1LtvqCaApEdUGFkpKMM4MstjcaL4dKg8SP\\\"]\"")
         );
 
-    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM)(UniValue::VNUM)(UniValue::VARR));
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM)(UniValue::VNUM)(UniValue::VARR)(UniValue::VNUM)(UniValue::VSTR));
 
     int nMinDepth = 1;
     if (params.size() > 0)
@@ -2385,52 +2692,50 @@ UniValue listunspent(const UniValue& params, bool fHelp)
         }
     }
 
+    int nCount = 0;
+    if (params.size() > 3) {
+        nCount = params[3].get_int();
+        if (nCount <= 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Count must be positive");
+    }
+
+    COutPoint outpointCursor;
+    if (params.size() > 4 && !params[4].get_str().empty()) {
+        // The cursor is the last outpoint the previous page looked at, "txid:n"
+        const string& strCursor = params[4].get_str();
+        string strHash = strCursor.substr(0, strCursor.find(':'));
+        int64_t n;
+        if (strHash.size() != 64 || !IsHex(strHash) || strCursor.size() < 66 || !ParseInt64(strCursor.substr(65), &n) || n < 0 || n > std::numeric_limits<int>::max())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        outpointCursor = COutPoint(uint256S(strHash), n);
+    }
+
     UniValue results(UniValue::VARR);
     vector<COutput> vecOutputs;
     assert(pwalletMain != NULL);
     LOCK2(cs_main, pwalletMain->cs_wallet);
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
-    BOOST_FOREACH(const COutput& out, vecOutputs) {
-        if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
-            continue;
-
-        if (setAddress.size()) {
-            CTxDestination address;
-            if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
-                continue;
-
-            if (!setAddress.count(address))
-                continue;
-        }
+    if (nCount == 0) {
+        pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
+        BOOST_FOREACH(const COutput& out, vecOutputs)
+            ListUnspent(out, nMinDepth, nMaxDepth, setAddress, results);
+        return results;
+    }
 
-        CAmount nValue = out.tx->vout[out.i].nValue;
-        const CScript& pk = out.tx->vout[out.i].scriptPubKey;
-        UniValue entry(UniValue::VOBJ);
-        entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
-        entry.push_back(Pair("vout", out.i));
-        CTxDestination address;
-        if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
-            entry.push_back(Pair("address", CBitcreditAddress(address).ToString()));
-            if (pwalletMain->mapAddressBook.count(address))
-                entry.push_back(Pair("account", pwalletMain->mapAddressBook[address].name));
-        }
-        entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
-        if (pk.IsPayToScriptHash()) {
-            CTxDestination address;
-            if (ExtractDestination(pk, address)) {
-                const CScriptID& hash = boost::get<CScriptID>(address);
-                CScript redeemScript;
-                if (pwalletMain->GetCScript(hash, redeemScript))
-                    entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
-            }
-        }
-        entry.push_back(Pair("amount",ValueFromAmount(nValue)));
-        entry.push_back(Pair("confirmations",out.nDepth));
-        entry.push_back(Pair("spendable", out.fSpendable));
-        results.push_back(entry);
+    // Fetch pages of coins until enough of them passed the filters
+    bool fMore = true;
+    while (fMore && (int)results.size() < nCount) {
+        fMore = pwalletMain->AvailableCoinsAfter(vecOutputs, outpointCursor, nCount - results.size(), false, true);
+        BOOST_FOREACH(const COutput& out, vecOutputs)
+            ListUnspent(out, nMinDepth, nMaxDepth, setAddress, results);
+        if (!vecOutputs.empty())
+            outpointCursor = COutPoint(vecOutputs.back().tx->GetHash(), vecOutputs.back().i);
     }
 
-    return results;
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("unspent", results));
+    if (fMore)
+        ret.push_back(Pair("cursor", outpointCursor.hash.GetHex() + ":" + i64tostr(outpointCursor.n)));
+    return ret;
 }
 
 UniValue fundrawtransaction(const UniValue& params, bool fHelp)
@@ -2512,8 +2817,10 @@ const CRPCCommand vWalletRPCCommands[] =
     { "rawtransactions",    "fundrawtransaction",       &fundrawtransaction,       false },
     { "hidden",             "resendwallettransactions", &resendwallettransactions, true  },
     { "wallet",             "abandontransaction",       &abandontransaction,       false },
+    { "wallet",             "abortrescan",              &abortrescan,              true  },
     { "wallet",             "addmultisigaddress",       &addmultisigaddress,       true  },
     { "wallet",             "backupwallet",             &backupwallet,             true  },
+    { "wallet",             "createbatchpayouts",       &createbatchpayouts,       false },
     { "wallet",             "dumpprivkey",              &dumpprivkey,              true  },
     { "wallet",             "dumpwallet",               &dumpwallet,               true  },
     { "wallet",             "encryptwallet",            &encryptwallet,            true  },
@@ -2525,6 +2832,7 @@ const CRPCCommand vWalletRPCCommands[] =
     { "wallet",             "getrawchangeaddress",      &getrawchangeaddress,      true  },
     { "wallet",             "getreceivedbyaccount",     &getreceivedbyaccount,     false },
     { "wallet",             "getreceivedbyaddress",     &getreceivedbyaddress,     false },
+    { "wallet",             "getrescaninfo",            &getrescaninfo,            true  },
     { "wallet",             "gettransaction",           &gettransaction,           false },
     { "wallet",             "getunconfirmedbalance",    &getunconfirmedbalance,    false },
     { "wallet",             "getwalletinfo",            &getwalletinfo,            false },
@@ -0,0 +1,204 @@
+// Copyright (c) 2016 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/logdb.h"
+
+#include "util.h"
+
+#include <stdio.h>
+#include <string>
+
+#include "test/test_bitcredit.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_FIXTURE_TEST_SUITE(logdb_tests, TestingSetup)
+
+static CSerializeData Data(const string& str)
+{
+    return CSerializeData(str.begin(), str.end());
+}
+
+static string Read(CLogDB& db, const string& strKey)
+{
+    CSerializeData value;
+    if (!db.Read(Data(strKey), value))
+        return "<none>";
+    return string(value.begin(), value.end());
+}
+
+static void CutFile(const boost::filesystem::path& path, unsigned int nBytes)
+{
+    unsigned int nSize = boost::filesystem::file_size(path);
+    FILE* file = fopen(path.string().c_str(), "rb+");
+    BOOST_CHECK(TruncateFile(file, nSize - nBytes));
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_write_read)
+{
+    boost::filesystem::path path = pathTemp / "logdb_write_read.dat";
+    {
+        CLogDB db(path);
+        BOOST_CHECK(!db.Open(false));
+        BOOST_CHECK(db.Open(true));
+        BOOST_CHECK(CLogDB::IsLogFile(path));
+        BOOST_CHECK(db.Write(Data("a"), Data("1")));
+        BOOST_CHECK(db.Write(Data("b"), Data("2")));
+        BOOST_CHECK(db.Write(Data("c"), Data("")));
+        BOOST_CHECK(!db.Write(Data("a"), Data("x"), false));
+        BOOST_CHECK(db.Write(Data("a"), Data("3")));
+        BOOST_CHECK(db.Erase(Data("b")));
+        BOOST_CHECK(db.Erase(Data("missing")));
+        BOOST_CHECK_EQUAL(Read(db, "a"), "3");
+        BOOST_CHECK_EQUAL(Read(db, "b"), "<none>");
+        BOOST_CHECK(db.Exists(Data("c")));
+        BOOST_CHECK(!db.Exists(Data("b")));
+        BOOST_CHECK(db.Flush());
+    }
+
+    // Everything is read back from the file
+    CLogDB db(path);
+    BOOST_CHECK(db.Open(false));
+    BOOST_CHECK_EQUAL(Read(db, "a"), "3");
+    BOOST_CHECK_EQUAL(Read(db, "b"), "<none>");
+    BOOST_CHECK_EQUAL(Read(db, "c"), "");
+
+    // Seek walks the keys in order
+    CSerializeData key, value;
+    BOOST_CHECK(db.Seek(key, value, true));
+    BOOST_CHECK(key == Data("a"));
+    BOOST_CHECK(db.Seek(key, value, false));
+    BOOST_CHECK(key == Data("c"));
+    BOOST_CHECK(!db.Seek(key, value, false));
+    key = Data("b");
+    BOOST_CHECK(db.Seek(key, value, true));
+    BOOST_CHECK(key == Data("c"));
+}
+
+BOOST_AUTO_TEST_CASE(logdb_torn_writes)
+{
+    boost::filesystem::path path = pathTemp / "logdb_torn_writes.dat";
+    {
+        CLogDB db(path);
+        BOOST_CHECK(db.Open(true));
+        BOOST_CHECK(db.Write(Data("a"), Data("1")));
+        CLogBatch batch;
+        batch[Data("a")] = make_pair(true, CSerializeData());
+        batch[Data("b")] = make_pair(false, Data("2"));
+        batch[Data("c")] = make_pair(false, Data("3"));
+        BOOST_CHECK(db.WriteBatch(batch));
+        BOOST_CHECK_EQUAL(Read(db, "a"), "<none>");
+        BOOST_CHECK_EQUAL(Read(db, "b"), "2");
+    }
+
+    // A batch without its commit record is dropped as a whole
+    CutFile(path, 1);
+    {
+        CLogDB db(path);
+        BOOST_CHECK(db.Open(false));
+        BOOST_CHECK_EQUAL(Read(db, "a"), "1");
+        BOOST_CHECK_EQUAL(Read(db, "b"), "<none>");
+        BOOST_CHECK_EQUAL(Read(db, "c"), "<none>");
+        // and the log carries on after the last good record
+        BOOST_CHECK(db.Write(Data("d"), Data("4")));
+    }
+    {
+        CLogDB db(path);
+        BOOST_CHECK(db.Open(false));
+        BOOST_CHECK_EQUAL(Read(db, "a"), "1");
+        BOOST_CHECK_EQUAL(Read(db, "d"), "4");
+    }
+
+    // A record that fails its checksum ends the log, which is backed up first
+    unsigned int nSize = boost::filesystem::file_size(path);
+    FILE* file = fopen(path.string().c_str(), "rb+");
+    fseek(file, nSize - 6, SEEK_SET);
+    fputc('5', file);
+    fclose(file);
+    CLogDB db(path);
+    BOOST_CHECK(db.Open(false));
+    BOOST_CHECK_EQUAL(Read(db, "a"), "1");
+    BOOST_CHECK_EQUAL(Read(db, "d"), "<none>");
+    BOOST_CHECK(boost::filesystem::file_size(path) < nSize);
+
+    // Not a log at all
+    FILE* fileOther = fopen((pathTemp / "logdb_other.dat").string().c_str(), "wb");
+    fputs("not a wallet log", fileOther);
+    fclose(fileOther);
+    CLogDB dbOther(pathTemp / "logdb_other.dat");
+    BOOST_CHECK(!CLogDB::IsLogFile(pathTemp / "logdb_other.dat"));
+    BOOST_CHECK(!dbOther.Open(false));
+}
+
+BOOST_AUTO_TEST_CASE(logdb_compact)
+{
+    boost::filesystem::path path = pathTemp / "logdb_compact.dat";
+    CLogDB db(path);
+    BOOST_CHECK(db.Open(true));
+    string strValue(1000, 'v');
+    for (int i = 0; i < 100; i++) {
+        BOOST_CHECK(db.Write(Data(strprintf("key%d", i % 10)), Data(strValue + strprintf("%d", i))));
+        BOOST_CHECK(db.Write(Data(strprintf("skip%d", i % 10)), Data("secret")));
+    }
+    uint64_t nSize = boost::filesystem::file_size(path);
+
+    BOOST_CHECK(db.Compact("skip"));
+    BOOST_CHECK(boost::filesystem::file_size(path) < nSize / 5);
+    BOOST_CHECK(!boost::filesystem::exists(path.string() + ".compact"));
+    BOOST_CHECK_EQUAL(Read(db, "key3"), strValue + "93");
+    BOOST_CHECK_EQUAL(Read(db, "skip3"), "<none>");
+
+    // Writes after compacting go on top of the compacted log
+    BOOST_CHECK(db.Write(Data("key3"), Data("3")));
+    db.Close();
+    BOOST_CHECK(db.Open(false));
+    BOOST_CHECK_EQUAL(Read(db, "key3"), "3");
+    BOOST_CHECK_EQUAL(Read(db, "key9"), strValue + "99");
+    BOOST_CHECK_EQUAL(Read(db, "skip9"), "<none>");
+
+    // An in-memory log keeps its records over Close() and Open()
+    CLogDB dbMemory((boost::filesystem::path()));
+    BOOST_CHECK(dbMemory.Open(true));
+    BOOST_CHECK(dbMemory.Write(Data("a"), Data("1")));
+    BOOST_CHECK(dbMemory.Compact());
+    dbMemory.Close();
+    BOOST_CHECK(dbMemory.Open(false));
+    BOOST_CHECK_EQUAL(Read(dbMemory, "a"), "1");
+}
+
+BOOST_AUTO_TEST_CASE(logdb_backup)
+{
+    boost::filesystem::path path = pathTemp / "logdb_backup.dat";
+    boost::filesystem::path pathBackup = pathTemp / "logdb_backup.bak";
+    CLogDB db(path);
+    BOOST_CHECK(db.Open(true));
+    BOOST_CHECK(db.Write(Data("a"), Data("1")));
+
+    // The copy of an open log holds everything written so far
+    BOOST_CHECK(db.Backup(pathBackup));
+    BOOST_CHECK(db.Write(Data("b"), Data("2")));
+    {
+        CLogDB dbBackup(pathBackup);
+        BOOST_CHECK(dbBackup.Open(false));
+        BOOST_CHECK_EQUAL(Read(dbBackup, "a"), "1");
+        BOOST_CHECK_EQUAL(Read(dbBackup, "b"), "<none>");
+    }
+
+    // Backing up again replaces the copy
+    BOOST_CHECK(db.Backup(pathBackup));
+    CLogDB dbBackup(pathBackup);
+    BOOST_CHECK(dbBackup.Open(false));
+    BOOST_CHECK_EQUAL(Read(dbBackup, "b"), "2");
+
+    // An in-memory log has no file to copy
+    CLogDB dbMemory((boost::filesystem::path()));
+    BOOST_CHECK(dbMemory.Open(true));
+    BOOST_CHECK(!dbMemory.Backup(pathTemp / "logdb_backup_memory.bak"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
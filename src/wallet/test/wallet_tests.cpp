@@ -4,6 +4,11 @@
 
 #include "wallet/wallet.h"
 
+#include "consensus/consensus.h"
+#include "darksend.h"
+#include "main.h"
+#include "random.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -11,8 +16,10 @@
 
 #include "test/test_bitcredit.h"
 
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -23,6 +30,8 @@
 
 using namespace std;
 
+extern CWallet* pwalletMain;
+
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
 BOOST_FIXTURE_TEST_SUITE(wallet_tests, TestingSetup)
@@ -361,4 +370,357 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 101);
 }
 
+BOOST_AUTO_TEST_CASE(rescan_script_filter)
+{
+    CWallet keystore;
+    LOCK(keystore.cs_wallet);
+    CKey key[4];
+    for (int i = 0; i < 4; i++)
+        key[i].MakeNewKey(i % 2 == 0);
+    BOOST_CHECK(keystore.AddKey(key[0]));
+    BOOST_CHECK(keystore.AddKey(key[1]));
+    std::vector<CPubKey> vMultisig;
+    vMultisig.push_back(key[0].GetPubKey());
+    vMultisig.push_back(key[1].GetPubKey());
+    CScript scriptMultisig = GetScriptForMultisig(2, vMultisig);
+    BOOST_CHECK(keystore.AddCScript(scriptMultisig));
+    CScript scriptWatched = CScript() << OP_RETURN << std::vector<unsigned char>(8, 1);
+    BOOST_CHECK(keystore.AddWatchOnly(scriptWatched));
+    CWalletScriptFilter filter;
+    keystore.GetScriptFilter(filter);
+
+    std::vector<CScript> vScripts;
+    for (int i = 0; i < 4; i++) {
+        vScripts.push_back(GetScriptForDestination(key[i].GetPubKey().GetID()));
+        vScripts.push_back(GetScriptForRawPubKey(key[i].GetPubKey()));
+    }
+    vScripts.push_back(scriptMultisig);
+    vScripts.push_back(GetScriptForDestination(CScriptID(scriptMultisig)));
+    vMultisig[1] = key[2].GetPubKey();
+    vScripts.push_back(GetScriptForMultisig(1, vMultisig));
+    vScripts.push_back(GetScriptForDestination(CScriptID(GetScriptForMultisig(1, vMultisig))));
+    vScripts.push_back(scriptWatched);
+    vScripts.push_back(CScript() << OP_RETURN << std::vector<unsigned char>(8, 2));
+    vScripts.push_back(CScript() << OP_1);
+
+    // Everything IsMine recognizes matches, and none of the foreign keys do
+    BOOST_FOREACH(const CScript& script, vScripts) {
+        if (IsMine(keystore, script) != ISMINE_NO)
+            BOOST_CHECK(filter.MatchesScript(script));
+    }
+    BOOST_CHECK(!filter.MatchesScript(vScripts[5]));
+    BOOST_CHECK(!filter.MatchesScript(vScripts[7]));
+    BOOST_CHECK(!filter.MatchesScript(vScripts[11]));
+    BOOST_CHECK(!filter.MatchesScript(vScripts[14]));
+
+    // Transactions spending from or conflicting with a wallet transaction match by txid
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = vScripts[6];
+    BOOST_CHECK(!filter.Matches(tx));
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+    txSpend.vout = tx.vout;
+    CMutableTransaction txConflict(tx);
+    txConflict.vout[0].nValue = 1;
+    filter.AddTx(tx);
+    BOOST_CHECK(filter.Matches(tx));
+    BOOST_CHECK(filter.Matches(txSpend));
+    BOOST_CHECK(filter.Matches(txConflict));
+}
+
+static CBlockIndex* GetGenesis()
+{
+    LOCK(cs_main);
+    return chainActive.Genesis();
+}
+
+// Add key to wallet and scan the whole chain for it, returning the number of transactions found
+static int AddKeyAndScan(CWallet& wallet, const CKey& key)
+{
+    {
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK(wallet.AddKey(key));
+    }
+    return wallet.ScanForWalletTransactions(GetGenesis());
+}
+
+// A transaction spending prevout, paid to scriptPubKey of key, back to scriptPubKey in one output of each of vValues
+static CMutableTransaction SpendToSelf(const CKey& key, const CScript& scriptPubKey, const COutPoint& prevout, const vector<CAmount>& vValues)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    BOOST_FOREACH(CAmount nValue, vValues)
+        tx.vout.push_back(CTxOut(nValue, scriptPubKey));
+    vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+BOOST_FIXTURE_TEST_CASE(rescan_pipeline, TestChain100Setup)
+{
+    CBlockIndex* pindexGenesis = GetGenesis();
+
+    // Every coinbase pays to coinbaseKey
+    CWallet wallet;
+    BOOST_CHECK_EQUAL(AddKeyAndScan(wallet, coinbaseKey), (int)coinbaseTxns.size());
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), coinbaseTxns.size());
+    BOOST_FOREACH(const CTransaction& tx, coinbaseTxns)
+        BOOST_CHECK(wallet.mapWallet.count(tx.GetHash()));
+    CWalletRescanInfo info = wallet.GetRescanInfo();
+    BOOST_CHECK(!info.fScanning);
+    BOOST_CHECK_EQUAL(info.nFound, (int)coinbaseTxns.size());
+    BOOST_CHECK(!wallet.AbortRescan());
+
+    // Scanning again only updates them, and a wallet without the key finds nothing
+    BOOST_CHECK_EQUAL(wallet.ScanForWalletTransactions(pindexGenesis), 0);
+    BOOST_CHECK_EQUAL(wallet.ScanForWalletTransactions(pindexGenesis, true), (int)coinbaseTxns.size());
+    CWallet walletEmpty;
+    BOOST_CHECK_EQUAL(walletEmpty.ScanForWalletTransactions(pindexGenesis), 0);
+    BOOST_CHECK(walletEmpty.mapWallet.empty());
+}
+
+BOOST_AUTO_TEST_CASE(select_coins_bnb)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    empty_wallet();
+
+    // Many coins that differ in value, where any three coins i, j and k with
+    // i + j + k = 339 add up to the target (and no other number of coins
+    // does): the branch and bound search finds one of them every time
+    for (int i = 0; i < 200; i++)
+        add_coin(1000 * COIN + 7919 * i);
+    for (int i = 0; i < RUN_TESTS; i++)
+    {
+        BOOST_CHECK(wallet.SelectCoinsMinConf(3000 * COIN + 7919 * (17 + 123 + 199), 1, 6, vCoins, setCoinsRet, nValueRet));
+        BOOST_CHECK_EQUAL(nValueRet, 3000 * COIN + 7919 * (17 + 123 + 199));
+        BOOST_CHECK_EQUAL(setCoinsRet.size(), 3U);
+    }
+
+    // A single subset adds up to the target, and it leaves out the largest
+    // coin, so the search has to backtrack to find it
+    empty_wallet();
+    const CAmount nValues[] = {4874, 4489, 4256, 3334, 3095, 2752, 1858, 1335, 871, 693, 575, 495};
+    BOOST_FOREACH(CAmount nValue, nValues)
+        add_coin(nValue * CENT);
+    for (int i = 0; i < RUN_TESTS; i++)
+    {
+        BOOST_CHECK(wallet.SelectCoinsMinConf((4489 + 3095 + 1335 + 575) * CENT, 1, 6, vCoins, setCoinsRet, nValueRet));
+        BOOST_CHECK_EQUAL(nValueRet, (4489 + 3095 + 1335 + 575) * CENT);
+        BOOST_CHECK_EQUAL(setCoinsRet.size(), 4U);
+    }
+
+    // No subset of coins worth an even number of satoshis adds up to an odd
+    // target. The search could not rule them all out in any reasonable time;
+    // it gives up after SELECT_COINS_BNB_TRIES steps and the stochastic
+    // approximation picks coins worth more than the target instead
+    empty_wallet();
+    for (int i = 0; i < 200; i++)
+        add_coin(1000 * COIN + 2 * 7919 * i);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(50000 * COIN + 1, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK(nValueRet > 50000 * COIN + 1);
+
+    // Coins worth less than the fee to spend them are never selected
+    empty_wallet();
+    add_coin(CWallet::GetRequiredFee(SELECT_COINS_INPUT_SIZE));
+    add_coin(CENT);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(CENT, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, CENT);
+    BOOST_CHECK(!wallet.SelectCoinsMinConf(CENT + 1, 1, 6, vCoins, setCoinsRet, nValueRet));
+
+    empty_wallet();
+}
+
+// The balances and coins as they were computed before the balance index, by walking all of mapWallet
+static void CheckBalanceIndex(const CWallet& wallet)
+{
+    LOCK2(cs_main, wallet.cs_wallet);
+    CAmount nTrusted = 0, nUnconfirmed = 0, nImmature = 0;
+    size_t nCoins = 0;
+    for (map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it)
+    {
+        const CWalletTx& wtx = it->second;
+        if (wtx.IsTrusted())
+            nTrusted += wtx.GetAvailableCredit(false);
+        else if (wtx.GetDepthInMainChain() == 0 && wtx.InMempool())
+            nUnconfirmed += wtx.GetAvailableCredit(false);
+        nImmature += wtx.GetImmatureCredit(false);
+        if (wtx.GetDepthInMainChain() > 0 && wtx.GetBlocksToMaturity() == 0)
+            for (unsigned int i = 0; i < wtx.vout.size(); i++)
+                if (wallet.IsMine(wtx.vout[i]) != ISMINE_NO && !wallet.IsSpent(wtx.GetHash(), i))
+                    nCoins++;
+    }
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), nTrusted);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), nUnconfirmed);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), nImmature);
+    vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), nCoins);
+
+    // The lookup by value finds the same coins of each amount
+    map<CAmount, size_t> mapCoinsByValue;
+    BOOST_FOREACH(const COutput& out, vCoins)
+        mapCoinsByValue[out.tx->vout[out.i].nValue]++;
+    for (map<CAmount, size_t>::const_iterator it = mapCoinsByValue.begin(); it != mapCoinsByValue.end(); ++it) {
+        vector<COutput> vCoinsByValue;
+        wallet.AvailableCoinsByValue(vCoinsByValue, it->first);
+        BOOST_CHECK_EQUAL(vCoinsByValue.size(), it->second);
+    }
+    vector<COutput> vCoinsNone;
+    wallet.AvailableCoinsByValue(vCoinsNone, 1);
+    BOOST_CHECK(vCoinsNone.empty());
+}
+
+BOOST_FIXTURE_TEST_CASE(balance_index, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CWallet wallet;
+    AddKeyAndScan(wallet, coinbaseKey);
+    CheckBalanceIndex(wallet);
+    // The chain is COINBASE_MATURITY blocks long, none of its coinbases are mature yet
+    CAmount nBalance = 0;
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 0);
+    BOOST_CHECK(wallet.GetImmatureBalance() > 0);
+
+    // Each new block to us matures one more coinbase, and the index follows
+    // through SyncTransaction alone
+    RegisterValidationInterface(&wallet);
+    for (int i = 0; i < 3; i++) {
+        CreateAndProcessBlock(vector<CMutableTransaction>(), scriptPubKey);
+        nBalance += coinbaseTxns[coinbaseTxns.size() - COINBASE_MATURITY + i].vout[0].nValue;
+        BOOST_CHECK_EQUAL(wallet.GetBalance(), nBalance);
+        CheckBalanceIndex(wallet);
+    }
+
+    // Spending a coin back to ourselves takes only the fee out of the balance
+    CMutableTransaction spend = SpendToSelf(coinbaseKey, scriptPubKey, COutPoint(coinbaseTxns[0].GetHash(), 0),
+                                            vector<CAmount>(1, coinbaseTxns[0].vout[0].nValue - CENT));
+    CreateAndProcessBlock(vector<CMutableTransaction>(1, spend), CScript() << OP_TRUE);
+    nBalance -= CENT;
+    nBalance += coinbaseTxns[coinbaseTxns.size() - COINBASE_MATURITY + 3].vout[0].nValue;
+    BOOST_CHECK(wallet.mapWallet.count(spend.GetHash()));
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), nBalance);
+    CheckBalanceIndex(wallet);
+    UnregisterValidationInterface(&wallet);
+
+    // A full rebuild agrees with the incremental updates
+    wallet.MarkDirty();
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), nBalance);
+    CheckBalanceIndex(wallet);
+}
+
+BOOST_FIXTURE_TEST_CASE(darksend_denominations, TestChain100Setup)
+{
+    const CAmount nDenomLarge = COIN + 1000, nDenomSmall = COIN / 10 + 100;
+    darkSendDenominations.push_back(nDenomLarge);
+    darkSendDenominations.push_back(nDenomSmall);
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CWallet wallet;
+    AddKeyAndScan(wallet, coinbaseKey);
+    RegisterValidationInterface(&wallet);
+
+    // Denominating a coinbase, with change and a collateral output, and
+    // mixing one of the large denominations into small ones
+    vector<CAmount> vValues(4, nDenomLarge);
+    vValues.insert(vValues.end(), 3, nDenomSmall);
+    vValues.push_back(DARKSEND_COLLATERAL + DARKSEND_FEE);
+    vValues.push_back(COIN);
+    CMutableTransaction txDenominate = SpendToSelf(coinbaseKey, scriptPubKey, COutPoint(coinbaseTxns[0].GetHash(), 0), vValues);
+    CMutableTransaction txMix = SpendToSelf(coinbaseKey, scriptPubKey, COutPoint(txDenominate.GetHash(), 0), vector<CAmount>(10, nDenomSmall));
+    CreateAndProcessBlock(vector<CMutableTransaction>(1, txDenominate), CScript() << OP_TRUE);
+    CreateAndProcessBlock(vector<CMutableTransaction>(1, txMix), CScript() << OP_TRUE);
+    UnregisterValidationInterface(&wallet);
+
+    BOOST_CHECK_EQUAL(wallet.GetOutputDarksendRounds(COutPoint(txDenominate.GetHash(), 1)), 0);
+    BOOST_CHECK_EQUAL(wallet.GetOutputDarksendRounds(COutPoint(txDenominate.GetHash(), 7)), -3);
+    BOOST_CHECK_EQUAL(wallet.GetOutputDarksendRounds(COutPoint(txDenominate.GetHash(), 8)), -2);
+    BOOST_CHECK_EQUAL(wallet.GetOutputDarksendRounds(COutPoint(txMix.GetHash(), 3)), 1);
+    BOOST_CHECK_EQUAL(wallet.GetOutputDarksendRounds(COutPoint(txMix.GetHash(), 10)), -4);
+    BOOST_CHECK_EQUAL(wallet.GetOutputDarksendRounds(COutPoint(GetRandHash(), 0)), -1);
+    BOOST_CHECK_EQUAL(wallet.CountInputsWithAmount(nDenomLarge), 3);
+    BOOST_CHECK_EQUAL(wallet.CountInputsWithAmount(nDenomSmall), 13);
+    BOOST_CHECK(!wallet.HasCollateralInputs());
+
+    // Only the coins in the rounds asked for are taken, up to the maximum
+    vector<CTxIn> vin;
+    vector<COutput> vCoins;
+    CAmount nValueRet;
+    BOOST_CHECK(wallet.SelectCoinsByDenominations(1 << 1, nDenomSmall, 100 * COIN, vin, vCoins, nValueRet, 1, 5));
+    BOOST_CHECK_EQUAL(vin.size(), 10U);
+    BOOST_CHECK_EQUAL(nValueRet, 10 * nDenomSmall);
+    BOOST_FOREACH(const CTxIn& txin, vin)
+        BOOST_CHECK(txin.prevout.hash == txMix.GetHash());
+    BOOST_CHECK(wallet.SelectCoinsByDenominations((1 << 0) | (1 << 1), 0, 2 * nDenomLarge + nDenomSmall, vin, vCoins, nValueRet, 0, 5));
+    BOOST_CHECK_EQUAL(vin.size(), 3U);
+    BOOST_CHECK_EQUAL(vCoins.size(), 3U);
+    BOOST_CHECK_EQUAL(nValueRet, 2 * nDenomLarge + nDenomSmall);
+    BOOST_CHECK(!wallet.SelectCoinsByDenominations(1 << 0, 4 * nDenomLarge, 100 * COIN, vin, vCoins, nValueRet, 0, 5));
+    BOOST_CHECK_EQUAL(nValueRet, 3 * nDenomLarge);
+
+    // Rounds worked out before the transaction an input comes from was in
+    // the wallet are worked out again once it is added
+    CWallet walletLate;
+    {
+        LOCK2(cs_main, walletLate.cs_wallet);
+        BOOST_CHECK(walletLate.AddKey(coinbaseKey));
+        walletLate.AddToWallet(CWalletTx(&walletLate, txMix), true, NULL);
+        BOOST_CHECK_EQUAL(walletLate.GetOutputDarksendRounds(COutPoint(txMix.GetHash(), 3)), 0);
+        walletLate.AddToWallet(CWalletTx(&walletLate, txDenominate), true, NULL);
+        BOOST_CHECK_EQUAL(walletLate.GetOutputDarksendRounds(COutPoint(txMix.GetHash(), 3)), 1);
+    }
+
+    darkSendDenominations.clear();
+}
+
+BOOST_AUTO_TEST_CASE(keypool_topup)
+{
+    CWallet* pwallet = pwalletMain;
+    {
+        LOCK(pwallet->cs_wallet);
+        BOOST_CHECK(pwallet->TopUpKeyPool(250));
+        BOOST_CHECK_EQUAL(pwallet->GetKeyPoolSize(), 251U);
+    }
+    // Every pool entry was written, and its key is in the wallet
+    {
+        CWalletDB walletdb(pwallet->strWalletFile);
+        for (int64_t nIndex = 1; nIndex <= 251; nIndex++) {
+            CKeyPool keypool;
+            BOOST_CHECK(walletdb.ReadPool(nIndex, keypool));
+            BOOST_CHECK(pwallet->HaveKey(keypool.vchPubKey.GetID()));
+        }
+    }
+
+    // With ThreadTopUpKeyPool running, taking a key below -keypoolmin has
+    // the keypool refilled in the background
+    mapArgs["-keypool"] = "400";
+    mapArgs["-keypoolmin"] = "300";
+    boost::thread thread(boost::bind(&ThreadTopUpKeyPool, pwallet));
+    while (!pwallet->RequestKeyPoolTopUp())
+        MilliSleep(1);
+    CPubKey pubkey;
+    BOOST_CHECK(pwallet->GetKeyFromPool(pubkey));
+    unsigned int nSize = 0;
+    for (int64_t nStart = GetTimeMillis(); nSize < 401 && GetTimeMillis() - nStart < 30000; MilliSleep(10)) {
+        LOCK(pwallet->cs_wallet);
+        nSize = pwallet->GetKeyPoolSize();
+    }
+    BOOST_CHECK_EQUAL(nSize, 401U);
+    thread.interrupt();
+    thread.join();
+    BOOST_CHECK(!pwallet->RequestKeyPoolTopUp());
+    mapArgs.erase("-keypool");
+    mapArgs.erase("-keypoolmin");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
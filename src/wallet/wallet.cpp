@@ -9,10 +9,12 @@
 #include "basenode.h"
 #include "checkpoints.h"
 #include "chain.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
 #include "darksend.h"
+#include "init.h"
 #include "key.h"
 #include "keystore.h"
 #include "main.h"
@@ -31,6 +33,7 @@
 #include <assert.h>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -77,6 +80,36 @@ std::string COutput::ToString() const
     return strprintf("COutput(%s, %d, %d) [%s]", tx->GetHash().ToString(), i, nDepth, FormatMoney(tx->vout[i].nValue));
 }
 
+/** Makes one key of a keypool top-up, on the signing threads */
+class CKeyGenerator
+{
+private:
+    CKey* pkey;
+    CPubKey* ppubkey;
+    bool fCompressed;
+
+public:
+    CKeyGenerator(CKey* pkeyIn, CPubKey* ppubkeyIn, bool fCompressedIn) : pkey(pkeyIn), ppubkey(ppubkeyIn), fCompressed(fCompressedIn) {}
+
+    bool operator()()
+    {
+        pkey->MakeNewKey(fCompressed);
+        *ppubkey = pkey->GetPubKey();
+        return pkey->VerifyPubKey(*ppubkey);
+    }
+};
+
+/** Make a new key for every element of vKeys, and put their public keys in vPubKeys */
+static bool GenerateKeys(std::vector<CKey>& vKeys, std::vector<CPubKey>& vPubKeys, bool fCompressed)
+{
+    vPubKeys.resize(vKeys.size());
+    std::vector<CSigningTask> vTasks;
+    vTasks.reserve(vKeys.size());
+    for (unsigned int i = 0; i < vKeys.size(); i++)
+        vTasks.push_back(CKeyGenerator(&vKeys[i], &vPubKeys[i], fCompressed));
+    return RunSigningTasks(vTasks);
+}
+
 const CWalletTx* CWallet::GetWalletTx(const uint256& hash) const
 {
     LOCK(cs_wallet);
@@ -112,11 +145,20 @@ CPubKey CWallet::GenerateNewKey()
     return pubkey;
 }
 
-bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
+bool CWallet::AddKeyPubKeyWithDB(CWalletDB& walletdb, const CKey& secret, const CPubKey& pubkey)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
-    if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
+
+    // Encrypted keys are added to the keystore here rather than through our
+    // AddCryptedKey, so that they are written with walletdb below
+    std::vector<unsigned char> vchCryptedSecret;
+    if (IsCrypted()) {
+        if (!EncryptKey(secret, pubkey, vchCryptedSecret) ||
+            !CCryptoKeyStore::AddCryptedKey(pubkey, vchCryptedSecret))
+            return false;
+    } else if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey)) {
         return false;
+    }
 
     // check if we need to remove from watch-only
     CScript script;
@@ -129,12 +171,19 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
 
     if (!fFileBacked)
         return true;
-    if (!IsCrypted()) {
-        return CWalletDB(strWalletFile).WriteKey(pubkey,
-                                                 secret.GetPrivKey(),
-                                                 mapKeyMetadata[pubkey.GetID()]);
-    }
-    return true;
+    if (IsCrypted())
+        return walletdb.WriteCryptedKey(pubkey,
+                                        vchCryptedSecret,
+                                        mapKeyMetadata[pubkey.GetID()]);
+    return walletdb.WriteKey(pubkey,
+                             secret.GetPrivKey(),
+                             mapKeyMetadata[pubkey.GetID()]);
+}
+
+bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
+{
+    CWalletDB walletdb(strWalletFile);
+    return AddKeyPubKeyWithDB(walletdb, secret, pubkey);
 }
 
 bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
@@ -369,6 +418,24 @@ void CWallet::Flush(bool shutdown)
 
 bool CWallet::Verify(const string& walletFile, string& warningString, string& errorString)
 {
+    string strStorage = GetArg("-walletstorage", DEFAULT_WALLET_STORAGE);
+    bool fLogFile = CLogDB::IsLogFile(GetDataDir() / walletFile);
+    if (strStorage == "log") {
+        // A log is checked record by record as it is opened, and cut short at the first bad one
+        bitdb.fLogDb = true;
+        if (boost::filesystem::exists(GetDataDir() / walletFile) && !fLogFile)
+            errorString += strprintf(_("%s is a Berkeley DB wallet; start with -walletstorage=bdb to use it"), walletFile);
+        return true;
+    }
+    if (strStorage != "bdb") {
+        errorString += strprintf(_("Unknown wallet storage: '%s'"), strStorage);
+        return true;
+    }
+    if (fLogFile) {
+        errorString += strprintf(_("%s is a wallet log; start with -walletstorage=log to use it"), walletFile);
+        return true;
+    }
+
     if (!bitdb.Open(GetDataDir()))
     {
         // try moving the database env out of the way
@@ -605,11 +672,113 @@ void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
+        fBalanceIndexReset = true;
+        mapDarksendRounds.clear();
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
     }
 }
 
+void CWallet::MarkBalanceDirty(const uint256& hash) const
+{
+    LOCK(cs_wallet);
+    if (!fBalanceIndexReset)
+        setBalanceDirty.insert(hash);
+}
+
+void CWallet::IndexWalletTx(const CWalletTx& wtx) const
+{
+    int nDepth = wtx.GetDepthInMainChain();
+    if (nDepth < 0)
+        return; // Conflicted, none of its outputs count
+
+    const uint256& hash = wtx.GetHash();
+    CWalletBalanceEntry entry;
+    if (wtx.IsCoinBase() && wtx.GetBlocksToMaturity() > 0) {
+        // Counted whether spent or not, see GetImmatureCredit(), and never available
+        entry.state = CWalletBalanceEntry::IMMATURE;
+        mapBalanceIndex[hash] = entry;
+        setBalanceImmature.insert(hash);
+        return;
+    }
+
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) != ISMINE_NO && !IsSpent(hash, i))
+            entry.vUnspent.push_back(i);
+    }
+    if (entry.vUnspent.empty())
+        return; // Nothing left to count or spend
+    BOOST_FOREACH(unsigned int i, entry.vUnspent)
+        setUnspentByValue.insert(make_pair(wtx.vout[i].nValue, COutPoint(hash, i)));
+
+    if (nDepth == 0) {
+        entry.state = CWalletBalanceEntry::PENDING;
+        setBalancePending.insert(hash);
+    } else {
+        entry.state = CWalletBalanceEntry::CONFIRMED;
+        entry.nCredit = wtx.GetAvailableCredit();
+        entry.nWatchOnlyCredit = wtx.GetAvailableWatchOnlyCredit();
+        nConfirmedBalance += entry.nCredit;
+        nConfirmedWatchOnlyBalance += entry.nWatchOnlyCredit;
+    }
+    mapBalanceIndex[hash] = entry;
+}
+
+void CWallet::UnindexWalletTx(const uint256& hash) const
+{
+    std::map<uint256, CWalletBalanceEntry>::iterator it = mapBalanceIndex.find(hash);
+    if (it == mapBalanceIndex.end())
+        return;
+    if (it->second.state == CWalletBalanceEntry::CONFIRMED) {
+        nConfirmedBalance -= it->second.nCredit;
+        nConfirmedWatchOnlyBalance -= it->second.nWatchOnlyCredit;
+    }
+    // Transactions never leave mapWallet, and their outputs never change
+    const CWalletTx& wtx = mapWallet.find(hash)->second;
+    BOOST_FOREACH(unsigned int i, it->second.vUnspent)
+        setUnspentByValue.erase(make_pair(wtx.vout[i].nValue, COutPoint(hash, i)));
+    setBalancePending.erase(hash);
+    setBalanceImmature.erase(hash);
+    mapBalanceIndex.erase(it);
+}
+
+void CWallet::UpdateBalanceIndex() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (fBalanceIndexReset) {
+        mapBalanceIndex.clear();
+        setBalanceDirty.clear();
+        setBalancePending.clear();
+        setBalanceImmature.clear();
+        setUnspentByValue.clear();
+        nConfirmedBalance = 0;
+        nConfirmedWatchOnlyBalance = 0;
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            IndexWalletTx(it->second);
+        fBalanceIndexReset = false;
+        return;
+    }
+
+    // Blocks connected since the last update matured some coinbases; blocks
+    // connected or disconnected otherwise only change the transactions they
+    // contain, and those came through SyncTransaction.
+    BOOST_FOREACH(const uint256& hash, setBalanceImmature) {
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+        if (it == mapWallet.end() || it->second.GetBlocksToMaturity() == 0)
+            setBalanceDirty.insert(hash);
+    }
+
+    BOOST_FOREACH(const uint256& hash, setBalanceDirty) {
+        UnindexWalletTx(hash);
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+        if (it != mapWallet.end())
+            IndexWalletTx(it->second);
+    }
+    setBalanceDirty.clear();
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
 {
     uint256 hash = wtxIn.GetHash();
@@ -621,6 +790,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         wtx.BindWallet(this);
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
         AddToSpends(hash);
+        ForgetDarksendRounds(wtx);
         BOOST_FOREACH(const CTxIn& txin, wtx.vin) {
             if (mapWallet.count(txin.prevout.hash)) {
                 CWalletTx& prevtx = mapWallet[txin.prevout.hash];
@@ -726,23 +896,31 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             if (!wtx.WriteToDisk(pwalletdb))
                 return false;
 
-        // Break debit/credit balance caches:
-        wtx.MarkDirty();
+        // Rounds worked out before this version of it was known may be off now
+        if (fInsertedNew || fUpdated)
+            ForgetDarksendRounds(wtx);
 
-        // Notify UI of new or updated transaction
-        NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
+        NotifyWalletTx(wtx, fInsertedNew ? CT_NEW : CT_UPDATED);
+    }
+    return true;
+}
 
-        // notify an external script when a wallet transaction comes in or is updated
-        std::string strCmd = GetArg("-walletnotify", "");
+void CWallet::NotifyWalletTx(CWalletTx& wtx, ChangeType status)
+{
+    // Break debit/credit balance caches:
+    wtx.MarkDirty();
 
-        if ( !strCmd.empty())
-        {
-            boost::replace_all(strCmd, "%s", wtxIn.GetHash().GetHex());
-            boost::thread t(runCommand, strCmd); // thread runs free
-        }
+    // Notify UI of new or updated transaction
+    NotifyTransactionChanged(this, wtx.GetHash(), status);
+
+    // notify an external script when a wallet transaction comes in or is updated
+    std::string strCmd = GetArg("-walletnotify", "");
 
+    if ( !strCmd.empty())
+    {
+        boost::replace_all(strCmd, "%s", wtx.GetHash().GetHex());
+        boost::thread t(runCommand, strCmd); // thread runs free
     }
-    return true;
 }
 
 /**
@@ -1186,18 +1364,275 @@ bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
     return pwalletdb->WriteTx(GetHash(), *this);
 }
 
+void CWalletScriptFilter::AddTx(const CTransaction& tx)
+{
+    setTxids.insert(tx.GetHash());
+    if (!tx.IsCoinBase()) {
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            setTxids.insert(txin.prevout.hash);
+    }
+}
+
+bool CWalletScriptFilter::MatchesScript(const CScript& scriptPubKey) const
+{
+    if (setIds.empty() && setWatchOnly.empty())
+        return false;
+    if (!setWatchOnly.empty() && setWatchOnly.count(scriptPubKey))
+        return true;
+
+    // Pay-to-pubkey-hash and pay-to-script-hash, the bulk of all outputs, without Solver
+    uint160 id;
+    if (scriptPubKey.size() == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 && scriptPubKey[2] == 20 &&
+        scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG) {
+        memcpy(id.begin(), &scriptPubKey[3], 20);
+        return setIds.count(id) > 0;
+    }
+    if (scriptPubKey.IsPayToScriptHash()) {
+        memcpy(id.begin(), &scriptPubKey[2], 20);
+        return setIds.count(id) > 0;
+    }
+
+    std::vector<std::vector<unsigned char> > vSolutions;
+    txnouttype whichType;
+    if (!Solver(scriptPubKey, whichType, vSolutions))
+        return false;
+    switch (whichType)
+    {
+    case TX_PUBKEY:
+        return setIds.count(CPubKey(vSolutions[0]).GetID()) > 0;
+    case TX_PUBKEYHASH:
+    case TX_SCRIPTHASH:
+        return setIds.count(uint160(vSolutions[0])) > 0;
+    case TX_MULTISIG:
+        // Any of the keys, IsMine wants all of them
+        for (unsigned int i = 1; i + 1 < vSolutions.size(); i++) {
+            if (setIds.count(CPubKey(vSolutions[i]).GetID()))
+                return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+bool CWalletScriptFilter::Matches(const CTransaction& tx) const
+{
+    if (!setTxids.empty()) {
+        if (setTxids.count(tx.GetHash()))
+            return true;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (setTxids.count(txin.prevout.hash))
+                return true;
+        }
+    }
+    BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+        if (MatchesScript(txout.scriptPubKey))
+            return true;
+    }
+    return false;
+}
+
+void CWallet::GetScriptFilter(CWalletScriptFilter& filter) const
+{
+    LOCK2(cs_wallet, cs_KeyStore);
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+    BOOST_FOREACH(const CKeyID& keyID, setKeys)
+        filter.AddId(keyID);
+    for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); it++)
+        filter.AddId(it->first);
+    BOOST_FOREACH(const CScript& script, setWatchOnly)
+        filter.AddWatchOnly(script);
+    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); it++)
+        filter.AddTx(it->second);
+}
+
+namespace {
+
+//! Blocks read ahead of the rescan, per reader thread
+static const unsigned int RESCAN_BLOCKS_PER_THREAD = 4;
+
+/**
+ * Reads the blocks of a rescan and matches their transactions against a
+ * CWalletScriptFilter on reader threads, a few blocks ahead of the thread
+ * adding the matches to the wallet. Blocks are consumed in the order they
+ * were pushed; the consumer reads the next one itself if no reader has
+ * taken it yet. Neither side takes any lock but the pipeline's own.
+ */
+class CRescanPipeline
+{
+public:
+    struct CBlockSlot
+    {
+        CBlockIndex* pindex;
+        CDiskBlockPos pos;
+        double dProgress;
+        CBlock block;
+        bool fRead;
+        //! per transaction of block, whether it matched the filter
+        std::vector<char> vMatch;
+        bool fDone;
+    };
+
+private:
+    const CWalletScriptFilter& filter;
+    const Consensus::Params& consensusParams;
+
+    boost::mutex mutex;
+    boost::condition_variable cvWork;
+    boost::condition_variable cvDone;
+    std::vector<CBlockSlot> vSlot;
+    uint64_t nPushed;
+    uint64_t nTaken;
+    uint64_t nPopped;
+    bool fStop;
+    boost::thread_group threads;
+
+    void Read(CBlockSlot& slot)
+    {
+        slot.fRead = ReadBlockFromDisk(slot.block, slot.pos, consensusParams) && slot.block.GetHash() == slot.pindex->GetBlockHash();
+        slot.vMatch.assign(slot.block.vtx.size(), false);
+        if (slot.fRead) {
+            for (unsigned int i = 0; i < slot.block.vtx.size(); i++)
+                slot.vMatch[i] = filter.Matches(slot.block.vtx[i]);
+        }
+    }
+
+    void ThreadRead()
+    {
+        RenameThread("bitcredit-rescan");
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true) {
+            while (!fStop && nTaken == nPushed)
+                cvWork.wait(lock);
+            if (fStop)
+                return;
+            CBlockSlot& slot = vSlot[nTaken++ % vSlot.size()];
+            lock.unlock();
+            Read(slot);
+            lock.lock();
+            slot.fDone = true;
+            cvDone.notify_all();
+        }
+    }
+
+public:
+    CRescanPipeline(const CWalletScriptFilter& filterIn, const Consensus::Params& consensusParamsIn, int nThreads) :
+        filter(filterIn), consensusParams(consensusParamsIn), vSlot(RESCAN_BLOCKS_PER_THREAD * (nThreads + 1)),
+        nPushed(0), nTaken(0), nPopped(0), fStop(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CRescanPipeline::ThreadRead, this));
+    }
+
+    ~CRescanPipeline()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        cvWork.notify_all();
+        threads.join_all();
+    }
+
+    bool IsEmpty()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        return nPushed == nPopped;
+    }
+
+    //! Number of blocks that can be pushed
+    size_t Space()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        return vSlot.size() - (nPushed - nPopped);
+    }
+
+    size_t Capacity() const { return vSlot.size(); }
+
+    void Push(CBlockIndex* pindex, const CDiskBlockPos& pos, double dProgress)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            assert(nPushed - nPopped < vSlot.size());
+            CBlockSlot& slot = vSlot[nPushed++ % vSlot.size()];
+            slot.pindex = pindex;
+            slot.pos = pos;
+            slot.dProgress = dProgress;
+            slot.fDone = false;
+        }
+        cvWork.notify_one();
+    }
+
+    //! The oldest block pushed, once it is read and matched
+    CBlockSlot& Front()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        assert(nPopped < nPushed);
+        CBlockSlot& slot = vSlot[nPopped % vSlot.size()];
+        if (nTaken == nPopped) {
+            nTaken++;
+            lock.unlock();
+            Read(slot);
+            lock.lock();
+            slot.fDone = true;
+        }
+        while (!slot.fDone)
+            cvDone.wait(lock);
+        return slot;
+    }
+
+    void Pop()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        CBlockSlot& slot = vSlot[nPopped++ % vSlot.size()];
+        slot.block.SetNull();
+        slot.vMatch.clear();
+    }
+};
+
+} // anon namespace
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
+{
+    {
+        LOCK(cs_rescan);
+        if (rescanInfo.fScanning) {
+            LogPrintf("%s: a rescan is running already\n", __func__);
+            return -1;
+        }
+        rescanInfo = CWalletRescanInfo();
+        rescanInfo.fScanning = true;
+        rescanInfo.nTimeStart = GetTimeMillis();
+        fAbortRescan = false;
+    }
+    int ret;
+    try {
+        ret = ScanBlocks(pindexStart, fUpdate);
+    } catch (...) {
+        LOCK(cs_rescan);
+        rescanInfo.fScanning = false;
+        throw;
+    }
+    LOCK(cs_rescan);
+    rescanInfo.fScanning = false;
+    return ret;
+}
+
+int CWallet::ScanBlocks(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
 
     CBlockIndex* pindex = pindexStart;
+    CWalletScriptFilter filter;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -1206,32 +1641,116 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+        GetScriptFilter(filter);
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            LOCK(cs_rescan);
+            rescanInfo.nStartHeight = rescanInfo.nHeight = pindex ? pindex->nHeight : chainActive.Height();
+            rescanInfo.nTipHeight = chainActive.Height();
+        }
+    }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+    CRescanPipeline pipeline(filter, chainParams.GetConsensus(), nScriptCheckThreads);
+    // Transactions added by this rescan, which later blocks may spend or conflict with
+    CWalletScriptFilter filterAdded;
+    CBlockIndex* pindexLast = NULL;
+    while (true) {
+        // Keep the pipeline fed with the next blocks of the active chain. If
+        // the last one pushed was disconnected meanwhile, go on from the fork.
+        if (pipeline.IsEmpty() || pipeline.Space() >= pipeline.Capacity() / 2) {
+            LOCK(cs_main);
+            CBlockIndex* pindexNext = pindex;
+            if (pindexLast)
+                pindexNext = chainActive.Next(chainActive.Contains(pindexLast) ? pindexLast : chainActive.FindFork(pindexLast));
+            for (size_t nSpace = pipeline.Space(); pindexNext && nSpace > 0; nSpace--) {
+                pipeline.Push(pindexNext, pindexNext->GetBlockPos(), Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindexNext, false));
+                pindexLast = pindexNext;
+                pindexNext = chainActive.Next(pindexNext);
+            }
+            dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+                LOCK(cs_rescan);
+                rescanInfo.nTipHeight = chainActive.Height();
             }
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+        }
+        if (pipeline.IsEmpty())
+            break;
+
+        bool fAbort = ShutdownRequested();
+        int nHeight;
+        {
+            LOCK(cs_rescan);
+            fAbort |= fAbortRescan;
+            nHeight = rescanInfo.nHeight;
+        }
+        if (fAbort) {
+            LogPrintf("Rescan aborted at block %d\n", nHeight);
+            ret = -1;
+            break;
+        }
+
+        CRescanPipeline::CBlockSlot& slot = pipeline.Front();
+        if (!slot.fRead)
+            LogPrintf("%s: could not read block %s, skipping it\n", __func__, slot.pindex->GetBlockHash().ToString());
+
+        // Only take the locks if there is anything to add
+        unsigned int nFirst = 0;
+        while (nFirst < slot.block.vtx.size() && !slot.vMatch[nFirst] && (filterAdded.IsEmpty() || !filterAdded.Matches(slot.block.vtx[nFirst])))
+            nFirst++;
+        if (nFirst < slot.block.vtx.size()) {
+            LOCK2(cs_main, cs_wallet);
+            // A block disconnected meanwhile is left alone, the active chain is rescanned from the fork
+            if (chainActive.Contains(slot.pindex)) {
+                for (unsigned int i = nFirst; i < slot.block.vtx.size(); i++) {
+                    const CTransaction& tx = slot.block.vtx[i];
+                    if (!slot.vMatch[i] && !filterAdded.Matches(tx))
+                        continue;
+                    if (AddToWalletIfInvolvingMe(tx, &slot.block, fUpdate))
+                        ret++;
+                    if (mapWallet.count(tx.GetHash()))
+                        filterAdded.AddTx(tx);
+                }
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
+        int nProgress;
+        {
+            LOCK(cs_rescan);
+            rescanInfo.nHeight = slot.pindex->nHeight;
+            rescanInfo.dProgress = dProgressTip - dProgressStart > 0.0 ? std::max(0.0, std::min(1.0, (slot.dProgress - dProgressStart) / (dProgressTip - dProgressStart))) : 1.0;
+            rescanInfo.nFound = ret;
+            nProgress = (int)(rescanInfo.dProgress * 100);
+        }
+        if (slot.pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+            ShowProgress(_("Rescanning..."), std::max(1, std::min(99, nProgress)));
+        if (GetTime() >= nNow + 60) {
+            nNow = GetTime();
+            LogPrintf("Still rescanning. At block %d. Progress=%f\n", slot.pindex->nHeight, slot.dProgress);
+        }
+        pipeline.Pop();
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
+bool CWallet::AbortRescan()
+{
+    LOCK(cs_rescan);
+    if (!rescanInfo.fScanning)
+        return false;
+    fAbortRescan = true;
+    return true;
+}
+
+CWalletRescanInfo CWallet::GetRescanInfo() const
+{
+    LOCK(cs_rescan);
+    return rescanInfo;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -1356,6 +1875,20 @@ CAmount CWalletTx::GetCredit(const isminefilter& filter) const
     return credit;
 }
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+    if (pwallet)
+        pwallet->MarkBalanceDirty(GetHash());
+}
+
 CAmount CWalletTx::GetImmatureCredit(bool fUseCache) const
 {
     if (IsCoinBase() && GetBlocksToMaturity() > 0 && IsInMainChain())
@@ -1564,9 +2097,11 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalanceIndex();
+        nTotal = nConfirmedBalance;
+        BOOST_FOREACH(const uint256& hash, setBalancePending)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1580,9 +2115,10 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalanceIndex();
+        BOOST_FOREACH(const uint256& hash, setBalancePending)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1595,9 +2131,10 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalanceIndex();
+        BOOST_FOREACH(const uint256& hash, setBalanceImmature)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -1609,9 +2146,11 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalanceIndex();
+        nTotal = nConfirmedWatchOnlyBalance;
+        BOOST_FOREACH(const uint256& hash, setBalancePending)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1625,9 +2164,10 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalanceIndex();
+        BOOST_FOREACH(const uint256& hash, setBalancePending)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1640,9 +2180,10 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalanceIndex();
+        BOOST_FOREACH(const uint256& hash, setBalanceImmature)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -1655,30 +2196,18 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateBalanceIndex();
+        for (map<uint256, CWalletBalanceEntry>::const_iterator it = mapBalanceIndex.begin(); it != mapBalanceIndex.end(); ++it)
         {
             const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!CheckFinalTx(*pcoin))
+            if (it->second.state == CWalletBalanceEntry::IMMATURE)
                 continue;
-
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
-
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
-
-            int nDepth = pcoin->GetDepthInMainChain();
+            const CWalletTx* pcoin = &mapWallet.find(wtxid)->second;
+            int nDepth = GetAvailableDepth(pcoin, fOnlyConfirmed);
             if (nDepth < 0)
                 continue;
 
-            // We should not consider coins which aren't at least in our mempool
-            // It's possible for these to be conflicted via ancestors which we may never be able to detect
-            if (nDepth == 0 && !pcoin->InMempool())
-                continue;
-
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+            BOOST_FOREACH(unsigned int i, it->second.vUnspent) {
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
                     !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
@@ -1691,7 +2220,82 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+void CWallet::AvailableCoinsByValue(vector<COutput>& vCoins, CAmount nValue, bool fOnlyConfirmed) const
+{
+    vCoins.clear();
+
+    {
+        LOCK2(cs_main, cs_wallet);
+        UpdateBalanceIndex();
+        set<pair<CAmount, COutPoint> >::const_iterator it = setUnspentByValue.lower_bound(make_pair(nValue, COutPoint(uint256(), 0)));
+        for (; it != setUnspentByValue.end() && it->first == nValue; ++it)
+            AddAvailableCoin(it->second, fOnlyConfirmed, vCoins);
+    }
+}
+
+bool CWallet::AvailableCoinsAfter(vector<COutput>& vCoins, const COutPoint& outpointAfter, unsigned int nMaxCoins, bool fOnlyConfirmed, bool fIncludeZeroValue) const
+{
+    vCoins.clear();
+
+    LOCK2(cs_main, cs_wallet);
+    UpdateBalanceIndex();
+    map<uint256, CWalletBalanceEntry>::const_iterator it = outpointAfter.IsNull() ? mapBalanceIndex.begin() : mapBalanceIndex.lower_bound(outpointAfter.hash);
+    for (; it != mapBalanceIndex.end(); ++it)
+    {
+        if (it->second.state == CWalletBalanceEntry::IMMATURE)
+            continue;
+        const CWalletTx& wtx = mapWallet.find(it->first)->second;
+        BOOST_FOREACH(unsigned int i, it->second.vUnspent) {
+            if (it->first == outpointAfter.hash && i <= outpointAfter.n)
+                continue;
+            if (vCoins.size() >= nMaxCoins)
+                return true;
+            if (wtx.vout[i].nValue > 0 || fIncludeZeroValue)
+                AddAvailableCoin(COutPoint(it->first, i), fOnlyConfirmed, vCoins);
+        }
+    }
+    return false;
+}
+
+bool CWallet::AddAvailableCoin(const COutPoint& outpoint, bool fOnlyConfirmed, vector<COutput>& vCoins) const
+{
+    const CWalletTx* pcoin = &mapWallet.find(outpoint.hash)->second;
+    int nDepth = GetAvailableDepth(pcoin, fOnlyConfirmed);
+    if (nDepth < 0)
+        return false;
+
+    isminetype mine = IsMine(pcoin->vout[outpoint.n]);
+    if (IsSpent(outpoint.hash, outpoint.n) || mine == ISMINE_NO || IsLockedCoin(outpoint.hash, outpoint.n))
+        return false;
+
+    vCoins.push_back(COutput(pcoin, outpoint.n, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
+    return true;
+}
+
+int CWallet::GetAvailableDepth(const CWalletTx* pcoin, bool fOnlyConfirmed) const
+{
+    if (!CheckFinalTx(*pcoin))
+        return -1;
+
+    if (fOnlyConfirmed && !pcoin->IsTrusted())
+        return -1;
+
+    if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+        return -1;
+
+    int nDepth = pcoin->GetDepthInMainChain();
+    if (nDepth < 0)
+        return -1;
+
+    // We should not consider coins which aren't at least in our mempool
+    // It's possible for these to be conflicted via ancestors which we may never be able to detect
+    if (nDepth == 0 && !pcoin->InMempool())
+        return -1;
+
+    return nDepth;
+}
+
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
@@ -1747,7 +2351,58 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
+/**
+ * Branch and bound search for a subset of vValue (sorted by decreasing value)
+ * adding up to exactly nTargetValue, so that no change is needed. Coins of
+ * the same value are interchangeable, so a coin is only tried if the one
+ * before it of the same value was too. Gives up after nMaxTries steps.
+ */
+static bool SelectCoinsBnB(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+                           vector<char>& vfBest, int nMaxTries = SELECT_COINS_BNB_TRIES)
+{
+    vector<char> vfSelected(vValue.size(), false);
+    CAmount nSelected = 0;
+    CAmount nRemaining = nTotalLower; // value of the coins from nDepth on
+    size_t nDepth = 0;
+
+    for (int nTries = 0; nTries < nMaxTries; nTries++)
+    {
+        if (nSelected == nTargetValue)
+        {
+            vfBest = vfSelected;
+            LogPrint("selectcoins", "SelectCoins() exact match after %d tries\n", nTries);
+            return true;
+        }
+
+        if (nSelected > nTargetValue || nSelected + nRemaining < nTargetValue)
+        {
+            // Backtrack to the last coin included, and try without it
+            while (nDepth > 0 && !vfSelected[nDepth - 1])
+            {
+                nDepth--;
+                nRemaining += vValue[nDepth].first;
+            }
+            if (nDepth == 0)
+                return false; // Searched everything
+            vfSelected[nDepth - 1] = false;
+            nSelected -= vValue[nDepth - 1].first;
+            continue;
+        }
+
+        // Include the next coin, unless it is worth the same as the one just left out
+        if (nDepth == 0 || vfSelected[nDepth - 1] || vValue[nDepth].first != vValue[nDepth - 1].first)
+        {
+            vfSelected[nDepth] = true;
+            nSelected += vValue[nDepth].first;
+        }
+        nRemaining -= vValue[nDepth].first;
+        nDepth++;
+    }
+    LogPrint("selectcoins", "SelectCoins() no exact match in %d tries\n", nMaxTries);
+    return false;
+}
+
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     setCoinsRet.clear();
@@ -1757,10 +2412,17 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     pair<CAmount, pair<const CWalletTx*,unsigned int> > coinLowestLarger;
     coinLowestLarger.first = std::numeric_limits<CAmount>::max();
     coinLowestLarger.second.first = NULL;
+    pair<CAmount, pair<const CWalletTx*,unsigned int> > coinExact;
+    coinExact.second.first = NULL;
     vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
+    // Spending a coin worth less than this costs more than it brings in
+    const CAmount nInputFee = GetRequiredFee(SELECT_COINS_INPUT_SIZE);
+
+    // Rather than shuffling vCoins, pick uniformly among the coins that tie
+    // for exact or lowest larger match, and shuffle vValue below.
+    int nExactTies = 0, nLargerTies = 0;
 
     BOOST_FOREACH(const COutput &output, vCoins)
     {
@@ -1774,14 +2436,15 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
 
         int i = output.i;
         CAmount n = pcoin->vout[i].nValue;
+        if (n <= nInputFee)
+            continue;
 
         pair<CAmount,pair<const CWalletTx*,unsigned int> > coin = make_pair(n,make_pair(pcoin, i));
 
         if (n == nTargetValue)
         {
-            setCoinsRet.insert(coin.second);
-            nValueRet += coin.first;
-            return true;
+            if (GetRandInt(++nExactTies) == 0)
+                coinExact = coin;
         }
         else if (n < nTargetValue + MIN_CHANGE)
         {
@@ -1789,11 +2452,23 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
             nTotalLower += n;
         }
         else if (n < coinLowestLarger.first)
+        {
+            coinLowestLarger = coin;
+            nLargerTies = 1;
+        }
+        else if (n == coinLowestLarger.first && GetRandInt(++nLargerTies) == 0)
         {
             coinLowestLarger = coin;
         }
     }
 
+    if (coinExact.second.first)
+    {
+        setCoinsRet.insert(coinExact.second);
+        nValueRet += coinExact.first;
+        return true;
+    }
+
     if (nTotalLower == nTargetValue)
     {
         for (unsigned int i = 0; i < vValue.size(); ++i)
@@ -1813,15 +2488,24 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
+    random_shuffle(vValue.begin(), vValue.end(), GetRandInt);
     std::sort(vValue.begin(), vValue.end(), CompareValueOnly());
     std::reverse(vValue.begin(), vValue.end());
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest);
+    if (SelectCoinsBnB(vValue, nTotalLower, nTargetValue, vfBest))
+    {
+        nBest = nTargetValue;
+    }
+    else
+    {
+        // Solve subset sum by stochastic approximation
+        int nIterations = std::max((int64_t)10, std::min((int64_t)1000, SELECT_COINS_APPROX_STEPS / (int64_t)vValue.size()));
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, nIterations);
+        if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
+            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest, nIterations);
+    }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -1851,12 +2535,10 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
 
 bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
 {
-    vector<COutput> vCoins(vAvailableCoins);
-
     // coin control -> return all selected outputs (we want all selected to go into the transaction for sure)
     if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs)
     {
-        BOOST_FOREACH(const COutput& out, vCoins)
+        BOOST_FOREACH(const COutput& out, vAvailableCoins)
         {
             if (!out.fSpendable)
                  continue;
@@ -1888,14 +2570,16 @@ bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount&
             return false; // TODO: Allow non-wallet inputs
     }
 
-    // remove preset inputs from vCoins
-    for (vector<COutput>::iterator it = vCoins.begin(); it != vCoins.end() && coinControl && coinControl->HasSelected();)
+    // remove preset inputs from vCoins, only copying it if there are any
+    vector<COutput> vCoinsNotPreset;
+    if (!setPresetCoins.empty())
     {
-        if (setPresetCoins.count(make_pair(it->tx, it->i)))
-            it = vCoins.erase(it);
-        else
-            ++it;
+        vCoinsNotPreset.reserve(vAvailableCoins.size());
+        BOOST_FOREACH(const COutput& out, vAvailableCoins)
+            if (!setPresetCoins.count(make_pair(out.tx, (uint32_t)out.i)))
+                vCoinsNotPreset.push_back(out);
     }
+    const vector<COutput>& vCoins = setPresetCoins.empty() ? vAvailableCoins : vCoinsNotPreset;
 
     bool res = nTargetValue <= nValueFromPresetInputs ||
         SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, vCoins, setCoinsRet, nValueRet) ||
@@ -1911,25 +2595,161 @@ bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount&
     return res;
 }
 
+/** The amounts of Darksend collateral outputs: one to five collaterals, plus the fee */
+static const CAmount darkSendCollateralAmounts[] = {
+    (DARKSEND_COLLATERAL * 1) + DARKSEND_FEE,
+    (DARKSEND_COLLATERAL * 2) + DARKSEND_FEE,
+    (DARKSEND_COLLATERAL * 3) + DARKSEND_FEE,
+    (DARKSEND_COLLATERAL * 4) + DARKSEND_FEE,
+    (DARKSEND_COLLATERAL * 5) + DARKSEND_FEE,
+};
+
 bool CWallet::HasCollateralInputs() const
 {
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins);
-
     int nFound = 0;
-    BOOST_FOREACH(const COutput& out, vCoins)
-        if(IsCollateralAmount(out.tx->vout[out.i].nValue)) nFound++;
+    BOOST_FOREACH(CAmount nAmount, darkSendCollateralAmounts) {
+        vector<COutput> vCoins;
+        AvailableCoinsByValue(vCoins, nAmount);
+        nFound += vCoins.size();
+    }
 
     return nFound > 1; // should have more than one just in case
 }
 
 bool CWallet::IsCollateralAmount(int64_t nInputAmount) const
 {
-    return  nInputAmount == (DARKSEND_COLLATERAL * 5)+DARKSEND_FEE ||
-            nInputAmount == (DARKSEND_COLLATERAL * 4)+DARKSEND_FEE ||
-            nInputAmount == (DARKSEND_COLLATERAL * 3)+DARKSEND_FEE ||
-            nInputAmount == (DARKSEND_COLLATERAL * 2)+DARKSEND_FEE ||
-            nInputAmount == (DARKSEND_COLLATERAL * 1)+DARKSEND_FEE;
+    BOOST_FOREACH(CAmount nAmount, darkSendCollateralAmounts)
+        if (nInputAmount == nAmount)
+            return true;
+    return false;
+}
+
+bool CWallet::IsDenominatedAmount(int64_t nInputAmount) const
+{
+    return GetDenominationBit(nInputAmount) >= 0;
+}
+
+int CWallet::CountInputsWithAmount(int64_t nInputAmount)
+{
+    vector<COutput> vCoins;
+    AvailableCoinsByValue(vCoins, nInputAmount);
+    return vCoins.size();
+}
+
+int CWallet::GetOutputDarksendRounds(const COutPoint& outpoint) const
+{
+    LOCK(cs_wallet);
+    return GetOutputDarksendRounds(outpoint, 0);
+}
+
+void CWallet::ForgetDarksendRounds(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (mapDarksendRounds.empty())
+        return;
+
+    // The rounds of an output depend on its ancestors, so follow the spends down
+    std::set<uint256> setDone;
+    std::vector<uint256> vTodo(1, wtx.GetHash());
+    while (!vTodo.empty()) {
+        uint256 hash = vTodo.back();
+        vTodo.pop_back();
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+        if (mi == mapWallet.end() || !setDone.insert(hash).second)
+            continue;
+        for (unsigned int i = 0; i < mi->second.vout.size(); i++) {
+            COutPoint outpoint(hash, i);
+            mapDarksendRounds.erase(outpoint);
+            std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(outpoint);
+            for (TxSpends::const_iterator it = range.first; it != range.second; it++)
+                vTodo.push_back(it->second);
+        }
+    }
+}
+
+int CWallet::GetOutputDarksendRounds(const COutPoint& outpoint, int nRounds) const
+{
+    AssertLockHeld(cs_wallet);
+
+    // Chains of mixes are not followed back any further
+    if (nRounds >= 17)
+        return nRounds;
+
+    map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+    if (mi == mapWallet.end())
+        return nRounds - 1;
+    map<COutPoint, int>::const_iterator it = mapDarksendRounds.find(outpoint);
+    if (it != mapDarksendRounds.end())
+        return it->second;
+
+    const CWalletTx& wtx = mi->second;
+    int nResult;
+    if (outpoint.n >= wtx.vout.size())
+        nResult = -4;
+    else if (IsCollateralAmount(wtx.vout[outpoint.n].nValue))
+        nResult = -3;
+    else if (!IsDenominatedAmount(wtx.vout[outpoint.n].nValue))
+        nResult = -2;
+    else
+    {
+        // A denominated output next to non-denominated ones starts a chain,
+        // otherwise it is one round past the shortest chain among our inputs
+        bool fAllDenoms = true;
+        BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+            fAllDenoms = fAllDenoms && IsDenominatedAmount(txout.nValue);
+        int nShortest = -1;
+        if (fAllDenoms)
+        {
+            BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+            {
+                if (IsMine(txin) == ISMINE_NO)
+                    continue;
+                int n = GetOutputDarksendRounds(txin.prevout, nRounds + 1);
+                if (n >= 0 && (nShortest < 0 || n < nShortest))
+                    nShortest = n;
+            }
+        }
+        nResult = nShortest + 1;
+    }
+    mapDarksendRounds[outpoint] = nResult;
+    return nResult;
+}
+
+bool CWallet::SelectCoinsByDenominations(int nDenom, int64_t nValueMin, int64_t nValueMax, vector<CTxIn>& setCoinsRet, vector<COutput>& vCoins, int64_t& nValueRet, int nDarksendRoundsMin, int nDarksendRoundsMax)
+{
+    setCoinsRet.clear();
+    vCoins.clear();
+    nValueRet = 0;
+
+    LOCK2(cs_main, cs_wallet);
+    UpdateBalanceIndex();
+    // Every denomination is a range of the index by value
+    for (unsigned int i = 0; i < darkSendDenominations.size(); i++)
+    {
+        if (!(nDenom & (1 << i)))
+            continue;
+        CAmount nValue = darkSendDenominations[i];
+        set<pair<CAmount, COutPoint> >::const_iterator it = setUnspentByValue.lower_bound(make_pair(nValue, COutPoint(uint256(), 0)));
+        for (; it != setUnspentByValue.end() && it->first == nValue && nValueRet + nValue <= nValueMax; ++it)
+        {
+            int nRounds = GetOutputDarksendRounds(it->second, 0);
+            if (nRounds < nDarksendRoundsMin || nRounds > nDarksendRoundsMax)
+                continue;
+            if (!AddAvailableCoin(it->second, true, vCoins))
+                continue;
+            if (!vCoins.back().fSpendable) {
+                vCoins.pop_back();
+                continue;
+            }
+
+            CTxIn vin(it->second);
+            vin.prevPubKey = vCoins.back().tx->vout[vin.prevout.n].scriptPubKey;
+            setCoinsRet.push_back(vin);
+            nValueRet += nValue;
+        }
+    }
+
+    return nValueRet >= nValueMin;
 }
 
 
@@ -1970,6 +2790,16 @@ bool CWallet::FundTransaction(CMutableTransaction& tx, CAmount &nFeeRet, int& nC
 
 bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, CAmount& nFeeRet,
                                 int& nChangePosRet, std::string& strFailReason, const CCoinControl* coinControl, bool sign)
+{
+    LOCK2(cs_main, cs_wallet);
+    std::vector<COutput> vAvailableCoins;
+    AvailableCoins(vAvailableCoins, true, coinControl);
+    return CreateTransaction(vecSend, vAvailableCoins, wtxNew, reservekey, nFeeRet, nChangePosRet, strFailReason, coinControl, sign);
+}
+
+bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, const std::vector<COutput>& vAvailableCoins, CWalletTx& wtxNew,
+                                CReserveKey& reservekey, CAmount& nFeeRet, int& nChangePosRet, std::string& strFailReason,
+                                const CCoinControl* coinControl, bool sign)
 {
     CAmount nValue = 0;
     unsigned int nSubtractFeeFromAmount = 0;
@@ -2030,9 +2860,6 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
     {
         LOCK2(cs_main, cs_wallet);
         {
-            std::vector<COutput> vAvailableCoins;
-            AvailableCoins(vAvailableCoins, true, coinControl);
-
             nFeeRet = 0;
             // Start with no fee and loop until there is enough fee
             while (true)
@@ -2182,26 +3009,28 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                     txNew.vin.push_back(CTxIn(coin.first->GetHash(),coin.second,CScript(),
                                               std::numeric_limits<unsigned int>::max()-1));
 
-                // Sign
+                // Sign, spreading the inputs over the signing threads
                 int nIn = 0;
                 CTransaction txNewConst(txNew);
+                std::vector<CInputSigner> vSigners;
                 BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
                 {
-                    bool signSuccess;
                     const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
                     CScript& scriptSigRes = txNew.vin[nIn].scriptSig;
                     if (sign)
-                        signSuccess = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, SIGHASH_ALL), scriptPubKey, scriptSigRes);
-                    else
-                        signSuccess = ProduceSignature(DummySignatureCreator(this), scriptPubKey, scriptSigRes);
-
-                    if (!signSuccess)
+                        vSigners.push_back(CInputSigner(this, &txNewConst, nIn, &scriptPubKey, &scriptSigRes));
+                    else if (!ProduceSignature(DummySignatureCreator(this), scriptPubKey, scriptSigRes))
                     {
                         strFailReason = _("Signing transaction failed");
                         return false;
                     }
                     nIn++;
                 }
+                if (sign && !SignInputs(vSigners))
+                {
+                    strFailReason = _("Signing transaction failed");
+                    return false;
+                }
 
                 unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
 
@@ -2311,6 +3140,151 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
     return true;
 }
 
+bool CWallet::CreateBatchTransactions(const vector<CRecipient>& vecSend, unsigned int nMaxOutputs, vector<CWalletTx>& vwtxNew,
+                                      vector<boost::shared_ptr<CReserveKey> >& vReserveKeys, CAmount& nFeeRet, std::string& strFailReason)
+{
+    assert(nMaxOutputs > 0);
+    vwtxNew.clear();
+    vReserveKeys.clear();
+    nFeeRet = 0;
+
+    LOCK2(cs_main, cs_wallet);
+    std::vector<COutput> vAvailableCoins;
+    AvailableCoins(vAvailableCoins, true, NULL);
+
+    // Plan the transactions with dummy signatures, taking the coins each one
+    // spends out of vAvailableCoins before planning the next
+    for (size_t nStart = 0; nStart < vecSend.size(); nStart += nMaxOutputs)
+    {
+        std::vector<CRecipient> vecChunk(vecSend.begin() + nStart, vecSend.begin() + std::min(vecSend.size(), nStart + nMaxOutputs));
+        vwtxNew.push_back(CWalletTx());
+        vReserveKeys.push_back(boost::shared_ptr<CReserveKey>(new CReserveKey(this)));
+        CAmount nFee;
+        int nChangePos;
+        if (!CreateTransaction(vecChunk, vAvailableCoins, vwtxNew.back(), *vReserveKeys.back(), nFee, nChangePos, strFailReason, NULL, false))
+            return false;
+        nFeeRet += nFee;
+
+        std::set<COutPoint> setSpent;
+        BOOST_FOREACH(const CTxIn& txin, vwtxNew.back().vin)
+            setSpent.insert(txin.prevout);
+        std::vector<COutput> vRemaining;
+        vRemaining.reserve(vAvailableCoins.size() - setSpent.size());
+        BOOST_FOREACH(const COutput& out, vAvailableCoins)
+            if (!setSpent.count(COutPoint(out.tx->GetHash(), out.i)))
+                vRemaining.push_back(out);
+        vAvailableCoins.swap(vRemaining);
+    }
+
+    // Sign all inputs of all transactions in one batch. The signers only read
+    // the unsigned transactions, and write to their own copy of the scriptSig.
+    std::vector<CMutableTransaction> vtxSigned(vwtxNew.begin(), vwtxNew.end());
+    std::vector<CInputSigner> vSigners;
+    for (unsigned int i = 0; i < vwtxNew.size(); i++)
+    {
+        for (unsigned int nIn = 0; nIn < vwtxNew[i].vin.size(); nIn++)
+        {
+            const COutPoint& prevout = vwtxNew[i].vin[nIn].prevout;
+            const CWalletTx* pcoin = GetWalletTx(prevout.hash);
+            assert(pcoin);
+            vSigners.push_back(CInputSigner(this, &vwtxNew[i], nIn, &pcoin->vout[prevout.n].scriptPubKey, &vtxSigned[i].vin[nIn].scriptSig));
+        }
+    }
+    if (!SignInputs(vSigners))
+    {
+        strFailReason = _("Signing transaction failed");
+        return false;
+    }
+    for (unsigned int i = 0; i < vwtxNew.size(); i++)
+        *static_cast<CTransaction*>(&vwtxNew[i]) = CTransaction(vtxSigned[i]);
+
+    return true;
+}
+
+bool CWallet::CommitBatchTransactions(vector<CWalletTx>& vwtxNew, vector<boost::shared_ptr<CReserveKey> >& vReserveKeys, vector<uint256>& vRejected)
+{
+    LOCK2(cs_main, cs_wallet);
+    LogPrintf("CommitBatchTransactions: %u transactions\n", vwtxNew.size());
+    vRejected.clear();
+
+    if (fFileBacked)
+    {
+        // Write the transactions before mapWallet learns of them, so that
+        // an aborted database transaction leaves nothing behind in memory
+        int64_t nOrderPos = nOrderPosNext;
+        CWalletDB walletdb(strWalletFile, "r+");
+        if (!walletdb.TxnBegin())
+            return error("CommitBatchTransactions(): TxnBegin failed");
+        BOOST_FOREACH(CWalletTx& wtxNew, vwtxNew)
+        {
+            wtxNew.nTimeReceived = GetAdjustedTime();
+            wtxNew.nTimeSmart = wtxNew.nTimeReceived;
+            wtxNew.nOrderPos = nOrderPos++;
+            if (mapWallet.count(wtxNew.GetHash()) || !walletdb.WriteTx(wtxNew.GetHash(), wtxNew))
+            {
+                walletdb.TxnAbort();
+                return error("CommitBatchTransactions(): writing transaction %s failed", wtxNew.GetHash().ToString());
+            }
+        }
+        if (!walletdb.WriteOrderPosNext(nOrderPos))
+        {
+            walletdb.TxnAbort();
+            return error("CommitBatchTransactions(): writing the order position failed");
+        }
+        if (!walletdb.TxnCommit())
+            return error("CommitBatchTransactions(): TxnCommit failed");
+
+        // They are on disk now, so add them as if loaded from it, and then
+        // tell about them as AddToWallet does for a new transaction
+        nOrderPosNext = nOrderPos;
+        BOOST_FOREACH(CWalletTx& wtxNew, vwtxNew)
+        {
+            AddToWallet(wtxNew, true, NULL);
+            LogPrintf("AddToWallet %s  new\n", wtxNew.GetHash().ToString());
+            NotifyWalletTx(mapWallet[wtxNew.GetHash()], CT_NEW);
+        }
+    }
+    else
+    {
+        BOOST_FOREACH(CWalletTx& wtxNew, vwtxNew)
+            AddToWallet(wtxNew, false, NULL);
+    }
+
+    // The key pool is written through a database handle of its own, which
+    // must not wait on the batch above; the change keys are only kept once
+    // the transactions spending to them are in the wallet
+    BOOST_FOREACH(const boost::shared_ptr<CReserveKey>& reservekey, vReserveKeys)
+        reservekey->KeepKey();
+
+    BOOST_FOREACH(CWalletTx& wtxNew, vwtxNew)
+    {
+        // Notify that old coins are spent
+        BOOST_FOREACH(const CTxIn& txin, wtxNew.vin)
+        {
+            CWalletTx &coin = mapWallet[txin.prevout.hash];
+            coin.BindWallet(this);
+            NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
+        }
+
+        // Track how many getdata requests our transaction gets
+        mapRequestCount[wtxNew.GetHash()] = 0;
+
+        if (fBroadcastTransactions)
+        {
+            // The transactions spend different coins, so one failing does not
+            // stop the others; it stays in the wallet, to be rebroadcast
+            if (!wtxNew.AcceptToMemoryPool(false, maxTxFee))
+            {
+                LogPrintf("CommitBatchTransactions(): Error: Transaction %s not valid\n", wtxNew.GetHash().ToString());
+                vRejected.push_back(wtxNew.GetHash());
+                continue;
+            }
+            wtxNew.RelayWalletTransaction();
+        }
+    }
+    return true;
+}
+
 bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB & pwalletdb)
 {
     if (!pwalletdb.WriteAccountingEntry_Backend(acentry))
@@ -2489,35 +3463,132 @@ bool CWallet::NewKeyPool()
 
 bool CWallet::TopUpKeyPool(unsigned int kpSize)
 {
+    while (TopUpKeyPoolBatch(kpSize) > 0) {}
+
+    LOCK(cs_wallet);
+    return !IsLocked();
+}
+
+unsigned int CWallet::TopUpKeyPoolBatch(unsigned int kpSize)
+{
+    unsigned int nTargetSize;
+    if (kpSize > 0)
+        nTargetSize = kpSize;
+    else
+        nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
+
+    unsigned int nKeys;
+    bool fCompressed;
     {
         LOCK(cs_wallet);
+        if (IsLocked() || setKeyPool.size() >= nTargetSize + 1)
+            return 0;
+        nKeys = min(nTargetSize + 1 - (unsigned int)setKeyPool.size(), KEYPOOL_TOPUP_BATCH);
+        fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
+    }
 
-        if (IsLocked())
-            return false;
+    // Making the keys is what takes the time, so it is spread over the
+    // key generation threads and done without the wallet lock
+    std::vector<CKey> vKeys(nKeys);
+    std::vector<CPubKey> vPubKeys;
+    if (!GenerateKeys(vKeys, vPubKeys, fCompressed))
+        throw runtime_error("TopUpKeyPool(): generated key does not match its public key");
 
-        CWalletDB walletdb(strWalletFile);
+    LOCK(cs_wallet);
+    // The wallet may have been locked meanwhile
+    if (IsLocked())
+        return 0;
+    AddKeyPoolKeys(vKeys, vPubKeys, fCompressed);
+    return nKeys;
+}
 
-        // Top up key pool
-        unsigned int nTargetSize;
-        if (kpSize > 0)
-            nTargetSize = kpSize;
-        else
-            nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
+void CWallet::AddKeyPoolKeys(const std::vector<CKey>& vKeys, const std::vector<CPubKey>& vPubKeys, bool fCompressed)
+{
+    AssertLockHeld(cs_wallet);
 
-        while (setKeyPool.size() < (nTargetSize + 1))
-        {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error("TopUpKeyPool(): writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+    // Compressed public keys were introduced in version 0.6.0
+    if (fCompressed)
+        SetMinVersion(FEATURE_COMPRPUBKEY);
+
+    int64_t nCreationTime = GetTime();
+    if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
+        nTimeFirstKey = nCreationTime;
+    int64_t nEnd = 1;
+    if (!setKeyPool.empty())
+        nEnd = *(--setKeyPool.end()) + 1;
+
+    // The keys, encrypted if the wallet is, and their keypool entries are
+    // written in one database transaction
+    CWalletDB walletdb(strWalletFile);
+    bool fTxn = walletdb.TxnBegin();
+    for (unsigned int i = 0; i < vKeys.size(); i++) {
+        mapKeyMetadata[vPubKeys[i].GetID()] = CKeyMetadata(nCreationTime);
+        if (!AddKeyPubKeyWithDB(walletdb, vKeys[i], vPubKeys[i]) ||
+            !walletdb.WritePool(nEnd + i, CKeyPool(vPubKeys[i]))) {
+            if (fTxn)
+                walletdb.TxnAbort();
+            throw runtime_error("TopUpKeyPool(): writing generated key failed");
         }
     }
+    if (fTxn && !walletdb.TxnCommit())
+        throw runtime_error("TopUpKeyPool(): writing generated keys failed");
+
+    for (unsigned int i = 0; i < vKeys.size(); i++)
+        setKeyPool.insert(nEnd + i);
+    LogPrintf("keypool added keys %d to %d, size=%u\n", nEnd, nEnd + vKeys.size() - 1, setKeyPool.size());
+}
+
+bool CWallet::RequestKeyPoolTopUp()
+{
+    boost::unique_lock<boost::mutex> lock(mutexKeyPoolTopUp);
+    if (!fKeyPoolTopUpThread)
+        return false;
+    fKeyPoolTopUpRequested = true;
+    condKeyPoolTopUp.notify_one();
     return true;
 }
 
+void ThreadTopUpKeyPool(CWallet* pwallet)
+{
+    // Make this thread recognisable as the keypool filling thread
+    RenameThread("bitcredit-keypool");
+
+    {
+        boost::unique_lock<boost::mutex> lock(pwallet->mutexKeyPoolTopUp);
+        pwallet->fKeyPoolTopUpThread = true;
+        // Start with whatever was used up before
+        pwallet->fKeyPoolTopUpRequested = true;
+    }
+    try {
+        while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(pwallet->mutexKeyPoolTopUp);
+                while (!pwallet->fKeyPoolTopUpRequested)
+                    pwallet->condKeyPoolTopUp.wait(lock);
+                pwallet->fKeyPoolTopUpRequested = false;
+            }
+
+            int64_t nStart = GetTimeMillis();
+            unsigned int nAdded = 0, nKeys;
+            while ((nKeys = pwallet->TopUpKeyPoolBatch()) > 0) {
+                nAdded += nKeys;
+                boost::this_thread::interruption_point();
+            }
+            if (nAdded > 0)
+                LogPrint("wallet", "ThreadTopUpKeyPool: added %u keys in %dms\n", nAdded, GetTimeMillis() - nStart);
+        }
+    } catch (const boost::thread_interrupted&) {
+        boost::unique_lock<boost::mutex> lock(pwallet->mutexKeyPoolTopUp);
+        pwallet->fKeyPoolTopUpThread = false;
+        throw;
+    } catch (const std::exception& e) {
+        // Leave the keypool to callers again, who top it up as they go
+        PrintExceptionContinue(&e, "ThreadTopUpKeyPool()");
+        boost::unique_lock<boost::mutex> lock(pwallet->mutexKeyPoolTopUp);
+        pwallet->fKeyPoolTopUpThread = false;
+    }
+}
+
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
 {
     nIndex = -1;
@@ -2525,8 +3596,15 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
     {
         LOCK(cs_wallet);
 
-        if (!IsLocked())
-            TopUpKeyPool();
+        // The keypool is refilled once it is below -keypoolmin: by
+        // ThreadTopUpKeyPool if it runs, so that callers only wait for keys
+        // to be made when none are left
+        if (!IsLocked() && setKeyPool.size() < (unsigned int)max(GetArg("-keypoolmin", DEFAULT_KEYPOOL_MIN), (int64_t)1)) {
+            if (!RequestKeyPoolTopUp())
+                TopUpKeyPool();
+            else if (setKeyPool.empty())
+                TopUpKeyPoolBatch();
+        }
 
         // Get the oldest key
         if(setKeyPool.empty())
@@ -2987,6 +4065,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     std::string strUsage = HelpMessageGroup(_("Wallet options:"));
     strUsage += HelpMessageOpt("-disablewallet", _("Do not load the wallet and disable wallet RPC calls"));
     strUsage += HelpMessageOpt("-keypool=<n>", strprintf(_("Set key pool size to <n> (default: %u)"), DEFAULT_KEYPOOL_SIZE));
+    strUsage += HelpMessageOpt("-keypoolmin=<n>", strprintf(_("Refill the key pool in the background once it has fewer than <n> keys (default: %u)"), DEFAULT_KEYPOOL_MIN));
     strUsage += HelpMessageOpt("-fallbackfee=<amt>", strprintf(_("A fee rate (in %s/kB) that will be used when fee estimation has insufficient data (default: %s)"),
                                                                CURRENCY_UNIT, FormatMoney(DEFAULT_FALLBACK_FEE)));
     strUsage += HelpMessageOpt("-mintxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for transaction creation (default: %s)"),
@@ -3013,6 +4092,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush wallet database activity from memory to disk log every <n> megabytes (default: %u)", DEFAULT_WALLET_DBLOGSIZE));
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", DEFAULT_FLUSHWALLET));
         strUsage += HelpMessageOpt("-privdb", strprintf("Sets the DB_PRIVATE flag in the wallet db environment (default: %u)", DEFAULT_WALLET_PRIVDB));
+        strUsage += HelpMessageOpt("-walletstorage=<type>", strprintf("Keep the wallet in Berkeley DB (bdb) or in an append-only log file (log) (default: %s)", DEFAULT_WALLET_STORAGE));
     }
 
     return strUsage;
@@ -7,6 +7,7 @@
 #define BITCREDIT_WALLET_WALLET_H
 
 #include "amount.h"
+#include "crypto/common.h"
 #include "streams.h"
 #include "tinyformat.h"
 #include "ui_interface.h"
@@ -27,6 +28,9 @@
 #include <vector>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_set.hpp>
 
 /**
  * Settings
@@ -37,6 +41,10 @@ extern bool bSpendZeroConfChange;
 extern bool fSendFreeTransactions;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 100;
+//! -keypoolmin default: the keypool is refilled in the background once it has fewer keys
+static const unsigned int DEFAULT_KEYPOOL_MIN = 50;
+//! Keys made and written at once by a keypool top-up
+static const unsigned int KEYPOOL_TOPUP_BATCH = 100;
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
 //! -fallbackfee default
@@ -45,6 +53,12 @@ static const CAmount DEFAULT_FALLBACK_FEE = 20000;
 static const CAmount DEFAULT_TRANSACTION_MINFEE = 1000;
 //! minimum change amount
 static const CAmount MIN_CHANGE = CENT;
+//! Steps the branch and bound coin selection may take looking for an exact match
+static const int SELECT_COINS_BNB_TRIES = 100000;
+//! Coins ApproximateBestSubset may visit over all its iterations, so large wallets get fewer of them
+static const int64_t SELECT_COINS_APPROX_STEPS = 10000000;
+//! Size of a pay-to-pubkey-hash input, to estimate what spending a coin costs
+static const unsigned int SELECT_COINS_INPUT_SIZE = 148;
 //! Default for -spendzeroconfchange
 static const bool DEFAULT_SPEND_ZEROCONF_CHANGE = true;
 //! Default for -sendfreetransactions
@@ -53,6 +67,8 @@ static const bool DEFAULT_SEND_FREE_TRANSACTIONS = false;
 static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 2;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+//! Default number of recipients per transaction for createbatchpayouts
+static const unsigned int DEFAULT_BATCH_PAYOUT_OUTPUTS = 500;
 static const bool DEFAULT_WALLETBROADCAST = true;
 
 extern const char * DEFAULT_WALLET_DAT;
@@ -63,8 +79,12 @@ class COutput;
 class CReserveKey;
 class CScript;
 class CTxMemPool;
+class CWallet;
 class CWalletTx;
 
+/** Top up the keypool of pwallet whenever it runs below -keypoolmin */
+void ThreadTopUpKeyPool(CWallet* pwallet);
+
 /** (client) version numbers for particular wallet features */
 enum WalletFeature
 {
@@ -355,18 +375,8 @@ public:
         mapValue.erase("timesmart");
     }
 
-    //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    //! make sure balances are recalculated, in this transaction and in the wallet's balance index
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -540,6 +550,72 @@ private:
 };
 
 
+/** Hash for the key ids and txids in CWalletScriptFilter, which are uniformly distributed already */
+struct CWalletFilterHasher
+{
+    size_t operator()(const uint160& id) const { return ReadLE64(id.begin()); }
+    size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+};
+
+/**
+ * What a wallet rescan looks for, precomputed so that blocks can be matched
+ * on other threads without the wallet lock: the wallet's key and script ids
+ * and watch-only scripts, and the txids of the wallet's transactions and of
+ * the outputs they spend. Matches() is true for every transaction
+ * AddToWalletIfInvolvingMe could add or mark conflicted, and a few more
+ * (multisig outputs with any of our keys, for example).
+ */
+class CWalletScriptFilter
+{
+private:
+    boost::unordered_set<uint160, CWalletFilterHasher> setIds;
+    std::set<CScript> setWatchOnly;
+    boost::unordered_set<uint256, CWalletFilterHasher> setTxids;
+
+public:
+    void AddId(const uint160& id) { setIds.insert(id); }
+    void AddWatchOnly(const CScript& script) { setWatchOnly.insert(script); }
+    //! Add a wallet transaction, so that it and anything spending from or conflicting with it matches
+    void AddTx(const CTransaction& tx);
+
+    bool MatchesScript(const CScript& scriptPubKey) const;
+    bool Matches(const CTransaction& tx) const;
+    bool IsEmpty() const { return setIds.empty() && setWatchOnly.empty() && setTxids.empty(); }
+};
+
+/** Progress of a wallet rescan, see getrescaninfo */
+struct CWalletRescanInfo
+{
+    bool fScanning;
+    int nStartHeight;
+    int nHeight;
+    int nTipHeight;
+    double dProgress;
+    int64_t nTimeStart;
+    int nFound;
+
+    CWalletRescanInfo() : fScanning(false), nStartHeight(0), nHeight(0), nTipHeight(0), dProgress(0), nTimeStart(0), nFound(0) {}
+};
+
+/** A wallet transaction in the balance index, see CWallet::UpdateBalanceIndex */
+struct CWalletBalanceEntry
+{
+    enum State {
+        CONFIRMED, //!< mature and in the main chain, counted in the confirmed balances
+        PENDING,   //!< not in a block, IsTrusted() and InMempool() are checked on every query
+        IMMATURE   //!< an immature coinbase
+    };
+
+    State state;
+    //! available credit, only kept for CONFIRMED entries
+    CAmount nCredit;
+    CAmount nWatchOnlyCredit;
+    //! outputs that were ours and unspent when the entry was made
+    std::vector<unsigned int> vUnspent;
+
+    CWalletBalanceEntry() : state(CONFIRMED), nCredit(0), nWatchOnlyCredit(0) {}
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -556,6 +632,18 @@ private:
 
     CWalletDB *pwalletdbEncryption;
 
+    //! Wake ThreadTopUpKeyPool; fKeyPoolTopUpThread is set while it runs
+    boost::mutex mutexKeyPoolTopUp;
+    boost::condition_variable condKeyPoolTopUp;
+    bool fKeyPoolTopUpRequested;
+    bool fKeyPoolTopUpThread;
+
+    //! Add keys made by GenerateKeys to the keystore and the keypool, in one database transaction
+    void AddKeyPoolKeys(const std::vector<CKey>& vKeys, const std::vector<CPubKey>& vPubKeys, bool fCompressed);
+    bool AddKeyPubKeyWithDB(CWalletDB& walletdb, const CKey& secret, const CPubKey& pubkey);
+
+    friend void ThreadTopUpKeyPool(CWallet* pwallet);
+
     //! the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
 
@@ -581,16 +669,71 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    //! protects the rescan state below, never held while taking other locks
+    mutable CCriticalSection cs_rescan;
+    CWalletRescanInfo rescanInfo;
+    bool fAbortRescan;
+
+    int ScanBlocks(CBlockIndex* pindexStart, bool fUpdate);
+
+    /**
+     * Balance index: the wallet transactions that are immature coinbases or
+     * have outputs of ours left unspent, with the credit of the confirmed
+     * ones summed up in nConfirmedBalance and nConfirmedWatchOnlyBalance.
+     * CWalletTx::MarkDirty queues a transaction in setBalanceDirty, and the
+     * index catches up on the next query. The balances then cost
+     * O(unconfirmed + immature transactions) instead of a walk over
+     * mapWallet, and AvailableCoins O(own unspent outputs).
+     */
+    mutable std::map<uint256, CWalletBalanceEntry> mapBalanceIndex;
+    mutable std::set<uint256> setBalanceDirty;
+    mutable std::set<uint256> setBalancePending;
+    mutable std::set<uint256> setBalanceImmature;
+    mutable bool fBalanceIndexReset;
+    mutable CAmount nConfirmedBalance;
+    mutable CAmount nConfirmedWatchOnlyBalance;
+    //! The unspent outputs of the mature entries by value, for exact amounts like basenode collateral
+    mutable std::set<std::pair<CAmount, COutPoint> > setUnspentByValue;
+    //! Darksend rounds of wallet outputs, each computed once
+    mutable std::map<COutPoint, int> mapDarksendRounds;
+
+    void IndexWalletTx(const CWalletTx& wtx) const;
+    void UnindexWalletTx(const uint256& hash) const;
+    //! Depth of pcoin if AvailableCoins may spend its outputs, otherwise -1
+    int GetAvailableDepth(const CWalletTx* pcoin, bool fOnlyConfirmed) const;
+    //! Append the coin at outpoint to vCoins if AvailableCoins would return it
+    bool AddAvailableCoin(const COutPoint& outpoint, bool fOnlyConfirmed, std::vector<COutput>& vCoins) const;
+    int GetOutputDarksendRounds(const COutPoint& outpoint, int nRounds) const;
+    //! Drop the memoized rounds wtx can change: its own outputs and those of the wallet transactions spending them
+    void ForgetDarksendRounds(const CWalletTx& wtx);
+    //! Break the balance caches of wtx and tell the UI and -walletnotify it is new or updated
+    void NotifyWalletTx(CWalletTx& wtx, ChangeType status);
+    //! Apply the queued changes to the balance index, cs_main and cs_wallet must be held
+    void UpdateBalanceIndex() const;
+
 public:
 
     bool SelectCoins2(CAmount nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet, const CCoinControl *coinControl = NULL, AvailableCoinsType coin_type=ALL_COINS, bool useIX = true) const;
     bool SelectCoinsDark(int64_t nValueMin, int64_t nValueMax, std::vector<CTxIn>& setCoinsRet, int64_t& nValueRet, int nDarksendRoundsMin, int nDarksendRoundsMax) const;
+    /**
+     * Take coins of the denominations in the nDenom bitmask, largest first, that went through
+     * nDarksendRoundsMin to nDarksendRoundsMax rounds, up to nValueMax in total. Only the
+     * coins taken or passed over are looked at. True if they add up to nValueMin.
+     */
     bool SelectCoinsByDenominations(int nDenom, int64_t nValueMin, int64_t nValueMax, std::vector<CTxIn>& setCoinsRet, std::vector<COutput>& vCoins, int64_t& nValueRet, int nDarksendRoundsMin, int nDarksendRoundsMax);
     bool SelectCoinsDarkDenominated(int64_t nTargetValue, std::vector<CTxIn>& setCoinsRet, int64_t& nValueRet) const;
     bool SelectCoinsBasenode(CTxIn& vin, int64_t& nValueRet, CScript& pubScript) const;
     bool HasCollateralInputs() const;
     bool IsCollateralAmount(int64_t nInputAmount) const;
+    bool IsDenominatedAmount(int64_t nInputAmount) const;
     int  CountInputsWithAmount(int64_t nInputAmount);
+    /**
+     * How many Darksend rounds a wallet output went through: -4 if it does
+     * not exist, -3 for collateral amounts, -2 for other non-denominated
+     * amounts, -1 if its transaction is not ours, otherwise how many mixes
+     * of only denominated outputs are behind it.
+     */
+    int GetOutputDarksendRounds(const COutPoint& outpoint) const;
 
     bool SelectCoinsCollateral(std::vector<CTxIn>& setCoinsRet, int64_t& nValueRet) const ;
     bool SelectCoinsWithoutDenomination(int64_t nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const;
@@ -642,11 +785,17 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        fKeyPoolTopUpRequested = false;
+        fKeyPoolTopUpThread = false;
         nOrderPosNext = 0;
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        fAbortRescan = false;
+        fBalanceIndexReset = true;
+        nConfirmedBalance = 0;
+        nConfirmedWatchOnlyBalance = 0;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -676,14 +825,27 @@ public:
      * populate vCoins with vector of available COutputs.
      */
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, bool fIncludeZeroValue=false) const;
+    /**
+     * The coins AvailableCoins would return that are worth exactly nValue,
+     * looked up in the balance index by value rather than by a walk over all
+     * unspent outputs.
+     */
+    void AvailableCoinsByValue(std::vector<COutput>& vCoins, CAmount nValue, bool fOnlyConfirmed=true) const;
+    /**
+     * A page of the coins AvailableCoins would return: at most nMaxCoins of
+     * them, in (txid, output) order starting after outpointAfter, or from the
+     * first coin if it is null. Returns whether the page ended at nMaxCoins.
+     */
+    bool AvailableCoinsAfter(std::vector<COutput>& vCoins, const COutPoint& outpointAfter, unsigned int nMaxCoins, bool fOnlyConfirmed=true, bool fIncludeZeroValue=false) const;
 
     /**
-     * Shuffle and select coins until nTargetValue is reached while avoiding
-     * small change; This method is stochastic for some inputs and upon
-     * completion the coin set and corresponding actual target value is
-     * assembled
+     * Select coins until nTargetValue is reached while avoiding small change.
+     * Coins worth less than the fee to spend them are left out. An exact
+     * match is looked for by branch and bound first, then by stochastic
+     * approximation; upon completion the coin set and corresponding actual
+     * target value is assembled
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
 
@@ -742,10 +904,24 @@ public:
     int64_t IncOrderPosNext(CWalletDB *pwalletdb = NULL);
 
     void MarkDirty();
+    //! Queue a transaction for the balance index to look at again
+    void MarkBalanceDirty(const uint256& hash) const;
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    /**
+     * Add the wallet transactions in the active chain from pindexStart on.
+     * Blocks are read and matched against GetScriptFilter() on worker
+     * threads, and the locks are only taken to add what matched. Returns the
+     * number of transactions added or updated, or -1 if the rescan was
+     * aborted or another one was running already.
+     */
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    //! Fill filter with everything a rescan must look for
+    void GetScriptFilter(CWalletScriptFilter& filter) const;
+    //! Stop the running rescan, if any, returns whether there was one
+    bool AbortRescan();
+    CWalletRescanInfo GetRescanInfo() const;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
@@ -768,7 +944,25 @@ public:
      */
     bool CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, CAmount& nFeeRet, int& nChangePosRet,
                            std::string& strFailReason, const CCoinControl *coinControl = NULL, bool sign = true);
+    /** As above, selecting from vAvailableCoins instead of all of AvailableCoins() */
+    bool CreateTransaction(const std::vector<CRecipient>& vecSend, const std::vector<COutput>& vAvailableCoins, CWalletTx& wtxNew, CReserveKey& reservekey,
+                           CAmount& nFeeRet, int& nChangePosRet, std::string& strFailReason, const CCoinControl *coinControl = NULL, bool sign = true);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey);
+    /**
+     * Create transactions paying the recipients, at most nMaxOutputs of them
+     * each, from one listing of the available coins. No coin is spent twice,
+     * and the inputs of all transactions are signed together by SignInputs().
+     * Each transaction gets its own reserve key for the change.
+     */
+    bool CreateBatchTransactions(const std::vector<CRecipient>& vecSend, unsigned int nMaxOutputs, std::vector<CWalletTx>& vwtxNew,
+                                 std::vector<boost::shared_ptr<CReserveKey> >& vReserveKeys, CAmount& nFeeRet, std::string& strFailReason);
+    /**
+     * Call after CreateBatchTransactions; writes all transactions in one database
+     * transaction, then broadcasts them. Returns false, with the wallet unchanged,
+     * if they could not be written; the ones the mempool refused are in vRejected.
+     */
+    bool CommitBatchTransactions(std::vector<CWalletTx>& vwtxNew, std::vector<boost::shared_ptr<CReserveKey> >& vReserveKeys,
+                                 std::vector<uint256>& vRejected);
 
     bool AddAccountingEntry(const CAccountingEntry&, CWalletDB & pwalletdb);
 
@@ -787,6 +981,14 @@ public:
 
     bool NewKeyPool();
     bool TopUpKeyPool(unsigned int kpSize = 0);
+    /**
+     * Add up to KEYPOOL_TOPUP_BATCH keys to the keypool, towards kpSize keys
+     * (-keypool if 0). The keys are made without holding cs_wallet, unless
+     * the caller does. Returns how many keys were added.
+     */
+    unsigned int TopUpKeyPoolBatch(unsigned int kpSize = 0);
+    //! Have ThreadTopUpKeyPool top up the keypool, without waiting for it; false if it is not running
+    bool RequestKeyPoolTopUp();
     void ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool);
     void KeepKey(int64_t nIndex);
     void ReturnKey(int64_t nIndex);
@@ -13,6 +13,7 @@
 #include "sync.h"
 #include "util.h"
 #include "utiltime.h"
+#include "wallet/logdb.h"
 #include "wallet/wallet.h"
 
 #include <boost/version.hpp>
@@ -213,7 +214,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit(): cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -630,7 +631,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -736,7 +737,7 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, vector<uint256>& vTxHash, vec
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -868,6 +869,20 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+    if (bitdb.fLogDb)
+    {
+        // A wallet log can be copied while it is in use, it only has to be
+        // committed to disk first
+        boost::filesystem::path pathDest(strDest);
+        if (boost::filesystem::is_directory(pathDest))
+            pathDest /= wallet.strWalletFile;
+        LOCK(bitdb.cs_db);
+        map<string, CLogDB*>::iterator mi = bitdb.mapLogDb.find(wallet.strWalletFile);
+        if (mi == bitdb.mapLogDb.end() || !mi->second || !mi->second->Backup(pathDest))
+            return false;
+        LogPrintf("copied %s to %s\n", wallet.strWalletFile, pathDest.string());
+        return true;
+    }
     while (true)
     {
         {